@@ -0,0 +1,254 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <threads.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "archive.h"
+#include "pcm_ring.h"
+#include "pcm_codec.h"
+
+//	Buffer circular de frames - escrito pelo ciclo de processamento
+static Pcm_ring *ring;
+static uint64_t signaled;	// frames assinaladas à tarefa
+
+static sem_t archive_semaphore;
+static atomic_bool archive_running;
+static thrd_t archive_thread;
+
+//	Estado da tarefa de codificação
+static struct config *archive_config;
+static time_t archive_ts;	// tempo de calendário da frame 0
+static uint64_t file_frames;	// frames por ficheiro
+static FILE *archive_fd;
+static uint64_t file_end;	// frame seguinte à última do ficheiro atual
+static int16_t *block;
+static uint8_t *encoded;
+static Archive_statistics statistics;
+
+static void put_uint16(uint8_t *bytes, uint16_t value)
+{
+	bytes[0] = value;
+	bytes[1] = value >> 8;
+}
+
+static void put_uint32(uint8_t *bytes, uint32_t value)
+{
+	put_uint16(bytes, value);
+	put_uint16(bytes + 2, value >> 16);
+}
+
+static void archive_file_close()
+{
+	if (archive_fd == NULL)
+		return;
+	fflush(archive_fd);
+	fsync(fileno(archive_fd));
+	fclose(archive_fd);
+	archive_fd = NULL;
+}
+
+/*
+ * Ficheiro com o nome do ficheiro de saída correspondente:
+ * output_path + output_filename + AAAAMMDDHHMMSS + ARCHIVE_FILE_EXTENSION
+ */
+static void archive_file_open(uint64_t position)
+{
+	archive_file_close();
+	time_t ts = archive_ts + position / archive_config->sample_rate;
+	char date[sizeof "AAAAMMDDHHMMSS"];
+	strftime(date, sizeof date, "%Y%m%d%H%M%S", localtime(&ts));
+	char *filepath = malloc(strlen(archive_config->output_path)
+		+ strlen(archive_config->output_filename) + strlen(date)
+		+ strlen(ARCHIVE_FILE_EXTENSION) + 1);
+	if (filepath == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return;
+	}
+	strcpy(filepath, archive_config->output_path);
+	strcat(filepath, archive_config->output_filename);
+	strcat(filepath, date);
+	strcat(filepath, ARCHIVE_FILE_EXTENSION);
+	archive_fd = fopen(filepath, "w");
+	if (archive_fd == NULL) {
+		fprintf(stderr, "fopen(%s, \"w\") error: %s\n", filepath, strerror(errno));
+		free(filepath);
+		return;
+	}
+	free(filepath);
+
+	uint8_t header[ARCHIVE_HEADER_SIZE];
+	memcpy(header, ARCHIVE_FILE_MAGIC, 4);
+	put_uint16(header + 4, ARCHIVE_FILE_VERSION);
+	put_uint16(header + 6, archive_config->channels);
+	put_uint32(header + 8, archive_config->sample_rate);
+	put_uint32(header + 12, ARCHIVE_BLOCK_FRAMES);
+	put_uint32(header + 16, (uint64_t)ts);
+	put_uint32(header + 20, (uint64_t)ts >> 32);
+	fwrite(header, sizeof header, 1, archive_fd);
+	statistics.compressed_bytes += sizeof header;
+	statistics.files++;
+}
+
+static void archive_block_write(unsigned nframes, const uint8_t *data, size_t size)
+{
+	if (archive_fd == NULL)
+		return;
+	uint8_t header[8];
+	put_uint16(header, ARCHIVE_BLOCK_SYNC);
+	put_uint16(header + 2, nframes);
+	put_uint32(header + 4, size);
+	fwrite(header, sizeof header, 1, archive_fd);
+	fwrite(data, 1, size, archive_fd);
+	statistics.compressed_bytes += sizeof header + size;
+}
+
+/*
+ * Arquiva as frames [position, end[ em blocos que não atravessam
+ * a fronteira dos ficheiros.
+ */
+static uint64_t archive_frames(uint64_t position, uint64_t end)
+{
+	uint64_t capacity = pcm_ring_capacity(ring);
+	while (position < end) {
+		if (position >= file_end) {
+			archive_file_open(position);
+			file_end += file_frames;
+		}
+		unsigned nframes = end - position < ARCHIVE_BLOCK_FRAMES ? end - position : ARCHIVE_BLOCK_FRAMES;
+		if (file_end - position < nframes)
+			nframes = file_end - position;
+		uint64_t lost = 0;
+		if (end > capacity && position < end - capacity)
+			lost = end - capacity - position < nframes ? end - capacity - position : nframes;
+		else
+			lost = pcm_ring_read(ring, position, block, nframes);
+		if (lost > 0) {
+			archive_block_write(lost, NULL, 0);
+			statistics.lost += lost;
+		}
+		if (lost < nframes) {
+			size_t size = pcm_codec_encode(block + lost * archive_config->channels,
+					nframes - lost, archive_config->channels, encoded);
+			archive_block_write(nframes - lost, encoded, size);
+		}
+		statistics.frames += nframes;
+		statistics.raw_bytes += (uint64_t)nframes * archive_config->channels * sizeof *block;
+		position += nframes;
+	}
+	return position;
+}
+
+static int archive_thread_func(void *not_used)
+{
+	//	Só esta tarefa - a codificação cede o processador ao ciclo de medição
+	if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), ARCHIVE_NICE) != 0)
+		fprintf(stderr, "Archive: setpriority error: %s\n", strerror(errno));
+
+	uint64_t position = 0;
+	while (true) {
+		sem_wait(&archive_semaphore);
+		bool running = atomic_load(&archive_running);
+		uint64_t count = pcm_ring_count(ring);
+		//	Só blocos completos, exceto no fim
+		uint64_t end = running ? count - count % ARCHIVE_BLOCK_FRAMES : count;
+		if (end > position)
+			position = archive_frames(position, end);
+		if (!running)
+			break;
+	}
+	archive_file_close();
+
+	struct timespec cpu;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	statistics.cpu_time = cpu.tv_sec + cpu.tv_nsec / 1e9;
+	return 0;
+}
+
+bool archive_begin(struct config *config)
+{
+	archive_config = config;
+	archive_ts = time(NULL);
+	file_frames = (uint64_t)config->file_period * config->segment_size;
+	file_end = 0;
+	archive_fd = NULL;
+	memset(&statistics, 0, sizeof statistics);
+	signaled = 0;
+	ring = pcm_ring_create((uint64_t)ARCHIVE_RING_DURATION * config->sample_rate, config->channels);
+	block = malloc(ARCHIVE_BLOCK_FRAMES * config->channels * sizeof *block);
+	encoded = malloc(PCM_CODEC_BOUND(ARCHIVE_BLOCK_FRAMES, config->channels));
+	if (ring == NULL || block == NULL || encoded == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		goto error;
+	}
+	atomic_init(&archive_running, true);
+	sem_init(&archive_semaphore, 0, 0);
+	if (thrd_success != thrd_create(&archive_thread, archive_thread_func, NULL)) {
+		fprintf(stderr, "Error in \"thrd_create(&archive_thread, archive_thread_func, NULL)\"");
+		sem_destroy(&archive_semaphore);
+		goto error;
+	}
+	return true;
+
+error:
+	if (ring != NULL)
+		pcm_ring_destroy(ring);
+	ring = NULL;
+	free(block);
+	free(encoded);
+	return false;
+}
+
+void archive_end()
+{
+	if (ring == NULL)
+		return;
+	atomic_store(&archive_running, false);
+	sem_post(&archive_semaphore);
+	int result;
+	thrd_join(archive_thread, &result);
+	sem_destroy(&archive_semaphore);
+	pcm_ring_destroy(ring);
+	ring = NULL;
+	free(block);
+	free(encoded);
+}
+
+void archive_append_samples(const int16_t *frames, unsigned nframes)
+{
+	if (ring == NULL)
+		return;
+	pcm_ring_write(ring, frames, nframes);
+	uint64_t count = pcm_ring_count(ring);
+	if (count - signaled >= ARCHIVE_BLOCK_FRAMES) {
+		signaled = count - count % ARCHIVE_BLOCK_FRAMES;
+		sem_post(&archive_semaphore);
+	}
+}
+
+const Archive_statistics *archive_statistics()
+{
+	return &statistics;
+}
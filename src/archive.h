@@ -0,0 +1,88 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/*
+ * Arquivo contínuo do som de entrada, comprimido sem perdas.
+ *
+ * As amostras originais (16 bits, canais intercalados) são depositadas
+ * num buffer circular lock-free. Uma tarefa de baixa prioridade codifica
+ * blocos de ARCHIVE_BLOCK_FRAMES frames com pcm_codec e escreve-os no
+ * ficheiro de arquivo. O ficheiro muda a cada file_period segmentos,
+ * tal como o ficheiro de saída, e tem o mesmo nome com a extensão
+ * ARCHIVE_FILE_EXTENSION.
+ *
+ * Se a tarefa se atrasar mais do que a capacidade do buffer circular,
+ * as frames perdidas são registadas como um bloco de silêncio,
+ * mantendo o alinhamento temporal do arquivo.
+ *
+ * Formato do ficheiro (little-endian):
+ *
+ *	cabeçalho
+ *		char     magic[4]		"SMAR"
+ *		uint16_t version		ARCHIVE_FILE_VERSION
+ *		uint16_t channels
+ *		uint32_t sample_rate
+ *		uint32_t block_frames		máximo de frames por bloco
+ *		int64_t  ts			início do ficheiro (segundos, UNIX)
+ *	bloco
+ *		uint16_t sync			ARCHIVE_BLOCK_SYNC
+ *		uint16_t nframes
+ *		uint32_t size			dimensão dos dados; 0 - frames perdidas
+ *		uint8_t  data[size]		pcm_codec_encode
+ */
+
+#define ARCHIVE_FILE_MAGIC	"SMAR"
+#define ARCHIVE_FILE_VERSION	1
+#define ARCHIVE_FILE_EXTENSION	".sma"
+#define ARCHIVE_HEADER_SIZE	24
+#define ARCHIVE_BLOCK_SYNC	0x5342
+#define ARCHIVE_BLOCK_FRAMES	4096
+#define ARCHIVE_RING_DURATION	30	// segundos de atraso tolerado à tarefa
+#define ARCHIVE_NICE		10	// prioridade da tarefa de codificação
+
+typedef struct {
+	uint64_t frames;		// frames arquivadas (incluindo perdidas)
+	uint64_t lost;			// frames perdidas por atraso da tarefa
+	uint64_t raw_bytes;		// dimensão do som sem compressão
+	uint64_t compressed_bytes;	// dimensão escrita nos ficheiros
+	double cpu_time;		// tempo de processador da tarefa (segundos)
+	unsigned files;
+} Archive_statistics;
+
+bool archive_begin(struct config *config);
+void archive_end();
+
+/**
+ * @brief Acrescenta frames (canais intercalados) ao buffer circular.
+ *
+ * Não faz nada se o arquivo não estiver ativo.
+ */
+void archive_append_samples(const int16_t *frames, unsigned nframes);
+
+/**
+ * @brief Estatísticas de compressão - válidas depois de archive_end.
+ */
+const Archive_statistics *archive_statistics();
+
+#endif
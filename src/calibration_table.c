@@ -0,0 +1,151 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "calibration_table.h"
+
+#define CALIBRATION_LINE_SIZE	256
+#define CALIBRATION_TOLERANCE	1e-4f	// dB; o ficheiro tem seis algarismos significativos
+
+static int epoch_compare(const void *a, const void *b)
+{
+	int64_t ts_a = ((const Calibration_epoch *)a)->ts;
+	int64_t ts_b = ((const Calibration_epoch *)b)->ts;
+	return (ts_a > ts_b) - (ts_a < ts_b);
+}
+
+Calibration_table *calibration_table_load(const char *filepath)
+{
+	Calibration_table *table = malloc(sizeof *table);
+	if (table == NULL)
+		return NULL;
+	table->count = 0;
+	table->epochs = NULL;
+	FILE *fd = fopen(filepath, "r");
+	if (fd == NULL) {
+		if (errno == ENOENT)
+			return table;
+		free(table);
+		return NULL;
+	}
+
+	unsigned capacity = 0, line_number = 0;
+	char line[CALIBRATION_LINE_SIZE];
+	while (fgets(line, sizeof line, fd) != NULL) {
+		line_number++;
+		char *text = line + strspn(line, " \t");
+		if (*text == '#' || *text == '\n' || *text == '\0')
+			continue;
+		double seconds;
+		float delta, reference = NAN;
+		if (sscanf(text, "%lf , %f , %f", &seconds, &delta, &reference) < 2) {
+			fprintf(stderr, "%s:%u: invalid calibration epoch\n", filepath, line_number);
+			fclose(fd);
+			calibration_table_destroy(table);
+			errno = EINVAL;
+			return NULL;
+		}
+		if (table->count == capacity) {
+			capacity = capacity == 0 ? 16 : capacity * 2;
+			Calibration_epoch *epochs = realloc(table->epochs, capacity * sizeof *epochs);
+			if (epochs == NULL) {
+				fclose(fd);
+				calibration_table_destroy(table);
+				return NULL;
+			}
+			table->epochs = epochs;
+		}
+		table->epochs[table->count++] = (Calibration_epoch){
+			.ts = llround(seconds * 1000), .delta = delta, .reference = reference
+		};
+	}
+	fclose(fd);
+	qsort(table->epochs, table->count, sizeof *table->epochs, epoch_compare);
+	return table;
+}
+
+void calibration_table_destroy(Calibration_table *table)
+{
+	free(table->epochs);
+	free(table);
+}
+
+/*
+ * Índice da última época iniciada até ts (0 antes da primeira).
+ */
+static unsigned epoch_search(const Calibration_table *table, int64_t ts)
+{
+	unsigned low = 1, high = table->count;
+	while (low < high) {
+		unsigned middle = low + (high - low) / 2;
+		if (table->epochs[middle].ts <= ts)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low - 1;
+}
+
+float calibration_table_delta(const Calibration_table *table, int64_t ts)
+{
+	return table->count > 0 ? table->epochs[epoch_search(table, ts)].delta : 0;
+}
+
+int64_t calibration_table_next(const Calibration_table *table, int64_t ts)
+{
+	if (table->count == 0)
+		return INT64_MAX;
+	unsigned index = epoch_search(table, ts);
+	if (table->epochs[index].ts > ts)
+		return table->epochs[index].ts;
+	return index + 1 < table->count ? table->epochs[index + 1].ts : INT64_MAX;
+}
+
+bool calibration_table_update(const char *filepath, int64_t ts, float delta, float reference)
+{
+	Calibration_table *table = calibration_table_load(filepath);
+	if (table == NULL) {
+		fprintf(stderr, "Calibration table %s: %s\n", filepath, strerror(errno));
+		return false;
+	}
+	bool current = false;
+	if (table->count > 0) {
+		const Calibration_epoch *epoch = &table->epochs[epoch_search(table, ts)];
+		current = fabsf(epoch->delta - delta) < CALIBRATION_TOLERANCE;
+	}
+	bool empty = table->count == 0;
+	calibration_table_destroy(table);
+	if (current)
+		return true;
+
+	FILE *fd = fopen(filepath, "a");
+	if (fd == NULL) {
+		fprintf(stderr, "fopen(%s, \"a\") error: %s\n", filepath, strerror(errno));
+		return false;
+	}
+	if (empty)
+		fprintf(fd, "# ts, calibration_delta, calibration_reference\n");
+	fprintf(fd, "%lld.%03d, %g, %g\n", (long long)(ts / 1000), (int)(ts % 1000), delta, reference);
+	bool written = fflush(fd) == 0 && fsync(fileno(fd)) == 0;
+	fclose(fd);
+	return written;
+}
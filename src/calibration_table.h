@@ -0,0 +1,74 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef CALIBRATION_TABLE_H
+#define CALIBRATION_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Tabela das épocas de calibração.
+ *
+ * Com level_raw os níveis são guardados sem calibration_delta; o valor
+ * a somar a cada nível é o da época em que o nível foi medido, registado
+ * num ficheiro de texto, uma época por linha:
+ *
+ *	<início (segundos, UNIX)>, <calibration_delta>, <calibration_reference>
+ *
+ * As linhas começadas por '#' são comentários. Cada época vale desde
+ * o seu início até ao início da seguinte; a primeira vale também para
+ * os níveis anteriores. Uma recalibração posterior ao registo dos níveis
+ * é apenas uma linha nova ou corrigida na tabela - as linhas não têm de
+ * estar ordenadas.
+ */
+
+typedef struct {
+	int64_t ts;		// início da época (milisegundos, UNIX)
+	float delta;
+	float reference;
+} Calibration_epoch;
+
+typedef struct {
+	unsigned count;
+	Calibration_epoch *epochs;	// ordenadas por ts
+} Calibration_table;
+
+/**
+ * @brief Lê a tabela do ficheiro filepath; tabela vazia se o ficheiro
+ * não existir. NULL com erro de leitura ou linha inválida.
+ */
+Calibration_table *calibration_table_load(const char *filepath);
+void calibration_table_destroy(Calibration_table *table);
+
+/**
+ * @brief calibration_delta em vigor no instante ts (milisegundos);
+ * 0 com a tabela vazia.
+ */
+float calibration_table_delta(const Calibration_table *table, int64_t ts);
+
+/**
+ * @brief Início da primeira época depois de ts, ou INT64_MAX.
+ */
+int64_t calibration_table_next(const Calibration_table *table, int64_t ts);
+
+/**
+ * @brief Acrescenta ao ficheiro a época iniciada em ts (milisegundos),
+ * se delta for diferente do da época em vigor.
+ */
+bool calibration_table_update(const char *filepath, int64_t ts, float delta, float reference);
+
+#endif
@@ -15,6 +15,7 @@ limitations under the License.
 */
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <jansson.h>
@@ -26,6 +27,7 @@ static struct config config = {
 	.output_path = CONFIG_OUTPUT_PATH,
 	.output_filename = CONFIG_OUTPUT_FILENAME,
 	.output_format = CONFIG_OUTPUT_FORMAT,
+	.output_sync = CONFIG_OUTPUT_SYNC,
 	.sample_rate = CONFIG_SAMPLE_RATE,
 	.channels = CONFIG_CHANNELS,
 	.bits_per_sample = CONFIG_BITS_PER_SAMPLE,
@@ -40,7 +42,47 @@ static struct config config = {
 	.mqtt_topic = CONFIG_MQTT_TOPIC,
 	.mqtt_qos = CONFIG_MQTT_QOS,
 	.mqtt_device_credential = CONFIG_MQTT_DEVICE_CREDENTIAL,
+	.mqtt_batch_size = CONFIG_MQTT_BATCH_SIZE,
+	.mqtt_batch_latency = CONFIG_MQTT_BATCH_LATENCY,
+	.mqtt_spool_enable = CONFIG_MQTT_SPOOL_ENABLE,
+	.mqtt_spool_rate = CONFIG_MQTT_SPOOL_RATE,
+	.mqtt_deadband = CONFIG_MQTT_DEADBAND,
+	.mqtt_heartbeat = CONFIG_MQTT_HEARTBEAT,
 	.server_socket = CONFIG_SERVER_SOCKET,
+	.server_backpressure = CONFIG_SERVER_BACKPRESSURE,
+	.server_history = CONFIG_SERVER_HISTORY,
+	.shm_enable = CONFIG_SHM_ENABLE,
+	.shm_name = CONFIG_SHM_NAME,
+	.shm_history = CONFIG_SHM_HISTORY,
+	.shm_pcm_enable = CONFIG_SHM_PCM_ENABLE,
+	.shm_pcm_name = CONFIG_SHM_PCM_NAME,
+	.shm_pcm_duration = CONFIG_SHM_PCM_DURATION,
+	.spectrum_enable = CONFIG_SPECTRUM_ENABLE,
+	.spectrum_size = CONFIG_SPECTRUM_SIZE,
+	.direction_enable = CONFIG_DIRECTION_ENABLE,
+	.direction_radius = CONFIG_DIRECTION_RADIUS,
+	.event_enable = CONFIG_EVENT_ENABLE,
+	.event_laeq_threshold = CONFIG_EVENT_LAEQ_THRESHOLD,
+	.event_lapeak_threshold = CONFIG_EVENT_LAPEAK_THRESHOLD,
+	.event_hysteresis = CONFIG_EVENT_HYSTERESIS,
+	.event_pre_trigger = CONFIG_EVENT_PRE_TRIGGER,
+	.event_post_trigger = CONFIG_EVENT_POST_TRIGGER,
+	.event_max_duration = CONFIG_EVENT_MAX_DURATION,
+	.archive_enable = CONFIG_ARCHIVE_ENABLE,
+	.level_archive_enable = CONFIG_LEVEL_ARCHIVE_ENABLE,
+	.level_archive_remove = CONFIG_LEVEL_ARCHIVE_REMOVE,
+	.level_db_enable = CONFIG_LEVEL_DB_ENABLE,
+	.level_db_path = CONFIG_LEVEL_DB_PATH,
+	.level_raw = CONFIG_LEVEL_RAW,
+	.calibration_table = CONFIG_CALIBRATION_TABLE,
+	.weighting = CONFIG_WEIGHTING,
+	.result_cache_enable = CONFIG_RESULT_CACHE_ENABLE,
+	.result_cache_path = CONFIG_RESULT_CACHE_PATH,
+	.watch_workers = CONFIG_WATCH_WORKERS,
+	.watch_journal = CONFIG_WATCH_JOURNAL,
+	.decode_threads = CONFIG_DECODE_THREADS,
+	.hub_window = CONFIG_HUB_WINDOW,
+	.hub_rolling = CONFIG_HUB_ROLLING,
 };
 
 struct config *config_struct = &config;
@@ -57,6 +99,7 @@ void config_print()
 		"\tOutput path: %s\n"
 		"\tOutput file: %s\n"
 		"\tOutput format: %s\n"
+		"\tOutput sync: %s\n"
 		"\tSample Rate: %d\n"
 		"\tChannels: %d\n"
 		"\tBits per sample: %d\n"
@@ -73,13 +116,54 @@ void config_print()
 		"\tMQTT Topic: %s\n"
 		"\tMQTT qos: %d\n"
 		"\tMQTT device credential: %s\n"
-		"\tServer socket: %s\n",
+		"\tMQTT batch size: %d records\n"
+		"\tMQTT batch latency: %d ms\n"
+		"\tMQTT spool: %s\n"
+		"\tMQTT spool rate: %d records/s\n"
+		"\tMQTT deadband: %.1f dB\n"
+		"\tMQTT heartbeat: %d seconds\n"
+		"\tServer socket: %s\n"
+		"\tServer backpressure: %s\n"
+		"\tServer history: %d hours\n"
+		"\tShared memory: %s\n"
+		"\tShared memory name: %s\n"
+		"\tShared memory history: %d hours\n"
+		"\tShared memory PCM: %s\n"
+		"\tShared memory PCM name: %s\n"
+		"\tShared memory PCM duration: %d seconds\n"
+		"\tSpectrum: %s\n"
+		"\tSpectrum size: %d samples\n"
+		"\tDirection: %s\n"
+		"\tDirection radius: %.4f m\n"
+		"\tEvent: %s\n"
+		"\tEvent LAeq threshold: %.1f dB\n"
+		"\tEvent LApeak threshold: %.1f dB\n"
+		"\tEvent hysteresis: %.1f dB\n"
+		"\tEvent pre-trigger: %d seconds\n"
+		"\tEvent post-trigger: %d seconds\n"
+		"\tEvent max duration: %d seconds\n"
+		"\tArchive: %s\n"
+		"\tLevel archive: %s\n"
+		"\tLevel archive remove: %s\n"
+		"\tLevel database: %s\n"
+		"\tLevel database path: %s\n"
+		"\tRaw levels: %s\n"
+		"\tCalibration table: %s\n"
+		"\tWeighting: %s\n"
+		"\tResult cache: %s\n"
+		"\tResult cache path: %s\n"
+		"\tWatch workers: %d\n"
+		"\tWatch journal: %s\n"
+		"\tDecode threads: %d\n"
+		"\tHub reorder window: %d ms\n"
+		"\tHub rolling window: %d segments\n",
 		config_struct->identification,
 		config_struct->input_device,
 		config_struct->input_file,
 		config_struct->output_path,
 		config_struct->output_filename,
 		config_struct->output_format,
+		config_struct->output_sync,
 		config_struct->sample_rate,
 		config_struct->channels,
 		config_struct->bits_per_sample,
@@ -96,7 +180,47 @@ void config_print()
 		config_struct->mqtt_topic,
 		config_struct->mqtt_qos,
 		config_struct->mqtt_device_credential,
-		config_struct->server_socket
+		config_struct->mqtt_batch_size,
+		config_struct->mqtt_batch_latency,
+		config_struct->mqtt_spool_enable? "enabled" : "disabled",
+		config_struct->mqtt_spool_rate,
+		config_struct->mqtt_deadband,
+		config_struct->mqtt_heartbeat,
+		config_struct->server_socket,
+		config_struct->server_backpressure,
+		config_struct->server_history,
+		config_struct->shm_enable? "enabled" : "disabled",
+		config_struct->shm_name,
+		config_struct->shm_history,
+		config_struct->shm_pcm_enable? "enabled" : "disabled",
+		config_struct->shm_pcm_name,
+		config_struct->shm_pcm_duration,
+		config_struct->spectrum_enable? "enabled" : "disabled",
+		config_struct->spectrum_size,
+		config_struct->direction_enable? "enabled" : "disabled",
+		config_struct->direction_radius,
+		config_struct->event_enable? "enabled" : "disabled",
+		config_struct->event_laeq_threshold,
+		config_struct->event_lapeak_threshold,
+		config_struct->event_hysteresis,
+		config_struct->event_pre_trigger,
+		config_struct->event_post_trigger,
+		config_struct->event_max_duration,
+		config_struct->archive_enable? "enabled" : "disabled",
+		config_struct->level_archive_enable? "enabled" : "disabled",
+		config_struct->level_archive_remove? "enabled" : "disabled",
+		config_struct->level_db_enable? "enabled" : "disabled",
+		config_struct->level_db_path,
+		config_struct->level_raw? "enabled" : "disabled",
+		config_struct->calibration_table,
+		config_struct->weighting,
+		config_struct->result_cache_enable? "enabled" : "disabled",
+		config_struct->result_cache_path,
+		config_struct->watch_workers,
+		config_struct->watch_journal,
+		config_struct->decode_threads,
+		config_struct->hub_window,
+		config_struct->hub_rolling
 		);
 }
 
@@ -143,6 +267,7 @@ static void config_update_from_json(struct config *config_struct, json_t *config
 	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, output_path);
 	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, output_filename);
 	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, output_format);
+	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, output_sync);
 
 	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, sample_rate);
 	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, channels);
@@ -161,7 +286,50 @@ static void config_update_from_json(struct config *config_struct, json_t *config
 	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, mqtt_topic);
 	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, mqtt_qos);
 	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, mqtt_device_credential);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, mqtt_batch_size);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, mqtt_batch_latency);
+	CONFIG_UPDATE_FROM_JSON_BOOL(config_struct, config_json, mqtt_spool_enable);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, mqtt_spool_rate);
+	CONFIG_UPDATE_FROM_JSON_REAL(config_struct, config_json, mqtt_deadband);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, mqtt_heartbeat);
 	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, server_socket);
+	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, server_backpressure);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, server_history);
+	CONFIG_UPDATE_FROM_JSON_BOOL(config_struct, config_json, shm_enable);
+	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, shm_name);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, shm_history);
+	CONFIG_UPDATE_FROM_JSON_BOOL(config_struct, config_json, shm_pcm_enable);
+	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, shm_pcm_name);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, shm_pcm_duration);
+
+	CONFIG_UPDATE_FROM_JSON_BOOL(config_struct, config_json, spectrum_enable);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, spectrum_size);
+
+	CONFIG_UPDATE_FROM_JSON_BOOL(config_struct, config_json, direction_enable);
+	CONFIG_UPDATE_FROM_JSON_REAL(config_struct, config_json, direction_radius);
+
+	CONFIG_UPDATE_FROM_JSON_BOOL(config_struct, config_json, event_enable);
+	CONFIG_UPDATE_FROM_JSON_REAL(config_struct, config_json, event_laeq_threshold);
+	CONFIG_UPDATE_FROM_JSON_REAL(config_struct, config_json, event_lapeak_threshold);
+	CONFIG_UPDATE_FROM_JSON_REAL(config_struct, config_json, event_hysteresis);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, event_pre_trigger);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, event_post_trigger);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, event_max_duration);
+	CONFIG_UPDATE_FROM_JSON_BOOL(config_struct, config_json, archive_enable);
+	CONFIG_UPDATE_FROM_JSON_BOOL(config_struct, config_json, level_archive_enable);
+	CONFIG_UPDATE_FROM_JSON_BOOL(config_struct, config_json, level_archive_remove);
+	CONFIG_UPDATE_FROM_JSON_BOOL(config_struct, config_json, level_db_enable);
+	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, level_db_path);
+	CONFIG_UPDATE_FROM_JSON_BOOL(config_struct, config_json, level_raw);
+	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, calibration_table);
+	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, weighting);
+	CONFIG_UPDATE_FROM_JSON_BOOL(config_struct, config_json, result_cache_enable);
+	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, result_cache_path);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, watch_workers);
+	CONFIG_UPDATE_FROM_JSON_STRING(config_struct, config_json, watch_journal);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, decode_threads);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, hub_window);
+	CONFIG_UPDATE_FROM_JSON_INTEGER(config_struct, config_json, hub_rolling);
 }
 
 #define	CONFIG_UPDATE_TO_JSON(type, config_struct, config_json, key) \
@@ -239,6 +407,7 @@ static void config_update_to_json(struct config *config_struct, json_t *config_j
 	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, output_path);
 	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, output_filename);
 	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, output_format);
+	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, output_sync);
 
 	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, sample_rate);
 	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, channels);
@@ -257,7 +426,50 @@ static void config_update_to_json(struct config *config_struct, json_t *config_j
 	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, mqtt_topic);
 	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, mqtt_qos);
 	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, mqtt_device_credential);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, mqtt_batch_size);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, mqtt_batch_latency);
+	CONFIG_UPDATE_TO_JSON_BOOL(config_struct, config_json, mqtt_spool_enable);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, mqtt_spool_rate);
+	CONFIG_UPDATE_TO_JSON_REAL(config_struct, config_json, mqtt_deadband);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, mqtt_heartbeat);
 	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, server_socket);
+	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, server_backpressure);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, server_history);
+	CONFIG_UPDATE_TO_JSON_BOOL(config_struct, config_json, shm_enable);
+	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, shm_name);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, shm_history);
+	CONFIG_UPDATE_TO_JSON_BOOL(config_struct, config_json, shm_pcm_enable);
+	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, shm_pcm_name);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, shm_pcm_duration);
+
+	CONFIG_UPDATE_TO_JSON_BOOL(config_struct, config_json, spectrum_enable);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, spectrum_size);
+
+	CONFIG_UPDATE_TO_JSON_BOOL(config_struct, config_json, direction_enable);
+	CONFIG_UPDATE_TO_JSON_REAL(config_struct, config_json, direction_radius);
+
+	CONFIG_UPDATE_TO_JSON_BOOL(config_struct, config_json, event_enable);
+	CONFIG_UPDATE_TO_JSON_REAL(config_struct, config_json, event_laeq_threshold);
+	CONFIG_UPDATE_TO_JSON_REAL(config_struct, config_json, event_lapeak_threshold);
+	CONFIG_UPDATE_TO_JSON_REAL(config_struct, config_json, event_hysteresis);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, event_pre_trigger);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, event_post_trigger);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, event_max_duration);
+	CONFIG_UPDATE_TO_JSON_BOOL(config_struct, config_json, archive_enable);
+	CONFIG_UPDATE_TO_JSON_BOOL(config_struct, config_json, level_archive_enable);
+	CONFIG_UPDATE_TO_JSON_BOOL(config_struct, config_json, level_archive_remove);
+	CONFIG_UPDATE_TO_JSON_BOOL(config_struct, config_json, level_db_enable);
+	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, level_db_path);
+	CONFIG_UPDATE_TO_JSON_BOOL(config_struct, config_json, level_raw);
+	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, calibration_table);
+	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, weighting);
+	CONFIG_UPDATE_TO_JSON_BOOL(config_struct, config_json, result_cache_enable);
+	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, result_cache_path);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, watch_workers);
+	CONFIG_UPDATE_TO_JSON(string, config_struct, config_json, watch_journal);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, decode_threads);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, hub_window);
+	CONFIG_UPDATE_TO_JSON_INTEGER(config_struct, config_json, hub_rolling);
 }
 
 void config_destroy()
@@ -309,3 +521,84 @@ void config_save(const char *config_filename)
 				config_filename);
 	}
 }
+
+//	Parâmetros que não alteram os níveis calculados de um ficheiro
+static const char *const results_ignored[] = {
+	"input_device", "output_path", "output_filename", "output_sync",
+	"mqtt_enable", "mqtt_broker", "mqtt_topic", "mqtt_qos", "mqtt_device_credential",
+	"mqtt_batch_size", "mqtt_batch_latency", "mqtt_spool_enable", "mqtt_spool_rate",
+	"mqtt_deadband", "mqtt_heartbeat",
+	"server_socket", "server_backpressure", "server_history",
+	"shm_enable", "shm_name", "shm_history", "shm_pcm_enable", "shm_pcm_name", "shm_pcm_duration",
+	"event_enable", "event_laeq_threshold", "event_lapeak_threshold", "event_hysteresis",
+	"event_pre_trigger", "event_post_trigger", "event_max_duration",
+	"archive_enable", "level_archive_enable", "level_archive_remove",
+	"level_db_enable", "level_db_path", "calibration_table",
+	"result_cache_enable", "result_cache_path",
+};
+
+char *config_results_json(struct config *config)
+{
+	json_t *results_json = json_object();
+	if (results_json == NULL)
+		return NULL;
+	config_update_to_json(config, results_json);
+	for (size_t i = 0; i < sizeof results_ignored / sizeof results_ignored[0]; i++)
+		json_object_del(results_json, results_ignored[i]);
+	char *text = json_dumps(results_json, JSON_COMPACT | JSON_SORT_KEYS);
+	json_decref(results_json);
+	return text;
+}
+
+static json_t *sweep_json;	// configurações do varrimento, donas das strings
+
+struct config *config_sweep_load(const char *filename, unsigned *count)
+{
+	json_error_t error;
+	json_t *variants = json_load_file(filename, 0, &error);
+	if (variants == NULL) {
+		fprintf(stderr, "%s: error on line %d: %s\n", filename, error.line, error.text);
+		return NULL;
+	}
+	size_t size = json_array_size(variants);
+	if (!json_is_array(variants) || size == 0) {
+		fprintf(stderr, "%s: expected a non empty array of configuration objects\n", filename);
+		json_decref(variants);
+		return NULL;
+	}
+	struct config *configs = malloc(size * sizeof *configs);
+	sweep_json = json_array();
+	if (configs == NULL || sweep_json == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		free(configs);
+		json_decref(variants);
+		return NULL;
+	}
+	size_t index;
+	json_t *variant;
+	json_array_foreach(variants, index, variant) {
+		if (!json_is_object(variant)) {
+			fprintf(stderr, "%s: element %zu is not an object\n", filename, index);
+			config_sweep_destroy(configs);
+			json_decref(variants);
+			return NULL;
+		}
+		//	A configuração completa, alterada pelo elemento do varrimento
+		json_t *variant_json = json_object();
+		config_update_to_json(config_struct, variant_json);
+		json_object_update(variant_json, variant);
+		configs[index] = *config_struct;
+		config_update_from_json(&configs[index], variant_json);
+		json_array_append_new(sweep_json, variant_json);
+	}
+	json_decref(variants);
+	*count = size;
+	return configs;
+}
+
+void config_sweep_destroy(struct config *configs)
+{
+	free(configs);
+	json_decref(sweep_json);
+	sweep_json = NULL;
+}
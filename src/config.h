@@ -29,6 +29,7 @@ limitations under the License.
 #define CONFIG_OUTPUT_PATH "data/"
 #define CONFIG_OUTPUT_FILENAME "sound_meter_"
 #define CONFIG_OUTPUT_FORMAT ".csv"
+#define CONFIG_OUTPUT_SYNC "record"	// record, file ou none
 
 #define CONFIG_IDENTIFICATION "XXXX_NNNN"
 
@@ -65,8 +66,53 @@ limitations under the License.
 #define CONFIG_MQTT_DEVICE_CREDENTIAL	"undefined"
 
 #define	CONFIG_MQTT_PUBLISH_PERIOD	10	//	Tempo de publicação em número de segmentos
+#define CONFIG_MQTT_BATCH_SIZE		1	// registos por mensagem
+#define CONFIG_MQTT_BATCH_LATENCY	5000	// espera máxima de um registo (milisegundos)
+#define CONFIG_MQTT_SPOOL_ENABLE	false
+#define CONFIG_MQTT_SPOOL_RATE		100	// registos guardados enviados por segundo
+#define CONFIG_MQTT_DEADBAND		0.0f	// dB - 0 publica todos os segmentos
+#define CONFIG_MQTT_HEARTBEAT		60	// segundos
+
+#define CONFIG_SPECTRUM_ENABLE	false
+#define CONFIG_SPECTRUM_SIZE	4096	// dimensão da FFT em número de amostras
+
+#define CONFIG_DIRECTION_ENABLE	false
+#define CONFIG_DIRECTION_RADIUS	0.0323f	// raio do array de microfones em metros (ReSpeaker 4-Mic)
+
+#define CONFIG_EVENT_ENABLE		false
+#define CONFIG_EVENT_LAEQ_THRESHOLD	80.0f	// dB
+#define CONFIG_EVENT_LAPEAK_THRESHOLD	120.0f	// dB
+#define CONFIG_EVENT_HYSTERESIS		3.0f	// dB
+#define CONFIG_EVENT_PRE_TRIGGER	5	// segundos
+#define CONFIG_EVENT_POST_TRIGGER	5	// segundos
+#define CONFIG_EVENT_MAX_DURATION	60	// segundos
+
+#define CONFIG_ARCHIVE_ENABLE	false
+#define CONFIG_LEVEL_ARCHIVE_ENABLE	false
+#define CONFIG_LEVEL_ARCHIVE_REMOVE	false
+#define CONFIG_LEVEL_DB_ENABLE	false
+#define CONFIG_LEVEL_DB_PATH	"data/db/"
+#define CONFIG_LEVEL_RAW	false
+#define CONFIG_CALIBRATION_TABLE	"data/calibration.csv"
+#define CONFIG_WEIGHTING	"A"
+#define CONFIG_RESULT_CACHE_ENABLE	false
+#define CONFIG_RESULT_CACHE_PATH	"data/cache/"
+#define CONFIG_WATCH_WORKERS	2
+#define CONFIG_WATCH_JOURNAL	"data/watch_journal.txt"
+#define CONFIG_DECODE_THREADS	0
+#define CONFIG_HUB_WINDOW	3000	// milisegundos
+#define CONFIG_HUB_ROLLING	3600	// segmentos (1 hora)
 
 #define CONFIG_SERVER_SOCKET	"sound_meter_server_socket"
+#define CONFIG_SERVER_BACKPRESSURE	"drop_oldest"	// drop_oldest, drop_newest ou disconnect
+#define CONFIG_SERVER_HISTORY		24	// horas de registos mantidos em memória
+
+#define CONFIG_SHM_ENABLE	false
+#define CONFIG_SHM_NAME		"/sound_meter_levels"
+#define CONFIG_SHM_HISTORY	1	// horas de registos em memória partilhada
+#define CONFIG_SHM_PCM_ENABLE	false
+#define CONFIG_SHM_PCM_NAME	"/sound_meter_pcm"
+#define CONFIG_SHM_PCM_DURATION	10	// segundos de som em memória partilhada
 
 struct config
 {
@@ -76,6 +122,7 @@ struct config
 	const char *output_path;	// diretoria onde são depositados os ficheiros criados
 	const char *output_filename;	// nome do ficheiro de saída
 	const char *output_format;	// formato dos dados de saída (extensão do ficheiro de saída)
+	const char *output_sync;	// fsync dos ficheiros de saída: record, file ou none
 
 	unsigned sample_rate;		// ritmo de amostragem
 	unsigned channels;		// número de canais
@@ -97,7 +144,52 @@ struct config
 	int mqtt_qos;
 	const char *mqtt_device_credential;
 	// int mqtt_publish_period;
+	unsigned mqtt_batch_size;	// número máximo de registos por mensagem
+	unsigned mqtt_batch_latency;	// espera máxima de um registo na fila (milisegundos)
+	bool mqtt_spool_enable;		// guardar em ficheiro os registos não publicados
+	unsigned mqtt_spool_rate;	// ritmo de envio dos registos guardados (registos/s)
+	float mqtt_deadband;		// variação mínima dos níveis para publicar (dB)
+	unsigned mqtt_heartbeat;	// intervalo máximo entre publicações (segundos)
 	const char *server_socket;
+	const char *server_backpressure;	// política para clientes que não leem a tempo
+	unsigned server_history;	// horas de registos mantidos para os clientes (0 - sem histórico)
+
+	bool shm_enable;		// níveis em memória partilhada (shm_levels.h)
+	const char *shm_name;		// nome do segmento de memória partilhada
+	unsigned shm_history;		// horas de registos em memória partilhada
+	bool shm_pcm_enable;		// som captado em memória partilhada (shm_pcm.h)
+	const char *shm_pcm_name;	// nome do segmento do som captado
+	unsigned shm_pcm_duration;	// segundos de som em memória partilhada
+
+	bool spectrum_enable;		// espectro de banda estreita por segmento
+	unsigned spectrum_size;		// dimensão da FFT (potência de 2)
+
+	bool direction_enable;		// direção da fonte sonora (channels >= 2)
+	float direction_radius;		// raio do array circular de microfones (m)
+
+	bool event_enable;		// deteção de excedências com gravação do som
+	float event_laeq_threshold;	// limiar do nível equivalente do segmento
+	float event_lapeak_threshold;	// limiar de LApeak
+	float event_hysteresis;		// histerese dos limiares
+	unsigned event_pre_trigger;	// som gravado antes do evento (segundos)
+	unsigned event_post_trigger;	// som gravado depois do evento (segundos)
+	unsigned event_max_duration;	// duração máxima de um evento (segundos)
+
+	bool archive_enable;		// arquivo contínuo do som, comprimido sem perdas
+	bool level_archive_enable;	// arquivo compacto dos ficheiros de saída fechados
+	bool level_archive_remove;	// apagar os ficheiros de saída arquivados
+	bool level_db_enable;		// base de dados de níveis indexada pelo tempo
+	const char *level_db_path;	// diretoria da base de dados de níveis
+	bool level_raw;			// guardar os níveis sem calibration_delta
+	const char *calibration_table;	// épocas de calibração dos níveis guardados
+	const char *weighting;		// ponderação na frequência: A ou Z
+	bool result_cache_enable;	// reutilizar os resultados do processamento de ficheiros
+	const char *result_cache_path;	// diretoria da cache de resultados
+	unsigned watch_workers;		// processamentos simultâneos no modo de vigilância
+	const char *watch_journal;	// ficheiros de entrada já processados
+	unsigned decode_threads;		// tarefas de descodificação FLAC (0 - uma por processador)
+	unsigned hub_window;		// janela de reordenação do concentrador (milisegundos)
+	unsigned hub_rolling;		// segmentos da média deslizante do concentrador
 };
 
 struct config *config_load(const char *config_filename);
@@ -105,6 +197,24 @@ void config_save(const char *config_filename);
 void config_destroy();
 void config_print();
 
+/**
+ * @brief Configurações de um varrimento (sweep.h): o ficheiro filename
+ * tem um array JSON de objetos; cada objeto altera os parâmetros
+ * de config_struct.
+ *
+ * @return count configurações, ou NULL em erro.
+ */
+struct config *config_sweep_load(const char *filename, unsigned *count);
+void config_sweep_destroy(struct config *configs);
+
+/**
+ * @brief Parâmetros de config que determinam os níveis calculados de um ficheiro,
+ * em JSON compacto com as chaves ordenadas (result_cache.h).
+ *
+ * @return texto a libertar com free, ou NULL em erro.
+ */
+char *config_results_json(struct config *config);
+
 extern struct config *config_struct;
 
 #endif
@@ -0,0 +1,214 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "direction.h"
+#include "fft.h"
+
+#define DIRECTION_ANGLES	360
+
+struct direction {
+	Fft *fft;
+	unsigned channels;
+	unsigned pairs;		// channels * (channels - 1) / 2
+	unsigned block_size;
+	unsigned bin_min, bin_max;	// banda usada [bin_min, bin_max]
+	unsigned bins;		// bin_max - bin_min + 1
+	float *window;		// janela retangular
+	float *spec_re;		// espetro do bloco por canal (channels * bins)
+	float *spec_im;
+	float *cross_re;	// soma dos espetros cruzados por par (pairs * bins)
+	float *cross_im;
+	unsigned blocks;	// blocos acumulados
+	int lag_max;		// atraso máximo em unidades de 1 / DIRECTION_LAG_RESOLUTION
+	unsigned lags;		// 2 * lag_max + 1
+	float *correlation;	// correlação cruzada por par (pairs * lags)
+	float *delay;		// atraso teórico por ângulo e par (DIRECTION_ANGLES * pairs)
+};
+
+Direction *direction_create(unsigned channels, unsigned block_size,
+		unsigned sample_rate, float radius)
+{
+	if (channels < 2)
+		return NULL;
+	unsigned bin_min = ceilf(DIRECTION_FREQ_MIN * block_size / sample_rate);
+	unsigned bin_max = fminf(DIRECTION_FREQ_MAX * block_size / sample_rate, block_size / 2 - 1);
+	if (bin_min < 1)
+		bin_min = 1;
+	if (bin_max < bin_min) {	// banda vazia a esta resolução
+		fprintf(stderr, "Direction: no FFT bins between %.0f Hz and %.0f Hz"
+			" with block size %u at %u Hz\n",
+			DIRECTION_FREQ_MIN, DIRECTION_FREQ_MAX, block_size, sample_rate);
+		return NULL;
+	}
+	Direction *direction = malloc(sizeof *direction);
+	if (direction == NULL)
+		return NULL;
+	direction->fft = fft_create(block_size);
+	if (direction->fft == NULL) {
+		free(direction);
+		return NULL;
+	}
+	direction->channels = channels;
+	direction->pairs = channels * (channels - 1) / 2;
+	direction->block_size = block_size;
+	direction->bin_min = bin_min;
+	direction->bin_max = bin_max;
+	direction->bins = direction->bin_max - direction->bin_min + 1;
+
+	float max_delay = 2 * radius / DIRECTION_SOUND_SPEED * sample_rate;	// amostras
+	direction->lag_max = ceilf(max_delay * DIRECTION_LAG_RESOLUTION) + 1;
+	direction->lags = 2 * direction->lag_max + 1;
+
+	size_t size = block_size
+		+ 2 * channels * direction->bins
+		+ 2 * direction->pairs * direction->bins
+		+ direction->pairs * direction->lags
+		+ DIRECTION_ANGLES * direction->pairs;
+	float *buffer = malloc(size * sizeof *buffer);
+	if (buffer == NULL) {
+		fft_destroy(direction->fft);
+		free(direction);
+		return NULL;
+	}
+	direction->window = buffer;
+	direction->spec_re = buffer += block_size;
+	direction->spec_im = buffer += channels * direction->bins;
+	direction->cross_re = buffer += channels * direction->bins;
+	direction->cross_im = buffer += direction->pairs * direction->bins;
+	direction->correlation = buffer += direction->pairs * direction->bins;
+	direction->delay = buffer += direction->pairs * direction->lags;
+
+	for (unsigned i = 0; i < block_size; i++)
+		direction->window[i] = 1.0f;
+	memset(direction->cross_re, 0, 2 * direction->pairs * direction->bins * sizeof *buffer);
+	direction->blocks = 0;
+
+	/*
+	 * Onda plana vinda do ângulo theta: o microfone c, na posição
+	 * radius * (cos phi_c, sin phi_c), recebe o som com o atraso
+	 * -radius * cos(theta - phi_c) / c. O atraso do par (i, j) é t_i - t_j.
+	 */
+	for (unsigned a = 0; a < DIRECTION_ANGLES; a++) {
+		double theta = 2 * M_PI * a / DIRECTION_ANGLES;
+		float *delay = direction->delay + a * direction->pairs;
+		for (unsigned i = 0, p = 0; i < channels; i++)
+			for (unsigned j = i + 1; j < channels; j++, p++) {
+				double phi_i = 2 * M_PI * i / channels;
+				double phi_j = 2 * M_PI * j / channels;
+				delay[p] = radius / DIRECTION_SOUND_SPEED * sample_rate
+					* (cos(theta - phi_j) - cos(theta - phi_i));
+			}
+	}
+	return direction;
+}
+
+void direction_destroy(Direction *direction)
+{
+	fft_destroy(direction->fft);
+	free(direction->window);
+	free(direction);
+}
+
+void direction_block(Direction *direction, const float *block, unsigned length)
+{
+	if (length != direction->block_size)
+		return;
+	unsigned bins = direction->bins;
+	for (unsigned c = 0; c < direction->channels; c++) {
+		fft_load(direction->fft, block + c * length, direction->window, 0, length);
+		fft_execute(direction->fft);
+		memcpy(direction->spec_re + c * bins, fft_real(direction->fft) + direction->bin_min,
+			bins * sizeof *direction->spec_re);
+		memcpy(direction->spec_im + c * bins, fft_imag(direction->fft) + direction->bin_min,
+			bins * sizeof *direction->spec_im);
+	}
+	for (unsigned i = 0, p = 0; i < direction->channels; i++)
+		for (unsigned j = i + 1; j < direction->channels; j++, p++) {
+			const float *xr = direction->spec_re + i * bins, *xi = direction->spec_im + i * bins;
+			const float *yr = direction->spec_re + j * bins, *yi = direction->spec_im + j * bins;
+			float *gr = direction->cross_re + p * bins, *gi = direction->cross_im + p * bins;
+			for (unsigned k = 0; k < bins; k++) {
+				//	X_i * conj(X_j) / |X_i * conj(X_j)|
+				float re = xr[k] * yr[k] + xi[k] * yi[k];
+				float im = xi[k] * yr[k] - xr[k] * yi[k];
+				float magnitude = sqrtf(re * re + im * im);
+				if (magnitude > 1e-20f) {
+					gr[k] += re / magnitude;
+					gi[k] += im / magnitude;
+				}
+			}
+		}
+	direction->blocks++;
+}
+
+/*
+ * R(tau) = soma_k Re(G[k] * exp(i * 2 * pi * k * tau / N))
+ */
+static void direction_correlation(Direction *direction, unsigned p)
+{
+	unsigned bins = direction->bins;
+	const float *gr = direction->cross_re + p * bins, *gi = direction->cross_im + p * bins;
+	float *correlation = direction->correlation + p * direction->lags;
+	for (int l = -direction->lag_max; l <= direction->lag_max; l++) {
+		double omega = 2 * M_PI * ((double)l / DIRECTION_LAG_RESOLUTION) / direction->block_size;
+		double step_re = cos(omega), step_im = sin(omega);
+		double rot_re = cos(omega * direction->bin_min), rot_im = sin(omega * direction->bin_min);
+		double sum = 0;
+		for (unsigned k = 0; k < bins; k++) {
+			sum += gr[k] * rot_re - gi[k] * rot_im;
+			double re = rot_re * step_re - rot_im * step_im;
+			rot_im = rot_re * step_im + rot_im * step_re;
+			rot_re = re;
+		}
+		correlation[l + direction->lag_max] = sum;
+	}
+}
+
+int direction_estimate(Direction *direction)
+{
+	if (direction->blocks == 0)
+		return DIRECTION_UNDEFINED;
+
+	for (unsigned p = 0; p < direction->pairs; p++)
+		direction_correlation(direction, p);
+
+	int best_angle = DIRECTION_UNDEFINED;
+	float best_score = -INFINITY;
+	for (unsigned a = 0; a < DIRECTION_ANGLES; a++) {
+		const float *delay = direction->delay + a * direction->pairs;
+		float score = 0;
+		for (unsigned p = 0; p < direction->pairs; p++) {
+			//	Interpolação linear na grelha de atrasos
+			float x = delay[p] * DIRECTION_LAG_RESOLUTION + direction->lag_max;
+			int index = x;
+			float fraction = x - index;
+			const float *correlation = direction->correlation + p * direction->lags;
+			score += correlation[index] + fraction * (correlation[index + 1] - correlation[index]);
+		}
+		if (score > best_score) {
+			best_score = score;
+			best_angle = a;
+		}
+	}
+	memset(direction->cross_re, 0, 2 * direction->pairs * direction->bins * sizeof *direction->cross_re);
+	direction->blocks = 0;
+	return best_angle;
+}
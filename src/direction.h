@@ -0,0 +1,60 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef DIRECTION_H
+#define DIRECTION_H
+
+/*
+ * Direção de chegada do som dominante (GCC-PHAT).
+ *
+ * Os microfones estão dispostos uniformemente numa circunferência de raio
+ * radius, o microfone do canal c no ângulo 360 * c / channels graus.
+ *
+ * Em cada bloco é calculada a FFT de cada canal e acumulado, para cada par
+ * de canais, o espetro cruzado normalizado (PHAT). No fim do segmento
+ * calcula-se a correlação cruzada de cada par, para os atrasos possíveis,
+ * e escolhe-se o ângulo cujos atrasos teóricos maximizam a soma das
+ * correlações. Não é necessário guardar as amostras do segmento.
+ */
+
+#define DIRECTION_SOUND_SPEED	343.0f	// velocidade do som (m/s)
+#define DIRECTION_FREQ_MIN	200.0f	// banda usada na estimação (Hz)
+#define DIRECTION_FREQ_MAX	8000.0f
+#define DIRECTION_LAG_RESOLUTION 4	// divisões de uma amostra nos atrasos
+#define DIRECTION_UNDEFINED	-1
+
+typedef struct direction Direction;
+
+Direction *direction_create(unsigned channels, unsigned block_size,
+		unsigned sample_rate, float radius);
+void direction_destroy(Direction *direction);
+
+/**
+ * @brief Acumula os espetros cruzados de um bloco.
+ *
+ * @param block Amostras por canal, em blocos consecutivos de length amostras.
+ * @param length Número de amostras por canal. Só são usados blocos completos.
+ */
+void direction_block(Direction *direction, const float *block, unsigned length);
+
+/**
+ * @brief Estima a direção com os blocos acumulados desde a última estimação.
+ *
+ * @return Ângulo em graus (0 .. 359) ou DIRECTION_UNDEFINED.
+ */
+int direction_estimate(Direction *direction);
+
+#endif
@@ -0,0 +1,314 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <threads.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "pcm_ring.h"
+
+typedef struct {
+	uint64_t start;		// primeira frame (contagem desde o início)
+	uint64_t trigger;	// frame de início da excedência
+	uint64_t end;		// frame seguinte à última
+	time_t ts;		// tempo de calendário correspondente a start
+	float lae_max;
+	float lapeak_max;
+} Event;
+
+//	Buffer circular de frames - escrito pelo ciclo de processamento
+static Pcm_ring *ring;
+static unsigned ring_channels;
+
+//	Fila de eventos para a tarefa de escrita
+static Event queue[EVENT_QUEUE_SIZE];
+static atomic_uint queue_put;
+static atomic_uint queue_get;
+static sem_t queue_semaphore;
+static atomic_bool writer_running;
+static thrd_t writer_thread;
+
+//	Estado da deteção - só acedido pelo ciclo de processamento
+static enum {EVENT_IDLE, EVENT_ACTIVE, EVENT_CLOSING} state;
+static Event current;
+static unsigned events_dropped;
+
+static struct config *event_config;
+
+static void event_write(Event *event);
+
+static int writer_thread_func(void *not_used)
+{
+	while (true) {
+		sem_wait(&queue_semaphore);
+		unsigned get = atomic_load_explicit(&queue_get, memory_order_relaxed);
+		unsigned put = atomic_load_explicit(&queue_put, memory_order_acquire);
+		if (get == put) {
+			if (!atomic_load(&writer_running))
+				break;
+			continue;
+		}
+		event_write(&queue[get % EVENT_QUEUE_SIZE]);
+		atomic_store_explicit(&queue_get, get + 1, memory_order_release);
+	}
+	return 0;
+}
+
+bool event_begin(struct config *config)
+{
+	event_config = config;
+	ring_channels = config->channels;
+	uint64_t capacity = (uint64_t)(config->event_pre_trigger + config->event_max_duration
+			+ config->event_post_trigger + EVENT_RING_GUARD) * config->sample_rate;
+	ring = pcm_ring_create(capacity, ring_channels);
+	if (ring == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return false;
+	}
+	atomic_init(&queue_put, 0);
+	atomic_init(&queue_get, 0);
+	atomic_init(&writer_running, true);
+	state = EVENT_IDLE;
+	events_dropped = 0;
+	sem_init(&queue_semaphore, 0, 0);
+	if (thrd_success != thrd_create(&writer_thread, writer_thread_func, NULL)) {
+		fprintf(stderr, "Error in \"thrd_create(&writer_thread, writer_thread_func, NULL)\"");
+		pcm_ring_destroy(ring);
+		ring = NULL;
+		return false;
+	}
+	return true;
+}
+
+static void event_post(Event *event)
+{
+	unsigned put = atomic_load_explicit(&queue_put, memory_order_relaxed);
+	unsigned get = atomic_load_explicit(&queue_get, memory_order_acquire);
+	if (put - get == EVENT_QUEUE_SIZE) {
+		events_dropped++;
+		fprintf(stderr, "Event: queue full, event dropped (%d)\n", events_dropped);
+		return;
+	}
+	queue[put % EVENT_QUEUE_SIZE] = *event;
+	atomic_store_explicit(&queue_put, put + 1, memory_order_release);
+	sem_post(&queue_semaphore);
+}
+
+void event_end()
+{
+	if (ring == NULL)
+		return;
+	if (state != EVENT_IDLE) {
+		uint64_t now = pcm_ring_count(ring);
+		if (current.end > now)
+			current.end = now;
+		event_post(&current);
+		state = EVENT_IDLE;
+	}
+	atomic_store(&writer_running, false);
+	sem_post(&queue_semaphore);
+	int result;
+	thrd_join(writer_thread, &result);
+	sem_destroy(&queue_semaphore);
+	pcm_ring_destroy(ring);
+	ring = NULL;
+}
+
+void event_append_samples(const int16_t *frames, unsigned nframes)
+{
+	if (ring != NULL)
+		pcm_ring_write(ring, frames, nframes);
+}
+
+void event_segment(Levels *levels, unsigned segment_index, struct config *config)
+{
+	if (ring == NULL)
+		return;
+	float lae = levels->LAE[segment_index];
+	float lapeak = levels->LApeak[segment_index];
+	bool exceeded = lae >= config->event_laeq_threshold
+			|| lapeak >= config->event_lapeak_threshold;
+	bool released = lae < config->event_laeq_threshold - config->event_hysteresis
+			&& lapeak < config->event_lapeak_threshold - config->event_hysteresis;
+
+	uint64_t now = pcm_ring_count(ring);
+	uint64_t pre = (uint64_t)config->event_pre_trigger * config->sample_rate;
+	uint64_t post = (uint64_t)config->event_post_trigger * config->sample_rate;
+	uint64_t max_duration = (uint64_t)config->event_max_duration * config->sample_rate;
+
+	switch (state) {
+	case EVENT_IDLE:
+		if (exceeded) {
+			current.trigger = now > config->segment_size ? now - config->segment_size : 0;
+			current.start = current.trigger > pre ? current.trigger - pre : 0;
+			current.ts = time(NULL) - (now - current.start) / config->sample_rate;
+			current.lae_max = lae;
+			current.lapeak_max = lapeak;
+			state = EVENT_ACTIVE;
+		}
+		break;
+	case EVENT_CLOSING:
+		if (exceeded && now - current.trigger < max_duration)
+			state = EVENT_ACTIVE;
+		/* fall through */
+	case EVENT_ACTIVE:
+		if (current.lae_max < lae)
+			current.lae_max = lae;
+		if (current.lapeak_max < lapeak)
+			current.lapeak_max = lapeak;
+		if (state == EVENT_ACTIVE && (released || now - current.trigger >= max_duration)) {
+			current.end = now + post;
+			state = EVENT_CLOSING;
+		}
+		break;
+	}
+	if (state == EVENT_CLOSING && now >= current.end) {
+		event_post(&current);
+		state = EVENT_IDLE;
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Tarefa de escrita
+
+static void put_uint32(FILE *fd, uint32_t value)
+{
+	uint8_t bytes[] = {value, value >> 8, value >> 16, value >> 24};
+	fwrite(bytes, sizeof bytes, 1, fd);
+}
+
+static void put_uint16(FILE *fd, uint16_t value)
+{
+	uint8_t bytes[] = {value, value >> 8};
+	fwrite(bytes, sizeof bytes, 1, fd);
+}
+
+static void put_info(FILE *fd, const char *id, const char *text, size_t size)
+{
+	fwrite(id, 4, 1, fd);
+	put_uint32(fd, size);
+	fwrite(text, size, 1, fd);
+	if (size % 2 != 0)
+		fputc(0, fd);
+}
+
+/*
+ * Ficheiro WAVE PCM 16 bits com os metadados do evento
+ * no subbloco LIST/INFO (ICRD - data, ICMT - descrição).
+ */
+static bool event_wave_store(const char *filepath, const int16_t *samples,
+		uint64_t nframes, const char *date, const char *comment)
+{
+	FILE *fd = fopen(filepath, "w");
+	if (fd == NULL) {
+		fprintf(stderr, "fopen(%s, \"w\") error: %s\n", filepath, strerror(errno));
+		return false;
+	}
+	size_t date_size = strlen(date) + 1;
+	size_t comment_size = strlen(comment) + 1;
+	uint32_t info_size = 4 + 8 + date_size + date_size % 2 + 8 + comment_size + comment_size % 2;
+	uint32_t data_size = nframes * ring_channels * sizeof *samples;
+
+	fwrite("RIFF", 4, 1, fd);
+	put_uint32(fd, 4 + (8 + 16) + (8 + info_size) + (8 + data_size));
+	fwrite("WAVE", 4, 1, fd);
+
+	fwrite("fmt ", 4, 1, fd);
+	put_uint32(fd, 16);
+	put_uint16(fd, 1);				// PCM
+	put_uint16(fd, ring_channels);
+	put_uint32(fd, event_config->sample_rate);
+	put_uint32(fd, event_config->sample_rate * ring_channels * sizeof *samples);
+	put_uint16(fd, ring_channels * sizeof *samples);
+	put_uint16(fd, 8 * sizeof *samples);
+
+	fwrite("LIST", 4, 1, fd);
+	put_uint32(fd, info_size);
+	fwrite("INFO", 4, 1, fd);
+	put_info(fd, "ICRD", date, date_size);
+	put_info(fd, "ICMT", comment, comment_size);
+
+	fwrite("data", 4, 1, fd);
+	put_uint32(fd, data_size);
+	fwrite(samples, data_size, 1, fd);	//	PCM little-endian
+
+	bool ok = !ferror(fd);
+	fflush(fd);
+	fsync(fileno(fd));
+	fclose(fd);
+	if (!ok)
+		fprintf(stderr, "Event: error writing %s\n", filepath);
+	return ok;
+}
+
+static void event_write(Event *event)
+{
+	uint64_t nframes = event->end - event->start;
+	int16_t *samples = malloc(nframes * ring_channels * sizeof *samples);
+	if (samples == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return;
+	}
+	//	As frames reescritas durante a cópia são descartadas
+	uint64_t lost = pcm_ring_read(ring, event->start, samples, nframes);
+	if (lost >= nframes) {
+		fprintf(stderr, "Event: audio overwritten before being saved\n");
+		free(samples);
+		return;
+	}
+
+	time_t ts = event->ts + lost / event_config->sample_rate;
+	//	O início da excedência pode ter sido reescrito com o som anterior
+	int64_t trigger = (int64_t)(event->trigger - event->start) - (int64_t)lost;
+	if (trigger < 0)
+		trigger = 0;
+	char date[sizeof "AAAA-MM-DDTHH:MM:SS"];
+	strftime(date, sizeof date, "%Y-%m-%dT%H:%M:%S", localtime(&ts));
+	char comment[400];
+	snprintf(comment, sizeof comment,
+		"identification=%s; start=%s; duration=%.3f s; trigger=%.3f s; "
+		"LAE max=%.1f dB; LApeak max=%.1f dB; "
+		"LAeq threshold=%.1f dB; LApeak threshold=%.1f dB; hysteresis=%.1f dB; "
+		"calibration delta=%.2f dB; lost=%.3f s",
+		event_config->identification, date,
+		(double)(nframes - lost) / event_config->sample_rate,
+		(double)trigger / event_config->sample_rate,
+		event->lae_max, event->lapeak_max,
+		event_config->event_laeq_threshold, event_config->event_lapeak_threshold,
+		event_config->event_hysteresis, event_config->calibration_delta,
+		(double)lost / event_config->sample_rate);
+
+	char second[sizeof "AAAAMMDDHHMMSS"];
+	strftime(second, sizeof second, "%Y%m%d%H%M%S", localtime(&ts));
+	size_t size = strlen(event_config->output_path) + sizeof "event_AAAAMMDDHHMMSS_4294967295.wav";
+	char *filepath = malloc(size);
+	if (filepath != NULL) {
+		//	Os eventos que começam no mesmo segundo têm um número de ordem
+		snprintf(filepath, size, "%sevent_%s.wav", event_config->output_path, second);
+		for (unsigned sequence = 2; access(filepath, F_OK) == 0; sequence++)
+			snprintf(filepath, size, "%sevent_%s_%u.wav", event_config->output_path, second, sequence);
+		event_wave_store(filepath, samples + lost * ring_channels, nframes - lost, date, comment);
+		free(filepath);
+	}
+	free(samples);
+}
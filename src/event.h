@@ -0,0 +1,60 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "process.h"
+
+/*
+ * Deteção de excedências com captura do som antes e depois do evento.
+ *
+ * As amostras originais (16 bits, canais intercalados) são depositadas
+ * continuamente num buffer circular com os últimos segundos de som.
+ * No fim de cada segmento os níveis são comparados com os limiares.
+ * Um evento começa quando o nível equivalente do segmento (LAE) ou o LApeak
+ * atinge o respetivo limiar e termina quando ambos descem abaixo do limiar
+ * menos a histerese. O som desde event_pre_trigger segundos antes do início
+ * até event_post_trigger segundos depois do fim é entregue a uma tarefa
+ * que escreve um ficheiro WAVE com os metadados do evento.
+ *
+ * O buffer circular e a fila de eventos são lock-free
+ * (um produtor, um consumidor): o ciclo de processamento nunca bloqueia.
+ */
+
+#define EVENT_RING_GUARD	5	// segundos de folga para a tarefa copiar o som
+#define EVENT_QUEUE_SIZE	8	// eventos pendentes para escrita
+
+bool event_begin(struct config *config);
+void event_end();
+
+/**
+ * @brief Acrescenta frames (canais intercalados) ao buffer circular.
+ *
+ * Não faz nada se a deteção não estiver ativa.
+ */
+void event_append_samples(const int16_t *frames, unsigned nframes);
+
+/**
+ * @brief Avalia os níveis do segmento segment_index.
+ */
+void event_segment(Levels *levels, unsigned segment_index, struct config *config);
+
+#endif
@@ -0,0 +1,236 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "fft.h"
+
+struct fft {
+	unsigned size;		// N - número de amostras reais
+	unsigned half;		// M = N/2 - dimensão da FFT complexa
+	unsigned *bitrev;	// permutação bit-reversed (M)
+	float *twiddle_re;	// fatores de rotação por andar; andar de meia dimensão h em [h, 2h[
+	float *twiddle_im;
+	float *post_re;		// W_N^k, k = 0 .. M, para a separação do espectro real
+	float *post_im;
+	float *re;		// dados de trabalho (M)
+	float *im;
+	float *out_re;		// espectro (M + 1)
+	float *out_im;
+};
+
+typedef float v4sf __attribute__ ((vector_size (16)));
+
+static inline v4sf v4sf_load(const float *p)
+{
+	v4sf v;
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+static inline void v4sf_store(float *p, v4sf v)
+{
+	memcpy(p, &v, sizeof v);
+}
+
+static unsigned log2_int(unsigned n)
+{
+	unsigned l = 0;
+	while ((1u << l) < n)
+		l++;
+	return l;
+}
+
+Fft *fft_create(unsigned size)
+{
+	if (size < 16 || (size & (size - 1)) != 0)
+		return NULL;
+	Fft *fft = malloc(sizeof *fft);
+	if (fft == NULL)
+		return NULL;
+	unsigned half = size / 2;
+	fft->size = size;
+	fft->half = half;
+	fft->bitrev = malloc(half * sizeof *fft->bitrev);
+	float *buffer = malloc((2 * half + 2 * (half + 1) + 2 * half + 2 * (half + 1)) * sizeof *buffer);
+	if (fft->bitrev == NULL || buffer == NULL) {
+		free(fft->bitrev);
+		free(buffer);
+		free(fft);
+		return NULL;
+	}
+	fft->twiddle_re = buffer;
+	fft->twiddle_im = buffer += half;
+	fft->post_re = buffer += half;
+	fft->post_im = buffer += half + 1;
+	fft->re = buffer += half + 1;
+	fft->im = buffer += half;
+	fft->out_re = buffer += half;
+	fft->out_im = buffer += half + 1;
+
+	unsigned bits = log2_int(half);
+	for (unsigned i = 0; i < half; i++) {
+		unsigned r = 0;
+		for (unsigned b = 0; b < bits; b++)
+			if (i & (1u << b))
+				r |= 1u << (bits - 1 - b);
+		fft->bitrev[i] = r;
+	}
+
+	fft->twiddle_re[0] = 1.0f;
+	fft->twiddle_im[0] = 0.0f;
+	for (unsigned h = 1; h < half; h *= 2)
+		for (unsigned j = 0; j < h; j++) {
+			double angle = -M_PI * j / h;
+			fft->twiddle_re[h + j] = cos(angle);
+			fft->twiddle_im[h + j] = sin(angle);
+		}
+
+	for (unsigned k = 0; k <= half; k++) {
+		double angle = -2.0 * M_PI * k / size;
+		fft->post_re[k] = cos(angle);
+		fft->post_im[k] = sin(angle);
+	}
+	return fft;
+}
+
+void fft_destroy(Fft *fft)
+{
+	free(fft->bitrev);
+	free(fft->twiddle_re);
+	free(fft);
+}
+
+unsigned fft_size(Fft *fft)
+{
+	return fft->size;
+}
+
+float *fft_real(Fft *fft)
+{
+	return fft->out_re;
+}
+
+float *fft_imag(Fft *fft)
+{
+	return fft->out_im;
+}
+
+void fft_load(Fft *fft, const float *samples, const float *window,
+		unsigned offset, unsigned length)
+{
+	assert(offset % 2 == 0 && length % 2 == 0);
+	assert(offset + length <= fft->size);
+	const unsigned *bitrev = fft->bitrev + offset / 2;
+	window += offset;
+	for (unsigned i = 0; i < length / 2; i++) {
+		unsigned n = bitrev[i];
+		fft->re[n] = samples[2 * i] * window[2 * i];
+		fft->im[n] = samples[2 * i + 1] * window[2 * i + 1];
+	}
+}
+
+/*
+ * Andares de meia dimensão 1 e 2 - fatores de rotação triviais.
+ */
+static void fft_first_stages(float *re, float *im, unsigned n)
+{
+	for (unsigned k = 0; k < n; k += 2) {
+		float tr = re[k + 1], ti = im[k + 1];
+		re[k + 1] = re[k] - tr;
+		im[k + 1] = im[k] - ti;
+		re[k] += tr;
+		im[k] += ti;
+	}
+	if (n < 4)
+		return;
+	for (unsigned k = 0; k < n; k += 4) {
+		float tr = re[k + 2], ti = im[k + 2];
+		re[k + 2] = re[k] - tr;
+		im[k + 2] = im[k] - ti;
+		re[k] += tr;
+		im[k] += ti;
+		//	multiplicação por -i
+		tr = im[k + 3];
+		ti = -re[k + 3];
+		re[k + 3] = re[k + 1] - tr;
+		im[k + 3] = im[k + 1] - ti;
+		re[k + 1] += tr;
+		im[k + 1] += ti;
+	}
+}
+
+/*
+ * Andar de meia dimensão h >= 4 - quatro borboletas por iteração.
+ */
+static void fft_stage(float *re, float *im, unsigned n, unsigned h,
+		const float *twiddle_re, const float *twiddle_im)
+{
+	for (unsigned k = 0; k < n; k += 2 * h) {
+		float *are = re + k, *aim = im + k;
+		float *bre = are + h, *bim = aim + h;
+		for (unsigned j = 0; j < h; j += 4) {
+			v4sf wr = v4sf_load(twiddle_re + j);
+			v4sf wi = v4sf_load(twiddle_im + j);
+			v4sf xr = v4sf_load(bre + j);
+			v4sf xi = v4sf_load(bim + j);
+			v4sf tr = wr * xr - wi * xi;
+			v4sf ti = wr * xi + wi * xr;
+			v4sf ar = v4sf_load(are + j);
+			v4sf ai = v4sf_load(aim + j);
+			v4sf_store(bre + j, ar - tr);
+			v4sf_store(bim + j, ai - ti);
+			v4sf_store(are + j, ar + tr);
+			v4sf_store(aim + j, ai + ti);
+		}
+	}
+}
+
+void fft_execute(Fft *fft)
+{
+	unsigned n = fft->half;
+	float *re = fft->re, *im = fft->im;
+
+	fft_first_stages(re, im, n);
+	for (unsigned h = 4; h < n; h *= 2)
+		fft_stage(re, im, n, h, fft->twiddle_re + h, fft->twiddle_im + h);
+
+	/*
+	 * Separação: X[k] = E[k] + W^k O[k]
+	 * E[k] = (Z[k] + Z*[M-k]) / 2, O[k] = (Z[k] - Z*[M-k]) / 2i
+	 */
+	for (unsigned k = 0; k <= n; k++) {
+		unsigned a = k == n ? 0 : k;
+		unsigned b = k == 0 ? 0 : n - k;
+		float ar = re[a], ai = im[a];
+		float br = re[b], bi = -im[b];
+		float er = 0.5f * (ar + br), ei = 0.5f * (ai + bi);
+		float or = 0.5f * (ai - bi), oi = -0.5f * (ar - br);
+		float wr = fft->post_re[k], wi = fft->post_im[k];
+		fft->out_re[k] = er + wr * or - wi * oi;
+		fft->out_im[k] = ei + wr * oi + wi * or;
+	}
+}
+
+void fft_power_accumulate(Fft *fft, float *power)
+{
+	const float *re = fft->out_re, *im = fft->out_im;
+	for (unsigned k = 0; k <= fft->half; k++)
+		power[k] += re[k] * re[k] + im[k] * im[k];
+}
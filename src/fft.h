@@ -0,0 +1,68 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef FFT_H
+#define FFT_H
+
+/*
+ * FFT real de dimensão N (potência de 2, N >= 16).
+ *
+ * O sinal real de N amostras é tratado como um sinal complexo de N/2 amostras
+ * (amostras pares na parte real, ímpares na parte imaginária), transformado
+ * por uma FFT radix-2 e separado no fim em N/2 + 1 componentes do espectro.
+ *
+ * Todas as tabelas (fatores de rotação e permutação bit-reversed)
+ * são calculadas em fft_create. As partes real e imaginária são guardadas
+ * em arrays separados para que as borboletas processem quatro valores
+ * de cada vez (extensões vetoriais do GCC: NEON no ARM, SSE no x86).
+ */
+
+typedef struct fft Fft;
+
+Fft *fft_create(unsigned size);
+void fft_destroy(Fft *fft);
+
+unsigned fft_size(Fft *fft);
+
+/**
+ * @brief Carrega N/2 pares de amostras, multiplicadas pela janela,
+ * a partir de um troço contíguo de memória.
+ *
+ * Permite carregar uma trama a partir de duas zonas de memória
+ * (buffer circular que dá a volta) sem cópia intermédia.
+ *
+ * @param offset Índice, na trama, da primeira amostra do troço (par).
+ * @param length Número de amostras do troço (par).
+ */
+void fft_load(Fft *fft, const float *samples, const float *window,
+		unsigned offset, unsigned length);
+
+/**
+ * @brief Executa a transformada sobre a trama carregada com fft_load.
+ *
+ * O resultado fica disponível em fft_real e fft_imag (N/2 + 1 valores).
+ */
+void fft_execute(Fft *fft);
+
+float *fft_real(Fft *fft);
+float *fft_imag(Fft *fft);
+
+/**
+ * @brief Acumula |X[k]|^2, k = 0 .. N/2, em power.
+ */
+void fft_power_accumulate(Fft *fft, float *power);
+
+#endif
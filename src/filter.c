@@ -114,3 +114,22 @@ void aweighting_filtering(Afilter *af, float x[], float y[], unsigned size)
 //		assert(a >= -1.0 && a <= +1.0);
 	}
 }
+
+bool weighting_parse(const char *name, Weighting *weighting)
+{
+	if (strcmp(name, "A") == 0)
+		*weighting = WEIGHTING_A;
+	else if (strcmp(name, "Z") == 0)
+		*weighting = WEIGHTING_Z;
+	else
+		return false;
+	return true;
+}
+
+void weighting_filtering(Afilter *af, Weighting weighting, float *x, float *y, unsigned size)
+{
+	if (weighting == WEIGHTING_Z)
+		memcpy(y, x, size * sizeof *y);
+	else
+		aweighting_filtering(af, x, y, size);
+}
@@ -23,6 +23,7 @@ ao PFC MoSEMusic realizado por Guilherme Albano e David Meneses
 #define _FILTER_H_
 
 #include <stdlib.h>
+#include <stdbool.h>
 #include <math.h>
 #include <string.h>
 #include "process.h"
@@ -55,4 +56,18 @@ void aweighting_filtering(Afilter *af, float *input, float *output, unsigned len
 float *aweighting_get_coef_a(int);
 float *aweighting_get_coef_b(int);
 
+typedef enum {WEIGHTING_A, WEIGHTING_Z} Weighting;
+
+/**
+ * @brief Ponderação config weighting: "A" ou "Z" (sem ponderação).
+ *
+ * @return false se weighting não for reconhecida.
+ */
+bool weighting_parse(const char *name, Weighting *weighting);
+
+/**
+ * @brief Ponderação A com af, ou cópia da entrada com WEIGHTING_Z.
+ */
+void weighting_filtering(Afilter *af, Weighting weighting, float *input, float *output, unsigned length);
+
 #endif
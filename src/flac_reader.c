@@ -0,0 +1,689 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <threads.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "flac_reader.h"
+
+#define FLAC_STREAMINFO		0
+#define FLAC_STREAMINFO_SIZE	34
+#define FLAC_FRAME_SIZE_MIN	10	// cabeçalho mínimo, um subbloco, CRC-16
+
+enum {
+	CHANNELS_INDEPENDENT = 7,	// 0 .. 7 - número de canais - 1
+	CHANNELS_LEFT_SIDE,
+	CHANNELS_RIGHT_SIDE,
+	CHANNELS_MID_SIDE
+};
+
+typedef struct {
+	unsigned count;				// inícios de trama candidatos
+	size_t positions[FLAC_JOB_FRAMES];
+	size_t ends[FLAC_JOB_FRAMES];		// fim da trama, 0 - inválida
+	unsigned frames[FLAC_JOB_FRAMES];	// amostras por canal
+	int32_t *samples;			// por trama, um bloco por canal
+	sem_t done;
+} Flac_job;
+
+struct flac_reader {
+	Flac_info info;
+	const uint8_t *data;
+	size_t size;
+	size_t frame_stride;			// amostras de uma trama no lote
+
+	//	Tarefas de descodificação
+	thrd_t *threads;
+	unsigned threads_number;
+	Flac_job *jobs;
+	unsigned jobs_number;
+	sem_t work;
+	atomic_uint claimed;
+	atomic_bool stop;
+
+	//	Só acedidos por quem lê
+	size_t scan;				// posição da procura de tramas
+	unsigned submitted, consumed;		// números de sequência dos lotes
+	Flac_job *job;				// lote em leitura
+	unsigned job_frame;
+	size_t frame_end;			// fim da última trama aceite
+	const int32_t *frame;
+	unsigned frame_offset, frame_remaining;
+	Flac_statistics statistics;
+};
+
+//------------------------------------------------------------------------------
+//	Leitura de bits, MSB primeiro
+
+typedef struct {
+	const uint8_t *data;
+	size_t size;				// bytes
+	size_t position;			// bits
+} Bit_reader;
+
+static inline uint64_t bits_load(const Bit_reader *reader)
+{
+	size_t byte = reader->position >> 3;
+	uint64_t word = 0;
+	if (byte + 8 <= reader->size) {
+		memcpy(&word, reader->data + byte, sizeof word);
+		word = __builtin_bswap64(word);
+	}
+	else {
+		for (unsigned i = 0; i < 8; i++)
+			word = word << 8 | (byte + i < reader->size ? reader->data[byte + i] : 0);
+	}
+	return word << (reader->position & 7);
+}
+
+static inline uint32_t bits_read(Bit_reader *reader, unsigned n)	// n <= 32
+{
+	if (n == 0)
+		return 0;
+	uint32_t value = bits_load(reader) >> (64 - n);
+	reader->position += n;
+	return value;
+}
+
+static inline int32_t bits_read_signed(Bit_reader *reader, unsigned n)
+{
+	if (n == 0)
+		return 0;
+	int32_t value = (int32_t)(bits_read(reader, n) << (32 - n));
+	return value >> (32 - n);
+}
+
+static inline unsigned bits_unary(Bit_reader *reader)
+{
+	unsigned zeros = 0;
+	while (reader->position < reader->size * 8) {
+		uint64_t word = bits_load(reader);
+		unsigned valid = 64 - (reader->position & 7);
+		unsigned leading = word != 0 ? __builtin_clzll(word) : 64;
+		if (leading < valid) {
+			reader->position += leading + 1;
+			return zeros + leading;
+		}
+		reader->position += valid;
+		zeros += valid;
+	}
+	return zeros;
+}
+
+static inline bool bits_overrun(const Bit_reader *reader)
+{
+	return reader->position > reader->size * 8;
+}
+
+//------------------------------------------------------------------------------
+
+static uint8_t crc8(const uint8_t *data, size_t size)
+{
+	uint8_t crc = 0;
+	while (size-- > 0) {
+		crc ^= *data++;
+		for (unsigned i = 0; i < 8; i++)
+			crc = crc & 0x80 ? crc << 1 ^ 0x07 : crc << 1;
+	}
+	return crc;
+}
+
+static uint16_t crc16_table[256];
+
+static void crc16_init()
+{
+	for (unsigned i = 0; i < 256; i++) {
+		uint16_t crc = i << 8;
+		for (unsigned j = 0; j < 8; j++)
+			crc = crc & 0x8000 ? crc << 1 ^ 0x8005 : crc << 1;
+		crc16_table[i] = crc;
+	}
+}
+
+static uint16_t crc16(const uint8_t *data, size_t size)
+{
+	uint16_t crc = 0;
+	while (size-- > 0)
+		crc = crc << 8 ^ crc16_table[(crc >> 8) ^ *data++];
+	return crc;
+}
+
+//------------------------------------------------------------------------------
+
+typedef struct {
+	unsigned block_size;
+	unsigned channel_assignment;
+	size_t size;				// bytes do cabeçalho
+} Frame_header;
+
+/*
+ * Valida o cabeçalho da trama em position, incluindo o CRC-8,
+ * e a coerência com STREAMINFO.
+ */
+static bool frame_header_parse(const Flac_reader *reader, size_t position, Frame_header *header)
+{
+	const uint8_t *data = reader->data + position;
+	size_t available = reader->size - position;
+	if (available < FLAC_FRAME_SIZE_MIN || data[0] != 0xFF || (data[1] & 0xFE) != 0xF8)
+		return false;
+	unsigned block_size_code = data[2] >> 4;
+	unsigned sample_rate_code = data[2] & 0x0F;
+	unsigned channel_assignment = data[3] >> 4;
+	unsigned sample_size_code = (data[3] >> 1) & 0x07;
+	if (block_size_code == 0 || sample_rate_code == 0x0F || (data[3] & 1) != 0
+			|| channel_assignment > CHANNELS_MID_SIDE)
+		return false;
+	unsigned channels = channel_assignment <= CHANNELS_INDEPENDENT ? channel_assignment + 1 : 2;
+	static const unsigned sample_sizes[8] = {0, 8, 12, 0, 16, 20, 24, 32};
+	if (channels != reader->info.channels
+			|| (sample_size_code != 0 && sample_sizes[sample_size_code] != reader->info.bits_per_sample))
+		return false;
+
+	//	Número da trama ou da amostra, em UTF-8
+	size_t size = 4;
+	unsigned extra = 0;
+	if ((data[size] & 0x80) == 0)
+		extra = 0;
+	else if ((data[size] & 0xE0) == 0xC0)
+		extra = 1;
+	else if ((data[size] & 0xF0) == 0xE0)
+		extra = 2;
+	else if ((data[size] & 0xF8) == 0xF0)
+		extra = 3;
+	else if ((data[size] & 0xFC) == 0xF8)
+		extra = 4;
+	else if ((data[size] & 0xFE) == 0xFC)
+		extra = 5;
+	else if (data[size] == 0xFE)
+		extra = 6;
+	else
+		return false;
+	size++;
+	if (size + extra + 4 > available)
+		return false;
+	for (unsigned i = 0; i < extra; i++)
+		if ((data[size++] & 0xC0) != 0x80)
+			return false;
+
+	unsigned block_size;
+	if (block_size_code == 1)
+		block_size = 192;
+	else if (block_size_code <= 5)
+		block_size = 576 << (block_size_code - 2);
+	else if (block_size_code == 6)
+		block_size = data[size++] + 1;
+	else if (block_size_code == 7) {
+		block_size = (data[size] << 8 | data[size + 1]) + 1;
+		size += 2;
+	}
+	else
+		block_size = 256 << (block_size_code - 8);
+	if (sample_rate_code == 12)
+		size += 1;
+	else if (sample_rate_code == 13 || sample_rate_code == 14)
+		size += 2;
+	if (block_size > reader->info.block_size_max || size + 1 > available
+			|| crc8(data, size) != data[size])
+		return false;
+	if (header != NULL)
+		*header = (Frame_header){block_size, channel_assignment, size + 1};
+	return true;
+}
+
+static bool residual_decode(Bit_reader *bits, int32_t *residual, unsigned block_size, unsigned order)
+{
+	unsigned method = bits_read(bits, 2);
+	if (method > 1)
+		return false;
+	unsigned parameter_bits = method == 0 ? 4 : 5;
+	unsigned escape = (1 << parameter_bits) - 1;
+	unsigned partition_order = bits_read(bits, 4);
+	unsigned partitions = 1 << partition_order;
+	if ((block_size >> partition_order) << partition_order != block_size
+			|| (block_size >> partition_order) < order)
+		return false;
+	unsigned index = 0;
+	for (unsigned p = 0; p < partitions; p++) {
+		unsigned count = (block_size >> partition_order) - (p == 0 ? order : 0);
+		unsigned parameter = bits_read(bits, parameter_bits);
+		if (parameter == escape) {
+			unsigned n = bits_read(bits, 5);
+			for (unsigned i = 0; i < count; i++)
+				residual[index++] = bits_read_signed(bits, n);
+		}
+		else {
+			for (unsigned i = 0; i < count; i++) {
+				uint32_t value = bits_unary(bits) << parameter | bits_read(bits, parameter);
+				residual[index++] = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+			}
+		}
+		if (bits_overrun(bits))
+			return false;
+	}
+	return true;
+}
+
+static bool subframe_decode(Bit_reader *bits, int32_t *samples, unsigned block_size, unsigned sample_size)
+{
+	if (bits_read(bits, 1) != 0)
+		return false;
+	unsigned type = bits_read(bits, 6);
+	unsigned wasted = 0;
+	if (bits_read(bits, 1) != 0)
+		wasted = bits_unary(bits) + 1;
+	if (wasted >= sample_size)
+		return false;
+	sample_size -= wasted;
+
+	unsigned order;
+	if (type == 0) {
+		int32_t value = bits_read_signed(bits, sample_size);
+		for (unsigned i = 0; i < block_size; i++)
+			samples[i] = value;
+	}
+	else if (type == 1) {
+		for (unsigned i = 0; i < block_size; i++)
+			samples[i] = bits_read_signed(bits, sample_size);
+	}
+	else if (type >= 8 && type <= 12) {
+		order = type - 8;
+		if (order > block_size)
+			return false;
+		for (unsigned i = 0; i < order; i++)
+			samples[i] = bits_read_signed(bits, sample_size);
+		if (!residual_decode(bits, samples + order, block_size, order))
+			return false;
+		for (unsigned i = order; i < block_size; i++) {
+			int32_t *s = samples + i;
+			switch (order) {
+			case 1:	s[0] += s[-1]; break;
+			case 2:	s[0] += 2 * s[-1] - s[-2]; break;
+			case 3:	s[0] += 3 * s[-1] - 3 * s[-2] + s[-3]; break;
+			case 4:	s[0] += 4 * s[-1] - 6 * s[-2] + 4 * s[-3] - s[-4]; break;
+			}
+		}
+	}
+	else if (type >= 32) {
+		order = type - 31;
+		if (order > block_size)
+			return false;
+		for (unsigned i = 0; i < order; i++)
+			samples[i] = bits_read_signed(bits, sample_size);
+		unsigned precision = bits_read(bits, 4) + 1;
+		int shift = bits_read_signed(bits, 5);
+		if (precision == 16 || shift < 0)
+			return false;
+		int32_t coefficients[32];
+		for (unsigned i = 0; i < order; i++)
+			coefficients[i] = bits_read_signed(bits, precision);
+		if (!residual_decode(bits, samples + order, block_size, order))
+			return false;
+		for (unsigned i = order; i < block_size; i++) {
+			int64_t prediction = 0;
+			for (unsigned j = 0; j < order; j++)
+				prediction += (int64_t)coefficients[j] * samples[i - 1 - j];
+			samples[i] += (int32_t)(prediction >> shift);
+		}
+	}
+	else {
+		return false;
+	}
+	if (wasted > 0)
+		for (unsigned i = 0; i < block_size; i++)
+			samples[i] = (int32_t)((uint32_t)samples[i] << wasted);
+	return !bits_overrun(bits);
+}
+
+/*
+ * Descodifica a trama em position para samples, um bloco de frame_stride
+ * amostras por canal.
+ *
+ * @return Posição a seguir à trama, 0 se a trama for inválida.
+ */
+static size_t frame_decode(const Flac_reader *reader, size_t position, int32_t *samples, unsigned *block_size)
+{
+	Frame_header header;
+	if (!frame_header_parse(reader, position, &header))
+		return 0;
+	Bit_reader bits = {
+		.data = reader->data + position, .size = reader->size - position,
+		.position = header.size * 8
+	};
+	unsigned stride = reader->info.block_size_max;
+	for (unsigned c = 0; c < reader->info.channels; c++) {
+		unsigned sample_size = reader->info.bits_per_sample;
+		//	O canal de diferença tem mais um bit
+		if ((header.channel_assignment == CHANNELS_LEFT_SIDE && c == 1)
+				|| (header.channel_assignment == CHANNELS_RIGHT_SIDE && c == 0)
+				|| (header.channel_assignment == CHANNELS_MID_SIDE && c == 1))
+			sample_size++;
+		if (!subframe_decode(&bits, samples + c * stride, header.block_size, sample_size))
+			return 0;
+	}
+	size_t size = (bits.position + 7) / 8;
+	if (size + 2 > bits.size
+			|| crc16(bits.data, size) != (bits.data[size] << 8 | bits.data[size + 1]))
+		return 0;
+
+	int32_t *left = samples, *right = samples + stride;
+	for (unsigned i = 0; i < header.block_size; i++)
+		switch (header.channel_assignment) {
+		case CHANNELS_LEFT_SIDE:
+			right[i] = left[i] - right[i];
+			break;
+		case CHANNELS_RIGHT_SIDE:
+			left[i] += right[i];
+			break;
+		case CHANNELS_MID_SIDE: {
+			int32_t side = right[i];
+			int32_t mid = (int32_t)((uint32_t)left[i] << 1) | (side & 1);
+			left[i] = (mid + side) >> 1;
+			right[i] = (mid - side) >> 1;
+			break;
+		}
+		}
+	*block_size = header.block_size;
+	return position + size + 2;
+}
+
+//------------------------------------------------------------------------------
+
+static int flac_worker(void *argument)
+{
+	Flac_reader *reader = argument;
+	while (true) {
+		sem_wait(&reader->work);
+		if (atomic_load(&reader->stop))
+			break;
+		unsigned sequence = atomic_fetch_add(&reader->claimed, 1);
+		Flac_job *job = &reader->jobs[sequence % reader->jobs_number];
+		for (unsigned i = 0; i < job->count; i++)
+			job->ends[i] = frame_decode(reader, job->positions[i],
+						job->samples + i * reader->frame_stride, &job->frames[i]);
+		sem_post(&job->done);
+	}
+	return 0;
+}
+
+static size_t frame_find(const Flac_reader *reader, size_t position)
+{
+	while (position + FLAC_FRAME_SIZE_MIN <= reader->size) {
+		const uint8_t *sync = memchr(reader->data + position, 0xFF, reader->size - position - 1);
+		if (sync == NULL)
+			break;
+		position = sync - reader->data;
+		if (frame_header_parse(reader, position, NULL))
+			return position;
+		position++;
+	}
+	return reader->size;
+}
+
+/*
+ * Entrega lotes às tarefas de descodificação enquanto houver lugares livres.
+ */
+static void jobs_submit(Flac_reader *reader)
+{
+	while (reader->submitted - reader->consumed < reader->jobs_number && reader->scan < reader->size) {
+		Flac_job *job = &reader->jobs[reader->submitted % reader->jobs_number];
+		job->count = 0;
+		while (job->count < FLAC_JOB_FRAMES) {
+			reader->scan = frame_find(reader, reader->scan);
+			if (reader->scan == reader->size)
+				break;
+			//	Um início falso não pode esconder o início verdadeiro seguinte
+			job->positions[job->count++] = reader->scan++;
+		}
+		if (job->count == 0)
+			break;
+		reader->submitted++;
+		sem_post(&reader->work);
+	}
+}
+
+/*
+ * Passa à trama seguinte: a primeira trama válida que começa
+ * no fim da anterior, ou depois dele se houver uma zona corrompida.
+ */
+static bool frame_next(Flac_reader *reader)
+{
+	while (true) {
+		if (reader->job == NULL || reader->job_frame == reader->job->count) {
+			if (reader->job != NULL) {
+				reader->job = NULL;
+				reader->consumed++;
+			}
+			jobs_submit(reader);
+			if (reader->consumed == reader->submitted)
+				return false;
+			reader->job = &reader->jobs[reader->consumed % reader->jobs_number];
+			reader->job_frame = 0;
+			sem_wait(&reader->job->done);
+		}
+		unsigned i = reader->job_frame++;
+		Flac_job *job = reader->job;
+		if (job->ends[i] == 0 || job->positions[i] < reader->frame_end)
+			continue;
+		if (job->positions[i] > reader->frame_end)
+			reader->statistics.gaps++;
+		reader->frame_end = job->ends[i];
+		reader->frame = job->samples + i * reader->frame_stride;
+		reader->frame_offset = 0;
+		reader->frame_remaining = job->frames[i];
+		reader->statistics.frames++;
+		return true;
+	}
+}
+
+size_t flac_reader_read(Flac_reader *reader, float *buffer, int16_t *samples, size_t nframes)
+{
+	unsigned channels = reader->info.channels;
+	unsigned bits_per_sample = reader->info.bits_per_sample;
+	float scale = 1.0f / (1 << (bits_per_sample - 1));
+	size_t length = 0;
+	while (length < nframes) {
+		if (reader->frame_remaining == 0 && !frame_next(reader))
+			break;
+		size_t n = nframes - length;
+		if (n > reader->frame_remaining)
+			n = reader->frame_remaining;
+		for (unsigned c = 0; c < channels; c++) {
+			const int32_t *frame = reader->frame + c * reader->info.block_size_max + reader->frame_offset;
+			float *block = buffer + c * nframes + length;
+			int16_t *sample = samples + length * channels + c;
+			for (size_t i = 0; i < n; i++, sample += channels) {
+				block[i] = frame[i] * scale;
+				*sample = bits_per_sample >= 16 ? frame[i] >> (bits_per_sample - 16)
+								: frame[i] * (1 << (16 - bits_per_sample));
+			}
+		}
+		reader->frame_offset += n;
+		reader->frame_remaining -= n;
+		length += n;
+	}
+	//	Com menos frames, os blocos dos canais ficam seguidos
+	if (length < nframes)
+		for (unsigned c = 1; c < channels; c++)
+			memmove(buffer + c * length, buffer + c * nframes, length * sizeof *buffer);
+	return length;
+}
+
+//------------------------------------------------------------------------------
+
+bool flac_reader_is_flac(const char *filepath)
+{
+	char magic[4];
+	FILE *fd = fopen(filepath, "r");
+	if (fd == NULL)
+		return false;
+	bool flac = fread(magic, sizeof magic, 1, fd) == 1 && memcmp(magic, FLAC_MAGIC, sizeof magic) == 0;
+	fclose(fd);
+	return flac;
+}
+
+/*
+ * Lê STREAMINFO e salta os restantes blocos de metadados.
+ *
+ * @return Posição da primeira trama, 0 em erro.
+ */
+static size_t metadata_parse(Flac_reader *reader)
+{
+	const uint8_t *data = reader->data;
+	size_t position = 4;
+	bool streaminfo = false;
+	bool last = false;
+	while (!last) {
+		if (position + 4 > reader->size)
+			return 0;
+		last = data[position] & 0x80;
+		unsigned type = data[position] & 0x7F;
+		size_t length = data[position + 1] << 16 | data[position + 2] << 8 | data[position + 3];
+		position += 4;
+		if (position + length > reader->size)
+			return 0;
+		if (type == FLAC_STREAMINFO && length >= FLAC_STREAMINFO_SIZE) {
+			const uint8_t *info = data + position;
+			reader->info.block_size_max = info[2] << 8 | info[3];
+			reader->info.sample_rate = info[10] << 12 | info[11] << 4 | info[12] >> 4;
+			reader->info.channels = ((info[12] >> 1) & 0x07) + 1;
+			reader->info.bits_per_sample = ((info[12] & 1) << 4 | info[13] >> 4) + 1;
+			reader->info.total_samples = (uint64_t)(info[13] & 0x0F) << 32
+				| (uint32_t)(info[14] << 24 | info[15] << 16 | info[16] << 8 | info[17]);
+			streaminfo = true;
+		}
+		position += length;
+	}
+	return streaminfo ? position : 0;
+}
+
+Flac_reader *flac_reader_open(const char *filepath, unsigned threads)
+{
+	static once_flag crc16_once = ONCE_FLAG_INIT;
+	call_once(&crc16_once, crc16_init);
+
+	Flac_reader *reader = calloc(1, sizeof *reader);
+	if (reader == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+	int fd = open(filepath, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "open(%s) error: %s\n", filepath, strerror(errno));
+		free(reader);
+		return NULL;
+	}
+	struct stat status;
+	fstat(fd, &status);
+	reader->size = status.st_size;
+	void *data = reader->size > 0 ? mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "mmap(%s) error: %s\n", filepath, strerror(errno));
+		free(reader);
+		return NULL;
+	}
+	madvise(data, reader->size, MADV_SEQUENTIAL);
+	reader->data = data;
+
+	size_t first = reader->size >= 4 && memcmp(data, FLAC_MAGIC, 4) == 0 ? metadata_parse(reader) : 0;
+	if (first == 0 || reader->info.bits_per_sample < 4 || reader->info.bits_per_sample > 24
+			|| reader->info.block_size_max < 16) {
+		fprintf(stderr, "%s: invalid or unsupported FLAC file (%u bits per sample)\n",
+			filepath, reader->info.bits_per_sample);
+		munmap(data, reader->size);
+		free(reader);
+		return NULL;
+	}
+	reader->scan = reader->frame_end = first;
+
+	if (threads == 0) {
+		long processors = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = processors > 0 ? processors : 1;
+	}
+	reader->threads_number = threads;
+	reader->jobs_number = 2 * threads;
+	reader->frame_stride = (size_t)reader->info.channels * reader->info.block_size_max;
+	reader->threads = malloc(threads * sizeof *reader->threads);
+	reader->jobs = calloc(reader->jobs_number, sizeof *reader->jobs);
+	if (reader->threads == NULL || reader->jobs == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		free(reader->threads);
+		free(reader->jobs);
+		munmap(data, reader->size);
+		free(reader);
+		return NULL;
+	}
+	for (unsigned i = 0; i < reader->jobs_number; i++) {
+		reader->jobs[i].samples = malloc(FLAC_JOB_FRAMES * reader->frame_stride * sizeof (int32_t));
+		sem_init(&reader->jobs[i].done, 0, 0);
+	}
+	sem_init(&reader->work, 0, 0);
+	atomic_init(&reader->claimed, 0);
+	atomic_init(&reader->stop, false);
+	unsigned created = 0;
+	for (; created < threads; created++)
+		if (thrd_success != thrd_create(&reader->threads[created], flac_worker, reader))
+			break;
+	reader->threads_number = created;
+	bool allocated = true;
+	for (unsigned i = 0; i < reader->jobs_number; i++)
+		allocated = allocated && reader->jobs[i].samples != NULL;
+	if (created == 0 || !allocated) {
+		fprintf(stderr, "FLAC: error creating the decoding workers\n");
+		flac_reader_close(reader);
+		return NULL;
+	}
+	return reader;
+}
+
+void flac_reader_close(Flac_reader *reader)
+{
+	atomic_store(&reader->stop, true);
+	for (unsigned i = 0; i < reader->threads_number; i++)
+		sem_post(&reader->work);
+	for (unsigned i = 0; i < reader->threads_number; i++) {
+		int result;
+		thrd_join(reader->threads[i], &result);
+	}
+	sem_destroy(&reader->work);
+	for (unsigned i = 0; i < reader->jobs_number; i++) {
+		sem_destroy(&reader->jobs[i].done);
+		free(reader->jobs[i].samples);
+	}
+	free(reader->jobs);
+	free(reader->threads);
+	munmap((void *)reader->data, reader->size);
+	free(reader);
+}
+
+const Flac_info *flac_reader_info(const Flac_reader *reader)
+{
+	return &reader->info;
+}
+
+void flac_reader_statistics(const Flac_reader *reader, Flac_statistics *statistics)
+{
+	*statistics = reader->statistics;
+}
@@ -0,0 +1,83 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef FLAC_READER_H
+#define FLAC_READER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Leitura de ficheiros FLAC, com as tramas descodificadas em paralelo.
+ *
+ * As tramas FLAC são independentes. O ficheiro é mapeado em memória;
+ * quem lê procura os inícios das tramas (sincronismo e CRC-8 do cabeçalho)
+ * e entrega lotes de FLAC_JOB_FRAMES inícios às tarefas de descodificação,
+ * que verificam cada trama com o CRC-16. Um início falso, dentro dos dados
+ * de outra trama, é rejeitado pelo CRC-16 ou por não continuar a trama
+ * anterior. A ordem das tramas é a dos lotes.
+ *
+ * São suportados os subblocos CONSTANT, VERBATIM, FIXED e LPC, o resíduo
+ * Rice de 4 e 5 bits com escape, os bits desperdiçados e a descorrelação
+ * estéreo, com 4 a 24 bits por amostra.
+ */
+
+#define FLAC_MAGIC		"fLaC"
+#define FLAC_JOB_FRAMES		16	// tramas por lote de descodificação
+
+typedef struct {
+	unsigned sample_rate;
+	unsigned channels;
+	unsigned bits_per_sample;
+	unsigned block_size_max;	// amostras por canal numa trama
+	uint64_t total_samples;		// por canal (0 - desconhecido)
+} Flac_info;
+
+typedef struct {
+	uint64_t frames;
+	unsigned gaps;			// zonas corrompidas saltadas
+} Flac_statistics;
+
+typedef struct flac_reader Flac_reader;
+
+/**
+ * @brief Verifica se filepath começa pela assinatura FLAC.
+ */
+bool flac_reader_is_flac(const char *filepath);
+
+/**
+ * @brief Abre o ficheiro com threads tarefas de descodificação
+ * (0 - uma por processador).
+ */
+Flac_reader *flac_reader_open(const char *filepath, unsigned threads);
+void flac_reader_close(Flac_reader *reader);
+
+const Flac_info *flac_reader_info(const Flac_reader *reader);
+
+/**
+ * @brief Lê até nframes frames.
+ *
+ * @param buffer amostras normalizadas em -1.0 .. +1.0, um bloco por canal;
+ * o bloco do canal c começa na posição c * <frames lidas>.
+ * @param samples as mesmas amostras a 16 bits, intercaladas.
+ * @return Número de frames lidas, 0 no fim do ficheiro.
+ */
+size_t flac_reader_read(Flac_reader *reader, float *buffer, int16_t *samples, size_t nframes);
+
+void flac_reader_statistics(const Flac_reader *reader, Flac_statistics *statistics);
+
+#endif
@@ -0,0 +1,117 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+
+#include "history.h"
+
+struct history {
+	History_record *records;
+	double *prefix;		// energia acumulada na época, incluindo o registo
+	unsigned capacity;
+	unsigned size;		// capacity + 1 - dimensão de uma época
+	uint64_t count;		// registos acrescentados desde o início
+	double epoch_total[2];	// energia total das épocas completas, por paridade
+};
+
+History *history_create(unsigned capacity)
+{
+	History *history = malloc(sizeof *history);
+	if (history == NULL)
+		return NULL;
+	history->capacity = capacity;
+	history->size = capacity + 1;
+	history->records = malloc(history->size * sizeof *history->records);
+	history->prefix = malloc(history->size * sizeof *history->prefix);
+	if (history->records == NULL || history->prefix == NULL) {
+		free(history->records);
+		free(history->prefix);
+		free(history);
+		return NULL;
+	}
+	history->count = 0;
+	return history;
+}
+
+void history_destroy(History *history)
+{
+	free(history->records);
+	free(history->prefix);
+	free(history);
+}
+
+void history_append(History *history, const History_record *record)
+{
+	unsigned slot = history->count % history->size;
+	double energy = isfinite(record->lae) ? pow(10, record->lae / 10) : 0;
+	history->prefix[slot] = slot == 0 ? energy : history->prefix[slot - 1] + energy;
+	history->records[slot] = *record;
+	if (slot == history->size - 1)
+		history->epoch_total[history->count / history->size % 2] = history->prefix[slot];
+	history->count++;
+}
+
+uint64_t history_first(History *history)
+{
+	return history->count > history->capacity ? history->count - history->capacity : 0;
+}
+
+uint64_t history_end(History *history)
+{
+	return history->count;
+}
+
+const History_record *history_get(History *history, uint64_t seq)
+{
+	assert(seq >= history_first(history) && seq < history->count);
+	return &history->records[seq % history->size];
+}
+
+uint64_t history_find(History *history, uint64_t ts)
+{
+	uint64_t low = history_first(history), high = history->count;
+	while (low < high) {
+		uint64_t middle = low + (high - low) / 2;
+		if (history->records[middle % history->size].ts < ts)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+/*
+ * Energia dos registos da época de seq anteriores a seq.
+ */
+static double prefix_before(History *history, uint64_t seq)
+{
+	unsigned slot = seq % history->size;
+	return slot == 0 ? 0 : history->prefix[slot - 1];
+}
+
+float history_laeq(History *history, uint64_t from, uint64_t to)
+{
+	assert(from >= history_first(history) && to <= history->count);
+	if (from >= to)
+		return -INFINITY;
+	double energy = prefix_before(history, to) - prefix_before(history, from);
+	uint64_t epoch_from = from / history->size;
+	if (to / history->size != epoch_from)
+		energy += history->epoch_total[epoch_from % 2];
+	return 10 * log10(energy / (to - from));
+}
@@ -0,0 +1,67 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+/*
+ * Histórico dos registos de segmento em memória (buffer circular).
+ *
+ * Os registos são identificados pelo número de ordem desde o início (seq).
+ * São mantidos os últimos capacity registos: [history_first, history_end[.
+ *
+ * Para cada registo é guardada a soma acumulada da energia do nível
+ * equivalente do segmento (10^(LAE/10)); o LAeq do registo é a média
+ * desde o arranque e não serve. Isto permite calcular o LAeq de qualquer
+ * intervalo com duas leituras. Para limitar o erro numérico a soma recomeça
+ * em cada época (capacity + 1 registos); um intervalo abrange no máximo
+ * duas épocas.
+ */
+
+typedef struct {
+	uint64_t ts;		// segundos, UNIX
+	float laeq, lafmin, lae, lafmax, lapeak;
+	int direction;
+} History_record;
+
+typedef struct history History;
+
+History *history_create(unsigned capacity);
+void history_destroy(History *history);
+
+void history_append(History *history, const History_record *record);
+
+uint64_t history_first(History *history);
+uint64_t history_end(History *history);
+
+/**
+ * @brief Registo seq, que deve estar em [history_first, history_end[.
+ */
+const History_record *history_get(History *history, uint64_t seq);
+
+/**
+ * @brief Primeiro registo com ts maior ou igual a ts (history_end se nenhum).
+ */
+uint64_t history_find(History *history, uint64_t ts);
+
+/**
+ * @brief Nível equivalente dos registos [from, to[ - O(1).
+ */
+float history_laeq(History *history, uint64_t from, uint64_t to);
+
+#endif
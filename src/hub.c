@@ -0,0 +1,713 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define _GNU_SOURCE	// pipe2
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <jansson.h>
+#include <MQTTClient.h>
+
+#include "hub.h"
+#include "process.h"
+#include "in_out.h"
+#include "server.h"
+#include "server_protocol.h"
+#include "shm_levels.h"
+#include "mqtt.h"
+
+typedef enum { SOURCE_UNIX, SOURCE_MQTT } Hub_source_type;
+
+typedef struct {
+	const char *name;		// nome dado na fonte ou endereço
+	bool named;
+	Hub_source_type type;
+	const char *address;		// caminho do socket ou tópico
+	bool wildcard;			// tópico com + ou #
+	int fd;				// unix: -1 - desligada
+	time_t reconnect;		// unix: próxima tentativa (CLOCK_MONOTONIC, segundos)
+	bool reported;			// unix: falha de ligação já assinalada
+	int sensor;			// unix: índice do sensor
+	size_t length;
+	uint8_t buffer[1024];		// unix: tramas recebidas incompletas
+} Hub_source;
+
+typedef struct {
+	char name[HUB_NAME_MAX];
+	uint64_t records, late, early, repeated;
+} Hub_sensor;
+
+typedef struct {
+	uint64_t ts;			// milisegundos, UNIX
+	float lafmin, lae, lafmax, lapeak;
+} Hub_sample;
+
+//	Registo recebido por MQTT, passado da tarefa de MQTT pelo pipe
+typedef struct {
+	char sensor[HUB_NAME_MAX];
+	Hub_sample sample;
+} Hub_message;
+
+typedef struct {
+	uint64_t slot;			// número do segmento (ts / segment_duration)
+	unsigned count;			// 0 - livre
+	double energy;			// soma de 10^(LAE/10)
+	float lafmin, lafmax, lapeak;
+	uint64_t sensors[HUB_SENSORS_MAX / 64];
+} Hub_slot;
+
+static volatile sig_atomic_t hub_running;
+
+static struct config *hub_config;
+static bool verbose_flag;
+
+static Hub_source sources[HUB_SOURCES_MAX];
+static unsigned sources_number;
+static Hub_sensor sensors[HUB_SENSORS_MAX];
+static unsigned sensors_number;
+static uint64_t sensors_refused;
+
+//	Alinhamento: segmentos ainda abertos
+static Hub_slot *slots;
+static unsigned slots_size;
+static uint64_t next_slot;		// próximo segmento a fechar
+static uint64_t pending;		// registos nos segmentos abertos
+
+//	Média deslizante dos últimos hub_rolling segmentos
+static double *rolling_energy;
+static unsigned *rolling_count;
+static unsigned rolling_size;
+static double rolling_energy_total;
+static uint64_t rolling_count_total;
+static uint64_t last_slot;		// último segmento agregado
+static bool aggregated_any;
+static uint64_t aggregated, gaps;
+
+static Levels *levels;
+
+//	MQTT
+static MQTTClient client;
+static bool mqtt_sources;
+static atomic_bool mqtt_connected;
+static time_t mqtt_reconnect;
+static int message_pipe[2] = {-1, -1};
+static atomic_ullong messages_dropped, messages_invalid;
+
+//------------------------------------------------------------------------------
+
+static time_t monotonic_seconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+static uint64_t realtime_milliseconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int sensor_find(const char *name)
+{
+	for (unsigned i = 0; i < sensors_number; i++)
+		if (strcmp(sensors[i].name, name) == 0)
+			return i;
+	if (sensors_number == HUB_SENSORS_MAX) {
+		if (sensors_refused++ == 0)
+			fprintf(stderr, "Hub: too many sensors (max %d), %s refused\n", HUB_SENSORS_MAX, name);
+		return -1;
+	}
+	snprintf(sensors[sensors_number].name, HUB_NAME_MAX, "%s", name);
+	if (verbose_flag)
+		printf("Hub: sensor %s\n", name);
+	return sensors_number++;
+}
+
+//------------------------------------------------------------------------------
+//	Agregação
+
+static void rolling_reset()
+{
+	for (unsigned i = 0; i < rolling_size; i++) {
+		rolling_energy[i] = 0;
+		rolling_count[i] = 0;
+	}
+	rolling_energy_total = 0;
+	rolling_count_total = 0;
+}
+
+static void rolling_set(uint64_t slot, double energy, unsigned count)
+{
+	unsigned i = slot % rolling_size;
+	rolling_energy_total += energy - rolling_energy[i];
+	rolling_count_total += count;
+	rolling_count_total -= rolling_count[i];
+	rolling_energy[i] = energy;
+	rolling_count[i] = count;
+	//	Uma vez por volta: a soma refeita não acumula erros de arredondamento
+	if (i == 0) {
+		rolling_energy_total = 0;
+		for (unsigned j = 0; j < rolling_size; j++)
+			rolling_energy_total += rolling_energy[j];
+	}
+}
+
+static void slot_aggregate(Hub_slot *slot)
+{
+	//	Os segmentos sem registos saem da média deslizante
+	if (aggregated_any) {
+		uint64_t gap = slot->slot - last_slot - 1;
+		gaps += gap;
+		if (gap >= rolling_size)
+			rolling_reset();
+		else
+			for (uint64_t s = last_slot + 1; s < slot->slot; s++)
+				rolling_set(s, 0, 0);
+	}
+	rolling_set(slot->slot, slot->energy, slot->count);
+	last_slot = slot->slot;
+	aggregated_any = true;
+	aggregated++;
+
+	int index = levels->segment_number;
+	levels->LAE[index] = 10 * log10(slot->energy / slot->count);
+	levels->LAeq[index] = 10 * log10(rolling_energy_total / rolling_count_total);
+	levels->LAFmin[index] = slot->lafmin;
+	levels->LAFmax[index] = slot->lafmax;
+	levels->LApeak[index] = slot->lapeak;
+	levels->direction[index] = DIRECTION_UNDEFINED;
+	levels->segment_number++;
+
+	Server_record record = {
+		.ts = slot->slot * hub_config->segment_duration / 1000,
+		.laeq = levels->LAeq[index], .lafmin = levels->LAFmin[index], .lae = levels->LAE[index],
+		.lafmax = levels->LAFmax[index], .lapeak = levels->LApeak[index],
+		.direction = DIRECTION_UNDEFINED
+	};
+	server_send(&record);
+	shm_levels_publish(&record);
+	if (hub_config->mqtt_enable)
+		mqtt_publish(levels, index);
+	if (verbose_flag)
+		printf("%llu %3u%6.1f%6.1f%6.1f%6.1f%6.1f\n", (unsigned long long)record.ts, slot->count,
+			record.laeq, record.lafmin, record.lae, record.lafmax, record.lapeak);
+
+	if (levels->segment_number == hub_config->record_period)
+		levels = output_record(levels);
+}
+
+static void sample_add(int sensor, const Hub_sample *sample)
+{
+	uint64_t slot_number = sample->ts / hub_config->segment_duration;
+	if (slot_number < next_slot) {
+		sensors[sensor].late++;
+		return;
+	}
+	if (slot_number >= next_slot + slots_size) {
+		sensors[sensor].early++;
+		return;
+	}
+	Hub_slot *slot = &slots[slot_number % slots_size];
+	if (slot->count == 0) {
+		*slot = (Hub_slot){.slot = slot_number, .lafmin = sample->lafmin,
+				.lafmax = sample->lafmax, .lapeak = sample->lapeak};
+	}
+	else if (slot->sensors[sensor / 64] & 1ULL << sensor % 64) {
+		sensors[sensor].repeated++;
+		return;
+	}
+	slot->sensors[sensor / 64] |= 1ULL << sensor % 64;
+	slot->energy += pow(10, sample->lae / 10);
+	slot->count++;
+	if (sample->lafmin < slot->lafmin)
+		slot->lafmin = sample->lafmin;
+	if (sample->lafmax > slot->lafmax)
+		slot->lafmax = sample->lafmax;
+	if (sample->lapeak > slot->lapeak)
+		slot->lapeak = sample->lapeak;
+	sensors[sensor].records++;
+	pending++;
+}
+
+/*
+ * Fecha os segmentos anteriores a limit.
+ */
+static void slots_close(uint64_t limit)
+{
+	while (next_slot < limit) {
+		//	Sem registos pendentes, os segmentos vazios não são percorridos
+		if (pending == 0) {
+			next_slot = limit;
+			break;
+		}
+		Hub_slot *slot = &slots[next_slot % slots_size];
+		if (slot->count > 0 && slot->slot == next_slot) {
+			slot_aggregate(slot);
+			pending -= slot->count;
+			slot->count = 0;
+		}
+		next_slot++;
+	}
+}
+
+//------------------------------------------------------------------------------
+//	Fontes unix: servidor local de um medidor, protocolo binário
+
+static unsigned get_uint16(const uint8_t *bytes)
+{
+	return bytes[0] | bytes[1] << 8;
+}
+
+static uint32_t get_uint32(const uint8_t *bytes)
+{
+	return get_uint16(bytes) | (uint32_t)get_uint16(bytes + 2) << 16;
+}
+
+static uint64_t get_uint64(const uint8_t *bytes)
+{
+	return get_uint32(bytes) | (uint64_t)get_uint32(bytes + 4) << 32;
+}
+
+static float get_float(const uint8_t *bytes)
+{
+	uint32_t word = get_uint32(bytes);
+	float value;
+	memcpy(&value, &word, sizeof value);
+	return value;
+}
+
+static void source_close(Hub_source *source)
+{
+	close(source->fd);
+	source->fd = -1;
+	source->length = 0;
+	source->reconnect = monotonic_seconds() + HUB_RECONNECT_INTERVAL;
+}
+
+static void source_connect(Hub_source *source)
+{
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	strncpy(address.sun_path, source->address, sizeof address.sun_path - 1);
+	source->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	static const char request[] = "binary\n";
+	if (source->fd < 0 || connect(source->fd, (struct sockaddr *)&address, sizeof address) < 0
+			|| write(source->fd, request, sizeof request - 1) != sizeof request - 1) {
+		if (!source->reported)
+			fprintf(stderr, "Hub: %s: connect error: %s, retry every %d s\n",
+				source->name, strerror(errno), HUB_RECONNECT_INTERVAL);
+		source->reported = true;
+		if (source->fd >= 0)
+			close(source->fd);
+		source->fd = -1;
+		source->reconnect = monotonic_seconds() + HUB_RECONNECT_INTERVAL;
+		return;
+	}
+	fcntl(source->fd, F_SETFL, O_NONBLOCK);
+	source->reported = false;
+	if (verbose_flag)
+		printf("Hub: %s connected\n", source->name);
+}
+
+static void frame_process(Hub_source *source, unsigned type, const uint8_t *data, uint32_t length)
+{
+	if (type == SERVER_FRAME_HELLO && length >= 8) {
+		unsigned segment_duration = get_uint32(data + 4);
+		if (segment_duration != hub_config->segment_duration)
+			fprintf(stderr, "Hub: %s: segment duration %u ms, hub %u ms\n",
+				source->name, segment_duration, hub_config->segment_duration);
+	}
+	else if (type == SERVER_FRAME_RECORD && length >= SERVER_RECORD_SIZE && source->sensor >= 0) {
+		int64_t ts = get_uint64(data + 8);
+		Hub_sample sample = {
+			.ts = ts * 1000, .lafmin = get_float(data + 20), .lae = get_float(data + 24),
+			.lafmax = get_float(data + 28), .lapeak = get_float(data + 32)
+		};
+		sample_add(source->sensor, &sample);
+	}
+}
+
+static void source_read(Hub_source *source)
+{
+	ssize_t length = read(source->fd, source->buffer + source->length,
+				sizeof source->buffer - source->length);
+	if (length <= 0) {
+		if (length < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		fprintf(stderr, "Hub: %s disconnected\n", source->name);
+		source_close(source);
+		return;
+	}
+	source->length += length;
+	const uint8_t *frame = source->buffer;
+	size_t remaining = source->length;
+	while (remaining >= SERVER_FRAME_HEADER_SIZE) {
+		uint32_t frame_length = get_uint32(frame + 4);
+		if (get_uint16(frame) != SERVER_PROTOCOL_MAGIC || frame[2] != SERVER_PROTOCOL_VERSION
+				|| frame_length > sizeof source->buffer - SERVER_FRAME_HEADER_SIZE) {
+			fprintf(stderr, "Hub: %s: protocol error\n", source->name);
+			source_close(source);
+			return;
+		}
+		if (remaining < SERVER_FRAME_HEADER_SIZE + frame_length)
+			break;
+		frame_process(source, frame[3], frame + SERVER_FRAME_HEADER_SIZE, frame_length);
+		frame += SERVER_FRAME_HEADER_SIZE + frame_length;
+		remaining -= SERVER_FRAME_HEADER_SIZE + frame_length;
+	}
+	memmove(source->buffer, frame, remaining);
+	source->length = remaining;
+}
+
+//------------------------------------------------------------------------------
+//	Fontes mqtt: os registos são recebidos pela tarefa da biblioteca MQTT
+
+static bool topic_match(const char *filter, const char *topic)
+{
+	while (*filter != '\0') {
+		if (*filter == '#')
+			return true;
+		if (*filter == '+') {
+			while (*topic != '\0' && *topic != '/')
+				topic++;
+			filter++;
+		}
+		else if (*filter++ != *topic++) {
+			return false;
+		}
+	}
+	return *topic == '\0';
+}
+
+static void message_send(const char *sensor, json_t *record)
+{
+	json_t *values = json_object_get(record, "values");
+	json_t *ts = json_object_get(record, "ts");
+	json_t *lae = json_object_get(values, "LAE");
+	if (!json_is_integer(ts) || !json_is_number(lae)) {
+		atomic_fetch_add_explicit(&messages_invalid, 1, memory_order_relaxed);
+		return;
+	}
+	Hub_message message = {.sample = {.ts = json_integer_value(ts), .lae = json_number_value(lae)}};
+	snprintf(message.sensor, sizeof message.sensor, "%s", sensor);
+	//	Sem um nível, é usado LAE
+	json_t *value = json_object_get(values, "LAFmin");
+	message.sample.lafmin = json_is_number(value) ? json_number_value(value) : message.sample.lae;
+	value = json_object_get(values, "LAFmax");
+	message.sample.lafmax = json_is_number(value) ? json_number_value(value) : message.sample.lae;
+	value = json_object_get(values, "LApeak");
+	message.sample.lapeak = json_is_number(value) ? json_number_value(value) : message.sample.lae;
+	//	Escrita atómica (< PIPE_BUF); com o pipe cheio, o registo é descartado
+	if (write(message_pipe[1], &message, sizeof message) != sizeof message)
+		atomic_fetch_add_explicit(&messages_dropped, 1, memory_order_relaxed);
+}
+
+static void records_send(const char *sensor, json_t *records)
+{
+	if (json_is_array(records)) {
+		size_t index;
+		json_t *record;
+		json_array_foreach(records, index, record)
+			message_send(sensor, record);
+	}
+	else {
+		message_send(sensor, records);
+	}
+}
+
+static int message_arrived(void *context, char *topic, int topic_length, MQTTClient_message *message)
+{
+	unsigned i = 0;
+	while (i < sources_number && (sources[i].type != SOURCE_MQTT || !topic_match(sources[i].address, topic)))
+		i++;
+	json_t *payload = json_loadb(message->payload, message->payloadlen, 0, NULL);
+	if (i < sources_number && payload != NULL) {
+		const Hub_source *source = &sources[i];
+		char sensor[HUB_NAME_MAX];
+		if (source->wildcard && source->named)
+			snprintf(sensor, sizeof sensor, "%s/%s", source->name, topic);
+		else
+			snprintf(sensor, sizeof sensor, "%s", source->wildcard ? topic : source->name);
+		if (json_is_object(payload) && json_object_get(payload, "ts") == NULL) {
+			//	Gateway: {"<dispositivo>": [registos], ...}
+			const char *device;
+			json_t *records;
+			json_object_foreach(payload, device, records) {
+				char device_sensor[HUB_NAME_MAX];
+				snprintf(device_sensor, sizeof device_sensor, "%s/%s", sensor, device);
+				records_send(device_sensor, records);
+			}
+		}
+		else {
+			records_send(sensor, payload);
+		}
+	}
+	else {
+		atomic_fetch_add_explicit(&messages_invalid, 1, memory_order_relaxed);
+	}
+	json_decref(payload);
+	MQTTClient_freeMessage(&message);
+	MQTTClient_free(topic);
+	return 1;
+}
+
+static void connection_lost(void *context, char *cause)
+{
+	atomic_store(&mqtt_connected, false);
+}
+
+static void hub_mqtt_connect()
+{
+	MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
+	conn_opts.username = hub_config->mqtt_device_credential;
+	conn_opts.password = hub_config->mqtt_device_credential;
+	conn_opts.keepAliveInterval = 20;
+	conn_opts.cleansession = 1;
+	conn_opts.connectTimeout = HUB_RECONNECT_INTERVAL;	// a espera suspende a agregação
+	mqtt_reconnect = monotonic_seconds() + HUB_RECONNECT_INTERVAL;
+	int rc = MQTTClient_connect(client, &conn_opts);
+	if (rc != MQTTCLIENT_SUCCESS) {
+		fprintf(stderr, "Hub: failed to connect MQTT, return code %d, retry in %d s\n",
+			rc, HUB_RECONNECT_INTERVAL);
+		return;
+	}
+	for (unsigned i = 0; i < sources_number; i++)
+		if (sources[i].type == SOURCE_MQTT
+				&& (rc = MQTTClient_subscribe(client, sources[i].address, hub_config->mqtt_qos))
+					!= MQTTCLIENT_SUCCESS)
+			fprintf(stderr, "Hub: failed to subscribe %s, return code %d\n", sources[i].address, rc);
+	atomic_store(&mqtt_connected, true);
+	if (verbose_flag)
+		printf("Hub: MQTT connected to %s\n", hub_config->mqtt_broker);
+}
+
+static bool hub_mqtt_begin()
+{
+	if (pipe2(message_pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+		fprintf(stderr, "pipe error: %s\n", strerror(errno));
+		return false;
+	}
+	//	Identificação própria: a publicação dos agregados usa a do medidor
+	char identification[strlen(hub_config->identification) + 5];
+	strcpy(identification, hub_config->identification);
+	strcat(identification, "_hub");
+	int rc = MQTTClient_create(&client, hub_config->mqtt_broker, identification,
+				MQTTCLIENT_PERSISTENCE_NONE, NULL);
+	if (rc != MQTTCLIENT_SUCCESS
+			|| MQTTClient_setCallbacks(client, NULL, connection_lost, message_arrived, NULL)
+				!= MQTTCLIENT_SUCCESS) {
+		fprintf(stderr, "Hub: failed to create MQTT client, return code %d\n", rc);
+		return false;
+	}
+	atomic_init(&mqtt_connected, false);
+	hub_mqtt_connect();
+	return true;
+}
+
+static void hub_mqtt_end()
+{
+	if (atomic_load(&mqtt_connected))
+		MQTTClient_disconnect(client, 1000);
+	MQTTClient_destroy(&client);
+	close(message_pipe[0]);
+	close(message_pipe[1]);
+}
+
+static void messages_read()
+{
+	Hub_message message;
+	while (read(message_pipe[0], &message, sizeof message) == sizeof message) {
+		int sensor = sensor_find(message.sensor);
+		if (sensor >= 0)
+			sample_add(sensor, &message.sample);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+static bool sources_parse(char *const *arguments, unsigned count)
+{
+	for (unsigned i = 0; i < count; i++) {
+		Hub_source *source = &sources[i];
+		*source = (Hub_source){.fd = -1, .sensor = -1};
+		char *argument = arguments[i];
+		char *equal = strchr(argument, '=');
+		if (equal != NULL && strncmp(argument, "unix:", 5) != 0 && strncmp(argument, "mqtt:", 5) != 0) {
+			*equal = '\0';
+			source->name = argument;
+			source->named = true;
+			argument = equal + 1;
+		}
+		if (strncmp(argument, "unix:", 5) == 0)
+			source->type = SOURCE_UNIX;
+		else if (strncmp(argument, "mqtt:", 5) == 0)
+			source->type = SOURCE_MQTT;
+		else {
+			fprintf(stderr, "Hub: invalid source \"%s\" (unix:<socket> or mqtt:<topic>)\n", argument);
+			return false;
+		}
+		source->address = argument + 5;
+		if (!source->named)
+			source->name = source->address;
+		if (source->address[0] == '\0' || strlen(source->name) >= HUB_NAME_MAX) {
+			fprintf(stderr, "Hub: invalid source \"%s\"\n", arguments[i]);
+			return false;
+		}
+		if (source->type == SOURCE_UNIX) {
+			if (strcmp(source->address, hub_config->server_socket) == 0) {
+				fprintf(stderr, "Hub: source %s is the hub server socket\n", source->address);
+				return false;
+			}
+			source->sensor = sensor_find(source->name);
+		}
+		else {
+			source->wildcard = strpbrk(source->address, "+#") != NULL;
+			mqtt_sources = true;
+		}
+	}
+	sources_number = count;
+	return true;
+}
+
+static void signal_handler(int signal)
+{
+	hub_running = false;
+}
+
+bool hub_run(char *const *arguments, unsigned count, struct config *config, bool verbose)
+{
+	verbose_flag = verbose;
+	hub_config = config;
+	if (!sources_parse(arguments, count))
+		return false;
+
+	//	Os agregados são níveis já calibrados, sem direção nem espectro
+	config->level_raw = false;
+	config->direction_enable = false;
+	config->spectrum_enable = false;
+
+	slots_size = config->hub_window / config->segment_duration + 3;
+	rolling_size = config->hub_rolling > 0 ? config->hub_rolling : 1;
+	slots = calloc(slots_size, sizeof *slots);
+	rolling_energy = calloc(rolling_size, sizeof *rolling_energy);
+	rolling_count = calloc(rolling_size, sizeof *rolling_count);
+	levels = levels_create();
+	if (slots == NULL || rolling_energy == NULL || rolling_count == NULL || levels == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	next_slot = (realtime_milliseconds() - config->hub_window) / config->segment_duration;
+
+	server_init();
+	if (config->shm_enable && !shm_levels_begin(config))
+		exit(EXIT_FAILURE);
+	if (config->mqtt_enable)
+		mqtt_begin();
+	output_open(true);
+	bool done = !mqtt_sources || hub_mqtt_begin();
+
+	//	Sem SA_RESTART: os sinais interrompem poll
+	struct sigaction action = {.sa_handler = signal_handler};
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	hub_running = done;
+
+	if (verbose && done)
+		printf("Hub: %u sources, window %u ms, rolling %u segments, server %s\n",
+			sources_number, config->hub_window, rolling_size, config->server_socket);
+	while (hub_running) {
+		time_t now = monotonic_seconds();
+		struct pollfd pollfds[HUB_SOURCES_MAX + 1];
+		Hub_source *polled[HUB_SOURCES_MAX + 1];
+		unsigned n = 0;
+		for (unsigned i = 0; i < sources_number; i++) {
+			Hub_source *source = &sources[i];
+			if (source->type != SOURCE_UNIX)
+				continue;
+			if (source->fd < 0 && now >= source->reconnect)
+				source_connect(source);
+			if (source->fd >= 0) {
+				pollfds[n] = (struct pollfd){.fd = source->fd, .events = POLLIN};
+				polled[n++] = source;
+			}
+		}
+		if (mqtt_sources) {
+			if (!atomic_load(&mqtt_connected) && now >= mqtt_reconnect)
+				hub_mqtt_connect();
+			pollfds[n] = (struct pollfd){.fd = message_pipe[0], .events = POLLIN};
+			polled[n++] = NULL;
+		}
+		if (poll(pollfds, n, HUB_POLL_INTERVAL) > 0)
+			for (unsigned i = 0; i < n; i++) {
+				if ((pollfds[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+					continue;
+				if (polled[i] == NULL)
+					messages_read();
+				else
+					source_read(polled[i]);
+			}
+		slots_close((realtime_milliseconds() - config->hub_window) / config->segment_duration);
+	}
+
+	//	Os segmentos abertos são agregados com os registos já recebidos
+	if (mqtt_sources)
+		messages_read();
+	slots_close(next_slot + slots_size);
+	levels = output_record(levels);
+
+	for (unsigned i = 0; i < sources_number; i++)
+		if (sources[i].fd >= 0)
+			close(sources[i].fd);
+	if (mqtt_sources && done)
+		hub_mqtt_end();
+	shm_levels_end();
+	server_end();
+	if (config->mqtt_enable)
+		mqtt_end();
+	output_close();
+
+	if (verbose) {
+		for (unsigned i = 0; i < sensors_number; i++)
+			printf("Hub: %s %llu records, %llu late, %llu early, %llu repeated\n", sensors[i].name,
+				(unsigned long long)sensors[i].records, (unsigned long long)sensors[i].late,
+				(unsigned long long)sensors[i].early, (unsigned long long)sensors[i].repeated);
+		printf("Hub: %llu segments aggregated, %llu gaps, %llu sensors refused\n",
+			(unsigned long long)aggregated, (unsigned long long)gaps,
+			(unsigned long long)sensors_refused);
+		if (mqtt_sources)
+			printf("Hub: MQTT %llu records dropped, %llu invalid\n",
+				(unsigned long long)atomic_load(&messages_dropped),
+				(unsigned long long)atomic_load(&messages_invalid));
+	}
+	levels_destroy(levels);
+	free(slots);
+	free(rolling_energy);
+	free(rolling_count);
+	return done;
+}
@@ -0,0 +1,63 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef HUB_H
+#define HUB_H
+
+#include <stdbool.h>
+
+#include "config.h"
+
+/*
+ * Modo concentrador (hub): agrega os níveis de vários medidores.
+ *
+ * Cada fonte tem a forma [<nome>=]unix:<socket> ou [<nome>=]mqtt:<tópico>.
+ *	unix:	servidor local de um medidor, no protocolo binário
+ *		(server_protocol.h); a ligação é restabelecida a cada
+ *		HUB_RECONNECT_INTERVAL segundos.
+ *	mqtt:	tópico no broker mqtt_broker, com mensagens no formato
+ *		de ThingsBoard de um dispositivo ({"ts": ..., "values": {...}}
+ *		ou um array destes) ou de gateway ({"<dispositivo>": [...], ...}).
+ *		O sensor de um registo de gateway é "<nome>/<dispositivo>".
+ * Sem nome, o sensor é identificado pelo caminho ou pelo tópico.
+ *
+ * Os registos são alinhados pelo tempo em segmentos de segment_duration.
+ * Um segmento é fechado hub_window milisegundos depois do seu fim (relógio
+ * do sistema); um registo que chega depois é descartado (atrasado), tal como
+ * um registo de um segmento para além da janela (adiantado) ou um segundo
+ * registo do mesmo sensor no mesmo segmento (repetido).
+ *
+ * Cada segmento fechado com registos dá um registo agregado:
+ *	LAE	média energética dos LAE dos sensores no segmento
+ *	LAeq	média energética dos LAE dos últimos hub_rolling segmentos,
+ *		atualizada incrementalmente
+ *	LAFmin	mínimo dos sensores; LAFmax e LApeak máximos
+ * publicado como os níveis de um medidor: servidor local (server_socket),
+ * memória partilhada, MQTT e ficheiros de saída.
+ */
+
+#define HUB_SOURCES_MAX		64
+#define HUB_SENSORS_MAX		256
+#define HUB_NAME_MAX		128	// dimensão máxima do nome de um sensor
+#define HUB_POLL_INTERVAL	100	// milisegundos
+#define HUB_RECONNECT_INTERVAL	5	// segundos
+
+/**
+ * @brief Agrega os níveis das fontes sources até SIGINT ou SIGTERM.
+ */
+bool hub_run(char *const *sources, unsigned sources_number, struct config *config, bool verbose);
+
+#endif
@@ -16,24 +16,58 @@ limitations under the License.
 */
 
 #include <alsa/asoundlib.h>
-#include <jansson.h>
+#include <math.h>
+#include <stddef.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <semaphore.h>
 #include "config.h"
 #include "in_out.h"
+#include "event.h"
+#include "archive.h"
+#include "shm_pcm.h"
+#include "spectrum.h"
+#include "slv.h"
+#include "level_archive.h"
 
 static Input_device device;
 
-bool input_device_open(struct config *config)
+bool input_open(Input_device *input, struct config *config, bool wait)
 {
-	if (config->input_file == NULL)	{
-		device.device = DEVICE_SOUND_CARD;
-		int result = snd_pcm_open(&device.alsa_handle, config->input_device, SND_PCM_STREAM_CAPTURE, 0);
+	if (config->input_file == NULL && pcm_stream_is_stream(config->input_device) && !wait) {
+		input->device = DEVICE_STREAM;
+		//	O formato de cada emissor é verificado quando se liga
+		input->stream = pcm_stream_listen(config->input_device, config->channels, config->sample_rate);
+		if (input->stream == NULL)
+			return false;
+		config->bits_per_sample = CONFIG_BITS_PER_SAMPLE;	// amostras intercaladas a 16 bits
+	}
+	else if (config->input_file == NULL && pcm_stream_is_stream(config->input_device)) {
+		input->device = DEVICE_STREAM;
+		input->stream = pcm_stream_open(config->input_device);
+		if (input->stream == NULL)
+			return false;
+		const Pcm_stream_header *header = pcm_stream_header(input->stream);
+		//	O segmento e os filtros já foram calculados para a configuração
+		if (header->channels != config->channels || header->sample_rate != config->sample_rate) {
+			fprintf(stderr, "PCM stream %s has %u channels at %u Hz, configured %u at %u Hz\n",
+				config->input_device, header->channels, header->sample_rate,
+				config->channels, config->sample_rate);
+			pcm_stream_close(input->stream);
+			return false;
+		}
+		config->bits_per_sample = CONFIG_BITS_PER_SAMPLE;	// amostras intercaladas a 16 bits
+	}
+	else if (config->input_file == NULL)	{
+		input->device = DEVICE_SOUND_CARD;
+		int result = snd_pcm_open(&input->alsa_handle, config->input_device, SND_PCM_STREAM_CAPTURE, 0);
 		if (result < 0) {
 			fprintf(stderr, "cannot open audio device %s (%s)\n",
 					config->input_device,
 					snd_strerror(result));
 			return false;
 		}
-		result = snd_pcm_set_params(device.alsa_handle,
+		result = snd_pcm_set_params(input->alsa_handle,
 					CONFIG_PCM_FORMAT, /* mudar */
 					SND_PCM_ACCESS_RW_INTERLEAVED,
 					config->channels,
@@ -42,39 +76,178 @@ bool input_device_open(struct config *config)
 					500000); /* 0.5 sec */
 		if (result < 0) {
 			fprintf(stderr, "snd_pcm_set_params: %s\n", snd_strerror(result));
+			snd_pcm_close(input->alsa_handle);
 			return false;
 		}
 #if 0
 		snd_pcm_uframes_t buffer_size, period_size;
-		result = snd_pcm_get_params(device.alsa_handle,
+		result = snd_pcm_get_params(input->alsa_handle,
 					&buffer_size, &period_size);
 		if (result < 0) {
 			fprintf(stderr, "snd_pcm_get_params: %s\n", snd_strerror(result));
+			snd_pcm_close(input->alsa_handle);
 			return false;
 		}
 		printf("buffer_size = %lu, period_size = %lu\n", buffer_size, period_size);
 #endif
-		result = snd_pcm_prepare(device.alsa_handle);
+		result = snd_pcm_prepare(input->alsa_handle);
 		if (result < 0) {
 			fprintf(stderr, "cannot prepare audio interface for use (%s)\n",
 					snd_strerror(result));
+			snd_pcm_close(input->alsa_handle);
 			return false;
 		}
-		snd_pcm_start(device.alsa_handle);
+		//	Com poll (input_descriptors), acorda com um bloco disponível
+		snd_pcm_sw_params_t *sw_params;
+		snd_pcm_sw_params_alloca(&sw_params);
+		if (snd_pcm_sw_params_current(input->alsa_handle, sw_params) == 0
+				&& snd_pcm_sw_params_set_avail_min(input->alsa_handle, sw_params, config->block_size) == 0)
+			snd_pcm_sw_params(input->alsa_handle, sw_params);
+		snd_pcm_start(input->alsa_handle);
+	}
+	else if (flac_reader_is_flac(config->input_file)) {
+		input->device = DEVICE_FLAC;
+		input->flac = flac_reader_open(config->input_file, config->decode_threads);
+		if (input->flac == NULL)
+			return false;
+		const Flac_info *info = flac_reader_info(input->flac);
+		if (info->channels != config->channels || info->sample_rate != config->sample_rate) {
+			fprintf(stderr, "FLAC file %s has %u channels at %u Hz, configured %u at %u Hz\n",
+				config->input_file, info->channels, info->sample_rate,
+				config->channels, config->sample_rate);
+			flac_reader_close(input->flac);
+			return false;
+		}
+		config->bits_per_sample = CONFIG_BITS_PER_SAMPLE;	// amostras intercaladas a 16 bits
 	}
 	else {
-		device.device = DEVICE_WAVE;
-		device.wave = wave_load(config->input_file);
-		if (device.wave == NULL) {
+		input->device = DEVICE_WAVE;
+		input->wave = wave_load(config->input_file);
+		if (input->wave == NULL) {
 			fprintf(stderr, "Can't load wave file %s\n", config->input_file);
 			return false;
 		}
-		config->sample_rate = wave_get_sample_rate(device.wave);
-		config->bits_per_sample = wave_get_bits_per_sample(device.wave);
+		config->sample_rate = wave_get_sample_rate(input->wave);
+		config->bits_per_sample = wave_get_bits_per_sample(input->wave);
+	}
+	return true;
+}
+
+static size_t input_samples(Input_device *input, float *buffer, int16_t *samples_int16, size_t nframes)
+{
+	size_t read_frames;
+	if (input->device == DEVICE_SOUND_CARD) {
+		snd_pcm_sframes_t result = snd_pcm_readi(input->alsa_handle, samples_int16, nframes);
+		if (result < 0) {
+			fprintf(stderr, "read from audio interface failed (%s)\n",
+					snd_strerror(result));
+			return 0;
+		}
+		read_frames = result;
+	}
+	else if (input->device == DEVICE_WAVE) {
+		read_frames = wave_read_samples(input->wave, (char *)samples_int16, nframes);
+		if (read_frames == 0)
+			return 0;
+	}
+	else if (input->device == DEVICE_FLAC) {
+		//	Descodificadas diretamente para os blocos float, com a resolução original
+		return flac_reader_read(input->flac, buffer, samples_int16, nframes);
+	}
+	else if (input->device == DEVICE_STREAM) {
+		return pcm_stream_read(input->stream, buffer, samples_int16, nframes);
+	}
+	else {
+		assert(false);	//	Should never reach this point
+		return 0;
+	}
+	samples_int16_to_float(samples_int16, buffer, read_frames);
+	return read_frames;
+}
+
+size_t input_read(Input_device *input, unsigned channels, float *buffer, size_t nframes)
+{
+	int16_t *samples_int16 = malloc(nframes * channels * sizeof *samples_int16);
+	if (samples_int16 == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 0;
+	}
+	size_t read_frames = input_samples(input, buffer, samples_int16, nframes);
+	free(samples_int16);
+	return read_frames;
+}
+
+void input_close(Input_device *input)
+{
+	if (input->device == DEVICE_SOUND_CARD) {
+		int result_code = snd_pcm_close(input->alsa_handle);
+		if (result_code < 0)
+			fprintf(stderr, "Error closing sound card\n");
+	}
+	else if (input->device == DEVICE_WAVE) {
+		wave_destroy(input->wave);
+	}
+	else if (input->device == DEVICE_FLAC) {
+		Flac_statistics statistics;
+		flac_reader_statistics(input->flac, &statistics);
+		if (statistics.gaps > 0)
+			fprintf(stderr, "FLAC: %u corrupted regions skipped\n", statistics.gaps);
+		flac_reader_close(input->flac);
+	}
+	else if (input->device == DEVICE_STREAM) {
+		pcm_stream_close(input->stream);
+	}
+}
+
+unsigned input_descriptors(Input_device *input, struct pollfd *pollfds, unsigned space)
+{
+	if (input->device == DEVICE_SOUND_CARD) {
+		int count = snd_pcm_poll_descriptors(input->alsa_handle, pollfds, space);
+		return count > 0 ? count : 0;
+	}
+	if (input->device == DEVICE_STREAM) {
+		int descriptors[2];
+		unsigned count = pcm_stream_descriptors(input->stream, descriptors);
+		if (count > space)
+			count = space;
+		for (unsigned i = 0; i < count; i++)
+			pollfds[i] = (struct pollfd){.fd = descriptors[i], .events = POLLIN};
+		return count;
+	}
+	return 0;
+}
+
+bool input_ready(Input_device *input, const struct pollfd *pollfds, unsigned count, size_t nframes)
+{
+	if (input->device == DEVICE_SOUND_CARD) {
+		//	Um erro (overrun) também é lido, para ser tratado por input_read
+		snd_pcm_sframes_t available = snd_pcm_avail(input->alsa_handle);
+		return available < 0 || (size_t)available >= nframes;
+	}
+	if (input->device == DEVICE_STREAM) {
+		if (pcm_stream_buffered(input->stream) >= nframes)
+			return true;
+		for (unsigned i = 0; i < count; i++)
+			if (pollfds[i].revents != 0)
+				return true;
+		return false;
 	}
 	return true;
 }
 
+bool input_ended(Input_device *input)
+{
+	return input->device != DEVICE_STREAM || pcm_stream_ended(input->stream);
+}
+
+//------------------------------------------------------------------------------
+//	Dispositivo de entrada do processo
+
+bool input_device_open(struct config *config)
+{
+	return input_open(&device, config, true);
+}
+
 /**
  * @brief Lê amostras do dispositivo de entrada -- ficheiro ou placa de som.
  *
@@ -88,88 +261,209 @@ bool input_device_open(struct config *config)
  */
 size_t input_device_read(float *buffer, size_t nframes)
 {
-	uint16_t *samples_int16 = malloc(nframes * config_struct->channels * sizeof *samples_int16);
+	int16_t *samples_int16 = malloc(nframes * config_struct->channels * sizeof *samples_int16);
 	if (samples_int16 == NULL) {
 		fprintf(stderr, "Out of memory\n");
 		return 0;
 	}
-	size_t read_frames;
-	if (device.device == DEVICE_SOUND_CARD) {
-		read_frames = snd_pcm_readi(device.alsa_handle, samples_int16, nframes);
-		if (read_frames < 0) {
-			fprintf(stderr, "read from audio interface failed (%s)\n",
-					snd_strerror(read_frames));
-			return 0;
-		}
-	}
-	else if (device.device == DEVICE_WAVE) {
-		read_frames = wave_read_samples(device.wave, (char *)samples_int16, nframes);
-		if (read_frames == 0)
-			return 0;
-	}
-	else {
-		assert(false);	//	Should never reach this point
+	size_t read_frames = input_samples(&device, buffer, samples_int16, nframes);
+	if (read_frames == 0) {
+		free(samples_int16);
 		return 0;
 	}
-	samples_int16_to_float(samples_int16, buffer, read_frames * config_struct->channels);
-//	if (config_struct->record_input)
-//		record_append_samples(samples_int16, read_frames);
+	event_append_samples(samples_int16, read_frames);
+	archive_append_samples(samples_int16, read_frames);
+	shm_pcm_append(SHM_PCM_RAW, samples_int16, read_frames);
 	free(samples_int16);
 	return read_frames;
 }
 
 void input_device_close()
 {
-	if (device.device == DEVICE_SOUND_CARD) {
-		int result_code = snd_pcm_close(device.alsa_handle);
-		if (result_code < 0)
-			fprintf(stderr, "Error closing sound card\n");
-	}
-	else if (device.device == DEVICE_WAVE) {
-		wave_destroy(device.wave);
-	}
+	input_close(&device);
 }
 
 //------------------------------------------------------------------------------
 //	Output
+/*
+ * A escrita dos ficheiros de saída é feita por uma tarefa própria.
+ * No fim de cada período de registo, output_record entrega os Levels
+ * preenchidos à tarefa de escrita, através de uma fila lock-free,
+ * e devolve Levels vazios, reciclados dos que a tarefa já escreveu.
+ * O ciclo de processamento só espera se a fila estiver cheia.
+ * A mudança de ficheiro (nome e instante) é decidida no ciclo
+ * de processamento e executada pela tarefa de escrita.
+ */
 
+//	Só acedidos pelo ciclo de processamento
 static char *output_filepath = NULL;
+static time_t calendar;
+static unsigned output_time; //	Tempo decorrido para o ficheiro atual
 
+//	Só acedidos pela tarefa de escrita
 static FILE *output_fd = NULL;
+static char *output_file_path;		// ficheiro aberto e o seu início
+static time_t output_file_ts;
+static unsigned output_index;
+static enum {SYNC_RECORD, SYNC_FILE, SYNC_NONE} output_sync;
+
+typedef struct {
+	Levels *levels;		// registos a escrever ou NULL
+	char *filepath;		// depois dos registos, fechar o ficheiro e abrir este (ou NULL)
+	time_t ts;		// início do novo ficheiro
+	struct timespec queued;
+} Output_job;
+
+static Output_job output_queue[OUTPUT_QUEUE_SIZE];
+static atomic_uint output_put;
+static atomic_uint output_get;
+static sem_t output_jobs;	// trabalhos na fila
+static sem_t output_space;	// lugares livres na fila
+static atomic_bool output_running;
+static thrd_t output_thread;
+
+//	Levels já escritos, devolvidos ao ciclo de processamento
+static Levels *output_free[OUTPUT_FREE_SIZE];
+static atomic_uint free_put;
+static atomic_uint free_get;
+
+static Output_statistics statistics;
 
-static json_t *output_json;
+static void output_new_filename(time_t time);
+static void output_file_open(char *filepath, time_t ts);
+static void output_levels_write(Levels *levels);
 
-static int output_index;
+static double elapsed(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
 
-static time_t calendar;
-static unsigned output_time; //	Tempo decorrido para o ficheiro atual
+static void output_file_sync()
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fsync(fileno(output_fd));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double time = elapsed(&start, &end);
+	statistics.syncs++;
+	statistics.sync_time += time;
+	if (statistics.sync_time_max < time)
+		statistics.sync_time_max = time;
+}
 
-static void output_new_filename(time_t time);
-static void output_file_open(char *filepath);
+static int output_thread_func(void *not_used)
+{
+	while (true) {
+		sem_wait(&output_jobs);
+		unsigned get = atomic_load_explicit(&output_get, memory_order_relaxed);
+		if (get == atomic_load_explicit(&output_put, memory_order_acquire)) {
+			if (!atomic_load(&output_running))
+				break;
+			continue;
+		}
+		Output_job *job = &output_queue[get % OUTPUT_QUEUE_SIZE];
+		if (job->levels != NULL) {
+			if (output_fd != NULL) {
+				output_levels_write(job->levels);
+				fflush(output_fd);
+				if (output_sync == SYNC_RECORD)
+					output_file_sync();
+			}
+			unsigned put = atomic_load_explicit(&free_put, memory_order_relaxed);
+			output_free[put % OUTPUT_FREE_SIZE] = job->levels;
+			atomic_store_explicit(&free_put, put + 1, memory_order_release);
+			statistics.records++;
+		}
+		if (job->filepath != NULL) {
+			output_file_close();
+			output_file_open(job->filepath, job->ts);
+			free(job->filepath);
+		}
+		//	Latência: desde a entrega até os dados estarem no ficheiro
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		double latency = elapsed(&job->queued, &now);
+		statistics.latency += latency;
+		if (statistics.latency_max < latency)
+			statistics.latency_max = latency;
+		statistics.jobs++;
+		atomic_store_explicit(&output_get, get + 1, memory_order_release);
+		sem_post(&output_space);
+	}
+	output_file_close();
+	return 0;
+}
+
+static void output_enqueue(Levels *levels, char *filepath, time_t ts)
+{
+	if (sem_trywait(&output_space) != 0) {
+		statistics.stalls++;
+		sem_wait(&output_space);
+	}
+	unsigned put = atomic_load_explicit(&output_put, memory_order_relaxed);
+	Output_job *job = &output_queue[put % OUTPUT_QUEUE_SIZE];
+	job->levels = levels;
+	job->filepath = filepath;
+	job->ts = ts;
+	clock_gettime(CLOCK_MONOTONIC, &job->queued);
+	atomic_store_explicit(&output_put, put + 1, memory_order_release);
+	sem_post(&output_jobs);
+}
 
 void output_open(bool continous)
 {
+	if (strcmp(config_struct->output_sync, "file") == 0)
+		output_sync = SYNC_FILE;
+	else if (strcmp(config_struct->output_sync, "none") == 0)
+		output_sync = SYNC_NONE;
+	else
+		output_sync = SYNC_RECORD;
+	memset(&statistics, 0, sizeof statistics);
+	atomic_init(&output_put, 0);
+	atomic_init(&output_get, 0);
+	atomic_init(&free_put, 0);
+	atomic_init(&free_get, 0);
+	atomic_init(&output_running, true);
+	sem_init(&output_jobs, 0, 0);
+	sem_init(&output_space, 0, OUTPUT_QUEUE_SIZE);
+
 	calendar = time(NULL);
 	if (continous)
 		output_new_filename(0);
-	output_file_open(output_filepath);
+	//	O primeiro ficheiro é aberto já, para assinalar erros no arranque
+	output_file_open(output_filepath, calendar);
+	if (thrd_success != thrd_create(&output_thread, output_thread_func, NULL)) {
+		fprintf(stderr, "Error in \"thrd_create(&output_thread, output_thread_func, NULL)\"");
+		exit(EXIT_FAILURE);
+	}
 }
 
 void output_close()
 {
-	output_file_close();
+	atomic_store(&output_running, false);
+	sem_post(&output_jobs);
+	int result;
+	thrd_join(output_thread, &result);
+	sem_destroy(&output_jobs);
+	sem_destroy(&output_space);
+	unsigned put = atomic_load(&free_put);
+	for (unsigned get = atomic_load(&free_get); get != put; get++)
+		levels_destroy(output_free[get % OUTPUT_FREE_SIZE]);
 	free(output_filepath);
 }
 
 void output_file_close()
 {
-	if (strcmp(config_struct->output_format, ".json") == 0) {
-		json_dumpf(output_json, output_fd, JSON_REAL_PRECISION(3));
-		json_decref(output_json);
-	}
-	if (output_fd != NULL)
-		fclose(output_fd);
+	if (output_fd == NULL)
+		return;
+	fflush(output_fd);
+	if (output_sync != SYNC_NONE)
+		output_file_sync();
+	fclose(output_fd);
 	output_fd = NULL;
+	level_archive_file(output_file_path, output_file_ts);
+	free(output_file_path);
+	output_file_path = NULL;
 }
 
 static char *output_init_filename()
@@ -203,147 +497,359 @@ static void output_new_filename(time_t time)
 		(output_filepath + date_position)[i] = buffer[i];
 }
 
-static json_t *LAeq_json;
-static json_t *LAE_json;
-static json_t *LAFmin_json;
-static json_t *LAFmax_json;
-static json_t *LApeak_json;
+/*
+ * Segmentos de um ficheiro, incluindo os do registo que provoca a mudança.
+ */
+static unsigned output_file_capacity()
+{
+	unsigned records = (config_struct->file_period + config_struct->record_period - 1)
+		/ config_struct->record_period;
+	return (records > 0 ? records : 1) * config_struct->record_period;
+}
+
+/*
+ * Formato JSON
+ *
+ *	{"ts": xxxxxxxxx, "segment": xx, "levels": {"LAeq": [], "LAE": [],
+ *		"LAFmin": [], "LAFmax": [], "LApeak": [], "Direction": []}}
+ *
+ * ("Direction" só com direction_enable.)
+ *
+ * O ficheiro é escrito à medida que os registos chegam, sem manter
+ * os valores em memória. Ao abrir o ficheiro, cada array recebe uma
+ * zona preenchida com espaços, com lugar para todos os valores
+ * do ficheiro (file_period segmentos). Cada valor é escrito na zona
+ * do seu array, seguido de ']' que é reescrito pelo valor seguinte.
+ * Os espaços que sobram são brancos válidos e o ficheiro é JSON válido
+ * depois de cada registo.
+ */
+enum {JSON_LAEQ, JSON_LAE, JSON_LAFMIN, JSON_LAFMAX, JSON_LAPEAK, JSON_DIRECTION, JSON_ARRAYS};
+
+static const char *json_array_names[JSON_ARRAYS] = {
+	"LAeq", "LAE", "LAFmin", "LAFmax", "LApeak", "Direction"
+};
+
+#define JSON_VALUE_SIZE		8	// "-99999.9"
+#define JSON_SLOT_SIZE		(JSON_VALUE_SIZE + 2)	// ", " + valor
 
-static void output_file_open(char *filepath)
+static unsigned json_arrays;			// número de arrays no ficheiro
+static unsigned json_capacity;			// valores por array
+static long json_end[JSON_ARRAYS];		// posição do ']' de cada array
+
+/*
+ * Escreve value com uma casa decimal, como no formato CSV.
+ * Os valores não finitos ou que não caibam em JSON_VALUE_SIZE
+ * são escritos como null. Devolve o número de caracteres.
+ */
+static int json_format_real(char *buffer, double value)
 {
-	output_fd = fopen(filepath, "w");
-	if (output_fd == NULL) {
-		fprintf(stderr, "fopen(%s, \"w\") error: %s\n", filepath, strerror(errno));
-		exit(EXIT_FAILURE);
-	}
-	if (strcmp(config_struct->output_format, ".csv") == 0)
-		fprintf(output_fd, "LAeq, LAFmin, LAE, LAFmax, LApeak\n");
-	else if (strcmp(config_struct->output_format, ".json") == 0) {
-	/*
-	{
-		"ts":xxxxxxxxx,
-		"segment": xx,
-		"levels": {
-			"LAeq": [],
-			"LAE": [],
-			"LAFmin": [],
-			"LAFmax": [],
-			"LApeak": []
-		}
-	}
-	*/
-	output_json = json_object();
-	if (output_json == NULL) {
-		fprintf(stderr, "Output: error creating JSON object \"output_json\".\n");
-		return;
-	}
-	json_t *object_json = json_integer(calendar);
-	if (object_json != NULL) {
-		if (json_object_set_new(output_json, "ts", object_json) != 0) {
-			fprintf(stderr, "Output: error adding JSON field \"ts\" ("__FILE__": %d)\n", __LINE__);
-			return;
+	if (!isfinite(value) || fabs(value) >= 99999.95) {
+		memcpy(buffer, "null", 4);
+		return 4;
+	}
+	char *p = buffer;
+	long tenths = lround(value * 10);
+	if (tenths < 0) {
+		*p++ = '-';
+		tenths = -tenths;
+	}
+	char digits[8];
+	int n = 0;
+	long integer = tenths / 10;
+	do {
+		digits[n++] = '0' + integer % 10;
+		integer /= 10;
+	} while (integer > 0);
+	while (n > 0)
+		*p++ = digits[--n];
+	*p++ = '.';
+	*p++ = '0' + tenths % 10;
+	return p - buffer;
+}
+
+static int json_format_integer(char *buffer, int value)
+{
+	if (value <= -10000000 || value >= 100000000) {
+		memcpy(buffer, "null", 4);
+		return 4;
+	}
+	char *p = buffer;
+	unsigned integer = value;
+	if (value < 0) {
+		*p++ = '-';
+		integer = -value;
+	}
+	char digits[8];
+	int n = 0;
+	do {
+		digits[n++] = '0' + integer % 10;
+		integer /= 10;
+	} while (integer > 0);
+	while (n > 0)
+		*p++ = digits[--n];
+	return p - buffer;
+}
+
+static void json_file_begin(time_t ts)
+{
+	json_capacity = output_file_capacity();
+	json_arrays = config_struct->direction_enable ? JSON_ARRAYS : JSON_DIRECTION;
+
+	char spaces[256];
+	memset(spaces, ' ', sizeof spaces);
+	fprintf(output_fd, "{\"ts\": %lld, \"segment\": %d, \"levels\": {",
+		(long long)ts, config_struct->segment_duration);
+	for (unsigned a = 0; a < json_arrays; ++a) {
+		fprintf(output_fd, "%s\"%s\": [", a == 0 ? "" : ", ", json_array_names[a]);
+		json_end[a] = ftell(output_fd);
+		fputc(']', output_fd);
+		for (size_t size = (size_t)json_capacity * JSON_SLOT_SIZE; size > 0; ) {
+			size_t length = size < sizeof spaces ? size : sizeof spaces;
+			fwrite(spaces, 1, length, output_fd);
+			size -= length;
 		}
 	}
-	object_json = json_integer(config_struct->segment_duration);
-	if (object_json != NULL) {
-		if (json_object_set_new(output_json, "segment", object_json) != 0) {
-			fprintf(stderr, "Output: error adding JSON field \"segment\" ("__FILE__": %d)\n", __LINE__);
-			return;
-		}
+	fputs("}}\n", output_fd);
+	output_index = 0;
+}
+
+static void json_levels_write(Levels *levels)
+{
+	unsigned count = levels->segment_number;
+	if (output_index + count > json_capacity) {
+		fprintf(stderr, "Output: JSON file full, %u segments lost\n",
+			output_index + count - json_capacity);
+		count = output_index < json_capacity ? json_capacity - output_index : 0;
 	}
-	json_t *levels_json = json_object();
-	if (levels_json != NULL) {
-		if (json_object_set_new(output_json, "levels", levels_json) != 0) {
-			fprintf(stderr, "Output: error adding JSON field \"levels\" ("__FILE__": %d)\n", __LINE__);
-			return;
+	if (count == 0)
+		return;
+	for (unsigned a = 0; a < json_arrays; ++a) {
+		fseek(output_fd, json_end[a], SEEK_SET);
+		for (unsigned i = 0; i < count; ++i) {
+			char buffer[JSON_SLOT_SIZE];
+			int length = 0;
+			if (output_index + i > 0) {
+				buffer[length++] = ',';
+				buffer[length++] = ' ';
+			}
+			switch (a) {
+			case JSON_LAEQ:
+				length += json_format_real(buffer + length, levels->LAeq[i]);
+				break;
+			case JSON_LAE:
+				length += json_format_real(buffer + length, levels->LAE[i]);
+				break;
+			case JSON_LAFMIN:
+				length += json_format_real(buffer + length, levels->LAFmin[i]);
+				break;
+			case JSON_LAFMAX:
+				length += json_format_real(buffer + length, levels->LAFmax[i]);
+				break;
+			case JSON_LAPEAK:
+				length += json_format_real(buffer + length, levels->LApeak[i]);
+				break;
+			case JSON_DIRECTION:
+				length += json_format_integer(buffer + length, levels->direction[i]);
+				break;
+			}
+			fwrite(buffer, 1, length, output_fd);
+			json_end[a] += length;
 		}
+		fputc(']', output_fd);
 	}
-	LAeq_json = json_array();
-	if (LAeq_json != NULL) {
-		if (json_object_set_new(levels_json, "LAeq", LAeq_json) != 0) {
-			fprintf(stderr, "Output: error adding JSON field \"LAeq\" ("__FILE__": %d)\n", __LINE__);
-			return;
-		}
+	output_index += count;
+}
+
+/*
+ * Formato SLV (slv.h)
+ *
+ * O ficheiro é criado com a dimensão final, para um período de ficheiro;
+ * cada registo é escrito no seu lugar em cada coluna e depois
+ * é atualizado count no cabeçalho.
+ */
+static Slv_header slv_header;
+
+_Static_assert(sizeof (int) == sizeof (int32_t), "Levels.direction is written as int32_t");
+
+static void slv_file_begin(time_t ts)
+{
+	unsigned bands = config_struct->spectrum_enable ? spectrum_octave_bands(config_struct->sample_rate) : 0;
+	memset(&slv_header, 0, sizeof slv_header);
+	memcpy(slv_header.magic, SLV_MAGIC, sizeof slv_header.magic);
+	slv_header.version = SLV_VERSION;
+	slv_header.header_size = sizeof slv_header;
+	memcpy(slv_header.identification, config_struct->identification,
+		strnlen(config_struct->identification, SLV_IDENTIFICATION_SIZE));
+	slv_header.sample_rate = config_struct->sample_rate;
+	slv_header.segment_duration = config_struct->segment_duration;
+	slv_header.calibration_reference = config_struct->calibration_reference;
+	slv_header.calibration_delta = config_struct->level_raw ? 0 : config_struct->calibration_delta;
+	slv_header.ts = ts;
+	slv_header.capacity = (output_file_capacity() + 15) & ~15u;
+	slv_header.count = 0;
+	slv_header.columns = SLV_BANDS + bands;
+	slv_header.bands = bands;
+	slv_header.flags = config_struct->direction_enable ? SLV_FLAG_DIRECTION : 0;
+	if (config_struct->level_raw)
+		slv_header.flags |= SLV_FLAG_RAW;
+	slv_header.data_offset = (sizeof slv_header + bands * sizeof (float) + 63) & ~63u;
+
+	fwrite(&slv_header, sizeof slv_header, 1, output_fd);
+	for (unsigned b = 0; b < bands; ++b) {
+		float frequency = spectrum_octave_frequency(b);
+		fwrite(&frequency, sizeof frequency, 1, output_fd);
 	}
-	LAE_json = json_array();
-	if (LAE_json != NULL) {
-		if (json_object_set_new(levels_json, "LAE", LAE_json) != 0) {
-			fprintf(stderr, "Output: error adding JSON field \"LAE\" ("__FILE__": %d)\n", __LINE__);
-			return;
-		}
+	fflush(output_fd);
+	off_t size = slv_header.data_offset + (off_t)slv_header.columns * slv_header.capacity * sizeof (float);
+	if (ftruncate(fileno(output_fd), size) < 0)
+		fprintf(stderr, "Output: ftruncate error: %s\n", strerror(errno));
+	output_index = 0;
+}
+
+static void slv_column_write(unsigned column, const void *values, unsigned count)
+{
+	fseek(output_fd, slv_header.data_offset
+		+ ((long)column * slv_header.capacity + output_index) * sizeof (float), SEEK_SET);
+	fwrite(values, sizeof (float), count, output_fd);
+}
+
+static void slv_levels_write(Levels *levels)
+{
+	unsigned count = levels->segment_number;
+	if (output_index + count > slv_header.capacity) {
+		fprintf(stderr, "Output: SLV file full, %u segments lost\n",
+			output_index + count - slv_header.capacity);
+		count = output_index < slv_header.capacity ? slv_header.capacity - output_index : 0;
 	}
-	LAFmin_json = json_array();
-	if (LAFmin_json != NULL) {
-		if (json_object_set_new(levels_json, "LAFmin", LAFmin_json) != 0) {
-			fprintf(stderr, "Output: error adding JSON field \"LAFmin\" ("__FILE__": %d)\n", __LINE__);
-			return;
-		}
+	if (count == 0)
+		return;
+	slv_column_write(SLV_LAEQ, levels->LAeq, count);
+	slv_column_write(SLV_LAFMIN, levels->LAFmin, count);
+	slv_column_write(SLV_LAE, levels->LAE, count);
+	slv_column_write(SLV_LAFMAX, levels->LAFmax, count);
+	slv_column_write(SLV_LAPEAK, levels->LApeak, count);
+	slv_column_write(SLV_DIRECTION, levels->direction, count);
+	unsigned bands = levels->bands < slv_header.bands ? levels->bands : slv_header.bands;
+	for (unsigned b = 0; b < bands; ++b) {
+		float column[count];
+		for (unsigned i = 0; i < count; ++i)
+			column[i] = levels->band_levels[i * levels->bands + b];
+		slv_column_write(SLV_BANDS + b, column, count);
+	}
+	output_index += count;
+
+	//	Os dados antes de count
+	fflush(output_fd);
+	slv_header.count = output_index;
+	fseek(output_fd, offsetof(Slv_header, count), SEEK_SET);
+	fwrite(&slv_header.count, sizeof slv_header.count, 1, output_fd);
+}
+
+static void output_file_open(char *filepath, time_t ts)
+{
+	output_fd = fopen(filepath, "w");
+	if (output_fd == NULL) {
+		fprintf(stderr, "fopen(%s, \"w\") error: %s\n", filepath, strerror(errno));
+		exit(EXIT_FAILURE);
 	}
-	LAFmax_json = json_array();
-	if (LAFmax_json != NULL) {
-		if (json_object_set_new(levels_json, "LAFmax", LAFmax_json) != 0) {
-			fprintf(stderr, "Output: error adding JSON field \"LAFmax\" ("__FILE__": %d)\n", __LINE__);
-			return;
-		}
+	output_file_path = strdup(filepath);
+	output_file_ts = ts;
+	statistics.files++;
+	if (strcmp(config_struct->output_format, ".csv") == 0) {
+		fprintf(output_fd, "LAeq, LAFmin, LAE, LAFmax, LApeak");
+		if (config_struct->direction_enable)
+			fprintf(output_fd, ", Direction");
+		fprintf(output_fd, "\n");
 	}
-	LApeak_json = json_array();
-	if (LApeak_json != NULL) {
-		if (json_object_set_new(levels_json, "LApeak", LApeak_json) != 0) {
-			fprintf(stderr, "Output: error adding JSON field \"LApeak\" ("__FILE__": %d)\n", __LINE__);
-			return;
-		}
+	else if (strcmp(config_struct->output_format, ".json") == 0) {
+		json_file_begin(ts);
 	}
-	output_index = 0;
+	else if (strcmp(config_struct->output_format, SLV_EXTENSION) == 0) {
+		slv_file_begin(ts);
 	}
 	else {
 		fprintf(stderr, "Output: no output format recognized\n");
 	}
 }
 
-#define JSON_ARRAY_SET(level_array_json, level_value) \
-{ \
-	json_t *real_json = json_real(level_value); \
-	if (real_json == NULL) { \
-		fprintf(stderr, "Output: error creating real_json ("__FILE__": %d)\n", __LINE__); \
-		return; \
-	} \
-	if (json_array_append_new(level_array_json, real_json) != 0) { \
-		fprintf(stderr, "Output: error set " #level_array_json "[i] ("__FILE__": %d)\n", __LINE__); \
-		return; \
-	} \
-}
-
-void output_record(Levels *levels)
+static void output_levels_write(Levels *levels)
 {
 	if (strcmp(config_struct->output_format, ".csv") == 0)
 	{
 	for (unsigned i = 0; i < levels->segment_number; ++i) {
-		fprintf(output_fd, "%5.1f, %5.1f, %5.1f, %5.1f, %5.1f\n",
+		fprintf(output_fd, "%5.1f, %5.1f, %5.1f, %5.1f, %5.1f",
 				// fprintf(output_fd, "%5.6f, %5.6f, %5.6f, %5.6f, %5.6f\n",
 				levels->LAeq[i], levels->LAFmin[i], levels->LAE[i],
 				levels->LAFmax[i], levels->LApeak[i]);
+		if (config_struct->direction_enable)
+			fprintf(output_fd, ", %3d", levels->direction[i]);
+		fprintf(output_fd, "\n");
 	}
 	}
 	else if (strcmp(config_struct->output_format, ".json") == 0)
 	{
-	for (unsigned i = 0; i < levels->segment_number; ++i) {
-		JSON_ARRAY_SET(LAeq_json, levels->LAeq[i]);
-		JSON_ARRAY_SET(LAE_json, levels->LAE[i]);
-		JSON_ARRAY_SET(LAFmin_json, levels->LAFmin[i]);
-		JSON_ARRAY_SET(LAFmax_json, levels->LAFmax[i]);
-		JSON_ARRAY_SET(LApeak_json, levels->LApeak[i]);
+		json_levels_write(levels);
 	}
-	output_index += levels->segment_number;
+	else if (strcmp(config_struct->output_format, SLV_EXTENSION) == 0)
+	{
+		slv_levels_write(levels);
 	}
+}
+
+/*
+ * Com level_raw os níveis entregues à saída ficam sem calibration_delta;
+ * a calibração de cada época fica na tabela config calibration_table.
+ */
+static void output_levels_uncalibrate(Levels *levels)
+{
+	float delta = config_struct->calibration_delta;
+	for (unsigned i = 0; i < levels->segment_number; ++i) {
+		levels->LAeq[i] -= delta;
+		levels->LAFmin[i] -= delta;
+		levels->LAE[i] -= delta;
+		levels->LAFmax[i] -= delta;
+		levels->LApeak[i] -= delta;
+	}
+	for (unsigned i = 0; i < levels->segment_number * levels->bands; ++i)
+		levels->band_levels[i] -= delta;
+}
+
+Levels *output_record(Levels *levels)
+{
+	if (config_struct->level_raw)
+		output_levels_uncalibrate(levels);
+	char *filepath = NULL;
+	time_t ts = 0;
 	output_time += config_struct->record_period; //	tempo de registo
-	fflush(output_fd);
-	fsync(fileno(output_fd));
 	if (output_time >= config_struct->file_period) { // altura de mudança de ficheiro
-		output_file_close();
 		output_new_filename((config_struct->segment_duration * output_time) / 1000);
-		output_file_open(output_filepath);
+		filepath = strdup(output_filepath);
+		ts = calendar;
 		output_time = 0;
 	}
+	output_enqueue(levels, filepath, ts);
+
+	Levels *empty;
+	unsigned get = atomic_load_explicit(&free_get, memory_order_relaxed);
+	if (get != atomic_load_explicit(&free_put, memory_order_acquire)) {
+		empty = output_free[get % OUTPUT_FREE_SIZE];
+		atomic_store_explicit(&free_get, get + 1, memory_order_release);
+	}
+	else {
+		empty = levels_create();
+		if (empty == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		statistics.buffers++;
+	}
+	empty->segment_number = 0;
+	return empty;
+}
+
+void output_statistics(Output_statistics *output)
+{
+	*output = statistics;
 }
 
 static const char *get_filename(const char *filename)
@@ -484,6 +990,7 @@ void audit_destroy(Audit *audit)
 /**
  * Converte uma sequência de frames com amostras intercaladas
  * para blocos de amostras, um bloco por canal.
+ * O bloco do canal c começa na posição c * length (length é o número de frames).
  * As amostras originais são representadas a 16 bits.
  * As amostras nos blocos são representadas em float e normalizadas no intervalo -1.0 .. +1.0
  */
@@ -18,14 +18,19 @@ limitations under the License.
 #define INPUT_H
 
 #include <alsa/asoundlib.h>
+#include <poll.h>
 #include <wave.h>
 #include "config.h"
 #include "process.h"
+#include "flac_reader.h"
+#include "pcm_stream.h"
 
 typedef struct input_device {
-	enum {DEVICE_WAVE, DEVICE_SOUND_CARD} device;
+	enum {DEVICE_WAVE, DEVICE_FLAC, DEVICE_STREAM, DEVICE_SOUND_CARD} device;
 	union {
 		Wave *wave;
+		Flac_reader *flac;
+		Pcm_stream *stream;
 		snd_pcm_t *alsa_handle;
 	};
 } Input_device;
@@ -34,14 +39,77 @@ bool input_device_open(struct config *);
 size_t input_device_read(float *buffer, size_t frames);
 void input_device_close();
 
+/*
+ * Entrada como objeto, para várias entradas no mesmo processo (streams.h).
+ * Ao contrário do dispositivo do processo (input_device_*), as amostras lidas
+ * não são entregues aos eventos, ao arquivo nem à memória partilhada.
+ */
+
+/**
+ * @brief Abre a entrada de config.
+ *
+ * @param wait espera por um emissor PCM (pcm_stream.h), na abertura
+ * e em cada leitura; sem espera, input_read devolve 0 sem amostras.
+ */
+bool input_open(Input_device *input, struct config *config, bool wait);
+size_t input_read(Input_device *input, unsigned channels, float *buffer, size_t frames);
+void input_close(Input_device *input);
+
+/**
+ * @brief Descritores a vigiar com poll até haver amostras.
+ *
+ * @return Número de descritores; 0 se a entrada (ficheiro) está sempre pronta.
+ */
+unsigned input_descriptors(Input_device *input, struct pollfd *pollfds, unsigned space);
+
+/**
+ * @brief Depois de poll, verifica se input_read de frames não tem de esperar
+ * (muito): os descritores têm atividade ou as frames já foram recebidas.
+ */
+bool input_ready(Input_device *input, const struct pollfd *pollfds, unsigned count, size_t frames);
+
+/**
+ * @brief Depois de input_read devolver 0, verifica se a entrada terminou
+ * ou se só não tinha amostras (entrada PCM aberta sem espera).
+ */
+bool input_ended(Input_device *input);
+
+#define OUTPUT_QUEUE_SIZE	16	// períodos de registo à espera da tarefa de escrita
+#define OUTPUT_FREE_SIZE	(2 * OUTPUT_QUEUE_SIZE)	// Levels reciclados (potência de 2)
+
+typedef struct {
+	uint64_t records;	// períodos de registo escritos
+	uint64_t jobs;
+	double latency;		// soma das latências - entrega até aos dados no ficheiro (segundos)
+	double latency_max;
+	uint64_t syncs;		// número de fsync
+	double sync_time;	// soma das durações de fsync (segundos)
+	double sync_time_max;
+	uint64_t stalls;	// esperas do ciclo de processamento com a fila cheia
+	unsigned buffers;	// Levels criados além do inicial
+	unsigned files;		// ficheiros de saída abertos
+} Output_statistics;
+
 void output_open(bool);
 void output_close();
 
 void output_set_filename(const char *filename, const char *extension);
 char *output_get_filepath();
-void output_record(Levels *levels);
+
+/**
+ * @brief Entrega os registos à tarefa de escrita.
+ *
+ * @return Levels vazios com que o processamento continua;
+ * levels passa a pertencer à tarefa de escrita.
+ */
+Levels *output_record(Levels *levels);
 void output_file_close();
 
+/**
+ * @brief Métricas da tarefa de escrita - válidas depois de output_close.
+ */
+void output_statistics(Output_statistics *statistics);
+
 
 typedef struct audit {
 	char *id;
@@ -0,0 +1,419 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <threads.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "level_archive.h"
+#include "level_codec.h"
+#include "slv_reader.h"
+
+typedef struct {
+	char *filepath;
+	time_t ts;
+} Level_archive_job;
+
+//	Fila de ficheiros fechados - escrita pela tarefa de escrita da saída
+static Level_archive_job queue[LEVEL_ARCHIVE_QUEUE_SIZE];
+static atomic_uint queue_put;
+static atomic_uint queue_get;
+static sem_t queue_jobs;
+static atomic_bool level_archive_running;
+static thrd_t level_archive_thread;
+static bool active;
+
+//	Estado da tarefa de conversão
+static struct config *archive_config;
+static FILE *archive_fd;
+static char archive_month[sizeof "AAAAMM"];
+static Level_archive_statistics statistics;
+
+//	Conteúdo do ficheiro de saída em conversão, quantificado
+static int32_t *columns[LEVEL_ARCHIVE_COLUMNS_MAX];
+static unsigned columns_capacity;
+static unsigned input_count;
+static unsigned input_columns;
+static unsigned input_flags;
+static unsigned input_segment_duration;
+static int64_t input_ts;		// milisegundos
+static uint8_t *encoded;
+static size_t encoded_size;
+
+static void put_uint16(uint8_t *bytes, uint16_t value)
+{
+	bytes[0] = value;
+	bytes[1] = value >> 8;
+}
+
+static void put_uint32(uint8_t *bytes, uint32_t value)
+{
+	put_uint16(bytes, value);
+	put_uint16(bytes + 2, value >> 16);
+}
+
+static void put_uint64(uint8_t *bytes, uint64_t value)
+{
+	put_uint32(bytes, value);
+	put_uint32(bytes + 4, value >> 32);
+}
+
+static bool columns_reserve(unsigned count)
+{
+	if (count <= columns_capacity)
+		return true;
+	unsigned capacity = columns_capacity == 0 ? 4096 : columns_capacity;
+	while (capacity < count)
+		capacity *= 2;
+	for (unsigned c = 0; c < LEVEL_ARCHIVE_COLUMNS_MAX; c++) {
+		int32_t *column = realloc(columns[c], capacity * sizeof *column);
+		if (column == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			return false;
+		}
+		columns[c] = column;
+	}
+	columns_capacity = capacity;
+	return true;
+}
+
+static bool load_slv(const char *filepath)
+{
+	Slv_reader *reader = slv_reader_open(filepath);
+	if (reader == NULL) {
+		fprintf(stderr, "Level archive: %s: %s\n", filepath, strerror(errno));
+		return false;
+	}
+	input_count = slv_reader_count(reader);
+	input_ts = slv_reader_ts(reader) * 1000;
+	input_segment_duration = slv_reader_segment_duration(reader);
+	const int32_t *direction = slv_reader_direction(reader);
+	input_flags = direction != NULL ? LEVEL_ARCHIVE_DIRECTION : 0;
+	if (slv_reader_raw(reader))
+		input_flags |= LEVEL_ARCHIVE_RAW;
+	unsigned first_band = LEVEL_ARCHIVE_LEVELS + (direction != NULL);
+	unsigned bands = slv_reader_bands(reader);
+	if (first_band + bands > LEVEL_ARCHIVE_COLUMNS_MAX)
+		bands = LEVEL_ARCHIVE_COLUMNS_MAX - first_band;
+	input_columns = first_band + bands;
+	if (!columns_reserve(input_count)) {
+		slv_reader_close(reader);
+		return false;
+	}
+	static const unsigned levels[LEVEL_ARCHIVE_LEVELS] = {
+		SLV_LAEQ, SLV_LAFMIN, SLV_LAE, SLV_LAFMAX, SLV_LAPEAK
+	};
+	for (unsigned c = 0; c < LEVEL_ARCHIVE_LEVELS; c++) {
+		const float *level = slv_reader_level(reader, levels[c]);
+		for (unsigned i = 0; i < input_count; i++)
+			columns[c][i] = level_codec_quantize(level[i]);
+	}
+	if (direction != NULL)
+		memcpy(columns[LEVEL_ARCHIVE_LEVELS], direction, input_count * sizeof *direction);
+	for (unsigned b = 0; b < bands; b++) {
+		const float *level = slv_reader_band(reader, b);
+		for (unsigned i = 0; i < input_count; i++)
+			columns[first_band + b][i] = level_codec_quantize(level[i]);
+	}
+	slv_reader_close(reader);
+	return true;
+}
+
+/*
+ * LAeq, LAFmin, LAE, LAFmax, LApeak[, Direction]
+ */
+static bool load_csv(const char *filepath, time_t ts)
+{
+	FILE *fd = fopen(filepath, "r");
+	if (fd == NULL) {
+		fprintf(stderr, "Level archive: fopen(%s) error: %s\n", filepath, strerror(errno));
+		return false;
+	}
+	char line[256];
+	if (fgets(line, sizeof line, fd) == NULL) {
+		fclose(fd);
+		fprintf(stderr, "Level archive: %s: empty file\n", filepath);
+		return false;
+	}
+	bool direction = strstr(line, "Direction") != NULL;
+	input_flags = direction ? LEVEL_ARCHIVE_DIRECTION : 0;
+	if (archive_config->level_raw)
+		input_flags |= LEVEL_ARCHIVE_RAW;
+	input_columns = LEVEL_ARCHIVE_LEVELS + direction;
+	input_ts = (int64_t)ts * 1000;
+	input_segment_duration = archive_config->segment_duration;
+	input_count = 0;
+	while (fgets(line, sizeof line, fd) != NULL) {
+		if (!columns_reserve(input_count + 1)) {
+			fclose(fd);
+			return false;
+		}
+		char *p = line;
+		for (unsigned c = 0; c < input_columns; c++) {
+			char *end;
+			float value = strtof(p, &end);
+			if (end == p) {
+				//	Última linha incompleta
+				fclose(fd);
+				return true;
+			}
+			columns[c][input_count] = c < LEVEL_ARCHIVE_LEVELS ? level_codec_quantize(value) : (int32_t)value;
+			p = end;
+			while (*p == ',' || *p == ' ')
+				p++;
+		}
+		input_count++;
+	}
+	fclose(fd);
+	return true;
+}
+
+static void archive_file_close()
+{
+	if (archive_fd == NULL)
+		return;
+	fflush(archive_fd);
+	fsync(fileno(archive_fd));
+	fclose(archive_fd);
+	archive_fd = NULL;
+}
+
+/*
+ * Ficheiro do mês de ts, criado com o cabeçalho se não existir:
+ * output_path + output_filename + AAAAMM + LEVEL_ARCHIVE_FILE_EXTENSION
+ */
+static bool archive_file_select(int64_t ts)
+{
+	time_t seconds = ts / 1000;
+	char month[sizeof archive_month];
+	strftime(month, sizeof month, "%Y%m", localtime(&seconds));
+	if (archive_fd != NULL && strcmp(month, archive_month) == 0)
+		return true;
+	archive_file_close();
+	char *filepath = malloc(strlen(archive_config->output_path)
+		+ strlen(archive_config->output_filename) + strlen(month)
+		+ strlen(LEVEL_ARCHIVE_FILE_EXTENSION) + 1);
+	if (filepath == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return false;
+	}
+	strcpy(filepath, archive_config->output_path);
+	strcat(filepath, archive_config->output_filename);
+	strcat(filepath, month);
+	strcat(filepath, LEVEL_ARCHIVE_FILE_EXTENSION);
+	archive_fd = fopen(filepath, "a");
+	if (archive_fd == NULL) {
+		fprintf(stderr, "fopen(%s, \"a\") error: %s\n", filepath, strerror(errno));
+		free(filepath);
+		return false;
+	}
+	free(filepath);
+	strcpy(archive_month, month);
+
+	fseek(archive_fd, 0, SEEK_END);
+	if (ftell(archive_fd) == 0) {
+		uint8_t header[LEVEL_ARCHIVE_HEADER_SIZE] = {0};
+		memcpy(header, LEVEL_ARCHIVE_FILE_MAGIC, 4);
+		put_uint16(header + 4, LEVEL_ARCHIVE_FILE_VERSION);
+		put_uint16(header + 6, LEVEL_ARCHIVE_HEADER_SIZE);
+		memcpy(header + 8, archive_config->identification,
+			strnlen(archive_config->identification, LEVEL_ARCHIVE_HEADER_SIZE - 8));
+		fwrite(header, sizeof header, 1, archive_fd);
+		statistics.archive_bytes += sizeof header;
+	}
+	return true;
+}
+
+static bool archive_block_write(unsigned first, unsigned count)
+{
+	int64_t ts = input_ts + (int64_t)first * input_segment_duration;
+	if (!archive_file_select(ts))
+		return false;
+	size_t bound = input_columns * LEVEL_CODEC_BOUND(count);
+	if (encoded_size < bound) {
+		uint8_t *buffer = realloc(encoded, bound);
+		if (buffer == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			return false;
+		}
+		encoded = buffer;
+		encoded_size = bound;
+	}
+	size_t size = 0;
+	for (unsigned c = 0; c < input_columns; c++)
+		size += level_codec_encode(columns[c] + first, count, encoded + size);
+
+	uint8_t header[LEVEL_ARCHIVE_BLOCK_HEADER_SIZE];
+	put_uint16(header, LEVEL_ARCHIVE_BLOCK_SYNC);
+	put_uint16(header + 2, input_columns);
+	put_uint32(header + 4, count);
+	put_uint64(header + 8, ts);
+	put_uint32(header + 16, input_segment_duration);
+	put_uint32(header + 20, input_flags);
+	put_uint32(header + 24, size);
+	uint32_t crc = level_codec_crc32(0, header, 28);
+	put_uint32(header + 28, level_codec_crc32(crc, encoded, size));
+	if (fwrite(header, sizeof header, 1, archive_fd) != 1
+			|| fwrite(encoded, 1, size, archive_fd) != size) {
+		fprintf(stderr, "Level archive: write error: %s\n", strerror(errno));
+		return false;
+	}
+	statistics.archive_bytes += sizeof header + size;
+	statistics.segments += count;
+	return true;
+}
+
+static void archive_convert(const char *filepath, time_t ts)
+{
+	struct stat status;
+	if (stat(filepath, &status) < 0) {
+		fprintf(stderr, "Level archive: %s: %s\n", filepath, strerror(errno));
+		statistics.errors++;
+		return;
+	}
+	size_t length = strlen(filepath);
+	bool loaded;
+	if (length > strlen(SLV_EXTENSION) && strcmp(filepath + length - strlen(SLV_EXTENSION), SLV_EXTENSION) == 0)
+		loaded = load_slv(filepath);
+	else
+		loaded = load_csv(filepath, ts);
+	if (!loaded || input_segment_duration == 0) {
+		statistics.errors++;
+		return;
+	}
+	//	Blocos que não atravessam a hora do relógio
+	const int64_t block_duration = LEVEL_ARCHIVE_BLOCK_DURATION * 1000;
+	unsigned first = 0;
+	while (first < input_count) {
+		int64_t start = input_ts + (int64_t)first * input_segment_duration;
+		int64_t end = (start / block_duration + 1) * block_duration;
+		unsigned count = (end - start + input_segment_duration - 1) / input_segment_duration;
+		if (count > input_count - first)
+			count = input_count - first;
+		if (!archive_block_write(first, count)) {
+			statistics.errors++;
+			return;
+		}
+		first += count;
+	}
+	//	O arquivo no disco antes de apagar o original
+	fflush(archive_fd);
+	fsync(fileno(archive_fd));
+	statistics.files++;
+	statistics.input_bytes += status.st_size;
+	if (archive_config->level_archive_remove && unlink(filepath) < 0)
+		fprintf(stderr, "Level archive: unlink(%s) error: %s\n", filepath, strerror(errno));
+}
+
+static int level_archive_thread_func(void *not_used)
+{
+	if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), LEVEL_ARCHIVE_NICE) != 0)
+		fprintf(stderr, "Level archive: setpriority error: %s\n", strerror(errno));
+
+	while (true) {
+		sem_wait(&queue_jobs);
+		unsigned get = atomic_load_explicit(&queue_get, memory_order_relaxed);
+		if (get == atomic_load_explicit(&queue_put, memory_order_acquire)) {
+			if (!atomic_load(&level_archive_running))
+				break;
+			continue;
+		}
+		Level_archive_job *job = &queue[get % LEVEL_ARCHIVE_QUEUE_SIZE];
+		archive_convert(job->filepath, job->ts);
+		free(job->filepath);
+		atomic_store_explicit(&queue_get, get + 1, memory_order_release);
+	}
+	archive_file_close();
+
+	struct timespec cpu;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	statistics.cpu_time = cpu.tv_sec + cpu.tv_nsec / 1e9;
+	return 0;
+}
+
+bool level_archive_begin(struct config *config)
+{
+	if (strcmp(config->output_format, ".csv") != 0 && strcmp(config->output_format, SLV_EXTENSION) != 0) {
+		fprintf(stderr, "Level archive requires CSV or SLV output format\n");
+		return false;
+	}
+	archive_config = config;
+	archive_fd = NULL;
+	memset(&statistics, 0, sizeof statistics);
+	atomic_init(&queue_put, 0);
+	atomic_init(&queue_get, 0);
+	atomic_init(&level_archive_running, true);
+	sem_init(&queue_jobs, 0, 0);
+	if (thrd_success != thrd_create(&level_archive_thread, level_archive_thread_func, NULL)) {
+		fprintf(stderr, "Error in \"thrd_create(&level_archive_thread, level_archive_thread_func, NULL)\"");
+		sem_destroy(&queue_jobs);
+		return false;
+	}
+	active = true;
+	return true;
+}
+
+void level_archive_end()
+{
+	if (!active)
+		return;
+	active = false;
+	atomic_store(&level_archive_running, false);
+	sem_post(&queue_jobs);
+	int result;
+	thrd_join(level_archive_thread, &result);
+	sem_destroy(&queue_jobs);
+	for (unsigned c = 0; c < LEVEL_ARCHIVE_COLUMNS_MAX; c++) {
+		free(columns[c]);
+		columns[c] = NULL;
+	}
+	columns_capacity = 0;
+	free(encoded);
+	encoded = NULL;
+	encoded_size = 0;
+}
+
+void level_archive_file(const char *filepath, time_t ts)
+{
+	if (!active)
+		return;
+	unsigned put = atomic_load_explicit(&queue_put, memory_order_relaxed);
+	if (put - atomic_load_explicit(&queue_get, memory_order_acquire) == LEVEL_ARCHIVE_QUEUE_SIZE) {
+		fprintf(stderr, "Level archive: queue full, %s not archived\n", filepath);
+		return;
+	}
+	char *copy = strdup(filepath);
+	if (copy == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return;
+	}
+	queue[put % LEVEL_ARCHIVE_QUEUE_SIZE] = (Level_archive_job){copy, ts};
+	atomic_store_explicit(&queue_put, put + 1, memory_order_release);
+	sem_post(&queue_jobs);
+}
+
+const Level_archive_statistics *level_archive_statistics()
+{
+	return &statistics;
+}
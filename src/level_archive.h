@@ -0,0 +1,104 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef LEVEL_ARCHIVE_H
+#define LEVEL_ARCHIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "config.h"
+
+/*
+ * Arquivo compacto de níveis para armazenamento de longa duração.
+ *
+ * Cada ficheiro de saída fechado (CSV ou SLV) é entregue a uma tarefa
+ * de baixa prioridade que o converte em blocos de uma hora (alinhados
+ * à hora do relógio), acrescentados ao ficheiro de arquivo do mês:
+ * output_path + output_filename + AAAAMM + LEVEL_ARCHIVE_FILE_EXTENSION.
+ * Cada coluna de um bloco é comprimida com level_codec (décimas de dB,
+ * diferenças, zigzag, varint ou bits).
+ * Com level_archive_remove o ficheiro de saída é apagado depois
+ * de o arquivo estar no disco.
+ *
+ * Formato do ficheiro (little-endian):
+ *
+ *	cabeçalho
+ *		char     magic[4]		"SMLA"
+ *		uint16_t version		LEVEL_ARCHIVE_FILE_VERSION
+ *		uint16_t header_size		LEVEL_ARCHIVE_HEADER_SIZE
+ *		char     identification[32]	config identification
+ *	bloco
+ *		uint16_t sync			LEVEL_ARCHIVE_BLOCK_SYNC
+ *		uint16_t columns		5 + direção + bandas
+ *		uint32_t count			número de segmentos
+ *		int64_t  ts			início do primeiro segmento (milisegundos, UNIX)
+ *		uint32_t segment_duration	milisegundos
+ *		uint32_t flags			LEVEL_ARCHIVE_DIRECTION, LEVEL_ARCHIVE_RAW
+ *		uint32_t size			dimensão dos dados
+ *		uint32_t crc			CRC-32 dos 28 bytes anteriores e dos dados
+ *		uint8_t  data[size]		uma coluna level_codec por coluna:
+ *						LAeq, LAFmin, LAE, LAFmax, LApeak,
+ *						direção (graus, com LEVEL_ARCHIVE_DIRECTION)
+ *						e o Leq de cada banda de oitava
+ *
+ * Um bloco incompleto ou com CRC errado (por exemplo, no fim do ficheiro
+ * depois de uma falha) é ignorado pelo leitor, que procura o sync seguinte.
+ */
+
+#define LEVEL_ARCHIVE_FILE_MAGIC	"SMLA"
+#define LEVEL_ARCHIVE_FILE_VERSION	1
+#define LEVEL_ARCHIVE_FILE_EXTENSION	".sla"
+#define LEVEL_ARCHIVE_HEADER_SIZE	40
+#define LEVEL_ARCHIVE_BLOCK_HEADER_SIZE	32
+#define LEVEL_ARCHIVE_BLOCK_SYNC	0x414c
+#define LEVEL_ARCHIVE_BLOCK_DURATION	3600	// segundos
+#define LEVEL_ARCHIVE_LEVELS		5	// colunas de níveis, antes da direção
+#define LEVEL_ARCHIVE_COLUMNS_MAX	(LEVEL_ARCHIVE_LEVELS + 1 + 16)
+#define LEVEL_ARCHIVE_DIRECTION		1
+#define LEVEL_ARCHIVE_RAW		2	// níveis sem calibração (calibration_table.h)
+#define LEVEL_ARCHIVE_QUEUE_SIZE	16	// ficheiros à espera de conversão
+#define LEVEL_ARCHIVE_NICE		10
+
+typedef struct {
+	unsigned files;			// ficheiros de saída convertidos
+	unsigned errors;		// ficheiros não convertidos
+	uint64_t segments;
+	uint64_t input_bytes;		// dimensão dos ficheiros de saída
+	uint64_t archive_bytes;		// dimensão acrescentada ao arquivo
+	double cpu_time;		// tempo de processador da tarefa (segundos)
+} Level_archive_statistics;
+
+bool level_archive_begin(struct config *config);
+
+/**
+ * @brief Converte os ficheiros pendentes e termina a tarefa.
+ */
+void level_archive_end();
+
+/**
+ * @brief Entrega à tarefa o ficheiro de saída filepath, já fechado,
+ * iniciado no instante ts. Não faz nada se o arquivo não estiver ativo.
+ */
+void level_archive_file(const char *filepath, time_t ts);
+
+/**
+ * @brief Estatísticas - válidas depois de level_archive_end.
+ */
+const Level_archive_statistics *level_archive_statistics();
+
+#endif
@@ -0,0 +1,203 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <threads.h>
+
+#include "level_codec.h"
+
+static inline uint64_t zigzag(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline unsigned bit_width(uint64_t value)
+{
+	return value == 0 ? 0 : 64 - __builtin_clzll(value);
+}
+
+static size_t varint_put(uint8_t *output, uint64_t value)
+{
+	size_t size = 0;
+	while (value >= 0x80) {
+		output[size++] = value | 0x80;
+		value >>= 7;
+	}
+	output[size++] = value;
+	return size;
+}
+
+static size_t varint_size(uint64_t value)
+{
+	return value == 0 ? 1 : (bit_width(value) + 6) / 7;
+}
+
+static size_t encode_varint(const uint64_t *deltas, unsigned count, uint8_t *output)
+{
+	size_t size = 0;
+	for (unsigned i = 0; i < count; i++)
+		size += varint_put(output + size, deltas[i]);
+	return size;
+}
+
+static size_t encode_packed(const uint64_t *deltas, unsigned count, uint8_t *output)
+{
+	size_t size = 0;
+	for (unsigned first = 0; first < count; first += LEVEL_CODEC_PARTITION) {
+		unsigned n = count - first < LEVEL_CODEC_PARTITION ? count - first : LEVEL_CODEC_PARTITION;
+		uint64_t bits = 0;
+		for (unsigned i = 0; i < n; i++)
+			bits |= deltas[first + i];
+		unsigned width = bit_width(bits);
+		output[size++] = width;
+		//	width <= 34: cabem sempre no acumulador com os bits pendentes
+		uint64_t accumulator = 0;
+		unsigned pending = 0;
+		for (unsigned i = 0; i < n; i++) {
+			accumulator |= deltas[first + i] << pending;
+			pending += width;
+			while (pending >= 8) {
+				output[size++] = accumulator;
+				accumulator >>= 8;
+				pending -= 8;
+			}
+		}
+		if (pending > 0)
+			output[size++] = accumulator;
+	}
+	return size;
+}
+
+size_t level_codec_encode(const int32_t *values, unsigned count, uint8_t *output)
+{
+	uint64_t deltas[LEVEL_CODEC_PARTITION];
+	size_t varint = 0, packed = 0;
+	int64_t previous = 0;
+	//	Dimensão dos dois modos, partição a partição
+	for (unsigned first = 0; first < count; first += LEVEL_CODEC_PARTITION) {
+		unsigned n = count - first < LEVEL_CODEC_PARTITION ? count - first : LEVEL_CODEC_PARTITION;
+		uint64_t bits = 0;
+		for (unsigned i = 0; i < n; i++) {
+			deltas[i] = zigzag(values[first + i] - previous);
+			previous = values[first + i];
+			varint += varint_size(deltas[i]);
+			bits |= deltas[i];
+		}
+		packed += 1 + ((size_t)n * bit_width(bits) + 7) / 8;
+	}
+	output[0] = packed < varint ? LEVEL_CODEC_PACKED : LEVEL_CODEC_VARINT;
+	size_t size = 1;
+	previous = 0;
+	for (unsigned first = 0; first < count; first += LEVEL_CODEC_PARTITION) {
+		unsigned n = count - first < LEVEL_CODEC_PARTITION ? count - first : LEVEL_CODEC_PARTITION;
+		for (unsigned i = 0; i < n; i++) {
+			deltas[i] = zigzag(values[first + i] - previous);
+			previous = values[first + i];
+		}
+		//	As partições do modo VARINT não têm cabeçalho: o resultado é contínuo
+		if (output[0] == LEVEL_CODEC_PACKED)
+			size += encode_packed(deltas, n, output + size);
+		else
+			size += encode_varint(deltas, n, output + size);
+	}
+	return size;
+}
+
+static bool value_put(int32_t *values, unsigned i, int64_t *previous, uint64_t delta)
+{
+	int64_t value = *previous + unzigzag(delta);
+	if (value < INT32_MIN || value > INT32_MAX)
+		return false;
+	values[i] = value;
+	*previous = value;
+	return true;
+}
+
+size_t level_codec_decode(const uint8_t *input, size_t size, unsigned count, int32_t *values)
+{
+	if (size < 1)
+		return 0;
+	size_t position = 1;
+	int64_t previous = 0;
+	if (input[0] == LEVEL_CODEC_VARINT) {
+		for (unsigned i = 0; i < count; i++) {
+			uint64_t delta = 0;
+			unsigned shift = 0;
+			uint8_t byte;
+			do {
+				if (position >= size || shift > 28)
+					return 0;
+				byte = input[position++];
+				delta |= (uint64_t)(byte & 0x7f) << shift;
+				shift += 7;
+			} while (byte & 0x80);
+			if (!value_put(values, i, &previous, delta))
+				return 0;
+		}
+		return position;
+	}
+	if (input[0] != LEVEL_CODEC_PACKED)
+		return 0;
+	for (unsigned first = 0; first < count; first += LEVEL_CODEC_PARTITION) {
+		unsigned n = count - first < LEVEL_CODEC_PARTITION ? count - first : LEVEL_CODEC_PARTITION;
+		if (position >= size)
+			return 0;
+		unsigned width = input[position++];
+		if (width > 34 || size - position < ((size_t)n * width + 7) / 8)
+			return 0;
+		uint64_t mask = width == 0 ? 0 : (UINT64_C(1) << width) - 1;
+		uint64_t accumulator = 0;
+		unsigned available = 0;
+		for (unsigned i = 0; i < n; i++) {
+			while (available < width) {
+				accumulator |= (uint64_t)input[position++] << available;
+				available += 8;
+			}
+			uint64_t delta = accumulator & mask;
+			accumulator >>= width;
+			available -= width;
+			if (!value_put(values, first + i, &previous, delta))
+				return 0;
+		}
+	}
+	return position;
+}
+
+static uint32_t crc_table[256];
+static once_flag crc_once = ONCE_FLAG_INIT;
+
+static void crc_table_init()
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (int k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+		crc_table[i] = crc;
+	}
+}
+
+uint32_t level_codec_crc32(uint32_t crc, const uint8_t *data, size_t size)
+{
+	call_once(&crc_once, crc_table_init);
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
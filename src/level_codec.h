@@ -0,0 +1,84 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef LEVEL_CODEC_H
+#define LEVEL_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+/*
+ * Compressão de uma coluna de níveis.
+ *
+ * Os níveis são quantificados em décimas de dB (inteiros) e cada valor
+ * é substituído pela diferença para o anterior (o primeiro pela diferença
+ * para 0). As diferenças, mapeadas em zigzag para inteiros sem sinal
+ * (0, -1, 1, -2 ... -> 0, 1, 2, 3 ...), são codificadas num de dois modos,
+ * o de menor dimensão:
+ *	- VARINT: cada valor em grupos de 7 bits, LSB primeiro, com o bit 7
+ *	  a indicar que há mais grupos;
+ *	- PACKED: em partições de LEVEL_CODEC_PARTITION valores, cada uma
+ *	  com um byte de largura w seguido dos valores em w bits
+ *	  (LSB primeiro), alinhada ao byte.
+ *
+ * Coluna: modo (1 byte) seguido dos valores.
+ * Os valores não finitos são representados por LEVEL_CODEC_MISSING.
+ */
+
+#define LEVEL_CODEC_VARINT	0
+#define LEVEL_CODEC_PACKED	1
+#define LEVEL_CODEC_PARTITION	128
+#define LEVEL_CODEC_MISSING	INT32_MIN
+
+/**
+ * @brief Dimensão máxima de uma coluna codificada.
+ */
+#define LEVEL_CODEC_BOUND(count)	(1 + 10 * (size_t)(count))
+
+static inline int32_t level_codec_quantize(float level)
+{
+	if (!isfinite(level) || fabsf(level) > INT32_MAX / 10)
+		return LEVEL_CODEC_MISSING;
+	return lroundf(level * 10);
+}
+
+static inline float level_codec_level(int32_t value)
+{
+	return value == LEVEL_CODEC_MISSING ? -INFINITY : value / 10.0f;
+}
+
+/**
+ * @brief Codifica count valores.
+ *
+ * @return Número de bytes escritos em output.
+ */
+size_t level_codec_encode(const int32_t *values, unsigned count, uint8_t *output);
+
+/**
+ * @brief Descodifica count valores de uma coluna produzida por level_codec_encode.
+ *
+ * @return Número de bytes da coluna em input; 0 se os dados estiverem corrompidos.
+ */
+size_t level_codec_decode(const uint8_t *input, size_t size, unsigned count, int32_t *values);
+
+/**
+ * @brief CRC-32 (IEEE 802.3) de data, continuando de crc (0 no início).
+ */
+uint32_t level_codec_crc32(uint32_t crc, const uint8_t *data, size_t size);
+
+#endif
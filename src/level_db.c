@@ -0,0 +1,273 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <threads.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "level_db.h"
+
+//	Fila de registos - escrita pelo ciclo de processamento
+static Level_db_record queue[LEVEL_DB_QUEUE_SIZE];
+static atomic_uint queue_put;
+static atomic_uint queue_get;
+static sem_t queue_records;
+static atomic_bool level_db_running;
+static thrd_t level_db_thread;
+static bool active;
+
+//	Estado da tarefa de escrita
+static FILE *files[LEVEL_DB_LEVELS];
+static uint64_t record_count;
+static int64_t record_last;			// ts do último registo
+static Level_db_summary summaries[LEVEL_DB_LEVELS];	// intervalo em curso de cada nível
+static bool summary_open[LEVEL_DB_LEVELS];
+static Level_db_statistics statistics;
+
+static uint64_t file_entries(unsigned level)
+{
+	struct stat status;
+	fstat(fileno(files[level]), &status);
+	size_t entry_size = level == 0 ? sizeof (Level_db_record) : sizeof (Level_db_summary);
+	return status.st_size < (off_t)sizeof (Level_db_header) ? 0
+		: (status.st_size - sizeof (Level_db_header)) / entry_size;
+}
+
+static off_t entry_offset(unsigned level, uint64_t index)
+{
+	size_t entry_size = level == 0 ? sizeof (Level_db_record) : sizeof (Level_db_summary);
+	return sizeof (Level_db_header) + index * entry_size;
+}
+
+/*
+ * Abre ou cria o ficheiro do nível level e descarta uma entrada
+ * incompleta no fim. Um ficheiro existente tem de ter o mesmo cabeçalho.
+ */
+static bool file_open(const char *path, unsigned level, uint32_t flags)
+{
+	char filepath[strlen(path) + strlen(level_db_filenames[level]) + 1];
+	strcpy(filepath, path);
+	strcat(filepath, level_db_filenames[level]);
+	Level_db_header header = {
+		.version = LEVEL_DB_VERSION,
+		.header_size = sizeof header,
+		.entry_size = level == 0 ? sizeof (Level_db_record) : sizeof (Level_db_summary),
+		.level = level,
+		.span = level_db_spans[level],
+		.flags = flags,
+	};
+	memcpy(header.magic, LEVEL_DB_MAGIC, sizeof header.magic);
+
+	FILE *fd = fopen(filepath, "r+");
+	if (fd == NULL && errno == ENOENT) {
+		fd = fopen(filepath, "w+");
+		if (fd != NULL)
+			fwrite(&header, sizeof header, 1, fd);
+	}
+	else if (fd != NULL) {
+		Level_db_header existing;
+		if (fread(&existing, sizeof existing, 1, fd) != 1
+				|| memcmp(&existing, &header, sizeof header) != 0) {
+			fprintf(stderr, "Level database: %s: invalid header\n", filepath);
+			fclose(fd);
+			return false;
+		}
+	}
+	if (fd == NULL) {
+		fprintf(stderr, "fopen(%s) error: %s\n", filepath, strerror(errno));
+		return false;
+	}
+	files[level] = fd;
+	fflush(fd);
+	if (ftruncate(fileno(fd), entry_offset(level, file_entries(level))) < 0)
+		fprintf(stderr, "Level database: ftruncate(%s) error: %s\n", filepath, strerror(errno));
+	return true;
+}
+
+static void summary_write(unsigned level)
+{
+	fseek(files[level], 0, SEEK_END);
+	fwrite(&summaries[level], sizeof summaries[level], 1, files[level]);
+	summary_open[level] = false;
+	statistics.summaries++;
+}
+
+static void summaries_add(const Level_db_record *record, uint64_t index, uint64_t *from)
+{
+	for (unsigned level = 1; level < LEVEL_DB_LEVELS; level++) {
+		if (index < from[level])
+			continue;
+		int64_t start = record->ts - record->ts % level_db_spans[level];
+		if (summary_open[level] && summaries[level].start != start)
+			summary_write(level);
+		if (!summary_open[level]) {
+			level_db_summary_init(&summaries[level], start, index);
+			summary_open[level] = true;
+		}
+		level_db_summary_add(&summaries[level], record);
+	}
+}
+
+static void record_write(Level_db_record *record)
+{
+	//	Tempo monótono, mesmo que o relógio recue
+	if (record->ts < record_last)
+		record->ts = record_last;
+	record_last = record->ts;
+	fseek(files[0], 0, SEEK_END);
+	fwrite(record, sizeof *record, 1, files[0]);
+	uint64_t from[LEVEL_DB_LEVELS] = {0};
+	summaries_add(record, record_count++, from);
+	statistics.records++;
+}
+
+/*
+ * Refaz o último resumo de cada nível a partir dos registos.
+ */
+static void summaries_recover()
+{
+	uint64_t from[LEVEL_DB_LEVELS] = {0};
+	uint64_t first = record_count;
+	for (unsigned level = 1; level < LEVEL_DB_LEVELS; level++) {
+		uint64_t entries = file_entries(level);
+		from[level] = 0;
+		if (entries > 0) {
+			Level_db_summary last;
+			fseek(files[level], entry_offset(level, entries - 1), SEEK_SET);
+			if (fread(&last, sizeof last, 1, files[level]) == 1) {
+				from[level] = last.first < record_count ? last.first : record_count;
+				fflush(files[level]);
+				if (ftruncate(fileno(files[level]), entry_offset(level, entries - 1)) < 0)
+					fprintf(stderr, "Level database: ftruncate error: %s\n", strerror(errno));
+			}
+		}
+		if (from[level] < first)
+			first = from[level];
+	}
+	fseek(files[0], entry_offset(0, first), SEEK_SET);
+	Level_db_record record;
+	for (uint64_t index = first; index < record_count; index++) {
+		if (fread(&record, sizeof record, 1, files[0]) != 1)
+			break;
+		summaries_add(&record, index, from);
+	}
+	record_last = INT64_MIN;
+	if (record_count > 0) {
+		fseek(files[0], entry_offset(0, record_count - 1), SEEK_SET);
+		if (fread(&record, sizeof record, 1, files[0]) == 1)
+			record_last = record.ts;
+	}
+}
+
+static int level_db_thread_func(void *not_used)
+{
+	while (true) {
+		sem_wait(&queue_records);
+		unsigned get = atomic_load_explicit(&queue_get, memory_order_relaxed);
+		unsigned put = atomic_load_explicit(&queue_put, memory_order_acquire);
+		if (get == put) {
+			if (!atomic_load(&level_db_running))
+				break;
+			continue;
+		}
+		for (; get != put; get++)
+			record_write(&queue[get % LEVEL_DB_QUEUE_SIZE]);
+		atomic_store_explicit(&queue_get, get, memory_order_release);
+		for (unsigned level = 0; level < LEVEL_DB_LEVELS; level++)
+			fflush(files[level]);
+	}
+	//	Os intervalos incompletos, refeitos na próxima abertura
+	for (unsigned level = 1; level < LEVEL_DB_LEVELS; level++)
+		if (summary_open[level])
+			summary_write(level);
+	return 0;
+}
+
+bool level_db_begin(struct config *config)
+{
+	if (mkdir(config->level_db_path, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "mkdir(%s) error: %s\n", config->level_db_path, strerror(errno));
+		return false;
+	}
+	memset(&statistics, 0, sizeof statistics);
+	for (unsigned level = 0; level < LEVEL_DB_LEVELS; level++) {
+		summary_open[level] = false;
+		if (!file_open(config->level_db_path, level, config->level_raw ? LEVEL_DB_RAW : 0)) {
+			while (level-- > 0)
+				fclose(files[level]);
+			return false;
+		}
+	}
+	record_count = file_entries(0);
+	summaries_recover();
+	statistics.summaries = 0;
+
+	atomic_init(&queue_put, 0);
+	atomic_init(&queue_get, 0);
+	atomic_init(&level_db_running, true);
+	sem_init(&queue_records, 0, 0);
+	if (thrd_success != thrd_create(&level_db_thread, level_db_thread_func, NULL)) {
+		fprintf(stderr, "Error in \"thrd_create(&level_db_thread, level_db_thread_func, NULL)\"");
+		sem_destroy(&queue_records);
+		for (unsigned level = 0; level < LEVEL_DB_LEVELS; level++)
+			fclose(files[level]);
+		return false;
+	}
+	active = true;
+	return true;
+}
+
+void level_db_end()
+{
+	if (!active)
+		return;
+	active = false;
+	atomic_store(&level_db_running, false);
+	sem_post(&queue_records);
+	int result;
+	thrd_join(level_db_thread, &result);
+	sem_destroy(&queue_records);
+	for (unsigned level = 0; level < LEVEL_DB_LEVELS; level++) {
+		fflush(files[level]);
+		fsync(fileno(files[level]));
+		fclose(files[level]);
+	}
+}
+
+void level_db_append(const Level_db_record *record)
+{
+	if (!active)
+		return;
+	unsigned put = atomic_load_explicit(&queue_put, memory_order_relaxed);
+	if (put - atomic_load_explicit(&queue_get, memory_order_acquire) == LEVEL_DB_QUEUE_SIZE) {
+		statistics.dropped++;
+		return;
+	}
+	queue[put % LEVEL_DB_QUEUE_SIZE] = *record;
+	atomic_store_explicit(&queue_put, put + 1, memory_order_release);
+	sem_post(&queue_records);
+}
+
+void level_db_statistics(Level_db_statistics *level_db)
+{
+	*level_db = statistics;
+}
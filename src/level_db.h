@@ -0,0 +1,157 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef LEVEL_DB_H
+#define LEVEL_DB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "config.h"
+
+/*
+ * Base de dados de níveis, indexada pelo tempo, só de acréscimo.
+ *
+ * A diretoria level_db_path contém quatro ficheiros de entradas
+ * de dimensão fixa, ordenadas pelo tempo:
+ *	records.ldb	um registo por segmento (Level_db_record)
+ *	minute.ldb	resumo de cada minuto com registos (Level_db_summary)
+ *	hour.ldb	resumo de cada hora
+ *	day.ldb		resumo de cada dia (UTC)
+ *
+ * Cada registo guarda o nível equivalente do segmento (LAE), e não o LAeq
+ * do processamento, que é a média desde o arranque.
+ * Cada resumo tem a energia (soma de 10^(LAE/10) * duração), a duração
+ * coberta, os extremos dos níveis e o índice do primeiro registo em
+ * records.ldb; os resumos de minuto servem de índice esparso dos registos.
+ * O LAeq, LAFmax e LAFmin de um intervalo são calculados com os resumos
+ * completamente contidos no intervalo, descendo de nível só nas pontas
+ * (level_db_reader.h).
+ *
+ * Um resumo é acrescentado quando o seu intervalo termina, e no fim
+ * com o intervalo incompleto. Ao abrir, o último resumo de cada nível
+ * é descartado e refeito a partir dos registos, o que também recupera
+ * resumos em falta depois de uma falha.
+ *
+ * Com level_raw os níveis são guardados sem calibration_delta (LEVEL_DB_RAW);
+ * a base de dados não pode mudar de modo.
+ *
+ * Cada ficheiro começa com um cabeçalho (Level_db_header).
+ * Os campos têm a representação nativa (little-endian).
+ */
+
+#define LEVEL_DB_MAGIC		"SMDB"
+#define LEVEL_DB_VERSION	2	// 1 - energia do LAeq acumulado
+#define LEVEL_DB_LEVELS		4	// registos, minuto, hora, dia
+#define LEVEL_DB_QUEUE_SIZE	256	// registos à espera da tarefa de escrita
+#define LEVEL_DB_RAW		1	// níveis sem calibração (calibration_table.h)
+
+static const char *const level_db_filenames[LEVEL_DB_LEVELS] = {
+	"records.ldb", "minute.ldb", "hour.ldb", "day.ldb"
+};
+
+//	Intervalo de cada nível de resumo (milisegundos)
+static const int64_t level_db_spans[LEVEL_DB_LEVELS] = {
+	0, 60 * 1000, 3600 * 1000, 86400 * 1000
+};
+
+typedef struct __attribute__ ((packed)) {
+	char magic[4];
+	uint16_t version;
+	uint16_t header_size;
+	uint32_t entry_size;
+	uint32_t level;		// 0 - registos, 1 .. 3 - resumos
+	int64_t span;		// milisegundos (0 nos registos)
+	uint32_t flags;		// LEVEL_DB_RAW
+	uint8_t reserved[4];
+} Level_db_header;
+
+typedef struct __attribute__ ((packed)) {
+	int64_t ts;		// início do segmento (milisegundos, UNIX)
+	uint32_t duration;	// milisegundos
+	float lae, lafmin, lafmax, lapeak;
+	uint32_t reserved;
+} Level_db_record;
+
+typedef struct __attribute__ ((packed)) {
+	int64_t start;		// início do intervalo (milisegundos, múltiplo de span)
+	uint64_t first;		// índice do primeiro registo
+	double energy;		// soma de 10^(LAE/10) * duration
+	uint64_t duration;	// soma de duration (milisegundos)
+	float lafmax, lafmin, lapeak;
+	uint32_t count;		// número de registos
+} Level_db_summary;
+
+static inline void level_db_summary_init(Level_db_summary *summary, int64_t start, uint64_t first)
+{
+	*summary = (Level_db_summary){
+		.start = start, .first = first,
+		.lafmax = -INFINITY, .lafmin = INFINITY, .lapeak = -INFINITY
+	};
+}
+
+static inline void level_db_summary_add(Level_db_summary *summary, const Level_db_record *record)
+{
+	if (isfinite(record->lae))
+		summary->energy += pow(10, record->lae / 10) * record->duration;
+	summary->duration += record->duration;
+	summary->lafmax = fmaxf(summary->lafmax, record->lafmax);
+	summary->lafmin = fminf(summary->lafmin, record->lafmin);
+	summary->lapeak = fmaxf(summary->lapeak, record->lapeak);
+	summary->count++;
+}
+
+static inline void level_db_summary_merge(Level_db_summary *summary, const Level_db_summary *other)
+{
+	summary->energy += other->energy;
+	summary->duration += other->duration;
+	summary->lafmax = fmaxf(summary->lafmax, other->lafmax);
+	summary->lafmin = fminf(summary->lafmin, other->lafmin);
+	summary->lapeak = fmaxf(summary->lapeak, other->lapeak);
+	summary->count += other->count;
+}
+
+static inline void level_db_summary_calibrate(Level_db_summary *summary, float delta)
+{
+	summary->energy *= pow(10, delta / 10);
+	summary->lafmax += delta;
+	summary->lafmin += delta;
+	summary->lapeak += delta;
+}
+
+static inline float level_db_summary_laeq(const Level_db_summary *summary)
+{
+	return summary->energy > 0 ? 10 * log10(summary->energy / summary->duration) : -INFINITY;
+}
+
+typedef struct {
+	uint64_t records;
+	uint64_t dropped;	// registos perdidos com a fila cheia
+	uint64_t summaries;
+} Level_db_statistics;
+
+bool level_db_begin(struct config *config);
+void level_db_end();
+
+/**
+ * @brief Acrescenta o registo de um segmento. Não bloqueia.
+ */
+void level_db_append(const Level_db_record *record);
+
+void level_db_statistics(Level_db_statistics *statistics);
+
+#endif
@@ -0,0 +1,238 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "level_db_reader.h"
+
+#define READ_ENTRIES	256	// entradas por leitura sequencial
+
+struct level_db_reader {
+	int fds[LEVEL_DB_LEVELS];
+	uint64_t entries[LEVEL_DB_LEVELS];	// entradas completas nesta consulta
+	int64_t covered[LEVEL_DB_LEVELS];	// fim do último resumo escrito
+	unsigned reads;
+	bool error;
+	bool raw;				// LEVEL_DB_RAW
+};
+
+static size_t entry_size(unsigned level)
+{
+	return level == 0 ? sizeof (Level_db_record) : sizeof (Level_db_summary);
+}
+
+static size_t entries_read(Level_db_reader *reader, unsigned level, uint64_t index,
+	size_t count, void *buffer)
+{
+	if (index >= reader->entries[level])
+		return 0;
+	if (count > reader->entries[level] - index)
+		count = reader->entries[level] - index;
+	reader->reads++;
+	ssize_t size = pread(reader->fds[level], buffer, count * entry_size(level),
+		sizeof (Level_db_header) + index * entry_size(level));
+	if (size < 0) {
+		reader->error = true;
+		return 0;
+	}
+	return size / entry_size(level);
+}
+
+/*
+ * Índice do primeiro resumo com início >= start.
+ */
+static uint64_t summary_search(Level_db_reader *reader, unsigned level, int64_t start)
+{
+	uint64_t low = 0, high = reader->entries[level];
+	while (low < high) {
+		uint64_t middle = low + (high - low) / 2;
+		Level_db_summary summary;
+		if (entries_read(reader, level, middle, 1, &summary) != 1)
+			return reader->entries[level];
+		if (summary.start < start)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+static int64_t floor_span(int64_t ts, int64_t span)
+{
+	int64_t start = ts / span * span;
+	return start > ts ? start - span : start;
+}
+
+static void records_merge(Level_db_reader *reader, int64_t from, int64_t to, Level_db_summary *result)
+{
+	//	Os resumos de minuto são o índice esparso dos registos
+	uint64_t index = 0;
+	uint64_t minute = summary_search(reader, 1, floor_span(from, level_db_spans[1]) + 1);
+	if (minute > 0) {
+		Level_db_summary summary;
+		if (entries_read(reader, 1, minute - 1, 1, &summary) == 1)
+			index = summary.first;
+	}
+	Level_db_record records[READ_ENTRIES];
+	size_t count;
+	while ((count = entries_read(reader, 0, index, READ_ENTRIES, records)) > 0) {
+		for (size_t i = 0; i < count; i++) {
+			if (records[i].ts >= to)
+				return;
+			if (records[i].ts >= from)
+				level_db_summary_add(result, &records[i]);
+		}
+		index += count;
+	}
+}
+
+static void summaries_merge(Level_db_reader *reader, unsigned level, int64_t from, int64_t to,
+	Level_db_summary *result)
+{
+	uint64_t index = summary_search(reader, level, from);
+	Level_db_summary summaries[READ_ENTRIES];
+	size_t count;
+	while ((count = entries_read(reader, level, index, READ_ENTRIES, summaries)) > 0) {
+		for (size_t i = 0; i < count; i++) {
+			if (summaries[i].start >= to)
+				return;
+			level_db_summary_merge(result, &summaries[i]);
+		}
+		index += count;
+	}
+}
+
+static void level_merge(Level_db_reader *reader, unsigned level, int64_t from, int64_t to,
+	Level_db_summary *result)
+{
+	if (from >= to)
+		return;
+	if (level == 0) {
+		records_merge(reader, from, to, result);
+		return;
+	}
+	int64_t span = level_db_spans[level];
+	int64_t start = floor_span(from - 1, span) + span;	// primeiro intervalo completo
+	int64_t end = floor_span(to, span);
+	if (end > reader->covered[level])
+		end = reader->covered[level];
+	if (start >= end) {
+		level_merge(reader, level - 1, from, to, result);
+		return;
+	}
+	level_merge(reader, level - 1, from, start, result);
+	summaries_merge(reader, level, start, end, result);
+	level_merge(reader, level - 1, end, to, result);
+}
+
+Level_db_reader *level_db_reader_open(const char *path)
+{
+	Level_db_reader *reader = malloc(sizeof *reader);
+	if (reader == NULL)
+		return NULL;
+	for (unsigned level = 0; level < LEVEL_DB_LEVELS; level++) {
+		char filepath[strlen(path) + strlen(level_db_filenames[level]) + 1];
+		strcpy(filepath, path);
+		strcat(filepath, level_db_filenames[level]);
+		int fd = open(filepath, O_RDONLY);
+		Level_db_header header;
+		if (fd >= 0 && (pread(fd, &header, sizeof header, 0) != sizeof header
+				|| memcmp(header.magic, LEVEL_DB_MAGIC, sizeof header.magic) != 0
+				|| header.version != LEVEL_DB_VERSION
+				|| header.header_size != sizeof header
+				|| header.entry_size != entry_size(level)
+				|| header.level != level)) {
+			close(fd);
+			fd = -1;
+			errno = EPROTO;
+		}
+		if (fd < 0) {
+			while (level-- > 0)
+				close(reader->fds[level]);
+			free(reader);
+			return NULL;
+		}
+		reader->fds[level] = fd;
+		reader->raw = (header.flags & LEVEL_DB_RAW) != 0;
+	}
+	return reader;
+}
+
+void level_db_reader_close(Level_db_reader *reader)
+{
+	for (unsigned level = 0; level < LEVEL_DB_LEVELS; level++)
+		close(reader->fds[level]);
+	free(reader);
+}
+
+bool level_db_reader_query(Level_db_reader *reader, int64_t from, int64_t to,
+	Level_db_summary *result, unsigned *reads)
+{
+	reader->reads = 0;
+	reader->error = false;
+	for (unsigned level = 0; level < LEVEL_DB_LEVELS; level++) {
+		struct stat status;
+		if (fstat(reader->fds[level], &status) < 0)
+			return false;
+		reader->entries[level] = status.st_size < (off_t)sizeof (Level_db_header) ? 0
+			: (status.st_size - sizeof (Level_db_header)) / entry_size(level);
+		reader->covered[level] = INT64_MIN;
+		Level_db_summary last;
+		if (level > 0 && entries_read(reader, level, reader->entries[level] - 1, 1, &last) == 1)
+			reader->covered[level] = last.start + level_db_spans[level];
+	}
+	level_db_summary_init(result, from, 0);
+	level_merge(reader, LEVEL_DB_LEVELS - 1, from, to, result);
+	if (reads != NULL)
+		*reads = reader->reads;
+	return !reader->error;
+}
+
+bool level_db_reader_raw(Level_db_reader *reader)
+{
+	return reader->raw;
+}
+
+bool level_db_reader_query_calibrated(Level_db_reader *reader, const Calibration_table *table,
+	int64_t from, int64_t to, Level_db_summary *result, unsigned *reads)
+{
+	if (!reader->raw)
+		return level_db_reader_query(reader, from, to, result, reads);
+	//	Uma consulta por época: os resumos só se somam com a mesma calibração
+	level_db_summary_init(result, from, 0);
+	unsigned total = 0;
+	for (int64_t start = from; start < to; ) {
+		int64_t end = calibration_table_next(table, start);
+		if (end > to)
+			end = to;
+		Level_db_summary part;
+		unsigned part_reads;
+		if (!level_db_reader_query(reader, start, end, &part, &part_reads))
+			return false;
+		level_db_summary_calibrate(&part, calibration_table_delta(table, start));
+		level_db_summary_merge(result, &part);
+		total += part_reads;
+		start = end;
+	}
+	if (reads != NULL)
+		*reads = total;
+	return true;
+}
@@ -0,0 +1,70 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef LEVEL_DB_READER_H
+#define LEVEL_DB_READER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "level_db.h"
+#include "calibration_table.h"
+
+/*
+ * Consulta da base de dados de níveis (level_db.h).
+ * Um intervalo [from, to[ é decomposto do nível mais largo para o mais
+ * fino: os resumos de dia completamente contidos no intervalo são lidos
+ * seguidos, e só as pontas descem para a hora, o minuto e os registos.
+ * Uma consulta de meses lê algumas dezenas de resumos de dia,
+ * em vez de milhões de registos.
+ * A base de dados pode estar a ser escrita: as dimensões dos ficheiros
+ * são relidas em cada consulta, e o intervalo de um resumo ainda
+ * não escrito é obtido do nível inferior.
+ */
+
+typedef struct level_db_reader Level_db_reader;
+
+/**
+ * @brief Abre a base de dados na diretoria path (terminada em '/').
+ * NULL se não existir ou não for válida (errno).
+ */
+Level_db_reader *level_db_reader_open(const char *path);
+void level_db_reader_close(Level_db_reader *reader);
+
+/**
+ * @brief Resume os registos com início em [from, to[ (milisegundos, UNIX).
+ *
+ * @param result LAeq com level_db_summary_laeq, extremos e duração coberta.
+ * @param reads Se não for NULL, recebe o número de leituras do disco.
+ * @return false se houver erro de leitura.
+ */
+bool level_db_reader_query(Level_db_reader *reader, int64_t from, int64_t to,
+	Level_db_summary *result, unsigned *reads);
+
+/**
+ * @brief Base de dados escrita com level_raw (LEVEL_DB_RAW).
+ */
+bool level_db_reader_raw(Level_db_reader *reader);
+
+/**
+ * @brief Como level_db_reader_query, com os níveis de uma base de dados
+ * LEVEL_DB_RAW calibrados pela época de cada registo: o intervalo
+ * é dividido nos inícios das épocas da tabela table.
+ */
+bool level_db_reader_query_calibrated(Level_db_reader *reader, const Calibration_table *table,
+	int64_t from, int64_t to, Level_db_summary *result, unsigned *reads);
+
+#endif
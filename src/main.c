@@ -32,6 +32,19 @@ ao PFC MoSEMusic realizado por Guilherme Albano e David Meneses
 #include "in_out.h"
 #include "mqtt.h"
 #include "server.h"
+#include "spectrum.h"
+#include "event.h"
+#include "archive.h"
+#include "level_archive.h"
+#include "level_db.h"
+#include "calibration_table.h"
+#include "sweep.h"
+#include "result_cache.h"
+#include "watch.h"
+#include "streams.h"
+#include "hub.h"
+#include "shm_levels.h"
+#include "shm_pcm.h"
 
 bool running = true;
 
@@ -50,13 +63,17 @@ static void help(char *prog_name)
 		"\t-d, --device <device name>\n"
 		"\t-i, --input <file name>\n"
 		"\t-o, --output <file name>\n"
-		"\t-f, --output_format <csv | json>\n"
+		"\t-f, --output_format <csv | json | slv>\n"
 		"\t-r, --sample_rate <rate>\n"
 		"\t-a, --channels <channels>\n"
 		"\t-n, --identification <name>\n"
 		"\t-t, --duration <seconds>\n"
 		"\t-c, --calibrate <seconds>\n"
-		"\t-g, --config <filename>\n",
+		"\t-g, --config <filename>\n"
+		"\t-w, --sweep <filename>\n"
+		"\t-W, --watch <directory>\n"
+		"\t-S, --streams <filename>\n"
+		"\t-H, --hub <source>\n",
 		prog_name);
 }
 
@@ -84,6 +101,10 @@ int main (int argc, char *argv[])
 		{"duration", required_argument, 0, 't'},
 		{"calibrate", optional_argument, 0, 'c'},
 		{"config", required_argument, 0, 'g'},
+		{"sweep", required_argument, 0, 'w'},
+		{"watch", required_argument, 0, 'W'},
+		{"streams", required_argument, 0, 'S'},
+		{"hub", required_argument, 0, 'H'},
 		{0, 0, 0, 0}
 	};
 
@@ -99,11 +120,17 @@ int main (int argc, char *argv[])
 	char *option_identification = NULL;
 	char *option_calibration_time = NULL;
 	char *option_config_filename = NULL;
+	char *option_sweep_filename = NULL;
+	char *option_watch_paths[WATCH_PATHS_MAX];
+	unsigned watch_paths_number = 0;
+	char *option_streams_filename = NULL;
+	char *option_hub_sources[HUB_SOURCES_MAX];
+	unsigned hub_sources_number = 0;
 	int run_duration = 0;
 
 	signal(SIGINT, int_handler);
 
-	while ((option_char = getopt_long(argc, argv, ":hvd:i:o:f:r:a:n:t:c:g:",
+	while ((option_char = getopt_long(argc, argv, ":hvd:i:o:f:r:a:n:t:c:g:w:W:S:H:",
 			long_options, &option_index)) != -1) {
 		switch (option_char) {
 		case 0:	//	Opções longas com afetação de flag
@@ -144,6 +171,28 @@ int main (int argc, char *argv[])
 		case 'c':
 			option_calibration_time = optarg;
 			break;
+		case 'w':
+			option_sweep_filename = optarg;
+			break;
+		case 'W':
+			if (watch_paths_number == WATCH_PATHS_MAX) {
+				fprintf(stderr, "Too many watch directories (max %d)\n", WATCH_PATHS_MAX);
+				error_in_options = true;
+				break;
+			}
+			option_watch_paths[watch_paths_number++] = optarg;
+			break;
+		case 'S':
+			option_streams_filename = optarg;
+			break;
+		case 'H':
+			if (hub_sources_number == HUB_SOURCES_MAX) {
+				fprintf(stderr, "Too many hub sources (max %d)\n", HUB_SOURCES_MAX);
+				error_in_options = true;
+				break;
+			}
+			option_hub_sources[hub_sources_number++] = optarg;
+			break;
 		case ':':
 			fprintf(stderr, "Error in option -%c argument\n", optopt);
 			error_in_options = true;
@@ -242,9 +291,98 @@ int main (int argc, char *argv[])
 			run_duration);
 	}
 
+	//----------------------------------------------------------------------
+	//	Vigilância de diretorias: cada ficheiro processado por um processo filho
+
+	if (watch_paths_number > 0) {
+		if (option_input_filename != NULL || option_output_filename != NULL) {
+			fprintf(stderr, "Watch mode does not accept -i or -o\n");
+			exit(EXIT_FAILURE);
+		}
+		char *arguments[16];
+		unsigned arguments_number = 0;
+		const struct { char *option; char *value; } forward[] = {
+			{"-g", option_config_filename}, {"-f", option_output_format},
+			{"-r", option_sample_rate}, {"-a", option_channels},
+			{"-n", option_identification}, {"-c", option_calibration_time},
+		};
+		for (unsigned i = 0; i < sizeof forward / sizeof forward[0]; i++)
+			if (forward[i].value != NULL) {
+				arguments[arguments_number++] = forward[i].option;
+				arguments[arguments_number++] = forward[i].value;
+			}
+		arguments[arguments_number] = NULL;
+		bool done = watch_run(option_watch_paths, watch_paths_number, arguments,
+					config_struct, verbose_flag);
+		config_destroy(config_struct);
+		return done ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	//----------------------------------------------------------------------
+	//	Multi-fluxo: os fluxos medidos num só processo, por um conjunto de tarefas
+
+	if (option_streams_filename != NULL) {
+		if (option_input_filename != NULL || option_output_filename != NULL) {
+			fprintf(stderr, "Streams mode does not accept -i or -o\n");
+			exit(EXIT_FAILURE);
+		}
+		bool done = streams_run(option_streams_filename, config_struct, verbose_flag);
+		config_destroy(config_struct);
+		return done ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	//----------------------------------------------------------------------
+	//	Concentrador: agrega os níveis de vários medidores
+
+	if (hub_sources_number > 0) {
+		if (option_input_filename != NULL || option_output_filename != NULL) {
+			fprintf(stderr, "Hub mode does not accept -i or -o\n");
+			exit(EXIT_FAILURE);
+		}
+		bool done = hub_run(option_hub_sources, hub_sources_number, config_struct, verbose_flag);
+		config_destroy(config_struct);
+		return done ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	//----------------------------------------------------------------------
+	//	Varrimento de configurações sobre um ficheiro
+
+	if (option_sweep_filename != NULL) {
+		if (option_input_filename == NULL) {
+			fprintf(stderr, "Sweep requires an input file (-i)\n");
+			exit(EXIT_FAILURE);
+		}
+		bool done = sweep_run(option_sweep_filename, verbose_flag);
+		config_destroy(config_struct);
+		return done ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	//----------------------------------------------------------------------
+	//	Resultados de um processamento anterior do mesmo ficheiro
+
+	bool result_cache = option_input_filename != NULL && config_struct->result_cache_enable
+		&& result_cache_begin(config_struct, option_input_filename, output_get_filepath());
+	if (result_cache && result_cache_lookup()) {
+		if (verbose_flag) {
+			Result_cache_statistics statistics;
+			result_cache_statistics(&statistics);
+			printf("Result cache: hit, %llu hits, %llu misses, hash %.1f MB in %.2f s\n",
+				(unsigned long long)statistics.hits, (unsigned long long)statistics.misses,
+				statistics.input_bytes / 1e6, statistics.hash_time);
+		}
+		result_cache_end();
+		config_destroy(config_struct);
+		return EXIT_SUCCESS;
+	}
+
 	//----------------------------------------------------------------------
 	//	Inicializações
 
+	Weighting weighting;
+	if (!weighting_parse(config_struct->weighting, &weighting)) {
+		fprintf(stderr, "Unknown weighting \"%s\" (A or Z)\n", config_struct->weighting);
+		exit(EXIT_FAILURE);
+	}
 	Timeweight *twfilter = timeweight_create();
 	Afilter *afilter = aweighting_create(3);
 
@@ -271,6 +409,7 @@ int main (int argc, char *argv[])
 		float average_sum = 0;
 		unsigned average_n = 0;
 		printf("\nCalibrating for %d seconds\n",config_struct->calibration_time);
+		config_struct->calibration_delta = 0;	// LAE medido sem calibração
 		while (milisecs < calibration_milisecs) {
 			size_t lenght_read = input_device_read(block_a, config_struct->block_size);
 			if (lenght_read == 0)
@@ -279,7 +418,7 @@ int main (int argc, char *argv[])
 			float *block_ring_b = sbuffer_write_ptr(ring_b);
 			assert(lenght_read <= sbuffer_write_size(ring_b));	// Há sempre um bloco disponível
 
-			aweighting_filtering(afilter, block_a, block_ring_b, lenght_read);
+			weighting_filtering(afilter, weighting, block_a, block_ring_b, lenght_read);
 			sbuffer_write_produces(ring_b, lenght_read);
 			process_block_square(block_ring_b, block_c, lenght_read);
 			sbuffer_read_consumes(ring_b, lenght_read);
@@ -291,7 +430,7 @@ int main (int argc, char *argv[])
 			sbuffer_write_produces(ring_d, lenght_read);
 
 			if (sbuffer_size(ring_d) >= config_struct->segment_size) {
-				process_segment_levels(levels, ring_d, 0);
+				process_segment_levels(levels, ring_d, config_struct);
 				if (milisecs < CONFIG_CALIBRATION_GUARD * 1000) {
 					if (verbose_flag)
 						puts("-");
@@ -320,18 +459,83 @@ int main (int argc, char *argv[])
 
 	//----------------------------------------------------------------------
 	//	Operação
+
+	//	Antes da saída, do servidor e de MQTT, que formatam os registos com a direção
+	Direction *direction = NULL;
+	if (config_struct->direction_enable) {
+		direction = direction_create(config_struct->channels, config_struct->block_size,
+				config_struct->sample_rate, config_struct->direction_radius);
+		if (direction == NULL) {
+			fprintf(stderr, "Direction requires at least 2 channels and a power of 2 block size\n");
+			config_struct->direction_enable = false;
+		}
+	}
+
 	server_init();
 
+	if (config_struct->shm_enable)
+		if (!shm_levels_begin(config_struct))
+			exit(EXIT_FAILURE);
+
+	if (config_struct->shm_pcm_enable)
+		if (!shm_pcm_begin(config_struct))
+			exit(EXIT_FAILURE);
+
 	if (config_struct->mqtt_enable)
 		mqtt_begin();
 
 	bool continuous = option_input_filename == NULL;
 
+	//	Os níveis guardados sem calibração: regista a calibração em vigor
+	if (continuous && config_struct->level_raw) {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		if (!calibration_table_update(config_struct->calibration_table,
+				now.tv_sec * 1000LL + now.tv_nsec / 1000000,
+				config_struct->calibration_delta, config_struct->calibration_reference))
+			exit(EXIT_FAILURE);
+	}
+
+	//	Antes da saída: recebe os ficheiros que a saída fecha
+	if (continuous && config_struct->level_archive_enable)
+		if (!level_archive_begin(config_struct))
+			exit(EXIT_FAILURE);
+
 	output_open(continuous);
 
 	if (!input_device_open(config_struct))
 		exit(EXIT_FAILURE);
 
+	if (continuous && config_struct->event_enable)
+		if (!event_begin(config_struct))
+			exit(EXIT_FAILURE);
+
+	if (continuous && config_struct->archive_enable)
+		if (!archive_begin(config_struct))
+			exit(EXIT_FAILURE);
+
+	if (continuous && config_struct->level_db_enable)
+		if (!level_db_begin(config_struct))
+			exit(EXIT_FAILURE);
+
+	Spectrum *spectrum = NULL;
+	if (config_struct->spectrum_enable) {
+		spectrum = spectrum_create(config_struct->spectrum_size, config_struct->block_size);
+		if (spectrum == NULL)
+			exit(EXIT_FAILURE);
+		spectrum_file_open(spectrum, output_get_filepath(), config_struct);
+	}
+
+	//	Registo enviado ao servidor, com os níveis por canal e por banda do protocolo binário
+	Server_record record = {
+		.channels = config_struct->channels < SERVER_CHANNELS_MAX ? config_struct->channels : SERVER_CHANNELS_MAX,
+		.bands = spectrum == NULL ? 0 : spectrum_octave_bands(config_struct->sample_rate)
+	};
+	if (record.bands > SERVER_BANDS_MAX)
+		record.bands = SERVER_BANDS_MAX;
+	double channel_energy[SERVER_CHANNELS_MAX] = {0};
+	unsigned channel_frames = 0;
+
 	if (verbose_flag)
 		printf("\nStarting sound level measuring...\n");
 
@@ -350,19 +554,37 @@ int main (int argc, char *argv[])
 	lae_average_create(config_struct->laeq_time);
 
 	if (verbose_flag)
-		printf("LAeq, LAFmin, LAE, LAFmax, LApeak\n");
+		printf("LAeq, LAFmin, LAE, LAFmax, LApeak%s\n",
+			config_struct->direction_enable ? ", Direction" : "");
 
 	unsigned time_elapsed = 0;	// Tempo que passou baseado na duração do segmento (milisegundos)
 	run_duration *= 1000; 		// Converter para milisegundos
 	while (running && (run_duration == 0 || time_elapsed < run_duration)) {
-		size_t lenght_read = input_device_read(block_a, config_struct->block_size);
+		//	Em mono as amostras Z são lidas diretamente para o buffer do espectro
+		float *block_z = block_a;
+		if (spectrum != NULL && config_struct->channels == 1)
+			block_z = spectrum_write_ptr(spectrum);
+
+		size_t lenght_read = input_device_read(block_z, config_struct->block_size);
 		if (lenght_read == 0)
 			break;
 
+		process_block_channels(channel_energy, block_z, lenght_read, record.channels);
+		channel_frames += lenght_read;
+
+		if (spectrum != NULL)
+			spectrum_write_produces(spectrum, block_z, lenght_read);
+
+		if (direction != NULL)
+			direction_block(direction, block_a, lenght_read);
+
 		float *block_ring_b = sbuffer_write_ptr(ring_b);
 		assert(lenght_read <= sbuffer_write_size(ring_b));
 
-		aweighting_filtering(afilter, block_a, block_ring_b, lenght_read);
+		weighting_filtering(afilter, weighting, block_z, block_ring_b, lenght_read);
+
+		shm_pcm_append(SHM_PCM_AWEIGHTED, block_ring_b, lenght_read);
+		shm_pcm_notify();
 
 		sbuffer_write_produces(ring_b, lenght_read);
 
@@ -377,46 +599,86 @@ int main (int argc, char *argv[])
 		sbuffer_write_produces(ring_d, lenght_read);
 
 		if (!continuous) {
-			audit_append_samples(wa, block_a, lenght_read);
+			audit_append_samples(wa, block_z, lenght_read);
 			audit_append_samples(wb, block_ring_b, lenght_read);
 			audit_append_samples(wc, block_c, lenght_read);
 			audit_append_samples(wd, block_ring_d, lenght_read);
 		}
 
 		if (sbuffer_size(ring_d) >= config_struct->segment_size) {
+			process_segment_direction(levels, direction, config_struct);
 			process_segment_levels(levels, ring_d, config_struct);
 			time_elapsed += config_struct->segment_duration;
 
 			int segment_index = levels->segment_number - 1;
 
-			server_send((uint64_t)time(NULL), levels->LAeq[segment_index],
-					levels->LAFmin[segment_index],
-					levels->LAE[segment_index],
-					levels->LAFmax[segment_index],
-					levels->LApeak[segment_index]);
+			if (spectrum != NULL) {
+				spectrum_segment(spectrum, config_struct);
+				memcpy(record.band_levels, spectrum_octave_levels(spectrum),
+					record.bands * sizeof *record.band_levels);
+				memcpy(levels->band_levels + segment_index * levels->bands, spectrum_octave_levels(spectrum),
+					levels->bands * sizeof *levels->band_levels);
+			}
+			process_segment_channels(record.channel_levels, channel_energy, channel_frames,
+					record.channels, config_struct);
+			channel_frames = 0;
+
+			record.ts = (uint64_t)time(NULL);
+			record.laeq = levels->LAeq[segment_index];
+			record.lafmin = levels->LAFmin[segment_index];
+			record.lae = levels->LAE[segment_index];
+			record.lafmax = levels->LAFmax[segment_index];
+			record.lapeak = levels->LApeak[segment_index];
+			record.direction = levels->direction[segment_index];
+			server_send(&record);
+			shm_levels_publish(&record);
+
+			if (continuous && config_struct->level_db_enable) {
+				struct timespec now;
+				clock_gettime(CLOCK_REALTIME, &now);
+				float delta = config_struct->level_raw ? config_struct->calibration_delta : 0;
+				Level_db_record level_db_record = {
+					.ts = now.tv_sec * 1000LL + now.tv_nsec / 1000000 - config_struct->segment_duration,
+					.duration = config_struct->segment_duration,
+					.lae = levels->LAE[segment_index] - delta,
+					.lafmin = levels->LAFmin[segment_index] - delta,
+					.lafmax = levels->LAFmax[segment_index] - delta,
+					.lapeak = levels->LApeak[segment_index] - delta,
+				};
+				level_db_append(&level_db_record);
+			}
 
 			if (config_struct->mqtt_enable)
 				mqtt_publish(levels, levels->segment_number - 1);
+
+			event_segment(levels, segment_index, config_struct);
 			if (verbose_flag) {
-				printf("\r%6.1f%6.1f%6.1f%6.1f%6.1f\n",
+				printf("\r%6.1f%6.1f%6.1f%6.1f%6.1f",
 					levels->LAeq[segment_index],
 					levels->LAFmin[segment_index],
 					levels->LAE[segment_index],
 					levels->LAFmax[segment_index],
 					levels->LApeak[segment_index]);
+				if (config_struct->direction_enable)
+					printf("%6d", levels->direction[segment_index]);
+				putchar('\n');
 			}
 		}
 
-		if (levels->segment_number == config_struct->record_period) {
-			output_record(levels);
-			levels->segment_number = 0;
-		}
+		if (levels->segment_number == config_struct->record_period)
+			levels = output_record(levels);
+
+		//	O ficheiro de espectro muda com o ficheiro de saída
+		if (spectrum != NULL && spectrum_file_segments(spectrum) >= config_struct->file_period)
+			spectrum_file_open(spectrum, output_get_filepath(), config_struct);
 	}
+	//	Terminou no fim do ficheiro de entrada, e não por sinal ou por run_duration
+	bool input_end = running && (run_duration == 0 || time_elapsed < run_duration);
 	running = false;
 	if (verbose_flag)
 		printf("\nTotal time: %d seconds\n", time_elapsed / 1000);
 
-	output_record(levels);
+	levels = output_record(levels);
 
 	if (verbose_flag)
 		printf("Saving configuration in " CONFIG_CONFIG_FILEPATH CONFIG_CONFIG_FILENAME "\n");
@@ -428,11 +690,99 @@ int main (int argc, char *argv[])
 		audit_destroy(wc);
 		audit_destroy(wd);
 	}
+	event_end();
+	archive_end();
+	if (verbose_flag && continuous && config_struct->archive_enable) {
+		const Archive_statistics *statistics = archive_statistics();
+		double duration = (double)statistics->frames / config_struct->sample_rate;
+		printf("Archive: %u files, %.1f seconds, compression ratio %.2f, CPU %.2f%%, lost %.1f seconds\n",
+			statistics->files, duration,
+			statistics->compressed_bytes > 0 ? (double)statistics->raw_bytes / statistics->compressed_bytes : 0,
+			duration > 0 ? statistics->cpu_time / duration * 100 : 0,
+			(double)statistics->lost / config_struct->sample_rate);
+	}
+	shm_pcm_end();
+	shm_levels_end();
 	server_end();
-	if (config_struct->mqtt_enable)
+	if (verbose_flag) {
+		Server_statistics statistics;
+		server_statistics(&statistics);
+		if (statistics.records_dropped + statistics.messages_dropped > 0)
+			printf("Server: %llu records dropped, %llu messages dropped to slow clients, %llu clients disconnected\n",
+				(unsigned long long)statistics.records_dropped,
+				(unsigned long long)statistics.messages_dropped,
+				(unsigned long long)statistics.clients_disconnected);
+	}
+	if (config_struct->mqtt_enable) {
 		mqtt_end();
+		if (verbose_flag) {
+			Mqtt_statistics statistics;
+			mqtt_statistics(&statistics);
+			printf("MQTT: %llu records in %llu messages, %llu dropped, %llu failed, queue max %u\n",
+				(unsigned long long)statistics.records, (unsigned long long)statistics.messages,
+				(unsigned long long)statistics.dropped, (unsigned long long)statistics.failed,
+				statistics.queue_max);
+			if (config_struct->mqtt_deadband > 0 && statistics.segments > 0)
+				printf("MQTT by exception: %llu of %llu segments suppressed, "
+					"messages %.1f%%, bytes %.1f%% of one message per segment\n",
+					(unsigned long long)statistics.suppressed,
+					(unsigned long long)statistics.segments,
+					100.0 * statistics.messages / statistics.segments,
+					statistics.segment_bytes > 0 ? 100.0 * statistics.bytes / statistics.segment_bytes : 0);
+			if (config_struct->mqtt_spool_enable)
+				printf("MQTT spool: %llu records stored, %llu pending, %u reconnects\n",
+					(unsigned long long)statistics.spooled,
+					(unsigned long long)statistics.spool_pending, statistics.reconnects);
+		}
+	}
 	input_device_close();
 	output_close();
+	if (verbose_flag) {
+		Output_statistics statistics;
+		output_statistics(&statistics);
+		printf("Output: %llu records, latency mean %.1f ms max %.1f ms, fsync mean %.1f ms max %.1f ms, %llu stalls\n",
+			(unsigned long long)statistics.records,
+			statistics.jobs > 0 ? statistics.latency / statistics.jobs * 1000 : 0,
+			statistics.latency_max * 1000,
+			statistics.syncs > 0 ? statistics.sync_time / statistics.syncs * 1000 : 0,
+			statistics.sync_time_max * 1000,
+			(unsigned long long)statistics.stalls);
+	}
+	level_archive_end();
+	if (verbose_flag && continuous && config_struct->level_archive_enable) {
+		const Level_archive_statistics *statistics = level_archive_statistics();
+		printf("Level archive: %u files, %llu segments, compression ratio %.1f, CPU %.3f s, %u errors\n",
+			statistics->files, (unsigned long long)statistics->segments,
+			statistics->archive_bytes > 0 ? (double)statistics->input_bytes / statistics->archive_bytes : 0,
+			statistics->cpu_time, statistics->errors);
+	}
+	level_db_end();
+	if (verbose_flag && continuous && config_struct->level_db_enable) {
+		Level_db_statistics statistics;
+		level_db_statistics(&statistics);
+		printf("Level database: %llu records, %llu summaries, %llu dropped\n",
+			(unsigned long long)statistics.records, (unsigned long long)statistics.summaries,
+			(unsigned long long)statistics.dropped);
+	}
+	if (spectrum != NULL)
+		spectrum_destroy(spectrum);
+	if (result_cache) {
+		//	Com mudança de ficheiro de saída o primeiro não tem todos os níveis
+		Output_statistics output;
+		output_statistics(&output);
+		if (input_end && output.files == 1)
+			result_cache_store();
+		if (verbose_flag) {
+			Result_cache_statistics statistics;
+			result_cache_statistics(&statistics);
+			printf("Result cache: miss, %llu hits, %llu misses, hash %.1f MB in %.2f s\n",
+				(unsigned long long)statistics.hits, (unsigned long long)statistics.misses,
+				statistics.input_bytes / 1e6, statistics.hash_time);
+		}
+		result_cache_end();
+	}
+	if (direction != NULL)
+		direction_destroy(direction);
 	levels_destroy(levels);
 	timeweight_destroy(twfilter);
 	aweighting_destroy(afilter);
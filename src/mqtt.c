@@ -18,28 +18,63 @@ limitations under the License.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <semaphore.h>
 #include "MQTTClient.h"
 
 #include "config.h"
 #include "mqtt.h"
+#include "mqtt_spool.h"
 
 static MQTTClient client;
+static bool connected;		// só acedido pela tarefa depois de mqtt_begin
+static bool spool_open;
 
-bool mqtt_begin() {
-    MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
-    int rc;
+//	Fila de registos para a tarefa de publicação
+static Mqtt_record queue[MQTT_QUEUE_SIZE];
+static atomic_uint queue_put;
+static atomic_uint queue_get;
+static sem_t queue_semaphore;
+static atomic_bool publisher_running;
+static bool publisher_started;
+static thrd_t publisher_thread;
 
-    if ((rc = MQTTClient_create(&client,
-        config_struct->mqtt_broker, config_struct->identification,
-        MQTTCLIENT_PERSISTENCE_NONE, NULL)) != MQTTCLIENT_SUCCESS) {
-         fprintf(stderr, "Failed to create MQTT client, return code %d\n", rc);
-         return false;
-    }
+static atomic_uint_least64_t records_published;
+static atomic_uint_least64_t messages_published;
+static atomic_uint_least64_t records_dropped;
+static atomic_uint_least64_t records_failed;
+static atomic_uint_least64_t records_spooled;
+static atomic_uint_least64_t spool_pending;
+static atomic_uint reconnects;
+static atomic_uint queue_max;
+static atomic_uint_least64_t segments_received;
+static atomic_uint_least64_t segments_suppressed;
+static atomic_uint_least64_t bytes_published;
+static atomic_uint_least64_t segment_bytes;
 
+//	Publicação por exceção - só acedido por mqtt_publish
+static Mqtt_record last_published;
+static Mqtt_record held;	// registo com os extremos dos segmentos omitidos
+static unsigned held_segments;
+static bool published_any;
+
+//	Modo gateway
+static const char *const *gateway_devices;
+static unsigned gateway_count;
+
+static int publisher_thread_func(void *not_used);
+
+static bool mqtt_connect()
+{
+    MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
 	conn_opts.username = config_struct->mqtt_device_credential;
 	conn_opts.password = config_struct->mqtt_device_credential;
     conn_opts.keepAliveInterval = 20;
     conn_opts.cleansession = 1;
+    int rc;
     if ((rc = MQTTClient_connect(client, &conn_opts)) != MQTTCLIENT_SUCCESS) {
         fprintf(stderr, "Failed to connect MQTT, return code %d\n", rc);
         return false;
@@ -47,30 +82,225 @@ bool mqtt_begin() {
     return true;
 }
 
+bool mqtt_begin() {
+    int rc;
+
+    if ((rc = MQTTClient_create(&client,
+        config_struct->mqtt_broker, config_struct->identification,
+        MQTTCLIENT_PERSISTENCE_NONE, NULL)) != MQTTCLIENT_SUCCESS) {
+         fprintf(stderr, "Failed to create MQTT client, return code %d\n", rc);
+         return false;
+    }
+
+	atomic_init(&queue_put, 0);
+	atomic_init(&queue_get, 0);
+	atomic_init(&publisher_running, true);
+	atomic_init(&records_published, 0);
+	atomic_init(&messages_published, 0);
+	atomic_init(&records_dropped, 0);
+	atomic_init(&records_failed, 0);
+	atomic_init(&records_spooled, 0);
+	atomic_init(&spool_pending, 0);
+	atomic_init(&reconnects, 0);
+	atomic_init(&queue_max, 0);
+	atomic_init(&segments_received, 0);
+	atomic_init(&segments_suppressed, 0);
+	atomic_init(&bytes_published, 0);
+	atomic_init(&segment_bytes, 0);
+	held_segments = 0;
+	published_any = false;
+
+	spool_open = false;
+	if (config_struct->mqtt_spool_enable && gateway_devices == NULL) {
+		char filepath[strlen(config_struct->output_path) + strlen(MQTT_SPOOL_FILENAME) + 1];
+		strcpy(filepath, config_struct->output_path);
+		strcat(filepath, MQTT_SPOOL_FILENAME);
+		spool_open = mqtt_spool_open(filepath);
+		atomic_init(&spool_pending, spool_open ? mqtt_spool_pending() : 0);
+	}
+
+	connected = mqtt_connect();
+
+	sem_init(&queue_semaphore, 0, 0);
+	if (thrd_success != thrd_create(&publisher_thread, publisher_thread_func, NULL)) {
+		fprintf(stderr, "Error in \"thrd_create(&publisher_thread, publisher_thread_func, NULL)\"");
+		sem_destroy(&queue_semaphore);
+		if (spool_open)
+			mqtt_spool_close();
+		MQTTClient_destroy(&client);
+		return false;
+	}
+	publisher_started = true;
+	return connected;
+}
+
 #define TIMEOUT     10000L
 
+#define RECORD_SIZE_MAX	200
+
+static int record_format(char *payload, const Mqtt_record *record);
+
+static bool queue_record(const Mqtt_record *record)
+{
+	unsigned put = atomic_load_explicit(&queue_put, memory_order_relaxed);
+	unsigned get = atomic_load_explicit(&queue_get, memory_order_acquire);
+	if (put - get == MQTT_QUEUE_SIZE) {
+		uint64_t dropped = atomic_fetch_add_explicit(&records_dropped, 1, memory_order_relaxed) + 1;
+		if ((dropped & (dropped - 1)) == 0)
+			fprintf(stderr, "MQTT: queue full, %llu records dropped\n", (unsigned long long)dropped);
+		return false;
+	}
+	queue[put % MQTT_QUEUE_SIZE] = *record;
+	atomic_store_explicit(&queue_put, put + 1, memory_order_release);
+	if (put + 1 - get > atomic_load_explicit(&queue_max, memory_order_relaxed))
+		atomic_store_explicit(&queue_max, put + 1 - get, memory_order_relaxed);
+	sem_post(&queue_semaphore);
+	return true;
+}
+
+static inline bool outside_deadband(float value, float reference)
+{
+	return fabsf(value - reference) > config_struct->mqtt_deadband
+		|| isinf(value) != isinf(reference);
+}
+
+/*
+ * Publicação por exceção: o segmento é omitido se os níveis não se
+ * afastaram dos últimos publicados e o heartbeat não expirou.
+ */
+static bool record_suppress(const Mqtt_record *record)
+{
+	if (config_struct->mqtt_deadband <= 0 || !published_any)
+		return false;
+	if (record->ts - last_published.ts >= (uint64_t)config_struct->mqtt_heartbeat * 1000)
+		return false;
+	return !outside_deadband(record->LAeq, last_published.LAeq)
+		&& !outside_deadband(record->LAFmin, last_published.LAFmin)
+		&& !outside_deadband(record->LAFmax, last_published.LAFmax)
+		&& !outside_deadband(record->LApeak, last_published.LApeak);
+}
+
 bool mqtt_publish(Levels *levels, int segment_number) {
-	char payload[120];
-    unsigned long long ts = (uint64_t)time(NULL) * 1000;
-	sprintf(payload, "{\"ts\": %lld, \"values\": "
-		"{\"LAeq\": %.1f, \"LAFmin\": %.1f, \"LAE\": %.1f, \"LAFmax\": %.1f, \"LApeak\": %.1f } }",
-        ts,
-        levels->LAeq[segment_number],
-        levels->LAFmin[segment_number],
-        levels->LAE[segment_number],
-        levels->LAFmax[segment_number],
-        levels->LApeak[segment_number]);
+	if (!publisher_started)
+		return false;
+	Mqtt_record record;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	record.ts = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	record.LAeq = levels->LAeq[segment_number];
+	record.LAFmin = levels->LAFmin[segment_number];
+	record.LAE = levels->LAE[segment_number];
+	record.LAFmax = levels->LAFmax[segment_number];
+	record.LApeak = levels->LApeak[segment_number];
+	record.direction = levels->direction[segment_number];
+
+	//	Custo da publicação de uma mensagem por segmento, para comparação
+	char payload[RECORD_SIZE_MAX];
+	atomic_fetch_add_explicit(&segments_received, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&segment_bytes, record_format(payload, &record), memory_order_relaxed);
+
+	bool suppress = record_suppress(&record);
+	if (held_segments > 0) {
+		record.LAFmin = fminf(record.LAFmin, held.LAFmin);
+		record.LAFmax = fmaxf(record.LAFmax, held.LAFmax);
+		record.LApeak = fmaxf(record.LApeak, held.LApeak);
+	}
+	if (suppress) {
+		held = record;
+		held_segments++;
+		atomic_fetch_add_explicit(&segments_suppressed, 1, memory_order_relaxed);
+		return true;
+	}
+	//	A comparação seguinte é feita com os níveis do segmento
+	last_published.ts = record.ts;
+	last_published.LAeq = levels->LAeq[segment_number];
+	last_published.LAFmin = levels->LAFmin[segment_number];
+	last_published.LAFmax = levels->LAFmax[segment_number];
+	last_published.LApeak = levels->LApeak[segment_number];
+	published_any = true;
+	held_segments = 0;
+	return queue_record(&record);
+}
+
+void mqtt_gateway(const char *const *devices, unsigned count)
+{
+	gateway_devices = devices;
+	gateway_count = count;
+}
+
+bool mqtt_publish_record(const Mqtt_record *record)
+{
+	if (!publisher_started || record->device >= gateway_count)
+		return false;
+	atomic_fetch_add_explicit(&segments_received, 1, memory_order_relaxed);
+	return queue_record(record);
+}
+
+static int record_format(char *payload, const Mqtt_record *record)
+{
+	int length = sprintf(payload, "{\"ts\": %llu, \"values\": "
+		"{\"LAeq\": %.1f, \"LAFmin\": %.1f, \"LAE\": %.1f, \"LAFmax\": %.1f, \"LApeak\": %.1f",
+		(unsigned long long)record->ts,
+		record->LAeq, record->LAFmin, record->LAE, record->LAFmax, record->LApeak);
+	if (config_struct->direction_enable)
+		length += sprintf(payload + length, ", \"direction\": %d", record->direction);
+	strcpy(payload + length, " } }");
+	return length + strlen(" } }");
+}
+
+/*
+ * Publica nrecords registos numa mensagem.
+ * Um único registo é publicado como objeto, vários como array.
+ */
+static bool publish_records(const Mqtt_record *records, unsigned nrecords)
+{
+	static char payload[MQTT_BATCH_MAX * (RECORD_SIZE_MAX + MQTT_GATEWAY_NAME_MAX + 8) + 2];
+	int length = 0;
+	if (gateway_devices != NULL) {
+		//	Os registos de cada dispositivo num array, pela ordem de chegada
+		bool done[MQTT_BATCH_MAX] = {false};
+		payload[length++] = '{';
+		for (unsigned i = 0; i < nrecords; i++) {
+			if (done[i])
+				continue;
+			unsigned device = records[i].device;
+			length += sprintf(payload + length, "%s\"%s\": [", length > 1 ? ", " : "",
+					gateway_devices[device]);
+			for (unsigned j = i; j < nrecords; j++)
+				if (records[j].device == device) {
+					if (j > i)
+						payload[length++] = ',';
+					length += record_format(payload + length, &records[j]);
+					done[j] = true;
+				}
+			payload[length++] = ']';
+		}
+		payload[length++] = '}';
+	}
+	else {
+		if (nrecords > 1)
+			payload[length++] = '[';
+		for (unsigned i = 0; i < nrecords; i++) {
+			if (i > 0)
+				payload[length++] = ',';
+			length += record_format(payload + length, &records[i]);
+		}
+		if (nrecords > 1)
+			payload[length++] = ']';
+	}
+	payload[length] = '\0';
 
 //    fprintf(stderr, "%s\n", payload);
     MQTTClient_message pubmsg = MQTTClient_message_initializer;
     MQTTClient_deliveryToken token;
     pubmsg.payload = payload;
-    pubmsg.payloadlen = strlen(payload);
+    pubmsg.payloadlen = length;
     pubmsg.qos = config_struct->mqtt_qos;
     pubmsg.retained = 0;
     int rc;
     if ((rc = MQTTClient_publishMessage(client,
-        config_struct->mqtt_topic, &pubmsg, &token)) != MQTTCLIENT_SUCCESS) {
+        gateway_devices != NULL ? MQTT_GATEWAY_TOPIC : config_struct->mqtt_topic,
+        &pubmsg, &token)) != MQTTCLIENT_SUCCESS) {
          fprintf(stderr, "Failed to publish MQTT message, return code %d\n", rc);
          return false;
     }
@@ -81,13 +311,178 @@ bool mqtt_publish(Levels *levels, int segment_number) {
     rc = MQTTClient_waitForCompletion(client, token, TIMEOUT);
     printf("Message with delivery token %d delivered\n", token);
 */
-    return true;
+	atomic_fetch_add_explicit(&records_published, nrecords, memory_order_relaxed);
+	atomic_fetch_add_explicit(&messages_published, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&bytes_published, length, memory_order_relaxed);
+	return true;
+}
+
+/*
+ * Registos que não puderam ser publicados: guardados em ficheiro
+ * ou perdidos.
+ */
+static void records_not_published(const Mqtt_record *records, unsigned nrecords)
+{
+	if (spool_open && mqtt_spool_append(records, nrecords)) {
+		atomic_fetch_add_explicit(&records_spooled, nrecords, memory_order_relaxed);
+		atomic_store_explicit(&spool_pending, mqtt_spool_pending(), memory_order_relaxed);
+	}
+	else {
+		atomic_fetch_add_explicit(&records_failed, nrecords, memory_order_relaxed);
+	}
+}
+
+static uint64_t time_ms()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int publisher_thread_func(void *not_used)
+{
+	unsigned batch_size = config_struct->mqtt_batch_size;
+	if (batch_size < 1)
+		batch_size = 1;
+	if (batch_size > MQTT_BATCH_MAX)
+		batch_size = MQTT_BATCH_MAX;
+
+	unsigned reconnect_interval = MQTT_RECONNECT_MIN * 1000;
+	uint64_t reconnect_time = time_ms() + reconnect_interval;
+
+	//	Balde de créditos para o envio dos registos guardados
+	unsigned spool_rate = config_struct->mqtt_spool_rate > 0 ? config_struct->mqtt_spool_rate : 1;
+	double credits_max = spool_rate > MQTT_BATCH_MAX ? spool_rate : MQTT_BATCH_MAX;
+	double credits = credits_max;
+	uint64_t credits_time = time_ms();
+
+	Mqtt_record records[MQTT_BATCH_MAX];
+	while (true) {
+		bool running = atomic_load(&publisher_running);
+		uint64_t now = time_ms();
+
+		if (connected && !MQTTClient_isConnected(client))
+			connected = false;
+		if (!connected && now >= reconnect_time && running) {
+			connected = mqtt_connect();
+			if (connected) {
+				atomic_fetch_add_explicit(&reconnects, 1, memory_order_relaxed);
+				reconnect_interval = MQTT_RECONNECT_MIN * 1000;
+			}
+			else {
+				reconnect_time = time_ms() + reconnect_interval;
+				if (reconnect_interval < MQTT_RECONNECT_MAX * 1000)
+					reconnect_interval *= 2;
+				if (reconnect_interval > MQTT_RECONNECT_MAX * 1000)
+					reconnect_interval = MQTT_RECONNECT_MAX * 1000;
+			}
+			continue;
+		}
+
+		//	Registos recentes
+		unsigned get = atomic_load_explicit(&queue_get, memory_order_relaxed);
+		unsigned depth = atomic_load_explicit(&queue_put, memory_order_acquire) - get;
+		uint64_t deadline = UINT64_MAX;
+		if (depth > 0) {
+			deadline = queue[get % MQTT_QUEUE_SIZE].ts + config_struct->mqtt_batch_latency;
+			if (depth >= batch_size || !running || now >= deadline || (!connected && spool_open)) {
+				unsigned n = depth < batch_size ? depth : batch_size;
+				for (unsigned i = 0; i < n; i++)
+					records[i] = queue[(get + i) % MQTT_QUEUE_SIZE];
+				atomic_store_explicit(&queue_get, get + n, memory_order_release);
+				if (!connected || !publish_records(records, n)) {
+					if (connected) {
+						connected = false;
+						reconnect_time = time_ms() + reconnect_interval;
+					}
+					records_not_published(records, n);
+				}
+				continue;
+			}
+		}
+
+		//	Registos guardados em ficheiro, ao ritmo de mqtt_spool_rate
+		uint64_t credits_deadline = UINT64_MAX;
+		if (connected && spool_open && mqtt_spool_pending() > 0) {
+			credits += (now - credits_time) * spool_rate / 1000.0;
+			if (credits > credits_max)
+				credits = credits_max;
+			credits_time = now;
+			unsigned n = mqtt_spool_pending() < MQTT_BATCH_MAX ? mqtt_spool_pending() : MQTT_BATCH_MAX;
+			if (credits >= n) {
+				n = mqtt_spool_peek(records, n);
+				if (n > 0 && publish_records(records, n)) {
+					mqtt_spool_consume(n);
+					atomic_store_explicit(&spool_pending, mqtt_spool_pending(), memory_order_relaxed);
+					credits -= n;
+				}
+				else {
+					connected = false;
+					reconnect_time = time_ms() + reconnect_interval;
+				}
+				continue;
+			}
+			credits_deadline = now + (uint64_t)((n - credits) * 1000 / spool_rate) + 1;
+		}
+
+		if (!running)
+			break;
+
+		uint64_t wakeup = deadline;
+		if (credits_deadline < wakeup)
+			wakeup = credits_deadline;
+		if (!connected && reconnect_time < wakeup)
+			wakeup = reconnect_time;
+		if (wakeup == UINT64_MAX) {
+			sem_wait(&queue_semaphore);
+		}
+		else {
+			struct timespec timeout = {.tv_sec = wakeup / 1000, .tv_nsec = wakeup % 1000 * 1000000};
+			while (sem_timedwait(&queue_semaphore, &timeout) != 0 && errno == EINTR)
+				;
+		}
+	}
+	return 0;
 }
 
 bool mqtt_end() {
-    int rc;
-    if ((rc = MQTTClient_disconnect(client, 10000)) != MQTTCLIENT_SUCCESS)
+	if (!publisher_started)
+		return false;
+	//	Os extremos dos segmentos omitidos no fim não se perdem
+	if (held_segments > 0) {
+		queue_record(&held);
+		held_segments = 0;
+	}
+	publisher_started = false;
+	atomic_store(&publisher_running, false);
+	sem_post(&queue_semaphore);
+	int result;
+	thrd_join(publisher_thread, &result);
+	sem_destroy(&queue_semaphore);
+	if (spool_open)
+		mqtt_spool_close();
+
+    int rc = MQTTCLIENT_SUCCESS;
+    if (connected && (rc = MQTTClient_disconnect(client, 10000)) != MQTTCLIENT_SUCCESS)
         fprintf(stderr, "Failed to disconnect MQTT, return code %d\n", rc);
     MQTTClient_destroy(&client);
     return rc == MQTTCLIENT_SUCCESS;
-}
\ No newline at end of file
+}
+
+void mqtt_statistics(Mqtt_statistics *statistics)
+{
+	statistics->segments = atomic_load_explicit(&segments_received, memory_order_relaxed);
+	statistics->suppressed = atomic_load_explicit(&segments_suppressed, memory_order_relaxed);
+	statistics->bytes = atomic_load_explicit(&bytes_published, memory_order_relaxed);
+	statistics->segment_bytes = atomic_load_explicit(&segment_bytes, memory_order_relaxed);
+	statistics->records = atomic_load_explicit(&records_published, memory_order_relaxed);
+	statistics->messages = atomic_load_explicit(&messages_published, memory_order_relaxed);
+	statistics->dropped = atomic_load_explicit(&records_dropped, memory_order_relaxed);
+	statistics->failed = atomic_load_explicit(&records_failed, memory_order_relaxed);
+	statistics->spooled = atomic_load_explicit(&records_spooled, memory_order_relaxed);
+	statistics->spool_pending = atomic_load_explicit(&spool_pending, memory_order_relaxed);
+	statistics->reconnects = atomic_load_explicit(&reconnects, memory_order_relaxed);
+	statistics->queue_depth = atomic_load_explicit(&queue_put, memory_order_relaxed)
+		- atomic_load_explicit(&queue_get, memory_order_relaxed);
+	statistics->queue_max = atomic_load_explicit(&queue_max, memory_order_relaxed);
+}
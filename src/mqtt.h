@@ -17,10 +17,87 @@ limitations under the License.
 #ifndef MQTT_H
 #define MQTT_H
 
+#include <stdint.h>
+
 #include "process.h"
 
+/*
+ * A publicação é feita por uma tarefa própria. mqtt_publish deposita
+ * o registo do segmento numa fila lock-free (um produtor, um consumidor)
+ * e retorna imediatamente. A tarefa agrupa até mqtt_batch_size registos
+ * numa mensagem, no formato de ThingsBoard [{"ts": ..., "values": {...}}, ...].
+ * Uma mensagem incompleta é enviada quando o registo mais antigo
+ * espera há mqtt_batch_latency milisegundos.
+ * Com a fila cheia, o registo é descartado.
+ *
+ * Se a ligação ao broker falhar, a tarefa tenta restabelecê-la com
+ * intervalos crescentes, de MQTT_RECONNECT_MIN a MQTT_RECONNECT_MAX
+ * segundos. Com mqtt_spool_enable, os registos não publicados são
+ * guardados em ficheiro (mqtt_spool.h) e, depois de restabelecida
+ * a ligação, são enviados em mensagens de MQTT_BATCH_MAX registos
+ * ao ritmo máximo de mqtt_spool_rate registos por segundo.
+ * Os registos recentes têm prioridade sobre os guardados.
+ *
+ * Com mqtt_deadband > 0, o registo de um segmento só é publicado quando
+ * LAeq, LAFmin, LAFmax ou LApeak se afastam mais de mqtt_deadband dB
+ * dos valores publicados por último, ou quando passaram mqtt_heartbeat
+ * segundos desde a última publicação. O registo publicado leva o mínimo
+ * de LAFmin e os máximos de LAFmax e LApeak dos segmentos omitidos.
+ *
+ * No modo gateway (mqtt_gateway), uma só ligação publica os registos
+ * de vários dispositivos, entregues por mqtt_publish_record, no tópico
+ * MQTT_GATEWAY_TOPIC e no formato de gateway de ThingsBoard
+ * {"<dispositivo>": [{"ts": ..., "values": {...}}, ...], ...}.
+ * Neste modo não há publicação por exceção nem registos em ficheiro.
+ */
+
+#define MQTT_QUEUE_SIZE		256	// registos pendentes (potência de 2)
+#define MQTT_BATCH_MAX		64	// máximo de registos por mensagem
+#define MQTT_RECONNECT_MIN	1	// segundos
+#define MQTT_RECONNECT_MAX	300	// segundos
+#define MQTT_SPOOL_FILENAME	"mqtt_spool"
+#define MQTT_GATEWAY_TOPIC	"v1/gateway/telemetry"
+#define MQTT_GATEWAY_NAME_MAX	64	// dimensão máxima do nome de um dispositivo
+
+typedef struct {
+	uint64_t ts;		// milisegundos, UNIX
+	float LAeq, LAFmin, LAE, LAFmax, LApeak;
+	int direction;
+	unsigned device;	// índice do dispositivo no modo gateway
+} Mqtt_record;
+
+typedef struct {
+	uint64_t segments;	// segmentos recebidos por mqtt_publish
+	uint64_t suppressed;	// segmentos omitidos (mqtt_deadband)
+	uint64_t bytes;		// bytes publicados
+	uint64_t segment_bytes;	// bytes de uma mensagem por segmento
+	uint64_t records;	// registos publicados
+	uint64_t messages;	// mensagens publicadas
+	uint64_t dropped;	// registos descartados com a fila cheia
+	uint64_t failed;	// registos perdidos por erro de publicação
+	uint64_t spooled;	// registos guardados em ficheiro
+	uint64_t spool_pending;	// registos em ficheiro por enviar
+	unsigned reconnects;	// ligações restabelecidas
+	unsigned queue_depth;	// registos na fila
+	unsigned queue_max;	// máximo de registos na fila
+} Mqtt_statistics;
+
 bool mqtt_begin();
 bool mqtt_publish(Levels *levels, int sgment_number);
 bool mqtt_end();
 
+/**
+ * @brief Passa ao modo gateway, com os dispositivos devices; antes de mqtt_begin.
+ * Os nomes têm de permanecer válidos até mqtt_end.
+ */
+void mqtt_gateway(const char *const *devices, unsigned count);
+
+/**
+ * @brief Publica, no modo gateway, o registo de um segmento do dispositivo
+ * record->device. Não bloqueia.
+ */
+bool mqtt_publish_record(const Mqtt_record *record);
+
+void mqtt_statistics(Mqtt_statistics *statistics);
+
 #endif
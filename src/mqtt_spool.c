@@ -0,0 +1,195 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mqtt_spool.h"
+
+static int spool_fd = -1;
+static uint64_t spool_sent;	// registos enviados
+static uint64_t spool_total;	// registos no ficheiro
+
+static void put_uint32(uint8_t *bytes, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		bytes[i] = value >> (8 * i);
+}
+
+static uint32_t get_uint32(const uint8_t *bytes)
+{
+	return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static void put_uint64(uint8_t *bytes, uint64_t value)
+{
+	put_uint32(bytes, value);
+	put_uint32(bytes + 4, value >> 32);
+}
+
+static uint64_t get_uint64(const uint8_t *bytes)
+{
+	return get_uint32(bytes) | (uint64_t)get_uint32(bytes + 4) << 32;
+}
+
+static void put_float(uint8_t *bytes, float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof bits);
+	put_uint32(bytes, bits);
+}
+
+static float get_float(const uint8_t *bytes)
+{
+	uint32_t bits = get_uint32(bytes);
+	float value;
+	memcpy(&value, &bits, sizeof value);
+	return value;
+}
+
+static bool header_write()
+{
+	uint8_t header[MQTT_SPOOL_HEADER_SIZE];
+	memcpy(header, MQTT_SPOOL_MAGIC, 4);
+	put_uint32(header + 4, MQTT_SPOOL_RECORD_SIZE);
+	put_uint64(header + 8, spool_sent);
+	if (pwrite(spool_fd, header, sizeof header, 0) != sizeof header) {
+		fprintf(stderr, "MQTT spool: write error: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+bool mqtt_spool_open(const char *filepath)
+{
+	spool_fd = open(filepath, O_RDWR | O_CREAT, 0644);
+	if (spool_fd < 0) {
+		fprintf(stderr, "open(%s) error: %s\n", filepath, strerror(errno));
+		return false;
+	}
+	uint8_t header[MQTT_SPOOL_HEADER_SIZE];
+	off_t size = lseek(spool_fd, 0, SEEK_END);
+	if (size >= MQTT_SPOOL_HEADER_SIZE
+			&& pread(spool_fd, header, sizeof header, 0) == sizeof header
+			&& memcmp(header, MQTT_SPOOL_MAGIC, 4) == 0
+			&& get_uint32(header + 4) == MQTT_SPOOL_RECORD_SIZE) {
+		//	Um registo incompleto no fim resulta de uma interrupção da escrita
+		spool_total = (size - MQTT_SPOOL_HEADER_SIZE) / MQTT_SPOOL_RECORD_SIZE;
+		spool_sent = get_uint64(header + 8);
+		if (spool_sent > spool_total)
+			spool_sent = spool_total;
+	}
+	else {
+		if (size > 0)
+			fprintf(stderr, "MQTT spool: %s is not a spool file, discarded\n", filepath);
+		spool_total = spool_sent = 0;
+	}
+	if (spool_sent == spool_total)
+		spool_total = spool_sent = 0;
+	if (ftruncate(spool_fd, MQTT_SPOOL_HEADER_SIZE + spool_total * MQTT_SPOOL_RECORD_SIZE) != 0
+			|| !header_write()) {
+		close(spool_fd);
+		spool_fd = -1;
+		return false;
+	}
+	return true;
+}
+
+void mqtt_spool_close()
+{
+	if (spool_fd < 0)
+		return;
+	fdatasync(spool_fd);
+	close(spool_fd);
+	spool_fd = -1;
+}
+
+bool mqtt_spool_append(const Mqtt_record *records, unsigned nrecords)
+{
+	if (spool_fd < 0)
+		return false;
+	uint8_t buffer[MQTT_BATCH_MAX * MQTT_SPOOL_RECORD_SIZE];
+	while (nrecords > 0) {
+		unsigned n = nrecords < MQTT_BATCH_MAX ? nrecords : MQTT_BATCH_MAX;
+		for (unsigned i = 0; i < n; i++) {
+			uint8_t *bytes = buffer + i * MQTT_SPOOL_RECORD_SIZE;
+			put_uint64(bytes, records[i].ts);
+			put_float(bytes + 8, records[i].LAeq);
+			put_float(bytes + 12, records[i].LAFmin);
+			put_float(bytes + 16, records[i].LAE);
+			put_float(bytes + 20, records[i].LAFmax);
+			put_float(bytes + 24, records[i].LApeak);
+			put_uint32(bytes + 28, records[i].direction);
+		}
+		size_t size = n * MQTT_SPOOL_RECORD_SIZE;
+		if (pwrite(spool_fd, buffer, size,
+				MQTT_SPOOL_HEADER_SIZE + spool_total * MQTT_SPOOL_RECORD_SIZE) != (ssize_t)size) {
+			fprintf(stderr, "MQTT spool: write error: %s\n", strerror(errno));
+			return false;
+		}
+		spool_total += n;
+		records += n;
+		nrecords -= n;
+	}
+	fdatasync(spool_fd);
+	return true;
+}
+
+uint64_t mqtt_spool_pending()
+{
+	return spool_total - spool_sent;
+}
+
+unsigned mqtt_spool_peek(Mqtt_record *records, unsigned nrecords)
+{
+	if (nrecords > MQTT_BATCH_MAX)
+		nrecords = MQTT_BATCH_MAX;
+	if (nrecords > spool_total - spool_sent)
+		nrecords = spool_total - spool_sent;
+	uint8_t buffer[MQTT_BATCH_MAX * MQTT_SPOOL_RECORD_SIZE];
+	size_t size = nrecords * MQTT_SPOOL_RECORD_SIZE;
+	if (pread(spool_fd, buffer, size,
+			MQTT_SPOOL_HEADER_SIZE + spool_sent * MQTT_SPOOL_RECORD_SIZE) != (ssize_t)size) {
+		fprintf(stderr, "MQTT spool: read error: %s\n", strerror(errno));
+		return 0;
+	}
+	for (unsigned i = 0; i < nrecords; i++) {
+		const uint8_t *bytes = buffer + i * MQTT_SPOOL_RECORD_SIZE;
+		records[i].ts = get_uint64(bytes);
+		records[i].LAeq = get_float(bytes + 8);
+		records[i].LAFmin = get_float(bytes + 12);
+		records[i].LAE = get_float(bytes + 16);
+		records[i].LAFmax = get_float(bytes + 20);
+		records[i].LApeak = get_float(bytes + 24);
+		records[i].direction = (int32_t)get_uint32(bytes + 28);
+	}
+	return nrecords;
+}
+
+void mqtt_spool_consume(unsigned nrecords)
+{
+	spool_sent += nrecords;
+	if (spool_sent >= spool_total) {
+		spool_sent = spool_total = 0;
+		if (ftruncate(spool_fd, MQTT_SPOOL_HEADER_SIZE) != 0)
+			fprintf(stderr, "MQTT spool: truncate error: %s\n", strerror(errno));
+	}
+	header_write();
+	fdatasync(spool_fd);
+}
@@ -0,0 +1,75 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef MQTT_SPOOL_H
+#define MQTT_SPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mqtt.h"
+
+/*
+ * Registos MQTT por enviar, guardados em ficheiro.
+ *
+ * Os registos são acrescentados ao fim do ficheiro. O cabeçalho guarda
+ * o número de registos já enviados; quando todos foram enviados o ficheiro
+ * é truncado. O ficheiro sobrevive ao reinício do programa.
+ * Uma falha entre o envio e a atualização do cabeçalho provoca o reenvio
+ * dos registos (entrega pelo menos uma vez).
+ *
+ * Formato do ficheiro (little-endian):
+ *
+ *	cabeçalho
+ *		char     magic[4]		"SMMQ"
+ *		uint32_t record_size		MQTT_SPOOL_RECORD_SIZE
+ *		uint64_t sent			registos já enviados
+ *	registo
+ *		uint64_t ts			milisegundos, UNIX
+ *		float    LAeq, LAFmin, LAE, LAFmax, LApeak
+ *		int32_t  direction
+ */
+
+#define MQTT_SPOOL_MAGIC	"SMMQ"
+#define MQTT_SPOOL_HEADER_SIZE	16
+#define MQTT_SPOOL_RECORD_SIZE	32
+
+bool mqtt_spool_open(const char *filepath);
+void mqtt_spool_close();
+
+/**
+ * @brief Acrescenta nrecords registos ao fim do ficheiro.
+ */
+bool mqtt_spool_append(const Mqtt_record *records, unsigned nrecords);
+
+/**
+ * @brief Número de registos por enviar.
+ */
+uint64_t mqtt_spool_pending();
+
+/**
+ * @brief Lê até nrecords dos registos mais antigos por enviar.
+ *
+ * @return Número de registos lidos.
+ */
+unsigned mqtt_spool_peek(Mqtt_record *records, unsigned nrecords);
+
+/**
+ * @brief Marca como enviados os nrecords registos mais antigos.
+ */
+void mqtt_spool_consume(unsigned nrecords);
+
+#endif
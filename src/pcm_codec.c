@@ -0,0 +1,504 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "pcm_codec.h"
+
+enum {SUBBLOCK_VERBATIM, SUBBLOCK_FIXED, SUBBLOCK_LPC};
+
+#define FIXED_ORDER_MAX		4
+#define LPC_PRECISION		15	// bits dos coeficientes quantificados
+#define RICE_PARAMETER_MAX	30
+#define PARTITION_ORDER_MAX	8
+#define PARTITION_SIZE_MIN	16
+
+//------------------------------------------------------------------------------
+//	Escrita e leitura de bits
+
+typedef struct {
+	uint8_t *data;
+	size_t size;
+	uint64_t accumulator;
+	unsigned bits;
+} Bit_writer;
+
+static void bits_put(Bit_writer *writer, uint32_t value, unsigned n)
+{
+	if (n == 0)
+		return;
+	writer->accumulator = (writer->accumulator << n) | (value & (0xffffffffu >> (32 - n)));
+	writer->bits += n;
+	while (writer->bits >= 8) {
+		writer->bits -= 8;
+		writer->data[writer->size++] = writer->accumulator >> writer->bits;
+	}
+}
+
+static void bits_put_unary(Bit_writer *writer, uint32_t zeros)
+{
+	for (; zeros >= 24; zeros -= 24)
+		bits_put(writer, 0, 24);
+	bits_put(writer, 1, zeros + 1);
+}
+
+static void bits_align(Bit_writer *writer)
+{
+	if (writer->bits > 0)
+		bits_put(writer, 0, 8 - writer->bits);
+}
+
+typedef struct {
+	const uint8_t *data;
+	size_t size;
+	size_t position;
+	uint64_t accumulator;
+	unsigned bits;
+	bool error;
+} Bit_reader;
+
+static uint32_t bits_get(Bit_reader *reader, unsigned n)
+{
+	if (n == 0)
+		return 0;
+	while (reader->bits < n) {
+		if (reader->position >= reader->size) {
+			reader->error = true;
+			return 0;
+		}
+		reader->accumulator = (reader->accumulator << 8) | reader->data[reader->position++];
+		reader->bits += 8;
+	}
+	reader->bits -= n;
+	return (reader->accumulator >> reader->bits) & (0xffffffffu >> (32 - n));
+}
+
+static uint32_t bits_get_unary(Bit_reader *reader)
+{
+	uint32_t zeros = 0;
+	while (!reader->error && bits_get(reader, 1) == 0)
+		zeros++;
+	return zeros;
+}
+
+static void bits_align_reader(Bit_reader *reader)
+{
+	reader->bits -= reader->bits % 8;
+}
+
+static inline uint32_t zigzag(int32_t value)
+{
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t value)
+{
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+//------------------------------------------------------------------------------
+//	Codificação de Rice do resíduo
+
+static size_t rice_bits(const uint32_t *u, unsigned n, unsigned k)
+{
+	size_t bits = (size_t)n * (k + 1);
+	for (unsigned i = 0; i < n; i++)
+		bits += u[i] >> k;
+	return bits;
+}
+
+static unsigned rice_parameter(const uint32_t *u, unsigned n, size_t *bits)
+{
+	uint64_t sum = 0;
+	for (unsigned i = 0; i < n; i++)
+		sum += u[i];
+	unsigned k = 0;
+	while (k < RICE_PARAMETER_MAX && ((uint64_t)n << (k + 1)) < sum)
+		k++;
+	unsigned best = k;
+	*bits = rice_bits(u, n, k);
+	for (unsigned candidate = k > 0 ? k - 1 : k + 1; candidate <= k + 1 && candidate <= RICE_PARAMETER_MAX;
+			candidate += 2) {
+		size_t candidate_bits = rice_bits(u, n, candidate);
+		if (candidate_bits < *bits) {
+			*bits = candidate_bits;
+			best = candidate;
+		}
+	}
+	return best;
+}
+
+static inline unsigned partition_start(unsigned length, unsigned order, unsigned i)
+{
+	return ((uint64_t)length * i) >> order;
+}
+
+/*
+ * Escolhe a ordem de partição e os parâmetros de Rice.
+ * Retorna o número de bits do resíduo codificado.
+ */
+static size_t residual_plan(const uint32_t *u, unsigned length, unsigned *partition_order,
+		unsigned parameters[])
+{
+	size_t best_bits = SIZE_MAX;
+	unsigned tmp[1 << PARTITION_ORDER_MAX];
+	for (unsigned order = 0; order <= PARTITION_ORDER_MAX
+			&& (order == 0 || (length >> order) >= PARTITION_SIZE_MIN); order++) {
+		size_t bits = 4;
+		for (unsigned i = 0; i < (1u << order); i++) {
+			unsigned start = partition_start(length, order, i);
+			unsigned end = partition_start(length, order, i + 1);
+			size_t partition_bits;
+			tmp[i] = rice_parameter(u + start, end - start, &partition_bits);
+			bits += 5 + partition_bits;
+		}
+		if (bits < best_bits) {
+			best_bits = bits;
+			*partition_order = order;
+			memcpy(parameters, tmp, (1u << order) * sizeof *tmp);
+		}
+	}
+	return best_bits;
+}
+
+static void residual_write(Bit_writer *writer, const uint32_t *u, unsigned length,
+		unsigned partition_order, const unsigned parameters[])
+{
+	bits_put(writer, partition_order, 4);
+	for (unsigned i = 0; i < (1u << partition_order); i++) {
+		unsigned k = parameters[i];
+		bits_put(writer, k, 5);
+		unsigned end = partition_start(length, partition_order, i + 1);
+		for (unsigned j = partition_start(length, partition_order, i); j < end; j++) {
+			bits_put_unary(writer, u[j] >> k);
+			bits_put(writer, u[j], k);
+		}
+	}
+}
+
+static bool residual_read(Bit_reader *reader, int32_t *residual, unsigned length)
+{
+	unsigned partition_order = bits_get(reader, 4);
+	if (partition_order > PARTITION_ORDER_MAX)
+		return false;
+	for (unsigned i = 0; i < (1u << partition_order); i++) {
+		unsigned k = bits_get(reader, 5);
+		if (k > RICE_PARAMETER_MAX)
+			return false;
+		unsigned end = partition_start(length, partition_order, i + 1);
+		for (unsigned j = partition_start(length, partition_order, i); j < end; j++) {
+			uint32_t q = bits_get_unary(reader);
+			residual[j] = unzigzag((q << k) | bits_get(reader, k));
+		}
+		if (reader->error)
+			return false;
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------------
+//	Preditores
+
+static void fixed_residual(const int32_t *x, unsigned n, unsigned order, uint32_t *u)
+{
+	for (unsigned i = order; i < n; i++) {
+		int32_t r;
+		switch (order) {
+		case 0: r = x[i]; break;
+		case 1: r = x[i] - x[i - 1]; break;
+		case 2: r = x[i] - 2 * x[i - 1] + x[i - 2]; break;
+		case 3: r = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3]; break;
+		default: r = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4]; break;
+		}
+		u[i - order] = zigzag(r);
+	}
+}
+
+static void fixed_restore(int32_t *x, unsigned n, unsigned order, const int32_t *r)
+{
+	for (unsigned i = order; i < n; i++) {
+		int32_t p;
+		switch (order) {
+		case 0: p = 0; break;
+		case 1: p = x[i - 1]; break;
+		case 2: p = 2 * x[i - 1] - x[i - 2]; break;
+		case 3: p = 3 * x[i - 1] - 3 * x[i - 2] + x[i - 3]; break;
+		default: p = 4 * x[i - 1] - 6 * x[i - 2] + 4 * x[i - 3] - x[i - 4]; break;
+		}
+		x[i] = p + r[i - order];
+	}
+}
+
+static void lpc_residual(const int32_t *x, unsigned n, const int32_t *coefs, unsigned order,
+		unsigned shift, uint32_t *u)
+{
+	for (unsigned i = order; i < n; i++) {
+		int64_t prediction = 0;
+		for (unsigned j = 0; j < order; j++)
+			prediction += (int64_t)coefs[j] * x[i - 1 - j];
+		u[i - order] = zigzag(x[i] - (int32_t)(prediction >> shift));
+	}
+}
+
+static void lpc_restore(int32_t *x, unsigned n, const int32_t *coefs, unsigned order,
+		unsigned shift, const int32_t *r)
+{
+	for (unsigned i = order; i < n; i++) {
+		int64_t prediction = 0;
+		for (unsigned j = 0; j < order; j++)
+			prediction += (int64_t)coefs[j] * x[i - 1 - j];
+		x[i] = (int32_t)(prediction >> shift) + r[i - order];
+	}
+}
+
+/*
+ * Coeficientes de predição linear de ordem 1 .. order_max (Levinson-Durbin)
+ * a partir da autocorrelação do sinal com janela de Tukey.
+ * lpc[p - 1][j]: coeficiente j do preditor de ordem p.
+ */
+static bool lpc_compute(const int32_t *x, unsigned n, unsigned order_max,
+		double lpc[][PCM_CODEC_LPC_ORDER_MAX])
+{
+	double *windowed = malloc(n * sizeof *windowed);
+	if (windowed == NULL)
+		return false;
+	unsigned taper = n / 4;
+	for (unsigned i = 0; i < n; i++) {
+		double w = 1.0;
+		if (i < taper)
+			w = 0.5 - 0.5 * cos(M_PI * i / taper);
+		else if (i >= n - taper)
+			w = 0.5 - 0.5 * cos(M_PI * (n - 1 - i) / taper);
+		windowed[i] = x[i] * w;
+	}
+	double autoc[PCM_CODEC_LPC_ORDER_MAX + 1];
+	for (unsigned lag = 0; lag <= order_max; lag++) {
+		double sum = 0;
+		for (unsigned i = lag; i < n; i++)
+			sum += windowed[i] * windowed[i - lag];
+		autoc[lag] = sum;
+	}
+	free(windowed);
+	if (autoc[0] == 0)
+		return false;
+
+	double a[PCM_CODEC_LPC_ORDER_MAX] = {0};
+	double error = autoc[0] * (1 + 1e-9);
+	for (unsigned i = 0; i < order_max; i++) {
+		double acc = autoc[i + 1];
+		for (unsigned j = 0; j < i; j++)
+			acc -= a[j] * autoc[i - j];
+		double k = acc / error;
+		double previous[PCM_CODEC_LPC_ORDER_MAX];
+		memcpy(previous, a, sizeof a);
+		for (unsigned j = 0; j < i; j++)
+			a[j] = previous[j] - k * previous[i - 1 - j];
+		a[i] = k;
+		error *= 1 - k * k;
+		memcpy(lpc[i], a, sizeof a);
+		if (error <= 0)
+			return false;
+	}
+	return true;
+}
+
+static bool lpc_quantize(const double *lpc, unsigned order, int32_t *coefs, unsigned *shift)
+{
+	double cmax = 0;
+	for (unsigned j = 0; j < order; j++)
+		if (fabs(lpc[j]) > cmax)
+			cmax = fabs(lpc[j]);
+	if (cmax == 0)
+		return false;
+	int exponent;
+	frexp(cmax, &exponent);
+	//	|coeficiente| < 16 - a predição cabe em 32 bits
+	if (exponent > 4)
+		return false;
+	int s = LPC_PRECISION - 1 - exponent;
+	if (s > 31)
+		s = 31;
+	int32_t limit = (1 << (LPC_PRECISION - 1)) - 1;
+	double error = 0;
+	for (unsigned j = 0; j < order; j++) {
+		error += lpc[j] * (1 << s);
+		long q = lround(error);
+		if (q > limit)
+			q = limit;
+		if (q < -limit - 1)
+			q = -limit - 1;
+		coefs[j] = q;
+		error -= q;
+	}
+	*shift = s;
+	return true;
+}
+
+//------------------------------------------------------------------------------
+
+typedef struct {
+	unsigned type;
+	unsigned order;
+	int32_t coefs[PCM_CODEC_LPC_ORDER_MAX];
+	unsigned shift;
+	unsigned partition_order;
+	unsigned parameters[1 << PARTITION_ORDER_MAX];
+	size_t bits;
+} Subblock;
+
+static void subblock_try(Subblock *best, Subblock *candidate, const uint32_t *u, unsigned n)
+{
+	candidate->bits = 8 + 16 * candidate->order
+		+ residual_plan(u, n - candidate->order, &candidate->partition_order, candidate->parameters);
+	if (candidate->type == SUBBLOCK_LPC)
+		candidate->bits += 4 + 5 + LPC_PRECISION * candidate->order;
+	if (candidate->bits < best->bits)
+		*best = *candidate;
+}
+
+static void channel_encode(Bit_writer *writer, const int32_t *x, unsigned n, uint32_t *u)
+{
+	Subblock best = {.type = SUBBLOCK_VERBATIM, .order = 0, .bits = 8 + 16 * (size_t)n};
+	Subblock candidate;
+
+	for (unsigned order = 0; order <= FIXED_ORDER_MAX && order < n; order++) {
+		candidate.type = SUBBLOCK_FIXED;
+		candidate.order = order;
+		fixed_residual(x, n, order, u);
+		subblock_try(&best, &candidate, u, n);
+	}
+
+	static const unsigned lpc_orders[] = {2, 4, 8, PCM_CODEC_LPC_ORDER_MAX};
+	double lpc[PCM_CODEC_LPC_ORDER_MAX][PCM_CODEC_LPC_ORDER_MAX];
+	if (n > 4 * PCM_CODEC_LPC_ORDER_MAX && lpc_compute(x, n, PCM_CODEC_LPC_ORDER_MAX, lpc)) {
+		for (unsigned i = 0; i < sizeof lpc_orders / sizeof lpc_orders[0]; i++) {
+			candidate.type = SUBBLOCK_LPC;
+			candidate.order = lpc_orders[i];
+			if (!lpc_quantize(lpc[candidate.order - 1], candidate.order, candidate.coefs, &candidate.shift))
+				continue;
+			lpc_residual(x, n, candidate.coefs, candidate.order, candidate.shift, u);
+			subblock_try(&best, &candidate, u, n);
+		}
+	}
+
+	bits_put(writer, best.type, 2);
+	bits_put(writer, best.order, 6);
+	if (best.type == SUBBLOCK_VERBATIM) {
+		for (unsigned i = 0; i < n; i++)
+			bits_put(writer, x[i], 16);
+	}
+	else {
+		for (unsigned i = 0; i < best.order; i++)
+			bits_put(writer, x[i], 16);
+		if (best.type == SUBBLOCK_FIXED) {
+			fixed_residual(x, n, best.order, u);
+		}
+		else {
+			bits_put(writer, LPC_PRECISION - 1, 4);
+			bits_put(writer, best.shift, 5);
+			for (unsigned j = 0; j < best.order; j++)
+				bits_put(writer, best.coefs[j], LPC_PRECISION);
+			lpc_residual(x, n, best.coefs, best.order, best.shift, u);
+		}
+		residual_write(writer, u, n - best.order, best.partition_order, best.parameters);
+	}
+	bits_align(writer);
+}
+
+size_t pcm_codec_encode(const int16_t *frames, unsigned nframes, unsigned channels,
+		uint8_t *output)
+{
+	int32_t *x = malloc(nframes * sizeof *x);
+	uint32_t *u = malloc(nframes * sizeof *u);
+	if (x == NULL || u == NULL) {
+		free(x);
+		free(u);
+		return 0;
+	}
+	Bit_writer writer = {.data = output};
+	for (unsigned c = 0; c < channels; c++) {
+		for (unsigned i = 0; i < nframes; i++)
+			x[i] = frames[i * channels + c];
+		channel_encode(&writer, x, nframes, u);
+	}
+	free(x);
+	free(u);
+	return writer.size;
+}
+
+static int32_t sign_extend(uint32_t value, unsigned bits)
+{
+	uint32_t sign = 1u << (bits - 1);
+	return (int32_t)((value ^ sign) - sign);
+}
+
+static bool channel_decode(Bit_reader *reader, int32_t *x, unsigned n, int32_t *r)
+{
+	unsigned type = bits_get(reader, 2);
+	unsigned order = bits_get(reader, 6);
+	if (order > n || (type == SUBBLOCK_FIXED && order > FIXED_ORDER_MAX)
+			|| (type == SUBBLOCK_LPC && order > PCM_CODEC_LPC_ORDER_MAX)
+			|| type > SUBBLOCK_LPC)
+		return false;
+	if (type == SUBBLOCK_VERBATIM) {
+		for (unsigned i = 0; i < n; i++)
+			x[i] = sign_extend(bits_get(reader, 16), 16);
+	}
+	else {
+		for (unsigned i = 0; i < order; i++)
+			x[i] = sign_extend(bits_get(reader, 16), 16);
+		int32_t coefs[PCM_CODEC_LPC_ORDER_MAX];
+		unsigned precision = 0, shift = 0;
+		if (type == SUBBLOCK_LPC) {
+			precision = bits_get(reader, 4) + 1;
+			shift = bits_get(reader, 5);
+			for (unsigned j = 0; j < order; j++)
+				coefs[j] = sign_extend(bits_get(reader, precision), precision);
+		}
+		if (!residual_read(reader, r, n - order))
+			return false;
+		if (type == SUBBLOCK_FIXED)
+			fixed_restore(x, n, order, r);
+		else
+			lpc_restore(x, n, coefs, order, shift, r);
+	}
+	bits_align_reader(reader);
+	return !reader->error;
+}
+
+bool pcm_codec_decode(const uint8_t *input, size_t size, unsigned nframes,
+		unsigned channels, int16_t *frames)
+{
+	int32_t *x = malloc(nframes * sizeof *x);
+	int32_t *r = malloc(nframes * sizeof *r);
+	if (x == NULL || r == NULL) {
+		free(x);
+		free(r);
+		return false;
+	}
+	Bit_reader reader = {.data = input, .size = size};
+	bool ok = true;
+	for (unsigned c = 0; c < channels && ok; c++) {
+		ok = channel_decode(&reader, x, nframes, r);
+		for (unsigned i = 0; i < nframes && ok; i++)
+			frames[i * channels + c] = x[i];
+	}
+	free(x);
+	free(r);
+	return ok;
+}
@@ -0,0 +1,68 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef PCM_CODEC_H
+#define PCM_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Compressão sem perdas de PCM de 16 bits, ao estilo FLAC.
+ *
+ * Cada canal de um bloco é codificado num subbloco independente:
+ *	- VERBATIM: amostras originais;
+ *	- FIXED: preditor polinomial fixo de ordem 0 a 4;
+ *	- LPC: preditor linear de ordem até PCM_CODEC_LPC_ORDER_MAX, com
+ *	  coeficientes quantificados, calculados por Levinson-Durbin.
+ * O resíduo da predição é codificado em Rice, com o parâmetro escolhido
+ * por partição. É escolhido o subbloco de menor dimensão.
+ *
+ * Subbloco (bits, MSB primeiro, alinhado ao byte):
+ *	tipo (2) ordem (6)
+ *	VERBATIM: n * 16
+ *	FIXED: amostras iniciais (ordem * 16) resíduo
+ *	LPC: amostras iniciais (ordem * 16) precisão - 1 (4) deslocamento (5)
+ *	     coeficientes (ordem * precisão) resíduo
+ *	resíduo: ordem de partição (4), por partição: parâmetro (5) valores
+ */
+
+#define PCM_CODEC_LPC_ORDER_MAX	12
+
+/**
+ * @brief Dimensão máxima do bloco codificado.
+ */
+#define PCM_CODEC_BOUND(nframes, channels) \
+	((size_t)(channels) * (2 * (size_t)(nframes) + 4))
+
+/**
+ * @brief Codifica nframes frames de channels canais intercalados.
+ *
+ * @return Número de bytes escritos em output.
+ */
+size_t pcm_codec_encode(const int16_t *frames, unsigned nframes, unsigned channels,
+		uint8_t *output);
+
+/**
+ * @brief Descodifica um bloco produzido por pcm_codec_encode.
+ *
+ * @return false se os dados estiverem corrompidos.
+ */
+bool pcm_codec_decode(const uint8_t *input, size_t size, unsigned nframes,
+		unsigned channels, int16_t *frames);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+#include "pcm_ring.h"
+
+struct pcm_ring {
+	int16_t *buffer;
+	uint64_t capacity;		// em frames
+	unsigned channels;
+	atomic_uint_least64_t reserved;	// frames em escrita ou escritas
+	atomic_uint_least64_t count;	// frames escritas
+};
+
+Pcm_ring *pcm_ring_create(uint64_t capacity, unsigned channels)
+{
+	Pcm_ring *ring = malloc(sizeof *ring);
+	if (ring == NULL)
+		return NULL;
+	ring->buffer = malloc(capacity * channels * sizeof *ring->buffer);
+	if (ring->buffer == NULL) {
+		free(ring);
+		return NULL;
+	}
+	ring->capacity = capacity;
+	ring->channels = channels;
+	atomic_init(&ring->reserved, 0);
+	atomic_init(&ring->count, 0);
+	return ring;
+}
+
+void pcm_ring_destroy(Pcm_ring *ring)
+{
+	free(ring->buffer);
+	free(ring);
+}
+
+uint64_t pcm_ring_capacity(Pcm_ring *ring)
+{
+	return ring->capacity;
+}
+
+void pcm_ring_write(Pcm_ring *ring, const int16_t *frames, unsigned nframes)
+{
+	uint64_t count = atomic_load_explicit(&ring->count, memory_order_relaxed);
+	//	Anunciar as posições que vão ser reescritas antes de as escrever
+	atomic_store_explicit(&ring->reserved, count + nframes, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	while (nframes > 0) {
+		uint64_t put = count % ring->capacity;
+		uint64_t length = ring->capacity - put < nframes ? ring->capacity - put : nframes;
+		memcpy(ring->buffer + put * ring->channels, frames,
+			length * ring->channels * sizeof *ring->buffer);
+		frames += length * ring->channels;
+		nframes -= length;
+		count += length;
+	}
+	atomic_store_explicit(&ring->count, count, memory_order_release);
+}
+
+uint64_t pcm_ring_count(Pcm_ring *ring)
+{
+	return atomic_load_explicit(&ring->count, memory_order_acquire);
+}
+
+uint64_t pcm_ring_read(Pcm_ring *ring, uint64_t from, int16_t *frames, uint64_t nframes)
+{
+	assert(from + nframes <= pcm_ring_count(ring));
+	uint64_t end = from + nframes;
+	for (uint64_t frame = from; frame < end; ) {
+		uint64_t get = frame % ring->capacity;
+		uint64_t length = ring->capacity - get < end - frame ? ring->capacity - get : end - frame;
+		memcpy(frames + (frame - from) * ring->channels, ring->buffer + get * ring->channels,
+			length * ring->channels * sizeof *ring->buffer);
+		frame += length;
+	}
+	/*
+	 * As frames anteriores a reserved - capacity podem ter sido
+	 * reescritas durante a cópia.
+	 */
+	atomic_thread_fence(memory_order_acquire);
+	uint64_t reserved = atomic_load_explicit(&ring->reserved, memory_order_relaxed);
+	if (reserved <= ring->capacity || reserved - ring->capacity <= from)
+		return 0;
+	uint64_t lost = reserved - ring->capacity - from;
+	return lost < nframes ? lost : nframes;
+}
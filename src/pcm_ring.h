@@ -0,0 +1,58 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef PCM_RING_H
+#define PCM_RING_H
+
+#include <stdint.h>
+
+/*
+ * Buffer circular lock-free de frames PCM de 16 bits (canais intercalados).
+ *
+ * Um único produtor (ciclo de processamento) escreve continuamente,
+ * reescrevendo as frames mais antigas. Os consumidores leem por posição
+ * absoluta (número de frames desde o início) e detetam as frames que foram
+ * reescritas durante a leitura. O produtor nunca espera pelos consumidores.
+ */
+
+typedef struct pcm_ring Pcm_ring;
+
+Pcm_ring *pcm_ring_create(uint64_t capacity, unsigned channels);
+void pcm_ring_destroy(Pcm_ring *ring);
+
+uint64_t pcm_ring_capacity(Pcm_ring *ring);
+
+/**
+ * @brief Acrescenta nframes frames (só o produtor).
+ */
+void pcm_ring_write(Pcm_ring *ring, const int16_t *frames, unsigned nframes);
+
+/**
+ * @brief Número de frames escritas desde o início.
+ */
+uint64_t pcm_ring_count(Pcm_ring *ring);
+
+/**
+ * @brief Copia as frames [from, from + nframes[ para frames.
+ *
+ * As frames pedidas devem já ter sido escritas.
+ *
+ * @return Número de frames iniciais que foram reescritas antes ou durante
+ * a cópia e cujo conteúdo não é válido (0 se a cópia for íntegra).
+ */
+uint64_t pcm_ring_read(Pcm_ring *ring, uint64_t from, int16_t *frames, uint64_t nframes);
+
+#endif
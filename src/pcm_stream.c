@@ -0,0 +1,441 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define _GNU_SOURCE	// accept4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "pcm_stream.h"
+
+struct pcm_stream {
+	const char *name;
+	int listener;			// socket à escuta, -1 - stdin ou FIFO
+	int fd;				// -1 - sem emissor
+	bool wait;			// false - pcm_stream_listen, nunca espera
+	unsigned channels, sample_rate;	// exigidos ao emissor, 0 - os do primeiro
+	Pcm_stream_header header;
+	Pcm_stream_header received;	// cabeçalho do emissor atual
+	size_t header_length;		// bytes de received já recebidos
+	int64_t activity;		// última receção do emissor atual, milisegundos (CLOCK_MONOTONIC)
+	unsigned connections;
+	unsigned frame_size;		// bytes
+	uint8_t *buffer;
+	size_t begin, end;		// bytes recebidos ainda não convertidos
+};
+
+static const unsigned sample_sizes[] = {
+	[PCM_STREAM_S16_LE] = 2, [PCM_STREAM_S32_LE] = 4, [PCM_STREAM_FLOAT_LE] = 4
+};
+
+bool pcm_stream_is_stream(const char *name)
+{
+	return strcmp(name, "stdin") == 0 || strncmp(name, "fifo:", 5) == 0
+		|| strncmp(name, "unix:", 5) == 0 || strncmp(name, "tcp:", 4) == 0;
+}
+
+static int64_t monotonic_ms()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * @return > 0 com dados, 0 com timeout, < 0 com sinal ou erro.
+ */
+static int readable_wait(int fd, int timeout)
+{
+	struct pollfd pollfd = {.fd = fd, .events = POLLIN};
+	int result = poll(&pollfd, 1, timeout);
+	if (result < 0 && errno != EINTR)
+		fprintf(stderr, "PCM stream: poll error: %s\n", strerror(errno));
+	return result;
+}
+
+/*
+ * Recebe o cabeçalho do emissor, em uma ou mais vezes.
+ *
+ * @return > 0 com o cabeçalho válido, 0 com timeout ou sinal,
+ * < 0 com o fim ou um cabeçalho inválido.
+ */
+static int header_read(Pcm_stream *stream, int timeout)
+{
+	Pcm_stream_header header;
+	while (stream->header_length < sizeof header) {
+		if (readable_wait(stream->fd, timeout) <= 0)
+			return 0;
+		ssize_t result = read(stream->fd, (uint8_t *)&stream->received + stream->header_length,
+					sizeof header - stream->header_length);
+		if (result < 0 && errno == EAGAIN)
+			continue;
+		if (result < 0 && errno == EINTR)
+			return 0;
+		if (result <= 0)
+			return -1;
+		stream->header_length += result;
+		stream->activity = monotonic_ms();
+	}
+	header = stream->received;
+	if (memcmp(header.magic, PCM_STREAM_MAGIC, sizeof header.magic) != 0
+			|| header.version != PCM_STREAM_VERSION
+			|| header.format < PCM_STREAM_S16_LE || header.format > PCM_STREAM_FLOAT_LE
+			|| header.channels == 0 || header.sample_rate == 0) {
+		fprintf(stderr, "PCM stream %s: invalid header\n", stream->name);
+		return -1;
+	}
+	if (stream->channels != 0 && (header.channels != stream->channels
+			|| header.sample_rate != stream->sample_rate)) {
+		fprintf(stderr, "PCM stream %s has %u channels at %u Hz, configured %u at %u Hz\n",
+			stream->name, header.channels, header.sample_rate,
+			stream->channels, stream->sample_rate);
+		return -1;
+	}
+	//	Uma nova ligação continua o mesmo som
+	if (stream->connections > 0 && (header.format != stream->header.format
+			|| header.channels != stream->header.channels
+			|| header.sample_rate != stream->header.sample_rate)) {
+		fprintf(stderr, "PCM stream %s: sender format changed (%u Hz, %u channels, format %u)\n",
+			stream->name, header.sample_rate, header.channels, header.format);
+		return -1;
+	}
+	stream->header = header;
+	stream->frame_size = header.channels * sample_sizes[header.format];
+	stream->connections++;
+	return 1;
+}
+
+/*
+ * Fim do emissor: a frame incompleta é descartada.
+ */
+static void sender_close(Pcm_stream *stream)
+{
+	if (stream->fd != STDIN_FILENO)
+		close(stream->fd);
+	stream->fd = -1;
+	if (stream->frame_size > 0)
+		stream->end -= (stream->end - stream->begin) % stream->frame_size;
+}
+
+static int sender_connect(Pcm_stream *stream)
+{
+	int fd = accept4(stream->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		if (errno != EINTR && errno != EAGAIN)
+			fprintf(stderr, "PCM stream %s: accept error: %s\n", stream->name, strerror(errno));
+		return -1;
+	}
+	int size = PCM_STREAM_BUFFER_SIZE;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+	return fd;
+}
+
+/*
+ * Espera por um emissor com um cabeçalho válido.
+ *
+ * @return false com sinal.
+ */
+static bool sender_accept(Pcm_stream *stream)
+{
+	while (true) {
+		if (readable_wait(stream->listener, -1) < 0)
+			return false;
+		stream->fd = sender_connect(stream);
+		if (stream->fd < 0)
+			continue;
+		stream->header_length = 0;
+		if (header_read(stream, PCM_STREAM_HEADER_TIMEOUT) > 0)
+			return true;
+		close(stream->fd);
+		stream->fd = -1;
+	}
+}
+
+/*
+ * Sem espera (pcm_stream_listen): aceita um emissor pendente e recebe
+ * o que já chegou do seu cabeçalho. Um novo emissor substitui o atual
+ * se este não envia nada há PCM_STREAM_HEADER_TIMEOUT; senão é recusado.
+ *
+ * @return true com o cabeçalho do emissor recebido.
+ */
+static bool sender_poll(Pcm_stream *stream)
+{
+	if (stream->listener >= 0) {
+		int fd = sender_connect(stream);
+		if (fd >= 0 && stream->fd >= 0
+				&& monotonic_ms() - stream->activity < PCM_STREAM_HEADER_TIMEOUT) {
+			fprintf(stderr, "PCM stream %s: sender refused, another one is connected\n", stream->name);
+			close(fd);
+		}
+		else if (fd >= 0) {
+			if (stream->fd >= 0)
+				sender_close(stream);
+			stream->fd = fd;
+			stream->header_length = 0;
+			stream->activity = monotonic_ms();
+		}
+	}
+	if (stream->fd < 0)
+		return false;
+	if (stream->header_length == sizeof stream->received)
+		return true;
+	int result = header_read(stream, 0);
+	if (result < 0)
+		sender_close(stream);
+	return result > 0;
+}
+
+static int unix_listen(const char *path)
+{
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof address.sun_path) {
+		fprintf(stderr, "PCM stream: socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(address.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&address, sizeof address) < 0 || listen(fd, 1) < 0) {
+		fprintf(stderr, "PCM stream: bind(%s) error: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int tcp_listen(const char *address)
+{
+	char host[strlen(address) + 1];
+	strcpy(host, address);
+	char *port = strrchr(host, ':');
+	if (port != NULL)
+		*port++ = '\0';
+	else
+		port = host;
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE
+	};
+	struct addrinfo *addresses;
+	int result = getaddrinfo(port == host ? NULL : host, port, &hints, &addresses);
+	if (result != 0) {
+		fprintf(stderr, "PCM stream: tcp:%s: %s\n", address, gai_strerror(result));
+		return -1;
+	}
+	int fd = -1;
+	for (struct addrinfo *ai = addresses; ai != NULL && fd < 0; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		int reuse = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) < 0 || listen(fd, 1) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(addresses);
+	if (fd < 0)
+		fprintf(stderr, "PCM stream: bind(tcp:%s) error: %s\n", address, strerror(errno));
+	return fd;
+}
+
+static Pcm_stream *source_open(const char *name, bool wait)
+{
+	Pcm_stream *stream = calloc(1, sizeof *stream);
+	if (stream != NULL)
+		stream->buffer = malloc(PCM_STREAM_BUFFER_SIZE);
+	if (stream == NULL || stream->buffer == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		free(stream);
+		return NULL;
+	}
+	stream->name = name;
+	stream->listener = stream->fd = -1;
+	stream->wait = wait;
+	if (strcmp(name, "stdin") == 0) {
+		stream->fd = STDIN_FILENO;
+	}
+	else if (strncmp(name, "fifo:", 5) == 0) {
+		if (mkfifo(name + 5, 0660) < 0 && errno != EEXIST)
+			fprintf(stderr, "mkfifo(%s) error: %s\n", name + 5, strerror(errno));
+		//	Não bloqueia à espera do emissor; a espera é feita em poll
+		stream->fd = open(name + 5, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (stream->fd < 0)
+			fprintf(stderr, "open(%s) error: %s\n", name + 5, strerror(errno));
+	}
+	else if (strncmp(name, "unix:", 5) == 0) {
+		stream->listener = unix_listen(name + 5);
+	}
+	else if (strncmp(name, "tcp:", 4) == 0) {
+		stream->listener = tcp_listen(name + 4);
+	}
+	if (stream->listener < 0 && stream->fd < 0) {
+		pcm_stream_close(stream);
+		return NULL;
+	}
+	return stream;
+}
+
+Pcm_stream *pcm_stream_open(const char *name)
+{
+	Pcm_stream *stream = source_open(name, true);
+	if (stream == NULL)
+		return NULL;
+	bool ready;
+	if (stream->listener >= 0)
+		ready = sender_accept(stream);
+	else
+		ready = header_read(stream, -1) > 0;
+	if (!ready) {
+		fprintf(stderr, "PCM stream %s: no sender\n", name);
+		pcm_stream_close(stream);
+		return NULL;
+	}
+	return stream;
+}
+
+Pcm_stream *pcm_stream_listen(const char *name, unsigned channels, unsigned sample_rate)
+{
+	Pcm_stream *stream = source_open(name, false);
+	if (stream != NULL) {
+		stream->channels = channels;
+		stream->sample_rate = sample_rate;
+	}
+	return stream;
+}
+
+void pcm_stream_close(Pcm_stream *stream)
+{
+	if (stream->fd >= 0 && stream->fd != STDIN_FILENO)
+		close(stream->fd);
+	if (stream->listener >= 0) {
+		close(stream->listener);
+		if (strncmp(stream->name, "unix:", 5) == 0)
+			unlink(stream->name + 5);
+	}
+	free(stream->buffer);
+	free(stream);
+}
+
+const Pcm_stream_header *pcm_stream_header(const Pcm_stream *stream)
+{
+	return &stream->header;
+}
+
+unsigned pcm_stream_descriptors(const Pcm_stream *stream, int descriptors[2])
+{
+	unsigned count = 0;
+	if (stream->fd >= 0)
+		descriptors[count++] = stream->fd;
+	if (stream->listener >= 0)
+		descriptors[count++] = stream->listener;
+	return count;
+}
+
+size_t pcm_stream_buffered(const Pcm_stream *stream)
+{
+	return stream->frame_size > 0 ? (stream->end - stream->begin) / stream->frame_size : 0;
+}
+
+bool pcm_stream_ended(const Pcm_stream *stream)
+{
+	return stream->fd < 0 && stream->listener < 0;
+}
+
+static void samples_convert(const Pcm_stream *stream, float *buffer, int16_t *samples, size_t frames)
+{
+	const uint8_t *data = stream->buffer + stream->begin;
+	unsigned channels = stream->header.channels;
+	unsigned sample_size = sample_sizes[stream->header.format];
+	for (size_t i = 0; i < frames; i++)
+		for (unsigned c = 0; c < channels; c++, data += sample_size) {
+			float value;
+			int16_t value16;
+			if (stream->header.format == PCM_STREAM_S16_LE) {
+				memcpy(&value16, data, sizeof value16);
+				value = value16 / 32768.0f;
+			}
+			else if (stream->header.format == PCM_STREAM_S32_LE) {
+				int32_t value32;
+				memcpy(&value32, data, sizeof value32);
+				value = value32 / 2147483648.0f;
+				value16 = value32 >> 16;
+			}
+			else {
+				memcpy(&value, data, sizeof value);
+				value = value < -1.0f ? -1.0f : value > 1.0f ? 1.0f : value;
+				value16 = value >= 1.0f ? INT16_MAX : (int16_t)(value * 32768.0f);
+			}
+			buffer[c * frames + i] = value;
+			samples[i * channels + c] = value16;
+		}
+}
+
+size_t pcm_stream_read(Pcm_stream *stream, float *buffer, int16_t *samples, size_t nframes)
+{
+	if (!stream->wait && !sender_poll(stream) && stream->frame_size == 0)
+		return 0;	// ainda nenhum emissor enviou o cabeçalho
+	if (nframes * stream->frame_size > PCM_STREAM_BUFFER_SIZE)
+		nframes = PCM_STREAM_BUFFER_SIZE / stream->frame_size;
+	size_t needed = nframes * stream->frame_size;
+	while (stream->end - stream->begin < needed) {
+		if (stream->begin > 0) {
+			memmove(stream->buffer, stream->buffer + stream->begin, stream->end - stream->begin);
+			stream->end -= stream->begin;
+			stream->begin = 0;
+		}
+		if (stream->wait && stream->fd < 0 && stream->listener >= 0)
+			sender_accept(stream);
+		if (stream->fd < 0 || stream->header_length < sizeof stream->received)
+			break;
+		if (readable_wait(stream->fd, stream->wait ? -1 : 0) <= 0)
+			break;
+		ssize_t length = read(stream->fd, stream->buffer + stream->end, PCM_STREAM_BUFFER_SIZE - stream->end);
+		if (length > 0) {
+			stream->end += length;
+			stream->activity = monotonic_ms();
+			continue;
+		}
+		if (length < 0 && errno == EAGAIN)
+			continue;
+		if (length < 0 && errno == EINTR)
+			break;
+		sender_close(stream);
+		if (stream->listener < 0 || !stream->wait)
+			break;
+	}
+	size_t frames = (stream->end - stream->begin) / stream->frame_size;
+	if (frames > nframes)
+		frames = nframes;
+	//	Sem espera, só blocos completos, até ao fim da entrada
+	if (!stream->wait && frames < nframes && !pcm_stream_ended(stream))
+		return 0;
+	samples_convert(stream, buffer, samples, frames);
+	stream->begin += frames * stream->frame_size;
+	return frames;
+}
@@ -0,0 +1,121 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef PCM_STREAM_H
+#define PCM_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Entrada de som PCM recebido de um nó de captação remoto.
+ *
+ * A origem é indicada em input_device:
+ *	stdin			entrada padrão
+ *	fifo:<caminho>		FIFO, criado se não existir
+ *	unix:<caminho>		socket UNIX à escuta
+ *	tcp:[<endereço>:]<porto>	socket TCP à escuta (por omissão, todos os endereços)
+ *
+ * O som começa por um cabeçalho (Pcm_stream_header), seguido das amostras
+ * intercaladas no formato declarado. Num socket, quando o emissor fecha
+ * a ligação, espera-se por nova ligação, com o mesmo formato; o som
+ * não recebido entretanto não é preenchido. Na entrada padrão e no FIFO,
+ * o fecho termina a entrada.
+ *
+ * As leituras são não bloqueantes, de até PCM_STREAM_BUFFER_SIZE bytes,
+ * depois de poll; um sinal interrompe a espera e a leitura devolve
+ * as frames já recebidas.
+ *
+ * Aberta com pcm_stream_listen, a origem nunca espera: o socket fica
+ * à escuta enquanto a origem estiver aberta, o emissor é aceite e o seu
+ * cabeçalho recebido à medida que chegam, e quem lê vigia com poll
+ * os descritores de pcm_stream_descriptors. Com um emissor ligado, um novo
+ * é recusado, a não ser que o atual não envie nada há PCM_STREAM_HEADER_TIMEOUT.
+ */
+
+#define PCM_STREAM_MAGIC		"SMPC"
+#define PCM_STREAM_VERSION		1
+#define PCM_STREAM_BUFFER_SIZE		(1024 * 1024)
+#define PCM_STREAM_HEADER_TIMEOUT	5000	// milisegundos
+
+enum {
+	PCM_STREAM_S16_LE = 1,
+	PCM_STREAM_S32_LE,
+	PCM_STREAM_FLOAT_LE
+};
+
+typedef struct __attribute__ ((packed)) {
+	char magic[4];
+	uint16_t version;
+	uint16_t format;		// PCM_STREAM_S16_LE ...
+	uint32_t sample_rate;
+	uint16_t channels;
+	uint16_t reserved;
+} Pcm_stream_header;
+
+typedef struct pcm_stream Pcm_stream;
+
+/**
+ * @brief Verifica se name designa uma origem PCM (e não uma placa de som).
+ */
+bool pcm_stream_is_stream(const char *name);
+
+/**
+ * @brief Abre a origem name e espera pelo cabeçalho do emissor.
+ */
+Pcm_stream *pcm_stream_open(const char *name);
+
+/**
+ * @brief Abre a origem name sem esperar pelo emissor; as leituras também não esperam.
+ *
+ * Um emissor que não declare channels e sample_rate é desligado.
+ */
+Pcm_stream *pcm_stream_listen(const char *name, unsigned channels, unsigned sample_rate);
+void pcm_stream_close(Pcm_stream *stream);
+
+const Pcm_stream_header *pcm_stream_header(const Pcm_stream *stream);
+
+/**
+ * @brief Descritores a vigiar com poll: a ligação do emissor e o socket à escuta.
+ *
+ * @return Número de descritores, até 2.
+ */
+unsigned pcm_stream_descriptors(const Pcm_stream *stream, int descriptors[2]);
+
+/**
+ * @brief Frames já recebidas, que pcm_stream_read devolve sem esperar.
+ */
+size_t pcm_stream_buffered(const Pcm_stream *stream);
+
+/**
+ * @brief Verifica se a origem terminou: o emissor fechou a entrada padrão ou o FIFO.
+ */
+bool pcm_stream_ended(const Pcm_stream *stream);
+
+/**
+ * @brief Lê até nframes frames, esperando pelo emissor.
+ *
+ * @param buffer amostras normalizadas em -1.0 .. +1.0, um bloco por canal;
+ * o bloco do canal c começa na posição c * <frames lidas>.
+ * @param samples as mesmas amostras a 16 bits, intercaladas.
+ * @return Número de frames lidas, 0 no fim da entrada. Aberta com
+ * pcm_stream_listen, 0 também enquanto não houver nframes frames recebidas
+ * (pcm_stream_ended distingue).
+ */
+size_t pcm_stream_read(Pcm_stream *stream, float *buffer, int16_t *samples, size_t nframes);
+
+#endif
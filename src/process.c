@@ -24,9 +24,9 @@ ao PFC MoSEMusic realizado por Guilherme Albano e David Meneses
 #include "process.h"
 #include "config.h"
 #include "ring.h"
+#include "spectrum.h"
 
-static double laeq_accumulator;
-static size_t laeq_counter;
+static Lae_average laeq_average;	// do ciclo de processamento
 
 /**
  * lae_average_create:
@@ -34,8 +34,8 @@ static size_t laeq_counter;
  */
 void lae_average_create(unsigned laeq_time)
 {
-	laeq_accumulator = 0;
-	laeq_counter = 0;
+	laeq_average.accumulator = 0;
+	laeq_average.counter = 0;
 }
 
 void lae_average_destroy()
@@ -44,17 +44,18 @@ void lae_average_destroy()
 
 /**
  * lae_average:
+ * @average: Acumulador de LAEq
  * @lae: Valor LAE do segmento corrente
  *
  *  Cálcular LAEq
  *
  * Returns: Valor LAEq
  */
-float lae_average(float lae)
+static float lae_average(Lae_average *average, float lae)
 {
-	laeq_accumulator += lae;
-	laeq_counter++;
-	return laeq_accumulator / laeq_counter;
+	average->accumulator += lae;
+	average->counter++;
+	return average->accumulator / average->counter;
 }
 
 //==============================================================================
@@ -78,6 +79,27 @@ Levels *levels_create()
 	levels->LAFmin = buffer += config_struct->record_period;
 	levels->LAE = buffer += config_struct->record_period;
 
+	levels->direction = malloc(config_struct->record_period * sizeof *levels->direction);
+	if (levels->direction == NULL) {
+		free(levels->LAeq);
+		free(levels);
+		return NULL;
+	}
+	for (unsigned i = 0; i < config_struct->record_period; i++)
+		levels->direction[i] = DIRECTION_UNDEFINED;
+
+	levels->bands = config_struct->spectrum_enable ? spectrum_octave_bands(config_struct->sample_rate) : 0;
+	levels->band_levels = NULL;
+	if (levels->bands > 0) {
+		levels->band_levels = calloc(config_struct->record_period * levels->bands, sizeof *levels->band_levels);
+		if (levels->band_levels == NULL) {
+			free(levels->direction);
+			free(levels->LAeq);
+			free(levels);
+			return NULL;
+		}
+	}
+
 	levels->segment_number = 0;
 	return levels;
 }
@@ -85,6 +107,8 @@ Levels *levels_create()
 void levels_destroy(Levels *levels)
 {
 	free(levels->LAeq);
+	free(levels->direction);
+	free(levels->band_levels);
 	free(levels);
 }
 
@@ -103,9 +127,9 @@ static inline unsigned min(unsigned a, unsigned b) {
 void process_segment_lapeak(Levels *levels, struct sbuffer *ring, struct config *config)
 {
 	/* Só processa ao fim de um segmento */
-	if (sbuffer_size(ring) >= config_struct->segment_size) {
+	if (sbuffer_size(ring) >= config->segment_size) {
 		float *samples = sbuffer_read_ptr(ring);
-		unsigned size = min(sbuffer_read_size(ring), config_struct->segment_size);
+		unsigned size = min(sbuffer_read_size(ring), config->segment_size);
 //		assert(samples[0] >= -1.0 && samples[0] <= +1.0);
 		float peak = fabs(samples[0]);
 		for (unsigned i = 1; i < size; i++) {
@@ -115,9 +139,9 @@ void process_segment_lapeak(Levels *levels, struct sbuffer *ring, struct config
 				peak = sample;
 		}
 		sbuffer_read_consumes(ring, size);
-		if (size < config_struct->segment_size) { /* O ring buffer deu a volta? */
+		if (size < config->segment_size) { /* O ring buffer deu a volta? */
 			samples = sbuffer_read_ptr(ring);
-			size = config_struct->segment_size - size;
+			size = config->segment_size - size;
 			for (unsigned i = 0; i < size; i++) {
 //				assert(samples[i] >= -1.0 && samples[i] <= +1.0);
 				float sample = fabs(samples[i]);
@@ -131,11 +155,17 @@ void process_segment_lapeak(Levels *levels, struct sbuffer *ring, struct config
 }
 
 void process_segment_levels(Levels *levels, struct sbuffer *ring, struct config *config)
+{
+	process_segment_levels_average(levels, ring, config, &laeq_average);
+}
+
+void process_segment_levels_average(Levels *levels, struct sbuffer *ring, struct config *config,
+		Lae_average *average)
 {
 	/* Só processa se o número de amostras disponível for maior ou igual a um segmento */
-	assert(sbuffer_size(ring) >= config_struct->segment_size);
+	assert(sbuffer_size(ring) >= config->segment_size);
 	float *samples = sbuffer_read_ptr(ring);
-	unsigned size = min(sbuffer_read_size(ring), config_struct->segment_size);
+	unsigned size = min(sbuffer_read_size(ring), config->segment_size);
 
 	float sample_sum = samples[0];
 	float sample_max = samples[0];
@@ -150,9 +180,9 @@ void process_segment_levels(Levels *levels, struct sbuffer *ring, struct config
 			sample_min = sample;
 	}
 	sbuffer_read_consumes(ring, size);
-	if (size < config_struct->segment_size) { /* O ring buffer deu a volta? */
+	if (size < config->segment_size) { /* O ring buffer deu a volta? */
 		samples = sbuffer_read_ptr(ring);
-		size = config_struct->segment_size - size;
+		size = config->segment_size - size;
 		for (unsigned i = 0; i < size; i++) {
 // 				assert(samples[i] >= -1.0 && samples[i] <= +1.0);
 			float sample = samples[i];
@@ -165,10 +195,10 @@ void process_segment_levels(Levels *levels, struct sbuffer *ring, struct config
 		sbuffer_read_consumes(ring, size);
 	}
 //	assert(sample_sum <= 48000.0);
-	float lae = sqrt(sample_sum / (config_struct->segment_size));
+	float lae = sqrt(sample_sum / (config->segment_size));
 	float lafmax = sqrt(sample_max);
 	float lafmin = sqrt(sample_min);
-	float laeq = lae_average(lae);
+	float laeq = lae_average(average, lae);
 	levels->LAeq[levels->segment_number] = linear_to_decibel(laeq) + config->calibration_delta;
 	levels->LAFmax[levels->segment_number] = linear_to_decibel(lafmax) + config->calibration_delta;
 	levels->LAFmin[levels->segment_number] = linear_to_decibel(lafmin) + config->calibration_delta;
@@ -177,11 +207,37 @@ void process_segment_levels(Levels *levels, struct sbuffer *ring, struct config
 }
 
 /**
- * @brief Processa a direção do som domante
+ * @brief Processa a direção do som dominante
  *
- * @param ring Array de buffers de segmentos
+ * Os espetros cruzados entre canais são acumulados bloco a bloco
+ * (direction_block); aqui apenas se estima o ângulo do segmento.
+ *
+ * @param direction Estimador de direção ou NULL se inativo
  * @param config Configuração do sistema
  */
-void process_segment_direction(Levels *levels, struct sbuffer *ring[], struct config *config)
+void process_segment_direction(Levels *levels, Direction *direction, struct config *config)
 {
+	levels->direction[levels->segment_number] =
+		direction != NULL ? direction_estimate(direction) : DIRECTION_UNDEFINED;
+}
+
+void process_block_channels(double *energy, const float *block, unsigned length, unsigned channels)
+{
+	for (unsigned c = 0; c < channels; c++) {
+		const float *samples = block + c * length;
+		double sum = 0;
+		for (unsigned i = 0; i < length; i++)
+			sum += samples[i] * samples[i];
+		energy[c] += sum;
+	}
+}
+
+void process_segment_channels(float *levels, double *energy, unsigned frames, unsigned channels,
+		struct config *config)
+{
+	for (unsigned c = 0; c < channels; c++) {
+		levels[c] = linear_to_decibel(sqrt(energy[c] / (frames > 0 ? frames : 1)))
+				+ config->calibration_delta;
+		energy[c] = 0;
+	}
 }
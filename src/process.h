@@ -29,6 +29,7 @@ ao PFC MoSEMusic realizado por Guilherme Albano e David Meneses
 #include <stdint.h>
 #include "config.h"
 #include "sbuffer.h"
+#include "direction.h"
 
 static inline float linear_to_decibel(float linear)
 {
@@ -47,7 +48,9 @@ typedef struct {
 	float *LAFmax;
 	float *LAFmin;
 	float *LAE;
-	int direction;	//	Direção da fonte sonora (0-360 graus)
+	int *direction;	//	Direção da fonte sonora (0-360 graus)
+	unsigned bands;		//	Bandas de oitava por segmento (0 sem espectro)
+	float *band_levels;	//	[segmento * bands + banda]
 } Levels;
 
 Levels *levels_create();
@@ -55,8 +58,37 @@ void levels_destroy(Levels *);
 
 void process_block_square(float *input, float *output, unsigned length);
 void process_segment_lapeak(Levels *levels, struct sbuffer *ring, struct config *config);
+typedef struct {
+	double accumulator;
+	size_t counter;
+} Lae_average;
+
 void process_segment_levels(Levels *levels, struct sbuffer *ring, struct config *config);
-void process_segment_direction(Levels *levels, struct sbuffer *ring[], struct config *config);
+
+/**
+ * @brief Como process_segment_levels, com o cálculo de LAeq em average
+ * em vez do do ciclo de processamento (varrimento - sweep.h).
+ */
+void process_segment_levels_average(Levels *levels, struct sbuffer *ring, struct config *config,
+		Lae_average *average);
+void process_segment_direction(Levels *levels, Direction *direction, struct config *config);
+
+/**
+ * @brief Acumula a energia, sem ponderação, de cada canal de um bloco.
+ *
+ * @param energy Soma dos quadrados de cada canal (channels)
+ * @param block Amostras de cada canal em sequência (canal c em block + c * length)
+ */
+void process_block_channels(double *energy, const float *block, unsigned length, unsigned channels);
+
+/**
+ * @brief Converte a energia acumulada de cada canal no nível equivalente Z
+ * do segmento e reinicia a soma.
+ *
+ * @param frames Número de frames acumuladas
+ */
+void process_segment_channels(float *levels, double *energy, unsigned frames, unsigned channels,
+		struct config *config);
 
 void lae_average_create(unsigned laeq_time);	//	Para cálculo de LAeq
 void lae_average_destroy();
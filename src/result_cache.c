@@ -0,0 +1,393 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "result_cache.h"
+#include "spectrum.h"
+#include "slv.h"
+
+#define RESULT_CACHE_BUFFER_SIZE	(1024 * 1024)	// múltiplo de 8
+
+static bool active;
+static const char *cache_path;
+static char *entry_path;		// <result_cache_path><chave>
+static char *key_text;			// texto do hash da configuração
+static char *output_filepath;
+static char *spectrum_filepath;		// NULL sem espectro
+static const char *output_format;
+static uint8_t *buffer;
+static Result_cache_statistics statistics;
+
+//------------------------------------------------------------------------------
+//	Hash de 64 bits, palavra a palavra (passo do MurmurHash3 x64)
+
+static uint64_t hash_mix(uint64_t hash, uint64_t word)
+{
+	word *= 0x87c37b91114253d5ULL;
+	word = word << 31 | word >> 33;
+	word *= 0x4cf5ad432745937fULL;
+	hash ^= word;
+	hash = hash << 27 | hash >> 37;
+	return hash * 5 + 0x52dce729;
+}
+
+/*
+ * Só o último bloco de dados pode ter dimensão que não seja múltipla de 8.
+ */
+static uint64_t hash_update(uint64_t hash, const uint8_t *data, size_t size)
+{
+	size_t i;
+	for (i = 0; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, sizeof word);
+		hash = hash_mix(hash, word);
+	}
+	if (i < size) {
+		uint64_t word = 0;
+		memcpy(&word, data + i, size - i);
+		hash = hash_mix(hash, word);
+	}
+	return hash;
+}
+
+static uint64_t hash_final(uint64_t hash, uint64_t size)
+{
+	hash ^= size;
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	return hash ^ hash >> 33;
+}
+
+//------------------------------------------------------------------------------
+
+/*
+ * Lê para buffer até o encher ou até ao fim do ficheiro.
+ */
+static ssize_t buffer_fill(int fd)
+{
+	size_t length = 0;
+	while (length < RESULT_CACHE_BUFFER_SIZE) {
+		ssize_t result = read(fd, buffer + length, RESULT_CACHE_BUFFER_SIZE - length);
+		if (result < 0)
+			return -1;
+		if (result == 0)
+			break;
+		length += result;
+	}
+	return length;
+}
+
+static bool file_hash(const char *filepath, uint64_t *hash)
+{
+	int fd = open(filepath, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Result cache: open(%s) error: %s\n", filepath, strerror(errno));
+		return false;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	uint64_t size = 0;
+	*hash = 0;
+	ssize_t length;
+	while ((length = buffer_fill(fd)) > 0) {
+		*hash = hash_update(*hash, buffer, length);
+		size += length;
+	}
+	close(fd);
+	if (length < 0) {
+		fprintf(stderr, "Result cache: read(%s) error: %s\n", filepath, strerror(errno));
+		return false;
+	}
+	*hash = hash_final(*hash, size);
+	statistics.input_bytes = size;
+	return true;
+}
+
+static bool file_copy(const char *from, const char *to)
+{
+	int in = open(from, O_RDONLY);
+	if (in < 0)
+		return false;
+	int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		fprintf(stderr, "Result cache: open(%s) error: %s\n", to, strerror(errno));
+		close(in);
+		return false;
+	}
+	ssize_t length;
+	while ((length = buffer_fill(in)) > 0)
+		if (write(out, buffer, length) != length)
+			break;
+	bool done = length == 0;
+	if (!done)
+		fprintf(stderr, "Result cache: copy %s to %s error: %s\n", from, to, strerror(errno));
+	close(in);
+	if (close(out) < 0)
+		done = false;
+	return done;
+}
+
+static bool text_write(const char *filepath, const char *text)
+{
+	FILE *fd = fopen(filepath, "w");
+	if (fd == NULL)
+		return false;
+	fprintf(fd, "%s\n", text);
+	return fclose(fd) == 0;
+}
+
+static char *path_join(const char *path, const char *name)
+{
+	char *filepath = malloc(strlen(path) + 1 + strlen(name) + 1);
+	if (filepath != NULL)
+		sprintf(filepath, "%s/%s", path, name);
+	return filepath;
+}
+
+static void entry_remove(const char *path)
+{
+	static const char *const names[] = {"levels", "spectrum", "key"};
+	for (unsigned i = 0; i < sizeof names / sizeof names[0]; i++) {
+		char *filepath = path_join(path, names[i]);
+		if (filepath != NULL)
+			unlink(filepath);
+		free(filepath);
+	}
+	rmdir(path);
+}
+
+/*
+ * Contadores de todas as execuções, no ficheiro statistics: "<acertos> <falhas>".
+ * O flock serializa as execuções simultâneas.
+ */
+static void statistics_update(bool hit)
+{
+	char filepath[strlen(cache_path) + sizeof "statistics"];
+	strcpy(filepath, cache_path);
+	strcat(filepath, "statistics");
+	int fd = open(filepath, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Result cache: open(%s) error: %s\n", filepath, strerror(errno));
+		return;
+	}
+	flock(fd, LOCK_EX);
+	char text[64] = {0};
+	unsigned long long hits = 0, misses = 0;
+	if (pread(fd, text, sizeof text - 1, 0) > 0)
+		sscanf(text, "%llu %llu", &hits, &misses);
+	if (hit)
+		hits++;
+	else
+		misses++;
+	int length = snprintf(text, sizeof text, "%llu %llu\n", hits, misses);
+	if (pwrite(fd, text, length, 0) != length || ftruncate(fd, length) < 0)
+		fprintf(stderr, "Result cache: write(%s) error: %s\n", filepath, strerror(errno));
+	close(fd);
+	statistics.hits = hits;
+	statistics.misses = misses;
+}
+
+//------------------------------------------------------------------------------
+
+bool result_cache_begin(struct config *config, const char *input_filepath, const char *output)
+{
+	memset(&statistics, 0, sizeof statistics);
+	cache_path = config->result_cache_path;
+	if (mkdir(cache_path, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "mkdir(%s) error: %s\n", cache_path, strerror(errno));
+		return false;
+	}
+	buffer = malloc(RESULT_CACHE_BUFFER_SIZE);
+	char *results_json = config_results_json(config);
+	if (buffer == NULL || results_json == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		free(buffer);
+		free(results_json);
+		return false;
+	}
+	//	calibration_time: a calibração, feita com o próprio ficheiro, altera calibration_delta
+	size_t key_size = strlen(results_json) + 32;
+	key_text = malloc(key_size);
+	if (key_text != NULL)
+		snprintf(key_text, key_size, "%d %u %s",
+			RESULT_CACHE_VERSION, config->calibration_time, results_json);
+	free(results_json);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uint64_t input_hash;
+	if (key_text == NULL || !file_hash(input_filepath, &input_hash)) {
+		free(key_text);
+		free(buffer);
+		return false;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	statistics.hash_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	uint64_t config_hash = hash_final(hash_update(0, (uint8_t *)key_text, strlen(key_text)),
+					strlen(key_text));
+
+	entry_path = malloc(strlen(cache_path) + 2 * 16 + 2);
+	output_filepath = strdup(output);
+	output_format = config->output_format;
+	spectrum_filepath = NULL;
+	if (config->spectrum_enable) {
+		spectrum_filepath = malloc(strlen(output) + strlen(SPECTRUM_FILE_EXTENSION) + 1);
+		if (spectrum_filepath != NULL)
+			sprintf(spectrum_filepath, "%s%s", output, SPECTRUM_FILE_EXTENSION);
+	}
+	if (entry_path == NULL || output_filepath == NULL
+			|| (config->spectrum_enable && spectrum_filepath == NULL)) {
+		fprintf(stderr, "Out of memory\n");
+		active = true;
+		result_cache_end();
+		return false;
+	}
+	sprintf(entry_path, "%s%016" PRIx64 "-%016" PRIx64, cache_path, input_hash, config_hash);
+	active = true;
+	return true;
+}
+
+void result_cache_end()
+{
+	if (!active)
+		return;
+	active = false;
+	free(entry_path);
+	free(key_text);
+	free(output_filepath);
+	free(spectrum_filepath);
+	free(buffer);
+}
+
+/*
+ * Escreve ts no campo binário de filepath na posição offset.
+ */
+static bool ts_write(const char *filepath, off_t offset, int64_t ts)
+{
+	int fd = open(filepath, O_WRONLY);
+	bool done = fd >= 0 && pwrite(fd, &ts, sizeof ts, offset) == sizeof ts;
+	if (!done)
+		fprintf(stderr, "Result cache: error writing ts in %s: %s\n", filepath, strerror(errno));
+	if (fd >= 0)
+		close(fd);
+	return done;
+}
+
+/*
+ * Escreve ts no cabeçalho {"ts": <ts>, ... de um ficheiro JSON;
+ * um número mais curto do que o original é completado com espaços.
+ */
+static bool json_ts_write(const char *filepath, int64_t ts)
+{
+	static const char prefix[] = "{\"ts\": ";
+	char header[64];
+	int fd = open(filepath, O_RDWR);
+	ssize_t length = fd >= 0 ? pread(fd, header, sizeof header - 1, 0) : -1;
+	bool done = false;
+	if (length > 0) {
+		header[length] = '\0';
+		size_t digits = strncmp(header, prefix, sizeof prefix - 1) == 0
+			? strspn(header + sizeof prefix - 1, "-0123456789") : 0;
+		char number[32];
+		int number_length = snprintf(number, sizeof number, "%" PRId64, ts);
+		if (digits > 0 && (size_t)number_length <= digits) {
+			memset(number + number_length, ' ', digits - number_length);
+			done = pwrite(fd, number, digits, sizeof prefix - 1) == (ssize_t)digits;
+		}
+	}
+	if (!done)
+		fprintf(stderr, "Result cache: can't write ts in %s\n", filepath);
+	if (fd >= 0)
+		close(fd);
+	return done;
+}
+
+/*
+ * O instante de início dos ficheiros é o desta execução, como num processamento real.
+ */
+static bool ts_rewrite()
+{
+	int64_t ts = time(NULL);
+	bool done = true;
+	if (strcmp(output_format, ".json") == 0)
+		done = json_ts_write(output_filepath, ts);
+	else if (strcmp(output_format, SLV_EXTENSION) == 0)
+		done = ts_write(output_filepath, offsetof(Slv_header, ts), ts);
+	if (done && spectrum_filepath != NULL)
+		done = ts_write(spectrum_filepath, SPECTRUM_FILE_TS_OFFSET, ts);
+	return done;
+}
+
+bool result_cache_lookup()
+{
+	if (!active)
+		return false;
+	char *levels = path_join(entry_path, "levels");
+	char *spectrum = path_join(entry_path, "spectrum");
+	statistics.hit = levels != NULL && spectrum != NULL
+		&& file_copy(levels, output_filepath)
+		&& (spectrum_filepath == NULL || file_copy(spectrum, spectrum_filepath))
+		&& ts_rewrite();
+	free(levels);
+	free(spectrum);
+	statistics_update(statistics.hit);
+	return statistics.hit;
+}
+
+void result_cache_store()
+{
+	if (!active || statistics.hit)
+		return;
+	char temporary[strlen(entry_path) + 32];
+	sprintf(temporary, "%s.%d.tmp", entry_path, (int)getpid());
+	if (mkdir(temporary, 0755) < 0) {
+		fprintf(stderr, "mkdir(%s) error: %s\n", temporary, strerror(errno));
+		return;
+	}
+	char *levels = path_join(temporary, "levels");
+	char *spectrum = path_join(temporary, "spectrum");
+	char *key = path_join(temporary, "key");
+	bool done = levels != NULL && spectrum != NULL && key != NULL
+		&& file_copy(output_filepath, levels)
+		&& (spectrum_filepath == NULL || file_copy(spectrum_filepath, spectrum))
+		&& text_write(key, key_text);
+	free(levels);
+	free(spectrum);
+	free(key);
+	//	Publicação atómica; outra execução pode ter publicado a mesma entrada
+	if (done && rename(temporary, entry_path) == 0)
+		return;
+	if (done && errno != EEXIST && errno != ENOTEMPTY)
+		fprintf(stderr, "rename(%s) error: %s\n", entry_path, strerror(errno));
+	entry_remove(temporary);
+}
+
+void result_cache_statistics(Result_cache_statistics *result_cache)
+{
+	*result_cache = statistics;
+}
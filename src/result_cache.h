@@ -0,0 +1,76 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/*
+ * Cache dos resultados do processamento de ficheiros (opção -i).
+ *
+ * A chave de uma entrada é formada pelo hash do conteúdo do ficheiro
+ * de entrada e pelo hash dos parâmetros que determinam os níveis
+ * (config_results_json, calibration_time e RESULT_CACHE_VERSION).
+ * Cada entrada é uma diretoria em result_cache_path:
+ *
+ *	<hash do conteúdo>-<hash da configuração>/
+ *		levels		ficheiro de saída
+ *		spectrum	ficheiro de espectro (spectrum_enable)
+ *		key		texto de que é calculado o hash da configuração
+ *
+ * Ao repor uma entrada, o instante de início (ts) do cabeçalho dos ficheiros
+ * JSON, SLV e de espectro passa a ser o da execução, como num processamento real.
+ * A entrada é preparada numa diretoria temporária e publicada com rename,
+ * por isso uma entrada existente está sempre completa.
+ * Os contadores de acertos e falhas de todas as execuções são mantidos
+ * no ficheiro statistics da diretoria da cache.
+ */
+
+#define RESULT_CACHE_VERSION	1	// mudar quando o cálculo dos níveis mudar
+
+typedef struct {
+	bool hit;			// desta execução
+	uint64_t hits, misses;		// de todas as execuções
+	uint64_t input_bytes;
+	double hash_time;		// segundos
+} Result_cache_statistics;
+
+/**
+ * @brief Calcula a chave de input_filepath com config;
+ * output_filepath é o ficheiro de saída a guardar ou repor.
+ */
+bool result_cache_begin(struct config *config, const char *input_filepath, const char *output_filepath);
+void result_cache_end();
+
+/**
+ * @brief Repõe os ficheiros de saída guardados com a mesma chave.
+ *
+ * @return true se existir a entrada - não é preciso processar o ficheiro.
+ */
+bool result_cache_lookup();
+
+/**
+ * @brief Guarda os ficheiros de saída, depois de fechados.
+ */
+void result_cache_store();
+
+void result_cache_statistics(Result_cache_statistics *statistics);
+
+#endif
@@ -62,6 +62,24 @@ void sbuffer_read_consumes(struct sbuffer *this, unsigned n) {
 	assert(this->get < sbuffer_capacity(this));
 }
 
+static unsigned sbuffer_peek_index(struct sbuffer *this, unsigned offset) {
+	unsigned index = this->get + offset;
+	if (index >= sbuffer_capacity(this))
+		index -= sbuffer_capacity(this);
+	return index;
+}
+
+float *sbuffer_peek_ptr(struct sbuffer *this, unsigned offset) {
+	assert(offset <= sbuffer_size(this));
+	return &this->buffer[sbuffer_peek_index(this, offset)];
+}
+
+unsigned sbuffer_peek_size(struct sbuffer *this, unsigned offset) {
+	assert(offset <= sbuffer_size(this));
+	return min(sbuffer_size(this) - offset,
+		sbuffer_capacity(this) - sbuffer_peek_index(this, offset));
+}
+
 float *sbuffer_write_ptr(struct sbuffer *this) {
 	return &this->buffer[this->put];
 }
@@ -40,6 +40,18 @@ unsigned sbuffer_read_size(struct sbuffer *this);
  */
 void sbuffer_read_consumes(struct sbuffer *this, unsigned n);
 
+/**
+ * @brief Retorna um ponteiro para o elemento que está offset posições
+ * à frente da posição de leitura, sem consumir.
+ */
+float *sbuffer_peek_ptr(struct sbuffer *this, unsigned offset);
+
+/**
+ * @brief Retorna o número de elementos contíguos que podem ser lidos
+ * a partir de sbuffer_peek_ptr(this, offset).
+ */
+unsigned sbuffer_peek_size(struct sbuffer *this, unsigned offset);
+
 /**
  * @brief Retorna um ponteiro para a zona de escrita.
  */
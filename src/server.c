@@ -1,152 +1,760 @@
+#define _GNU_SOURCE	// accept4
+
 #include <threads.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <math.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 
 #include "config.h"
+#include "server.h"
+#include "history.h"
+#include "server_protocol.h"
+#include "spectrum.h"
+
+/*
+ * Servidor local de níveis (socket UNIX).
+ *
+ * server_send deposita o registo do segmento numa fila lock-free
+ * (um produtor, um consumidor) e acorda a tarefa do servidor através
+ * de um eventfd. A tarefa, baseada em epoll, formata cada registo uma vez
+ * e acrescenta a mensagem, partilhada por contagem de referências,
+ * à fila de saída de cada cliente. As escritas são não bloqueantes;
+ * um cliente que não aceita dados fica à espera de EPOLLOUT.
+ * Com a fila de um cliente cheia, aplica-se a política server_backpressure.
+ *
+ * Os registos das últimas server_history horas são mantidos em memória
+ * (history.h). Um cliente pode enviar pedidos, terminados por '\n':
+ *	since <ts>			registos com ts >= <ts>
+ *	range <a>..<b>			registos com <a> <= ts <= <b>
+ *	aggregate LAeq <a>..<b>		{"from": a, "to": b, "segments": n, "LAeq": x}
+ * Os registos pedidos são enviados, à medida que o socket os aceita,
+ * em mensagens com até SERVER_BACKFILL_RECORDS registos, seguidos de
+ * {"end": n}, em que n é o número de registos enviados.
+ * Em JSON, cada objeto (registo, resposta ou erro) termina em '\n':
+ * o socket não delimita as mensagens.
+ *
+ * Com o pedido "binary" o cliente passa a receber tramas binárias
+ * (server_protocol.h). Cada registo é codificado uma única vez em cada
+ * formato pedido pelos clientes e partilhado por todos eles.
+ */
+
+typedef struct {
+	unsigned references;
+	bool history;		// registos do histórico: não são descartados
+	unsigned length;
+	char data[];
+} Message;
+
+typedef struct client {
+	int fd;			// -1 depois de fechado
+	unsigned index;		// posição em clients
+	struct client *next;	// lista de clientes fechados
+	Message *queue[SERVER_CLIENT_QUEUE_SIZE];
+	unsigned head, count;
+	unsigned offset;	// bytes já escritos da primeira mensagem
+	bool waiting;		// à espera de EPOLLOUT
+	bool eof;		// o cliente fechou a escrita: fechado depois de esvaziar a fila
+	bool binary;		// protocolo binário (server_protocol.h)
+	char request[SERVER_REQUEST_SIZE];
+	unsigned request_length;
+	bool backfill;		// envio de registos do histórico em curso
+	uint64_t backfill_next, backfill_end, backfill_sent;
+} Client;
+
+//	Fila de registos do ciclo de processamento para o servidor
+static Server_record record_queue[SERVER_QUEUE_SIZE];
+static atomic_uint record_put;
+static atomic_uint record_get;
+static atomic_bool server_stop;
+static atomic_uint_least64_t records_dropped;
 
-static mtx_t server_mutex;
-static cnd_t server_condition;
 static thrd_t server_thread;
+static int listen_fd;
+static int epoll_fd;
+static int event_fd;
+
+//	Só acedidos pela tarefa do servidor
+static Client **clients;
+static unsigned clients_size, clients_count;
+static Client *clients_closed;	// libertados no fim de cada ciclo de epoll
+static enum {DROP_OLDEST, DROP_NEWEST, DISCONNECT} backpressure;
+static atomic_uint_least64_t messages_dropped;
+static atomic_uint_least64_t clients_disconnected;
+static History *history;
+static uint64_t record_seq;	// número de ordem do próximo registo
+
+static void message_release(Message *message)
+{
+	if (--message->references == 0)
+		free(message);
+}
+
+static Message *message_create(const char *data, unsigned length)
+{
+	Message *message = malloc(sizeof *message + length);
+	if (message == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+	message->references = 1;
+	message->history = false;
+	message->length = length;
+	memcpy(message->data, data, length);
+	return message;
+}
+
+static int record_format(char *buffer, size_t size, const History_record *record)
+{
+	int length = snprintf(buffer, size, "{\"ts\": %lld, \"values\": "
+			"{\"LAeq\": %.1f, \"LAFmin\": %.1f, \"LAE\": %.1f, \"LAFmax\": %.1f, \"LApeak\": %.1f",
+			(long long)record->ts, record->laeq, record->lafmin, record->lae,
+			record->lafmax, record->lapeak);
+	if (config_struct->direction_enable)
+		length += snprintf(buffer + length, size - length,
+				", \"direction\": %d", record->direction);
+	length += snprintf(buffer + length, size - length, " } }\n");
+	return length;
+}
+
+static Message *message_format(const History_record *record)
+{
+	char buffer[SERVER_MESSAGE_SIZE];
+	return message_create(buffer, record_format(buffer, sizeof buffer, record));
+}
+
+//------------------------------------------------------------------------------
+//	Protocolo binário - little-endian, independente da arquitetura
+
+static uint8_t *put_uint16(uint8_t *bytes, uint16_t value)
+{
+	bytes[0] = value;
+	bytes[1] = value >> 8;
+	return bytes + 2;
+}
+
+static uint8_t *put_uint32(uint8_t *bytes, uint32_t value)
+{
+	put_uint16(bytes, value);
+	return put_uint16(bytes + 2, value >> 16);
+}
+
+static uint8_t *put_uint64(uint8_t *bytes, uint64_t value)
+{
+	put_uint32(bytes, value);
+	return put_uint32(bytes + 4, value >> 32);
+}
+
+static uint8_t *put_float(uint8_t *bytes, float value)
+{
+	uint32_t word;
+	memcpy(&word, &value, sizeof word);
+	return put_uint32(bytes, word);
+}
+
+/*
+ * Cabeçalho da trama, escrito depois dos dados, que começam
+ * em buffer + SERVER_FRAME_HEADER_SIZE e terminam em end.
+ * Retorna a dimensão da trama.
+ */
+static unsigned frame_header(uint8_t *buffer, unsigned type, const uint8_t *end)
+{
+	unsigned length = end - buffer - SERVER_FRAME_HEADER_SIZE;
+	uint8_t *bytes = put_uint16(buffer, SERVER_PROTOCOL_MAGIC);
+	*bytes++ = SERVER_PROTOCOL_VERSION;
+	*bytes++ = type;
+	put_uint32(bytes, length);
+	return SERVER_FRAME_HEADER_SIZE + length;
+}
+
+static unsigned record_encode(uint8_t *buffer, unsigned type, uint64_t seq, const History_record *record,
+		unsigned channels, const float *channel_levels, unsigned bands, const float *band_levels)
+{
+	uint8_t *bytes = put_uint64(buffer + SERVER_FRAME_HEADER_SIZE, seq);
+	bytes = put_uint64(bytes, record->ts);
+	bytes = put_float(bytes, record->laeq);
+	bytes = put_float(bytes, record->lafmin);
+	bytes = put_float(bytes, record->lae);
+	bytes = put_float(bytes, record->lafmax);
+	bytes = put_float(bytes, record->lapeak);
+	bytes = put_uint32(bytes, record->direction);
+	bytes = put_uint16(bytes, channels);
+	bytes = put_uint16(bytes, bands);
+	for (unsigned i = 0; i < channels; i++)
+		bytes = put_float(bytes, channel_levels[i]);
+	for (unsigned i = 0; i < bands; i++)
+		bytes = put_float(bytes, band_levels[i]);
+	return frame_header(buffer, type, bytes);
+}
+
+static Message *message_encode(uint64_t seq, const Server_record *record, const History_record *levels)
+{
+	uint8_t buffer[SERVER_MESSAGE_SIZE];
+	return message_create((char *)buffer, record_encode(buffer, SERVER_FRAME_RECORD, seq, levels,
+			record->channels, record->channel_levels, record->bands, record->band_levels));
+}
+
+static Message *message_hello()
+{
+	uint8_t buffer[SERVER_MESSAGE_SIZE];
+	unsigned bands = config_struct->spectrum_enable ? spectrum_octave_bands(config_struct->sample_rate) : 0;
+	uint8_t *bytes = put_uint32(buffer + SERVER_FRAME_HEADER_SIZE, config_struct->sample_rate);
+	bytes = put_uint32(bytes, config_struct->segment_duration);
+	bytes = put_uint16(bytes, config_struct->channels < SERVER_CHANNELS_MAX
+				? config_struct->channels : SERVER_CHANNELS_MAX);
+	bytes = put_uint16(bytes, bands);
+	for (unsigned i = 0; i < bands; i++)
+		bytes = put_float(bytes, spectrum_octave_frequency(i));
+	return message_create((char *)buffer, frame_header(buffer, SERVER_FRAME_HELLO, bytes));
+}
+
+//------------------------------------------------------------------------------
+
+static void client_close(Client *client)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+	for (unsigned i = 0; i < client->count; i++)
+		message_release(client->queue[(client->head + i) % SERVER_CLIENT_QUEUE_SIZE]);
+	client->count = 0;
+	clients[client->index] = clients[--clients_count];
+	clients[client->index]->index = client->index;
+	//	Podem existir eventos pendentes deste cliente no ciclo de epoll corrente
+	client->fd = -1;
+	client->next = clients_closed;
+	clients_closed = client;
+}
+
+static void clients_closed_free()
+{
+	while (clients_closed != NULL) {
+		Client *client = clients_closed;
+		clients_closed = client->next;
+		free(client);
+	}
+}
+
+static void client_events(Client *client)
+{
+	struct epoll_event event = {.events = (client->eof ? 0 : EPOLLIN | EPOLLRDHUP)
+				| (client->waiting ? EPOLLOUT : 0), .data.ptr = client};
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+}
+
+static void client_wait(Client *client, bool waiting)
+{
+	if (client->waiting == waiting)
+		return;
+	client->waiting = waiting;
+	client_events(client);
+}
+
+static void client_push(Client *client, Message *message)
+{
+	client->queue[(client->head + client->count++) % SERVER_CLIENT_QUEUE_SIZE] = message;
+}
 
-static unsigned long long server_ts;
-static float server_laeq;
-static float server_lapeak;
-static float server_lafmax;
-static float server_lafmin;
-static float server_lae;
+/*
+ * Acrescenta à fila de saída registos do histórico pedidos pelo cliente,
+ * enquanto a fila estiver a menos de metade: a outra metade fica
+ * para os registos em tempo real.
+ */
+static void client_backfill(Client *client)
+{
+	while (client->backfill && client->count < SERVER_CLIENT_QUEUE_SIZE / 2) {
+		char buffer[SERVER_BACKFILL_RECORDS * SERVER_MESSAGE_SIZE];
+		uint8_t *bytes = (uint8_t *)buffer;
+		int length = 0;
+		//	Os registos mais antigos podem ter saído do histórico entretanto
+		if (client->backfill_next < history_first(history))
+			client->backfill_next = history_first(history);
+		if (client->backfill_next >= client->backfill_end) {
+			if (client->binary)
+				length = frame_header(bytes, SERVER_FRAME_END,
+						put_uint64(bytes + SERVER_FRAME_HEADER_SIZE, client->backfill_sent));
+			else
+				length = snprintf(buffer, sizeof buffer, "{\"end\": %llu}\n",
+						(unsigned long long)client->backfill_sent);
+			client->backfill = false;
+		}
+		else {
+			for (unsigned n = 0; n < SERVER_BACKFILL_RECORDS
+					&& client->backfill_next < client->backfill_end; n++) {
+				const History_record *record = history_get(history, client->backfill_next);
+				if (client->binary)
+					length += record_encode(bytes + length, SERVER_FRAME_HISTORY, client->backfill_next,
+							record, 0, NULL, 0, NULL);
+				else
+					length += record_format(buffer + length, sizeof buffer - length, record);
+				client->backfill_next++;
+				client->backfill_sent++;
+			}
+		}
+		Message *message = message_create(buffer, length);
+		if (message == NULL)
+			return;
+		message->history = true;
+		client_push(client, message);
+	}
+}
+
+/*
+ * Escreve as mensagens em fila até o socket deixar de aceitar dados.
+ * Retorna false se o cliente foi fechado.
+ */
+static bool client_flush(Client *client)
+{
+	while (true) {
+		client_backfill(client);
+		if (client->count == 0)
+			break;
+		struct iovec iov[SERVER_CLIENT_QUEUE_SIZE];
+		for (unsigned i = 0; i < client->count; i++) {
+			Message *message = client->queue[(client->head + i) % SERVER_CLIENT_QUEUE_SIZE];
+			iov[i].iov_base = message->data;
+			iov[i].iov_len = message->length;
+		}
+		iov[0].iov_base = (char *)iov[0].iov_base + client->offset;
+		iov[0].iov_len -= client->offset;
+		ssize_t written = writev(client->fd, iov, client->count);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				client_wait(client, true);
+				return true;
+			}
+			client_close(client);
+			return false;
+		}
+		size_t remaining = written;
+		while (client->count > 0) {
+			Message *message = client->queue[client->head];
+			if (remaining < message->length - client->offset) {
+				client->offset += remaining;
+				break;
+			}
+			remaining -= message->length - client->offset;
+			client->offset = 0;
+			message_release(message);
+			client->head = (client->head + 1) % SERVER_CLIENT_QUEUE_SIZE;
+			client->count--;
+		}
+	}
+	if (client->eof) {
+		client_close(client);
+		return false;
+	}
+	client_wait(client, false);
+	return true;
+}
+
+/*
+ * Retorna false se o cliente foi fechado.
+ */
+static bool client_enqueue(Client *client, Message *message)
+{
+	if (client->count == SERVER_CLIENT_QUEUE_SIZE) {
+		atomic_fetch_add_explicit(&messages_dropped, 1, memory_order_relaxed);
+		switch (backpressure) {
+		case DROP_NEWEST:
+			return true;
+		case DISCONNECT:
+			atomic_fetch_add_explicit(&clients_disconnected, 1, memory_order_relaxed);
+			client_close(client);
+			return false;
+		case DROP_OLDEST: {
+			//	A primeira mensagem, se já parcialmente escrita, é mantida, tal como
+			//	os registos do histórico, já contados no fim do envio ({"end": n})
+			unsigned oldest = client->offset > 0 ? 1 : 0;
+			while (oldest < client->count
+					&& client->queue[(client->head + oldest) % SERVER_CLIENT_QUEUE_SIZE]->history)
+				oldest++;
+			if (oldest == client->count)
+				return true;
+			message_release(client->queue[(client->head + oldest) % SERVER_CLIENT_QUEUE_SIZE]);
+			for (unsigned i = oldest; i > 0; i--)
+				client->queue[(client->head + i) % SERVER_CLIENT_QUEUE_SIZE] =
+					client->queue[(client->head + i - 1) % SERVER_CLIENT_QUEUE_SIZE];
+			client->head = (client->head + 1) % SERVER_CLIENT_QUEUE_SIZE;
+			client->count--;
+			break;
+		}
+		}
+	}
+	message->references++;
+	client_push(client, message);
+	return true;
+}
+
+/*
+ * Envia uma mensagem só para este cliente. Retorna false se o cliente foi fechado.
+ */
+static bool client_send(Client *client, Message *message)
+{
+	if (message == NULL)
+		return true;
+	bool open = client_enqueue(client, message);
+	message_release(message);
+	return open && (client->waiting || client_flush(client));
+}
 
+static bool client_reply(Client *client, const char *text, int length)
+{
+	return client_send(client, message_create(text, length));
+}
+
+/*
+ * Retorna false se o cliente foi fechado.
+ */
+static bool client_error(Client *client, const char *text)
+{
+	char reply[SERVER_MESSAGE_SIZE];
+	if (!client->binary)
+		return client_reply(client, reply, snprintf(reply, sizeof reply, "{\"error\": \"%s\"}\n", text));
+	uint8_t *bytes = (uint8_t *)reply;
+	unsigned length = strlen(text);
+	memcpy(bytes + SERVER_FRAME_HEADER_SIZE, text, length);
+	return client_reply(client, reply,
+			frame_header(bytes, SERVER_FRAME_ERROR, bytes + SERVER_FRAME_HEADER_SIZE + length));
+}
+
+static bool client_aggregate(Client *client, uint64_t from, uint64_t to)
+{
+	char reply[SERVER_MESSAGE_SIZE];
+	uint64_t first = history_find(history, from);
+	uint64_t end = history_find(history, to + 1);
+	uint64_t segments = end > first ? end - first : 0;
+	if (client->binary) {
+		uint8_t *bytes = put_uint64((uint8_t *)reply + SERVER_FRAME_HEADER_SIZE, from);
+		bytes = put_uint64(bytes, to);
+		bytes = put_uint64(bytes, segments);
+		bytes = put_float(bytes, segments > 0 ? history_laeq(history, first, end) : NAN);
+		return client_reply(client, reply, frame_header((uint8_t *)reply, SERVER_FRAME_AGGREGATE, bytes));
+	}
+	int length = snprintf(reply, sizeof reply,
+			"{\"from\": %llu, \"to\": %llu, \"segments\": %llu, \"LAeq\": ",
+			(unsigned long long)from, (unsigned long long)to, (unsigned long long)segments);
+	if (segments > 0)
+		length += snprintf(reply + length, sizeof reply - length, "%.1f}\n",
+				history_laeq(history, first, end));
+	else
+		length += snprintf(reply + length, sizeof reply - length, "null}\n");
+	return client_reply(client, reply, length);
+}
 
-static void timespec_add_mili(struct timespec *ts, unsigned milis) {
-	if ( 999999999 - ts->tv_nsec > 1000000L * milis) {
-		ts->tv_nsec += 1000000L * milis;
+static bool client_request(Client *client, const char *request)
+{
+	unsigned long long from, to;
+	if (strcmp(request, "binary") == 0) {
+		client->binary = true;
+		return client_send(client, message_hello());
+	}
+	if (strcmp(request, "json") == 0) {
+		client->binary = false;
+		return true;
+	}
+	if (history == NULL)
+		return client_error(client, "history disabled");
+	if (sscanf(request, "since %llu", &from) == 1) {
+		client->backfill_next = history_find(history, from);
+		client->backfill_end = history_end(history);
+	}
+	else if (sscanf(request, "range %llu..%llu", &from, &to) == 2) {
+		client->backfill_next = history_find(history, from);
+		client->backfill_end = history_find(history, to + 1);
+	}
+	else if (sscanf(request, "aggregate LAeq %llu..%llu", &from, &to) == 2) {
+		return client_aggregate(client, from, to);
 	}
 	else {
-		ts->tv_sec += 1;
-		ts->tv_nsec = 1000000L * milis - (999999999 - ts->tv_nsec);
+		return client_error(client, "unknown request");
+	}
+	client->backfill = true;
+	client->backfill_sent = 0;
+	return client->waiting || client_flush(client);
+}
+
+static void server_broadcast()
+{
+	unsigned get = atomic_load_explicit(&record_get, memory_order_relaxed);
+	unsigned put = atomic_load_explicit(&record_put, memory_order_acquire);
+	for (; get != put; get++) {
+		Server_record *record = &record_queue[get % SERVER_QUEUE_SIZE];
+		History_record levels = {.ts = record->ts, .laeq = record->laeq, .lafmin = record->lafmin,
+				.lae = record->lae, .lafmax = record->lafmax, .lapeak = record->lapeak,
+				.direction = record->direction};
+		if (history != NULL)
+			history_append(history, &levels);
+		//	Cada formato é codificado uma vez, só se houver clientes que o usem
+		Message *json = NULL, *binary = NULL;
+		for (unsigned i = 0; i < clients_count; ) {
+			Client *client = clients[i];
+			Message **message = client->binary ? &binary : &json;
+			if (*message == NULL)
+				*message = client->binary ? message_encode(record_seq, record, &levels)
+							: message_format(&levels);
+			if (*message == NULL || (client_enqueue(client, *message)
+					&& (client->waiting || client_flush(client))))
+				i++;
+			//	Um cliente fechado é substituído na posição i pelo último
+		}
+		if (json != NULL)
+			message_release(json);
+		if (binary != NULL)
+			message_release(binary);
+		record_seq++;
 	}
+	atomic_store_explicit(&record_get, get, memory_order_release);
 }
 
-static int sockcli_table[5];
-static size_t sockcli_table_current;
+static void server_accept()
+{
+	while (true) {
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				fprintf(stderr, "Error in \"accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK)\": %s\n",
+					strerror(errno));
+			return;
+		}
+		if (clients_count == clients_size) {
+			unsigned size = clients_size * 2;
+			Client **new_clients = realloc(clients, size * sizeof *clients);
+			if (new_clients == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				close(fd);
+				continue;
+			}
+			clients = new_clients;
+			clients_size = size;
+		}
+		Client *client = calloc(1, sizeof *client);
+		if (client == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			close(fd);
+			continue;
+		}
+		client->fd = fd;
+		struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP, .data.ptr = client};
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+			fprintf(stderr, "Error in \"epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd)\": %s\n", strerror(errno));
+			close(fd);
+			free(client);
+			continue;
+		}
+		client->index = clients_count;
+		clients[clients_count++] = client;
+	}
+}
 
-#define ARRAY_SIZE(a) (sizeof (a) / sizeof (a)[0])
+static void client_event(Client *client, uint32_t events)
+{
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		client_close(client);
+		return;
+	}
+	//	Com EPOLLRDHUP ainda pode haver pedidos por ler
+	if (events & (EPOLLIN | EPOLLRDHUP)) {
+		ssize_t nbytes;
+		while ((nbytes = read(client->fd, client->request + client->request_length,
+				sizeof client->request - client->request_length)) > 0) {
+			client->request_length += nbytes;
+			char *newline;
+			while ((newline = memchr(client->request, '\n', client->request_length)) != NULL) {
+				*newline = '\0';
+				if (!client_request(client, client->request))
+					return;
+				unsigned consumed = newline + 1 - client->request;
+				client->request_length -= consumed;
+				memmove(client->request, newline + 1, client->request_length);
+			}
+			if (client->request_length == sizeof client->request) {
+				client->request_length = 0;
+				if (!client_error(client, "request too long"))
+					return;
+			}
+		}
+		if (nbytes == 0) {
+			//	Fim dos pedidos: as respostas em fila ainda são enviadas
+			client->eof = true;
+			client_events(client);
+			if (!client->waiting)
+				client_flush(client);
+			return;
+		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			client_close(client);
+			return;
+		}
+	}
+	if (events & EPOLLOUT)
+		client_flush(client);
+}
 
-extern bool running;
+static int server_thread_func(void *not_used)
+{
+	struct epoll_event events[SERVER_EPOLL_EVENTS];
+	while (!atomic_load(&server_stop)) {
+		int n = epoll_wait(epoll_fd, events, SERVER_EPOLL_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Error in \"epoll_wait\": %s\n", strerror(errno));
+			break;
+		}
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.ptr == &listen_fd) {
+				server_accept();
+			}
+			else if (events[i].data.ptr == &event_fd) {
+				uint64_t value;
+				if (read(event_fd, &value, sizeof value) < 0 && errno != EAGAIN)
+					fprintf(stderr, "Error in \"read(event_fd)\": %s\n", strerror(errno));
+				server_broadcast();
+			}
+			else {
+				Client *client = events[i].data.ptr;
+				if (client->fd >= 0)
+					client_event(client, events[i].events);
+			}
+		}
+		clients_closed_free();
+	}
+	return 0;
+}
 
-static int server_thread_func(void *not_used) {
-	int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
-	if (sockfd < 0) {
-		fprintf(stderr, "Error in \"socket(AF_UNIX, SOCK_DGRAM, 0)\"");
-		exit(EXIT_FAILURE);
+static void setup_error(const char *call)
+{
+	fprintf(stderr, "Error in \"%s\": %s\n", call, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+void server_init() {
+	//	Milhares de clientes - usar o limite máximo de descritores
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
 	}
-        int flags = fcntl(sockfd, F_GETFL, 0);
-        if (flags < 0) {
-                fprintf(stderr, "Error in \"fcntl(sockfd, F_GETFL, 0)\"");
-                exit(EXIT_FAILURE);
-        }
-        int result = fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
-        if (result < 0) {
-                fprintf(stderr, "Error in \"fcntl(sockfd, F_SETFL, 0)\"");
-                exit(EXIT_FAILURE);
-        }
+
+	if (strcmp(config_struct->server_backpressure, "drop_newest") == 0)
+		backpressure = DROP_NEWEST;
+	else if (strcmp(config_struct->server_backpressure, "disconnect") == 0)
+		backpressure = DISCONNECT;
+	else
+		backpressure = DROP_OLDEST;
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0)
+		setup_error("socket(AF_UNIX, SOCK_STREAM, 0)");
 	struct sockaddr_un sockaddr_local;
 	sockaddr_local.sun_family = AF_UNIX;
 	strcpy(sockaddr_local.sun_path, config_struct->server_socket);
 	unlink(sockaddr_local.sun_path);
 	size_t len = sizeof(sockaddr_local.sun_family) + strlen(sockaddr_local.sun_path);
-	result = bind(sockfd, (struct sockaddr *)&sockaddr_local, len);
-	if (result < 0) {
-		fprintf(stderr, "Error in \"bind(sock, local, len)\"");
+	if (bind(listen_fd, (struct sockaddr *)&sockaddr_local, len) < 0)
+		setup_error("bind(sock, local, len)");
+	if (listen(listen_fd, SOMAXCONN) < 0)
+		setup_error("listen(listen_fd, SOMAXCONN)");
+
+	event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (event_fd < 0)
+		setup_error("eventfd(0, EFD_NONBLOCK)");
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+		setup_error("epoll_create1(EPOLL_CLOEXEC)");
+	struct epoll_event event = {.events = EPOLLIN, .data.ptr = &listen_fd};
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) < 0)
+		setup_error("epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd)");
+	event.data.ptr = &event_fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &event) < 0)
+		setup_error("epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd)");
+
+	clients_size = 16;
+	clients_count = 0;
+	clients_closed = NULL;
+	history = NULL;
+	record_seq = 0;
+	if (config_struct->server_history > 0) {
+		history = history_create((uint64_t)config_struct->server_history * 3600 * 1000
+				/ config_struct->segment_duration);
+		if (history == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	clients = malloc(clients_size * sizeof *clients);
+	if (clients == NULL) {
+		fprintf(stderr, "Out of memory\n");
 		exit(EXIT_FAILURE);
 	}
+	atomic_init(&record_put, 0);
+	atomic_init(&record_get, 0);
+	atomic_init(&server_stop, false);
+	atomic_init(&records_dropped, 0);
+	atomic_init(&messages_dropped, 0);
+	atomic_init(&clients_disconnected, 0);
 
-	result = listen(sockfd, ARRAY_SIZE(sockcli_table));
-	if (result < 0) {
-		fprintf(stderr, "Error in \"listen(sockfd, 0)\"");
+	if (thrd_success != thrd_create(&server_thread, server_thread_func, NULL)) {
+		fprintf(stderr, "Error in \"thrd_create(&thread_server, server_thread_func, NULL)\"");
 		exit(EXIT_FAILURE);
 	}
-
-//	printf("Waiting for connection in \"sound_server_socket\" ...\n");
-        mtx_lock(&server_mutex);
-        while (running) {
-		struct timespec time_point;
-                timespec_get(&time_point, TIME_UTC);
-                timespec_add_mili(&time_point, 100);     /* daqui a 100 milisegundos */
-                int result = cnd_timedwait(&server_condition, &server_mutex, &time_point);
-                if (result == thrd_success) {
-                        char buffer[120];
-                        snprintf(buffer, sizeof buffer, "{\"ts\": %lld, \"values\": "
-                                         "{\"LAeq\": %.1f, \"LAFmin\": %.1f, \"LAE\": %.1f, \"LAFmax\": %.1f, \"LApeak\": %.1f } }",
-                                server_ts, server_laeq, server_lafmin, server_lae, server_lafmax, server_lapeak);
-                        for (int i = 0; i < sockcli_table_current; ) {
-                                ssize_t written = write(sockcli_table[i], buffer, strlen(buffer));
-                                if (written < 0) {
-                                    close(sockcli_table[i]);
-                                    sockcli_table[i] = sockcli_table[--sockcli_table_current];
-                                }
-                                else {
-                                        i++;
-                                }
-                        }
-                }
-                else if (result == thrd_timedout 
-                        && sockcli_table_current < ARRAY_SIZE(sockcli_table)) {
-                        int sockclifd = accept(sockfd, NULL, 0);
-                        if (sockclifd < 0) {
-                                if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                                        fprintf(stderr, "Error in \"accept(sockfd, NULL, 0)\"");
-                                        exit(EXIT_FAILURE);
-                                }
-                        }
-                        else { /* nova ligação */
-                                int flags = fcntl(sockclifd, F_GETFL, 0);
-                                if (flags < 0) {
-                                        fprintf(stderr, "Error in \"fcntl(sockfd, F_GETFL, 0)\"");
-                                        exit(EXIT_FAILURE);
-                                }
-                                int result = fcntl(sockclifd, F_SETFL, flags | O_NONBLOCK);
-                                if (result < 0) {
-                                        fprintf(stderr, "Error in \"fcntl(sockfd, F_SETFL, 0)\"");
-                                        exit(EXIT_FAILURE);
-                                }
-                                sockcli_table[sockcli_table_current++] = sockclifd;
-                        }
-                }
-        }
-        mtx_unlock(&server_mutex);
-        return 0;
 }
 
-void server_init() {
-        mtx_init(&server_mutex, mtx_plain);
-        cnd_init(&server_condition);
-        if (thrd_success != thrd_create(&server_thread, server_thread_func, NULL)) {
-                fprintf(stderr, "Error in \"thrd_create(&thread_server, server_thread_func, NULL)\"");
-                exit(EXIT_FAILURE);
-        }
+static void server_wakeup()
+{
+	uint64_t one = 1;
+	if (write(event_fd, &one, sizeof one) < 0 && errno != EAGAIN)
+		fprintf(stderr, "Error in \"write(event_fd)\": %s\n", strerror(errno));
 }
 
 void server_end() {
-        int result;
-        thrd_join(server_thread, &result);
+	atomic_store(&server_stop, true);
+	server_wakeup();
+	int result;
+	thrd_join(server_thread, &result);
+	while (clients_count > 0)
+		client_close(clients[0]);
+	clients_closed_free();
+	free(clients);
+	if (history != NULL)
+		history_destroy(history);
+	close(epoll_fd);
+	close(event_fd);
+	close(listen_fd);
+	unlink(config_struct->server_socket);
 }
 
-void server_send(uint64_t ts, float laeq, float lafmin, float lae, float lafmax, float lapeak) {
-	mtx_lock(&server_mutex);
-        server_ts = ts;
-        server_laeq = laeq;
-        server_lapeak = lapeak;
-        server_lafmax = lafmax;
-        server_lafmin = lafmin;
-        server_lae = lae;
-	mtx_unlock(&server_mutex);
-	cnd_signal(&server_condition);
+void server_send(const Server_record *record) {
+	unsigned put = atomic_load_explicit(&record_put, memory_order_relaxed);
+	unsigned get = atomic_load_explicit(&record_get, memory_order_acquire);
+	if (put - get == SERVER_QUEUE_SIZE) {
+		atomic_fetch_add_explicit(&records_dropped, 1, memory_order_relaxed);
+		return;
+	}
+	record_queue[put % SERVER_QUEUE_SIZE] = *record;
+	atomic_store_explicit(&record_put, put + 1, memory_order_release);
+	server_wakeup();
 }
 
+void server_statistics(Server_statistics *statistics)
+{
+	statistics->records_dropped = atomic_load_explicit(&records_dropped, memory_order_relaxed);
+	statistics->messages_dropped = atomic_load_explicit(&messages_dropped, memory_order_relaxed);
+	statistics->clients_disconnected = atomic_load_explicit(&clients_disconnected, memory_order_relaxed);
+}
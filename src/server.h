@@ -1,9 +1,41 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <stdint.h>
+
+#define SERVER_QUEUE_SIZE		64	// registos entre o processamento e o servidor
+#define SERVER_CLIENT_QUEUE_SIZE	64	// mensagens pendentes por cliente
+#define SERVER_MESSAGE_SIZE		200
+#define SERVER_EPOLL_EVENTS		256
+#define SERVER_REQUEST_SIZE		128	// dimensão máxima de um pedido
+#define SERVER_BACKFILL_RECORDS		32	// registos do histórico por mensagem
+#define SERVER_CHANNELS_MAX		8	// níveis por canal no protocolo binário
+#define SERVER_BANDS_MAX		16	// níveis por banda no protocolo binário
+
+/*
+ * Registo de um segmento. Os níveis por canal e por banda só são enviados
+ * aos clientes do protocolo binário (server_protocol.h).
+ */
+typedef struct {
+	uint64_t ts;		// segundos, UNIX
+	float laeq, lafmin, lae, lafmax, lapeak;
+	int direction;
+	unsigned channels, bands;
+	float channel_levels[SERVER_CHANNELS_MAX];	// LZeq de cada canal
+	float band_levels[SERVER_BANDS_MAX];		// Leq de cada banda de oitava
+} Server_record;
+
+typedef struct {
+	uint64_t records_dropped;	// registos perdidos com a fila do servidor cheia
+	uint64_t messages_dropped;	// mensagens não entregues a clientes lentos
+	uint64_t clients_disconnected;	// clientes desligados (política disconnect)
+} Server_statistics;
+
 void server_init();
 void server_end();
 
-void server_send(uint64_t ts, float laeq, float lafmin, float lae, float lafmax, float lapeak);
+void server_send(const Server_record *record);
+
+void server_statistics(Server_statistics *statistics);
 
 #endif
@@ -0,0 +1,84 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SERVER_PROTOCOL_H
+#define SERVER_PROTOCOL_H
+
+/*
+ * Protocolo binário do servidor local.
+ *
+ * Por omissão o servidor envia mensagens JSON. Um cliente muda para
+ * o protocolo binário enviando a linha "binary\n" (e volta ao JSON com
+ * "json\n"); o servidor responde com uma trama HELLO. Os pedidos
+ * ao histórico continuam a ser linhas de texto.
+ *
+ * Cada trama tem um cabeçalho fixo seguido de length bytes de dados.
+ * Todos os campos são little-endian; float é IEEE 754 de 32 bits.
+ *
+ *	cabeçalho
+ *		uint16_t magic			SERVER_PROTOCOL_MAGIC
+ *		uint8_t  version		SERVER_PROTOCOL_VERSION
+ *		uint8_t  type			SERVER_FRAME_*
+ *		uint32_t length			dimensão dos dados
+ *
+ *	SERVER_FRAME_HELLO
+ *		uint32_t sample_rate
+ *		uint32_t segment_duration	milisegundos
+ *		uint16_t channels		número de canais de entrada
+ *		uint16_t bands			número de bandas de oitava (0 sem espectro)
+ *		float    frequency[bands]	frequência central de cada banda
+ *	SERVER_FRAME_RECORD
+ *		uint64_t seq			número de ordem do segmento
+ *		int64_t  ts			segundos, UNIX
+ *		float    LAeq, LAFmin, LAE, LAFmax, LApeak
+ *		int32_t  direction		DIRECTION_UNDEFINED se inativo
+ *		uint16_t channels		número de níveis por canal
+ *		uint16_t bands			número de níveis por banda
+ *		float    LZeq[channels]		nível equivalente Z de cada canal
+ *		float    Leq[bands]		nível equivalente de cada banda de oitava (canal 0)
+ *	SERVER_FRAME_HISTORY		registo pedido ao histórico
+ *		formato de SERVER_FRAME_RECORD, com channels e bands a 0
+ *	SERVER_FRAME_END		fim dos registos pedidos ao histórico
+ *		uint64_t count			número de registos enviados
+ *	SERVER_FRAME_AGGREGATE		resposta a "aggregate LAeq <a>..<b>"
+ *		int64_t  from, to
+ *		uint64_t segments
+ *		float    LAeq			NaN se segments for 0
+ *	SERVER_FRAME_ERROR
+ *		char     text[length]		mensagem de erro (sem terminador)
+ *
+ * O seq de SERVER_FRAME_RECORD é consecutivo; um salto indica registos
+ * perdidos (política server_backpressure), que podem ser pedidos
+ * ao histórico. O seq de SERVER_FRAME_HISTORY é o mesmo do registo original.
+ * Um cliente deve ignorar os tipos de trama que desconhece e os bytes
+ * para além dos campos que conhece, o que permite acrescentar campos
+ * sem mudar de versão.
+ */
+
+#define SERVER_PROTOCOL_MAGIC		0x4d53	// "SM"
+#define SERVER_PROTOCOL_VERSION		1
+#define SERVER_FRAME_HEADER_SIZE	8
+
+#define SERVER_FRAME_HELLO		1
+#define SERVER_FRAME_RECORD		2
+#define SERVER_FRAME_HISTORY		3
+#define SERVER_FRAME_END		4
+#define SERVER_FRAME_AGGREGATE		5
+#define SERVER_FRAME_ERROR		6
+
+#define SERVER_RECORD_SIZE		44	// dados de SERVER_FRAME_RECORD sem níveis por canal e banda
+
+#endif
@@ -0,0 +1,118 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shm_levels.h"
+
+static Shm_levels *shm;
+static size_t shm_size;
+static const char *shm_name;
+
+bool shm_levels_begin(struct config *config)
+{
+	uint64_t capacity = (uint64_t)config->shm_history * 3600 * 1000 / config->segment_duration;
+	if (capacity == 0)
+		capacity = 1;
+	shm_name = config->shm_name;
+	shm_size = sizeof *shm + capacity * sizeof *shm->slots;
+
+	//	Um segmento antigo continua válido para quem o tem mapeado
+	shm_unlink(shm_name);
+	int fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "shm_open(%s) error: %s\n", shm_name, strerror(errno));
+		return false;
+	}
+	if (ftruncate(fd, shm_size) < 0) {
+		fprintf(stderr, "ftruncate(%s) error: %s\n", shm_name, strerror(errno));
+		close(fd);
+		shm_unlink(shm_name);
+		return false;
+	}
+	shm = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		fprintf(stderr, "mmap(%s) error: %s\n", shm_name, strerror(errno));
+		shm = NULL;
+		shm_unlink(shm_name);
+		return false;
+	}
+	//	A memória vem a zeros: stamp = 0 em todas as posições
+	shm->version = SHM_LEVELS_VERSION;
+	shm->header_size = sizeof *shm;
+	shm->slot_size = sizeof *shm->slots;
+	shm->capacity = capacity;
+	shm->segment_duration = config->segment_duration;
+	shm->sample_rate = config->sample_rate;
+	atomic_store_explicit(&shm->magic, SHM_LEVELS_MAGIC, memory_order_release);
+	return true;
+}
+
+static void shm_levels_wake()
+{
+	atomic_fetch_add(&shm->futex, 1);
+	syscall(SYS_futex, &shm->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+void shm_levels_end()
+{
+	if (shm == NULL)
+		return;
+	atomic_store(&shm->closed, 1);
+	shm_levels_wake();
+	munmap(shm, shm_size);
+	shm = NULL;
+	shm_unlink(shm_name);
+}
+
+void shm_levels_publish(const Server_record *record)
+{
+	if (shm == NULL)
+		return;
+	uint64_t seq = atomic_load_explicit(&shm->count, memory_order_relaxed);
+	Shm_levels_slot *slot = &shm->slots[seq % shm->capacity];
+
+	atomic_store_explicit(&slot->stamp, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	Shm_levels_record *data = &slot->record;
+	data->seq = seq;
+	data->ts = record->ts;
+	data->laeq = record->laeq;
+	data->lafmin = record->lafmin;
+	data->lae = record->lae;
+	data->lafmax = record->lafmax;
+	data->lapeak = record->lapeak;
+	data->direction = record->direction;
+	data->channels = record->channels < SHM_LEVELS_CHANNELS_MAX ? record->channels : SHM_LEVELS_CHANNELS_MAX;
+	data->bands = record->bands < SHM_LEVELS_BANDS_MAX ? record->bands : SHM_LEVELS_BANDS_MAX;
+	memcpy(data->channel_levels, record->channel_levels, data->channels * sizeof *data->channel_levels);
+	memcpy(data->band_levels, record->band_levels, data->bands * sizeof *data->band_levels);
+
+	atomic_store_explicit(&slot->stamp, seq + 1, memory_order_release);
+	atomic_store_explicit(&shm->count, seq + 1, memory_order_release);
+	shm_levels_wake();
+}
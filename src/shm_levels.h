@@ -0,0 +1,88 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SHM_LEVELS_H
+#define SHM_LEVELS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "config.h"
+#include "server.h"
+
+/*
+ * Publicação dos níveis em memória partilhada POSIX (shm_open).
+ *
+ * O segmento de memória contém um cabeçalho e um buffer circular com os
+ * registos dos últimos capacity segmentos. O registo seq ocupa a posição
+ * seq % capacity. Cada posição é protegida por um seqlock: o escritor
+ * anula stamp, escreve o registo e coloca stamp = seq + 1. Um leitor
+ * copia o registo e só o aceita se stamp for seq + 1 antes e depois
+ * da cópia. O escritor nunca espera pelos leitores e os leitores só
+ * leem a memória (shm_levels_reader.h).
+ *
+ * count é o número de registos publicados; o último é count - 1.
+ * futex é incrementado a cada registo e acorda os leitores em espera
+ * (FUTEX_WAIT). Com closed a 1 o escritor terminou.
+ *
+ * Os campos têm a representação nativa: só para processos locais.
+ */
+
+#define SHM_LEVELS_MAGIC	0x564c4d53	// "SMLV"
+#define SHM_LEVELS_VERSION	1
+#define SHM_LEVELS_CHANNELS_MAX	8
+#define SHM_LEVELS_BANDS_MAX	16
+
+typedef struct {
+	uint64_t seq;
+	uint64_t ts;			// segundos, UNIX
+	float laeq, lafmin, lae, lafmax, lapeak;
+	int32_t direction;
+	uint16_t channels, bands;
+	float channel_levels[SHM_LEVELS_CHANNELS_MAX];	// LZeq de cada canal
+	float band_levels[SHM_LEVELS_BANDS_MAX];	// Leq das bandas de oitava
+} Shm_levels_record;
+
+typedef struct {
+	_Atomic uint64_t stamp;		// seq + 1 do registo; 0 durante a escrita
+	Shm_levels_record record;
+} Shm_levels_slot;
+
+typedef struct {
+	_Atomic uint32_t magic;		// escrito por último, depois de todo o cabeçalho
+	uint32_t version;
+	uint32_t header_size;		// sizeof (Shm_levels)
+	uint32_t slot_size;		// sizeof (Shm_levels_slot)
+	uint32_t capacity;		// número de posições do buffer circular
+	uint32_t segment_duration;	// milisegundos
+	uint32_t sample_rate;
+	_Atomic uint32_t closed;
+	_Atomic uint64_t count;
+	_Atomic uint32_t futex;
+	uint32_t reserved;
+	Shm_levels_slot slots[];
+} Shm_levels;
+
+bool shm_levels_begin(struct config *config);
+void shm_levels_end();
+
+/**
+ * @brief Publica o registo de um segmento. Não bloqueia.
+ */
+void shm_levels_publish(const Server_record *record);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shm_levels_reader.h"
+
+struct shm_levels_reader {
+	Shm_levels *shm;	// mapeado só para leitura
+	size_t size;
+};
+
+Shm_levels_reader *shm_levels_reader_open(const char *name)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+	struct stat status;
+	if (fstat(fd, &status) < 0 || (size_t)status.st_size < sizeof (Shm_levels)) {
+		close(fd);
+		return NULL;
+	}
+	Shm_levels *shm = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+		return NULL;
+	if (atomic_load_explicit(&shm->magic, memory_order_acquire) != SHM_LEVELS_MAGIC
+			|| shm->version != SHM_LEVELS_VERSION
+			|| shm->header_size != sizeof *shm || shm->slot_size != sizeof *shm->slots
+			|| sizeof *shm + (size_t)shm->capacity * sizeof *shm->slots > (size_t)status.st_size) {
+		munmap(shm, status.st_size);
+		errno = EPROTO;
+		return NULL;
+	}
+	Shm_levels_reader *reader = malloc(sizeof *reader);
+	if (reader == NULL) {
+		munmap(shm, status.st_size);
+		return NULL;
+	}
+	reader->shm = shm;
+	reader->size = status.st_size;
+	return reader;
+}
+
+void shm_levels_reader_close(Shm_levels_reader *reader)
+{
+	munmap(reader->shm, reader->size);
+	free(reader);
+}
+
+uint64_t shm_levels_reader_count(Shm_levels_reader *reader)
+{
+	return atomic_load_explicit(&reader->shm->count, memory_order_acquire);
+}
+
+uint64_t shm_levels_reader_first(Shm_levels_reader *reader)
+{
+	uint64_t count = shm_levels_reader_count(reader);
+	//	A posição mais antiga pode estar a ser reescrita
+	return count >= reader->shm->capacity ? count - reader->shm->capacity + 1 : 0;
+}
+
+bool shm_levels_reader_get(Shm_levels_reader *reader, uint64_t seq, Shm_levels_record *record)
+{
+	Shm_levels_slot *slot = &reader->shm->slots[seq % reader->shm->capacity];
+	if (atomic_load_explicit(&slot->stamp, memory_order_acquire) != seq + 1)
+		return false;
+	memcpy(record, &slot->record, sizeof *record);
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&slot->stamp, memory_order_relaxed) == seq + 1;
+}
+
+bool shm_levels_reader_latest(Shm_levels_reader *reader, Shm_levels_record *record)
+{
+	//	O último registo só é reescrito depois de capacity publicações
+	uint64_t count;
+	do {
+		count = shm_levels_reader_count(reader);
+		if (count == 0)
+			return false;
+	} while (!shm_levels_reader_get(reader, count - 1, record));
+	return true;
+}
+
+bool shm_levels_reader_wait(Shm_levels_reader *reader, uint64_t count, int timeout)
+{
+	_Atomic uint32_t *futex = &reader->shm->futex;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += timeout / 1000;
+	end.tv_nsec += timeout % 1000 * 1000000L;
+	if (end.tv_nsec >= 1000000000L) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000L;
+	}
+	while (true) {
+		uint32_t value = atomic_load(futex);
+		if (shm_levels_reader_count(reader) > count)
+			return true;
+		if (shm_levels_reader_closed(reader))
+			return false;
+		struct timespec remaining, *pointer = NULL;
+		if (timeout >= 0) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining.tv_sec = end.tv_sec - now.tv_sec;
+			remaining.tv_nsec = end.tv_nsec - now.tv_nsec;
+			if (remaining.tv_nsec < 0) {
+				remaining.tv_sec--;
+				remaining.tv_nsec += 1000000000L;
+			}
+			if (remaining.tv_sec < 0)
+				return false;
+			pointer = &remaining;
+		}
+		//	Retorna de imediato se futex já mudou desde a leitura de value
+		syscall(SYS_futex, futex, FUTEX_WAIT, value, pointer, NULL, 0);
+	}
+}
+
+bool shm_levels_reader_closed(Shm_levels_reader *reader)
+{
+	return atomic_load(&reader->shm->closed) != 0;
+}
+
+unsigned shm_levels_reader_segment_duration(Shm_levels_reader *reader)
+{
+	return reader->shm->segment_duration;
+}
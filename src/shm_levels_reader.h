@@ -0,0 +1,76 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SHM_LEVELS_READER_H
+#define SHM_LEVELS_READER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "shm_levels.h"
+
+/*
+ * Leitura, por outros processos, dos níveis publicados em memória
+ * partilhada (shm_levels.h). Não usa o socket do servidor nem bloqueia
+ * o escritor; a memória é mapeada só para leitura.
+ */
+
+typedef struct shm_levels_reader Shm_levels_reader;
+
+/**
+ * @brief Liga-se ao segmento name (config shm_name). NULL se não existir.
+ */
+Shm_levels_reader *shm_levels_reader_open(const char *name);
+void shm_levels_reader_close(Shm_levels_reader *reader);
+
+/**
+ * @brief Número de registos publicados (o último é count - 1).
+ */
+uint64_t shm_levels_reader_count(Shm_levels_reader *reader);
+
+/**
+ * @brief Registos [first, count[ ainda disponíveis no buffer circular.
+ */
+uint64_t shm_levels_reader_first(Shm_levels_reader *reader);
+
+/**
+ * @brief Copia o registo seq.
+ *
+ * @return false se o registo ainda não foi publicado ou já foi reescrito.
+ */
+bool shm_levels_reader_get(Shm_levels_reader *reader, uint64_t seq, Shm_levels_record *record);
+
+/**
+ * @brief Copia o último registo publicado.
+ */
+bool shm_levels_reader_latest(Shm_levels_reader *reader, Shm_levels_record *record);
+
+/**
+ * @brief Espera que count ultrapasse count, no máximo timeout milisegundos
+ * (negativo - sem limite).
+ *
+ * @return false em timeout ou se o escritor terminou.
+ */
+bool shm_levels_reader_wait(Shm_levels_reader *reader, uint64_t count, int timeout);
+
+/**
+ * @brief true se o escritor terminou; é necessário voltar a ligar.
+ */
+bool shm_levels_reader_closed(Shm_levels_reader *reader);
+
+unsigned shm_levels_reader_segment_duration(Shm_levels_reader *reader);
+
+#endif
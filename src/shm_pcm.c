@@ -0,0 +1,116 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shm_pcm.h"
+
+static Shm_pcm *shm;
+static size_t shm_size;
+static const char *shm_name;
+
+bool shm_pcm_begin(struct config *config)
+{
+	uint64_t capacity = (uint64_t)config->shm_pcm_duration * config->sample_rate;
+	if (capacity < config->block_size)
+		capacity = config->block_size;
+	size_t raw_size = capacity * config->channels * sizeof (int16_t);
+	size_t weighted_size = capacity * sizeof (float);
+	shm_name = config->shm_pcm_name;
+	shm_size = sizeof *shm + raw_size + weighted_size;
+
+	//	Um segmento antigo continua válido para quem o tem mapeado
+	shm_unlink(shm_name);
+	int fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "shm_open(%s) error: %s\n", shm_name, strerror(errno));
+		return false;
+	}
+	if (ftruncate(fd, shm_size) < 0) {
+		fprintf(stderr, "ftruncate(%s) error: %s\n", shm_name, strerror(errno));
+		close(fd);
+		shm_unlink(shm_name);
+		return false;
+	}
+	shm = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		fprintf(stderr, "mmap(%s) error: %s\n", shm_name, strerror(errno));
+		shm = NULL;
+		shm_unlink(shm_name);
+		return false;
+	}
+	shm->version = SHM_PCM_VERSION;
+	shm->header_size = sizeof *shm;
+	shm->sample_rate = config->sample_rate;
+	shm->capacity = capacity;
+	shm->streams[SHM_PCM_RAW] = (Shm_pcm_stream){.offset = sizeof *shm, .format = SHM_PCM_INT16,
+			.channels = config->channels, .frame_size = config->channels * sizeof (int16_t)};
+	shm->streams[SHM_PCM_AWEIGHTED] = (Shm_pcm_stream){.offset = sizeof *shm + raw_size,
+			.format = SHM_PCM_FLOAT, .channels = 1, .frame_size = sizeof (float)};
+	atomic_store_explicit(&shm->magic, SHM_PCM_MAGIC, memory_order_release);
+	return true;
+}
+
+void shm_pcm_end()
+{
+	if (shm == NULL)
+		return;
+	atomic_store(&shm->closed, 1);
+	shm_pcm_notify();
+	munmap(shm, shm_size);
+	shm = NULL;
+	shm_unlink(shm_name);
+}
+
+void shm_pcm_append(unsigned stream, const void *frames, unsigned nframes)
+{
+	if (shm == NULL)
+		return;
+	Shm_pcm_stream *ring = &shm->streams[stream];
+	uint8_t *buffer = (uint8_t *)shm + ring->offset;
+	const uint8_t *data = frames;
+	uint64_t count = atomic_load_explicit(&ring->count, memory_order_relaxed);
+	//	Anunciar as posições que vão ser reescritas antes de as escrever
+	atomic_store_explicit(&ring->reserved, count + nframes, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	while (nframes > 0) {
+		uint64_t put = count % shm->capacity;
+		uint64_t length = shm->capacity - put < nframes ? shm->capacity - put : nframes;
+		memcpy(buffer + put * ring->frame_size, data, length * ring->frame_size);
+		data += length * ring->frame_size;
+		nframes -= length;
+		count += length;
+	}
+	atomic_store_explicit(&ring->count, count, memory_order_release);
+}
+
+void shm_pcm_notify()
+{
+	if (shm == NULL)
+		return;
+	atomic_fetch_add(&shm->futex, 1);
+	syscall(SYS_futex, &shm->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
@@ -0,0 +1,85 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SHM_PCM_H
+#define SHM_PCM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "config.h"
+
+/*
+ * Derivação do som captado para outros processos, em memória partilhada
+ * POSIX (shm_open).
+ *
+ * O segmento contém SHM_PCM_STREAMS buffers circulares de frames:
+ *	SHM_PCM_RAW		amostras originais, int16_t, canais intercalados
+ *	SHM_PCM_AWEIGHTED	canal 0 com ponderação A, float
+ * Tal como em pcm_ring.h, o produtor nunca espera pelos consumidores:
+ * anuncia em reserved as frames que vai escrever, escreve-as e publica
+ * count. Um consumidor lê as frames [from, from + n[, com from + n <= count,
+ * diretamente da memória partilhada e, depois de as usar, confirma que
+ * from >= reserved - capacity; caso contrário foi ultrapassado pelo
+ * produtor e deve saltar para a frente (shm_pcm_reader.h).
+ *
+ * futex é incrementado a cada bloco e acorda os consumidores em espera.
+ * Os campos têm a representação nativa: só para processos locais.
+ */
+
+#define SHM_PCM_MAGIC		0x43504d53	// "SMPC"
+#define SHM_PCM_VERSION		1
+#define SHM_PCM_RAW		0
+#define SHM_PCM_AWEIGHTED	1
+#define SHM_PCM_STREAMS		2
+#define SHM_PCM_INT16		1
+#define SHM_PCM_FLOAT		2
+
+typedef struct {
+	uint32_t offset;		// início dos dados, a partir do início do segmento
+	uint32_t format;		// SHM_PCM_INT16 ou SHM_PCM_FLOAT
+	uint32_t channels;
+	uint32_t frame_size;		// bytes por frame
+	_Atomic uint64_t reserved;	// frames em escrita ou escritas
+	_Atomic uint64_t count;		// frames escritas
+} Shm_pcm_stream;
+
+typedef struct {
+	_Atomic uint32_t magic;		// escrito por último, depois de todo o cabeçalho
+	uint32_t version;
+	uint32_t header_size;		// sizeof (Shm_pcm)
+	uint32_t sample_rate;
+	uint64_t capacity;		// frames de cada buffer circular
+	_Atomic uint32_t closed;
+	_Atomic uint32_t futex;
+	Shm_pcm_stream streams[SHM_PCM_STREAMS];
+} Shm_pcm;
+
+bool shm_pcm_begin(struct config *config);
+void shm_pcm_end();
+
+/**
+ * @brief Acrescenta frames ao buffer stream. Não faz nada se inativo.
+ */
+void shm_pcm_append(unsigned stream, const void *frames, unsigned nframes);
+
+/**
+ * @brief Acorda os consumidores em espera - uma vez por bloco.
+ */
+void shm_pcm_notify();
+
+#endif
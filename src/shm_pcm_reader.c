@@ -0,0 +1,198 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shm_pcm_reader.h"
+
+struct shm_pcm_reader {
+	Shm_pcm *shm;		// mapeado só para leitura
+	size_t size;
+	uint64_t position[SHM_PCM_STREAMS];	// próxima frame a ler
+	uint64_t lost[SHM_PCM_STREAMS];
+};
+
+Shm_pcm_reader *shm_pcm_reader_open(const char *name)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+	struct stat status;
+	if (fstat(fd, &status) < 0 || (size_t)status.st_size < sizeof (Shm_pcm)) {
+		close(fd);
+		return NULL;
+	}
+	Shm_pcm *shm = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+		return NULL;
+	bool valid = atomic_load_explicit(&shm->magic, memory_order_acquire) == SHM_PCM_MAGIC
+			&& shm->version == SHM_PCM_VERSION && shm->header_size == sizeof *shm;
+	for (unsigned i = 0; valid && i < SHM_PCM_STREAMS; i++)
+		valid = shm->streams[i].offset + shm->capacity * shm->streams[i].frame_size
+				<= (uint64_t)status.st_size;
+	if (!valid) {
+		munmap(shm, status.st_size);
+		errno = EPROTO;
+		return NULL;
+	}
+	Shm_pcm_reader *reader = malloc(sizeof *reader);
+	if (reader == NULL) {
+		munmap(shm, status.st_size);
+		return NULL;
+	}
+	reader->shm = shm;
+	reader->size = status.st_size;
+	for (unsigned i = 0; i < SHM_PCM_STREAMS; i++) {
+		reader->position[i] = atomic_load_explicit(&shm->streams[i].count, memory_order_acquire);
+		reader->lost[i] = 0;
+	}
+	return reader;
+}
+
+void shm_pcm_reader_close(Shm_pcm_reader *reader)
+{
+	munmap(reader->shm, reader->size);
+	free(reader);
+}
+
+unsigned shm_pcm_reader_sample_rate(Shm_pcm_reader *reader)
+{
+	return reader->shm->sample_rate;
+}
+
+unsigned shm_pcm_reader_channels(Shm_pcm_reader *reader, unsigned stream)
+{
+	return reader->shm->streams[stream].channels;
+}
+
+/*
+ * Primeira frame que não pode estar a ser reescrita.
+ */
+static uint64_t stream_first(Shm_pcm *shm, Shm_pcm_stream *ring)
+{
+	uint64_t reserved = atomic_load_explicit(&ring->reserved, memory_order_relaxed);
+	return reserved > shm->capacity ? reserved - shm->capacity : 0;
+}
+
+const void *shm_pcm_reader_peek(Shm_pcm_reader *reader, unsigned stream, unsigned *nframes)
+{
+	Shm_pcm *shm = reader->shm;
+	Shm_pcm_stream *ring = &shm->streams[stream];
+	uint64_t count = atomic_load_explicit(&ring->count, memory_order_acquire);
+	uint64_t first = stream_first(shm, ring);
+	if (reader->position[stream] < first) {
+		//	Ultrapassado - recomeçar a meio do buffer, com margem para o próximo bloco
+		uint64_t position = count > shm->capacity / 2 ? count - shm->capacity / 2 : 0;
+		if (position < first)
+			position = first;
+		reader->lost[stream] += position - reader->position[stream];
+		reader->position[stream] = position;
+	}
+	uint64_t get = reader->position[stream] % shm->capacity;
+	uint64_t available = count - reader->position[stream];
+	if (available > shm->capacity - get)
+		available = shm->capacity - get;
+	*nframes = available;
+	return (uint8_t *)shm + ring->offset + get * ring->frame_size;
+}
+
+bool shm_pcm_reader_consume(Shm_pcm_reader *reader, unsigned stream, unsigned nframes)
+{
+	//	As frames anteriores a reserved - capacity podem ter sido reescritas
+	atomic_thread_fence(memory_order_acquire);
+	bool valid = reader->position[stream] >= stream_first(reader->shm, &reader->shm->streams[stream]);
+	reader->position[stream] += nframes;
+	return valid;
+}
+
+unsigned shm_pcm_reader_read(Shm_pcm_reader *reader, unsigned stream, void *frames, unsigned nframes)
+{
+	unsigned frame_size = reader->shm->streams[stream].frame_size;
+	unsigned total = 0;
+	while (total < nframes) {
+		unsigned available;
+		const void *data = shm_pcm_reader_peek(reader, stream, &available);
+		if (available == 0)
+			break;
+		if (available > nframes - total)
+			available = nframes - total;
+		memcpy((uint8_t *)frames + total * frame_size, data, available * frame_size);
+		if (!shm_pcm_reader_consume(reader, stream, available)) {
+			//	Cópia inválida - as frames seguintes não seriam contíguas às anteriores
+			reader->lost[stream] += available;
+			break;
+		}
+		total += available;
+	}
+	return total;
+}
+
+uint64_t shm_pcm_reader_lost(Shm_pcm_reader *reader, unsigned stream)
+{
+	return reader->lost[stream];
+}
+
+bool shm_pcm_reader_wait(Shm_pcm_reader *reader, unsigned stream, int timeout)
+{
+	_Atomic uint32_t *futex = &reader->shm->futex;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += timeout / 1000;
+	end.tv_nsec += timeout % 1000 * 1000000L;
+	if (end.tv_nsec >= 1000000000L) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000L;
+	}
+	while (true) {
+		uint32_t value = atomic_load(futex);
+		if (atomic_load_explicit(&reader->shm->streams[stream].count, memory_order_acquire)
+				> reader->position[stream])
+			return true;
+		if (shm_pcm_reader_closed(reader))
+			return false;
+		struct timespec remaining, *pointer = NULL;
+		if (timeout >= 0) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining.tv_sec = end.tv_sec - now.tv_sec;
+			remaining.tv_nsec = end.tv_nsec - now.tv_nsec;
+			if (remaining.tv_nsec < 0) {
+				remaining.tv_sec--;
+				remaining.tv_nsec += 1000000000L;
+			}
+			if (remaining.tv_sec < 0)
+				return false;
+			pointer = &remaining;
+		}
+		//	Retorna de imediato se futex já mudou desde a leitura de value
+		syscall(SYS_futex, futex, FUTEX_WAIT, value, pointer, NULL, 0);
+	}
+}
+
+bool shm_pcm_reader_closed(Shm_pcm_reader *reader)
+{
+	return atomic_load(&reader->shm->closed) != 0;
+}
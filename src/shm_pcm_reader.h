@@ -0,0 +1,93 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SHM_PCM_READER_H
+#define SHM_PCM_READER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "shm_pcm.h"
+
+/*
+ * Leitura, por outros processos, do som derivado para memória partilhada
+ * (shm_pcm.h). Cada leitor tem, para cada buffer, a posição da próxima
+ * frame a ler, que começa nas frames mais recentes. Um leitor que se
+ * atrase mais do que a capacidade do buffer salta para a frente;
+ * o produtor nunca espera.
+ *
+ * Leitura sem cópia:
+ *	const int16_t *frames = shm_pcm_reader_peek(reader, SHM_PCM_RAW, &n);
+ *	... usar frames[0 .. n * channels[ ...
+ *	if (!shm_pcm_reader_consume(reader, SHM_PCM_RAW, n))
+ *		... as frames foram reescritas durante a utilização ...
+ */
+
+typedef struct shm_pcm_reader Shm_pcm_reader;
+
+/**
+ * @brief Liga-se ao segmento name (config shm_pcm_name). NULL se não existir.
+ */
+Shm_pcm_reader *shm_pcm_reader_open(const char *name);
+void shm_pcm_reader_close(Shm_pcm_reader *reader);
+
+unsigned shm_pcm_reader_sample_rate(Shm_pcm_reader *reader);
+unsigned shm_pcm_reader_channels(Shm_pcm_reader *reader, unsigned stream);
+
+/**
+ * @brief Frames contíguas disponíveis a partir da posição do leitor,
+ * diretamente na memória partilhada.
+ *
+ * Se o leitor foi ultrapassado salta para a frente, somando as frames
+ * saltadas às devolvidas por shm_pcm_reader_lost.
+ *
+ * @param nframes Número de frames disponíveis (0 se nenhuma)
+ */
+const void *shm_pcm_reader_peek(Shm_pcm_reader *reader, unsigned stream, unsigned *nframes);
+
+/**
+ * @brief Avança nframes frames depois de usar as frames de shm_pcm_reader_peek.
+ *
+ * @return false se alguma foi reescrita durante a utilização.
+ */
+bool shm_pcm_reader_consume(Shm_pcm_reader *reader, unsigned stream, unsigned nframes);
+
+/**
+ * @brief Copia até nframes frames e avança.
+ *
+ * @return Número de frames copiadas.
+ */
+unsigned shm_pcm_reader_read(Shm_pcm_reader *reader, unsigned stream, void *frames, unsigned nframes);
+
+/**
+ * @brief Frames saltadas por atraso do leitor, em cada buffer.
+ */
+uint64_t shm_pcm_reader_lost(Shm_pcm_reader *reader, unsigned stream);
+
+/**
+ * @brief Espera por novas frames no buffer stream, no máximo timeout
+ * milisegundos (negativo - sem limite).
+ *
+ * @return false em timeout ou se o produtor terminou.
+ */
+bool shm_pcm_reader_wait(Shm_pcm_reader *reader, unsigned stream, int timeout);
+
+/**
+ * @brief true se o produtor terminou; é necessário voltar a ligar.
+ */
+bool shm_pcm_reader_closed(Shm_pcm_reader *reader);
+
+#endif
@@ -0,0 +1,98 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SLV_H
+#define SLV_H
+
+#include <stdint.h>
+
+/*
+ * Formato binário de saída por colunas (output_format ".slv").
+ *
+ * O ficheiro tem um cabeçalho, a tabela de frequências das bandas
+ * e as colunas. Cada coluna tem lugar para capacity segmentos
+ * (um período de ficheiro) e ocupa capacity * 4 bytes a partir de
+ *
+ *	data_offset + column * capacity * 4
+ *
+ * pelo que um leitor acede a uma coluna sem ler as outras. As colunas
+ * são escritas à medida que os registos chegam; count, no cabeçalho,
+ * é atualizado depois dos dados e indica os segmentos válidos.
+ *
+ * Todos os campos são little-endian; float é IEEE 754 de 32 bits.
+ *
+ *	cabeçalho
+ *		char     magic[4]		"SMLF"
+ *		uint16_t version		SLV_VERSION
+ *		uint16_t header_size		sizeof (Slv_header)
+ *		char     identification[32]	config identification
+ *		uint32_t sample_rate
+ *		uint32_t segment_duration	milisegundos
+ *		float    calibration_reference
+ *		float    calibration_delta	já incluído nos níveis (0 com SLV_FLAG_RAW)
+ *		int64_t  ts			início do ficheiro (segundos, UNIX)
+ *		uint32_t capacity		segmentos por coluna (múltiplo de 16)
+ *		uint32_t count			segmentos escritos
+ *		uint16_t columns		SLV_BANDS + bands
+ *		uint16_t bands			número de bandas de oitava (0 sem espectro)
+ *		uint32_t flags			SLV_FLAG_*
+ *		uint32_t data_offset		início da primeira coluna (múltiplo de 64)
+ *	float frequency[bands]			frequência central de cada banda
+ *	colunas
+ *		float    LAeq[capacity]		SLV_LAEQ
+ *		float    LAFmin[capacity]	SLV_LAFMIN
+ *		float    LAE[capacity]		SLV_LAE
+ *		float    LAFmax[capacity]	SLV_LAFMAX
+ *		float    LApeak[capacity]	SLV_LAPEAK
+ *		int32_t  direction[capacity]	SLV_DIRECTION, válida com SLV_FLAG_DIRECTION
+ *		float    Leq[capacity]		SLV_BANDS + b, nível da banda b (canal 0)
+ */
+
+#define SLV_MAGIC		"SMLF"
+#define SLV_VERSION		1
+#define SLV_EXTENSION		".slv"
+#define SLV_IDENTIFICATION_SIZE	32
+
+#define SLV_LAEQ		0
+#define SLV_LAFMIN		1
+#define SLV_LAE			2
+#define SLV_LAFMAX		3
+#define SLV_LAPEAK		4
+#define SLV_DIRECTION		5
+#define SLV_BANDS		6	// primeira coluna de bandas
+
+#define SLV_FLAG_DIRECTION	1
+#define SLV_FLAG_RAW		2	// níveis sem calibração (calibration_table.h)
+
+typedef struct __attribute__ ((packed)) {
+	char magic[4];
+	uint16_t version;
+	uint16_t header_size;
+	char identification[SLV_IDENTIFICATION_SIZE];
+	uint32_t sample_rate;
+	uint32_t segment_duration;
+	float calibration_reference;
+	float calibration_delta;
+	int64_t ts;
+	uint32_t capacity;
+	uint32_t count;
+	uint16_t columns;
+	uint16_t bands;
+	uint32_t flags;
+	uint32_t data_offset;
+} Slv_header;
+
+#endif
@@ -0,0 +1,164 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "slv_reader.h"
+
+struct slv_reader {
+	const uint8_t *map;		// ficheiro mapeado só para leitura
+	size_t size;
+	const Slv_header *header;
+	char identification[SLV_IDENTIFICATION_SIZE + 1];
+};
+
+Slv_reader *slv_reader_open(const char *filepath)
+{
+	int fd = open(filepath, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat status;
+	if (fstat(fd, &status) < 0 || (size_t)status.st_size < sizeof (Slv_header)) {
+		close(fd);
+		errno = EPROTO;
+		return NULL;
+	}
+	const uint8_t *map = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	const Slv_header *header = (const Slv_header *)map;
+	if (memcmp(header->magic, SLV_MAGIC, sizeof header->magic) != 0
+			|| header->version != SLV_VERSION
+			|| header->header_size < sizeof *header
+			|| header->columns < SLV_BANDS + header->bands
+			|| header->data_offset < header->header_size + header->bands * sizeof (float)
+			|| header->data_offset % sizeof (float) != 0
+			|| header->data_offset + (size_t)header->columns * header->capacity * sizeof (float)
+				> (size_t)status.st_size) {
+		munmap((void *)map, status.st_size);
+		errno = EPROTO;
+		return NULL;
+	}
+	Slv_reader *reader = malloc(sizeof *reader);
+	if (reader == NULL) {
+		munmap((void *)map, status.st_size);
+		return NULL;
+	}
+	reader->map = map;
+	reader->size = status.st_size;
+	reader->header = header;
+	memcpy(reader->identification, header->identification, SLV_IDENTIFICATION_SIZE);
+	reader->identification[SLV_IDENTIFICATION_SIZE] = '\0';
+	return reader;
+}
+
+void slv_reader_close(Slv_reader *reader)
+{
+	munmap((void *)reader->map, reader->size);
+	free(reader);
+}
+
+unsigned slv_reader_count(Slv_reader *reader)
+{
+	//	Atualizado pelo escritor enquanto o ficheiro está aberto
+	uint32_t count = *(const volatile uint32_t *)(reader->map + offsetof(Slv_header, count));
+	return count < reader->header->capacity ? count : reader->header->capacity;
+}
+
+static const void *slv_reader_column(Slv_reader *reader, unsigned column)
+{
+	return reader->map + reader->header->data_offset
+		+ (size_t)column * reader->header->capacity * sizeof (float);
+}
+
+const float *slv_reader_level(Slv_reader *reader, unsigned column)
+{
+	if (column > SLV_LAPEAK)
+		return NULL;
+	return slv_reader_column(reader, column);
+}
+
+const int32_t *slv_reader_direction(Slv_reader *reader)
+{
+	if ((reader->header->flags & SLV_FLAG_DIRECTION) == 0)
+		return NULL;
+	return slv_reader_column(reader, SLV_DIRECTION);
+}
+
+unsigned slv_reader_bands(Slv_reader *reader)
+{
+	return reader->header->bands;
+}
+
+float slv_reader_band_frequency(Slv_reader *reader, unsigned band)
+{
+	if (band >= reader->header->bands)
+		return 0;
+	float frequency;
+	memcpy(&frequency, reader->map + reader->header->header_size + band * sizeof frequency,
+		sizeof frequency);
+	return frequency;
+}
+
+const float *slv_reader_band(Slv_reader *reader, unsigned band)
+{
+	if (band >= reader->header->bands)
+		return NULL;
+	return slv_reader_column(reader, SLV_BANDS + band);
+}
+
+const char *slv_reader_identification(Slv_reader *reader)
+{
+	return reader->identification;
+}
+
+int64_t slv_reader_ts(Slv_reader *reader)
+{
+	return reader->header->ts;
+}
+
+unsigned slv_reader_segment_duration(Slv_reader *reader)
+{
+	return reader->header->segment_duration;
+}
+
+unsigned slv_reader_sample_rate(Slv_reader *reader)
+{
+	return reader->header->sample_rate;
+}
+
+float slv_reader_calibration_reference(Slv_reader *reader)
+{
+	return reader->header->calibration_reference;
+}
+
+float slv_reader_calibration_delta(Slv_reader *reader)
+{
+	return reader->header->calibration_delta;
+}
+
+bool slv_reader_raw(Slv_reader *reader)
+{
+	return (reader->header->flags & SLV_FLAG_RAW) != 0;
+}
@@ -0,0 +1,84 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SLV_READER_H
+#define SLV_READER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "slv.h"
+
+/*
+ * Leitura de ficheiros de níveis por colunas (slv.h).
+ * O ficheiro é mapeado em memória só para leitura; as colunas são
+ * devolvidas como ponteiros para o mapeamento, sem cópia, e só as
+ * páginas das colunas acedidas são lidas do disco.
+ * Um ficheiro ainda em escrita pode ser lido: count vai aumentando.
+ */
+
+typedef struct slv_reader Slv_reader;
+
+/**
+ * @brief Abre o ficheiro filepath. NULL se não existir ou não for válido (errno).
+ */
+Slv_reader *slv_reader_open(const char *filepath);
+void slv_reader_close(Slv_reader *reader);
+
+/**
+ * @brief Número de segmentos escritos; índice válido nas colunas.
+ */
+unsigned slv_reader_count(Slv_reader *reader);
+
+/**
+ * @brief Coluna SLV_LAEQ, SLV_LAFMIN, SLV_LAE, SLV_LAFMAX ou SLV_LAPEAK.
+ *
+ * @return slv_reader_count valores, ou NULL se column não existir.
+ */
+const float *slv_reader_level(Slv_reader *reader, unsigned column);
+
+/**
+ * @brief Direção da fonte sonora em cada segmento.
+ *
+ * @return NULL se o ficheiro foi escrito sem direction_enable.
+ */
+const int32_t *slv_reader_direction(Slv_reader *reader);
+
+/**
+ * @brief Número de bandas de oitava (0 sem espectro).
+ */
+unsigned slv_reader_bands(Slv_reader *reader);
+float slv_reader_band_frequency(Slv_reader *reader, unsigned band);
+
+/**
+ * @brief Nível da banda band em cada segmento, ou NULL se não existir.
+ */
+const float *slv_reader_band(Slv_reader *reader, unsigned band);
+
+const char *slv_reader_identification(Slv_reader *reader);
+int64_t slv_reader_ts(Slv_reader *reader);
+unsigned slv_reader_segment_duration(Slv_reader *reader);
+unsigned slv_reader_sample_rate(Slv_reader *reader);
+float slv_reader_calibration_reference(Slv_reader *reader);
+float slv_reader_calibration_delta(Slv_reader *reader);
+
+/**
+ * @brief Níveis sem calibração (SLV_FLAG_RAW): a calibração de cada
+ * segmento está na tabela de épocas (calibration_table.h).
+ */
+bool slv_reader_raw(Slv_reader *reader);
+
+#endif
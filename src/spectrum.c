@@ -0,0 +1,276 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <math.h>
+#include <assert.h>
+
+#include "spectrum.h"
+
+struct spectrum {
+	Fft *fft;
+	unsigned size;		// dimensão da trama (N)
+	unsigned hop;		// avanço entre tramas
+	float *window;		// janela de Hann (N)
+	float window_norm;	// 2 / (soma da janela)^2 - nível RMS de uma sinusoide
+	struct sbuffer *ring;	// amostras Z do canal 0
+	float *power;		// soma das potências das tramas do segmento (N/2 + 1)
+	unsigned frames;	// número de tramas somadas
+	int16_t *level;		// registo do segmento (N/2 + 1)
+	float octave[SPECTRUM_OCTAVE_BANDS];	// níveis das bandas de oitava do segmento
+	FILE *fd;
+	unsigned file_segments;	// segmentos registados no ficheiro corrente
+	time_t calendar;	// início do ficheiro corrente
+};
+
+static inline unsigned min(unsigned a, unsigned b) {
+	return a < b ? a : b;
+}
+
+static const float octave_frequency[SPECTRUM_OCTAVE_BANDS] = {
+	31.5, 63, 125, 250, 500, 1000, 2000, 4000, 8000, 16000
+};
+
+//	Frequência central exata (base 2) da banda de oitava
+static inline double octave_center(unsigned band) {
+	return 1000.0 * pow(2, (int)band - 5);
+}
+
+Spectrum *spectrum_create(unsigned fft_size, unsigned block_size)
+{
+	Spectrum *spectrum = malloc(sizeof *spectrum);
+	if (spectrum == NULL)
+		return NULL;
+	spectrum->fft = fft_create(fft_size);
+	if (spectrum->fft == NULL) {
+		fprintf(stderr, "Spectrum: invalid FFT size %d (power of 2, >= 16)\n", fft_size);
+		free(spectrum);
+		return NULL;
+	}
+	spectrum->size = fft_size;
+	spectrum->hop = fft_size / 2;
+	unsigned bins = fft_size / 2 + 1;
+
+	//	Capacidade para uma trama e um bloco, múltipla da dimensão do bloco
+	//	e par: a leitura avança hop amostras e fft_load só aceita troços pares
+	unsigned blocks = (fft_size + block_size - 1) / block_size + 1;
+	if (block_size % 2 != 0)
+		blocks += blocks % 2;
+	unsigned capacity = blocks * block_size;
+	spectrum->ring = sbuffer_create(capacity);
+	spectrum->window = malloc((fft_size + bins) * sizeof *spectrum->window);
+	spectrum->level = malloc(bins * sizeof *spectrum->level);
+	if (spectrum->ring == NULL || spectrum->window == NULL || spectrum->level == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		if (spectrum->ring != NULL)
+			sbuffer_destroy(spectrum->ring);
+		free(spectrum->window);
+		free(spectrum->level);
+		fft_destroy(spectrum->fft);
+		free(spectrum);
+		return NULL;
+	}
+	spectrum->power = spectrum->window + fft_size;
+	memset(spectrum->power, 0, bins * sizeof *spectrum->power);
+	spectrum->frames = 0;
+	for (unsigned i = 0; i < SPECTRUM_OCTAVE_BANDS; i++)
+		spectrum->octave[i] = -INFINITY;
+
+	double sum = 0;
+	for (unsigned i = 0; i < fft_size; i++) {
+		spectrum->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / fft_size);
+		sum += spectrum->window[i];
+	}
+	spectrum->window_norm = 2.0 / (sum * sum);
+
+	spectrum->fd = NULL;
+	spectrum->file_segments = 0;
+	return spectrum;
+}
+
+void spectrum_destroy(Spectrum *spectrum)
+{
+	spectrum_file_close(spectrum);
+	sbuffer_destroy(spectrum->ring);
+	fft_destroy(spectrum->fft);
+	free(spectrum->window);
+	free(spectrum->level);
+	free(spectrum);
+}
+
+float *spectrum_write_ptr(Spectrum *spectrum)
+{
+	return sbuffer_write_ptr(spectrum->ring);
+}
+
+void spectrum_write_produces(Spectrum *spectrum, const float *block, unsigned length)
+{
+	struct sbuffer *ring = spectrum->ring;
+	assert(length <= sbuffer_write_size(ring));	// Há sempre um bloco disponível
+	float *ptr = sbuffer_write_ptr(ring);
+	if (block != ptr)
+		memcpy(ptr, block, length * sizeof *ptr);
+	sbuffer_write_produces(ring, length);
+
+	while (sbuffer_size(ring) >= spectrum->size) {
+		unsigned span = min(sbuffer_peek_size(ring, 0), spectrum->size);
+		fft_load(spectrum->fft, sbuffer_peek_ptr(ring, 0), spectrum->window, 0, span);
+		if (span < spectrum->size)	/* O ring buffer deu a volta? */
+			fft_load(spectrum->fft, sbuffer_peek_ptr(ring, span), spectrum->window,
+				span, spectrum->size - span);
+		fft_execute(spectrum->fft);
+		fft_power_accumulate(spectrum->fft, spectrum->power);
+		spectrum->frames++;
+		sbuffer_read_consumes(ring, spectrum->hop);
+	}
+}
+
+static void spectrum_record_write(Spectrum *spectrum, uint16_t frames)
+{
+	uint32_t segment = spectrum->file_segments;
+	size_t bins = spectrum->size / 2 + 1;
+	if (fwrite(&segment, sizeof segment, 1, spectrum->fd) != 1
+		|| fwrite(&frames, sizeof frames, 1, spectrum->fd) != 1
+		|| fwrite(spectrum->level, sizeof *spectrum->level, bins, spectrum->fd) != bins)
+		fprintf(stderr, "Spectrum: error writing record: %s\n", strerror(errno));
+}
+
+void spectrum_segment(Spectrum *spectrum, struct config *config)
+{
+	unsigned bins = spectrum->size / 2 + 1;
+	float reference = CONFIG_PRESSURE_REFERENCE * CONFIG_PRESSURE_REFERENCE;
+	float scale = spectrum->window_norm / reference;
+	if (spectrum->frames > 0)
+		scale /= spectrum->frames;
+	//	O ficheiro de espetro, com level_raw, fica sem calibração
+	float delta = config->level_raw ? 0 : config->calibration_delta;
+	for (unsigned k = 0; k < bins; k++) {
+		float power = spectrum->power[k] * scale;
+		int level = SPECTRUM_LEVEL_MIN;
+		if (power > 0)
+			level = lrintf((10.0f * log10f(power) + delta) * 100.0f);
+		spectrum->level[k] = level < INT16_MIN ? INT16_MIN : level > INT16_MAX ? INT16_MAX : level;
+	}
+
+	/*
+	 * A soma das riscas de uma banda com a normalização de uma sinusoide
+	 * excede a potência na largura de banda equivalente de ruído da janela
+	 * de Hann (1,5 riscas).
+	 */
+	double resolution = (double)config->sample_rate / spectrum->size;
+	unsigned bands = spectrum_octave_bands(config->sample_rate);
+	for (unsigned i = 0; i < SPECTRUM_OCTAVE_BANDS; i++) {
+		double power = 0;
+		if (i < bands) {
+			unsigned low = ceil(octave_center(i) / M_SQRT2 / resolution);
+			unsigned high = ceil(octave_center(i) * M_SQRT2 / resolution);
+			for (unsigned k = low; k < high && k < bins; k++)
+				power += spectrum->power[k];
+			power *= scale / 1.5;
+		}
+		spectrum->octave[i] = power > 0 ? 10.0 * log10(power) + config->calibration_delta : -INFINITY;
+	}
+	if (spectrum->fd != NULL)
+		spectrum_record_write(spectrum, spectrum->frames);
+	spectrum->file_segments++;
+	memset(spectrum->power, 0, bins * sizeof *spectrum->power);
+	spectrum->frames = 0;
+}
+
+const float *spectrum_octave_levels(Spectrum *spectrum)
+{
+	return spectrum->octave;
+}
+
+unsigned spectrum_octave_bands(unsigned sample_rate)
+{
+	unsigned bands = 0;
+	while (bands < SPECTRUM_OCTAVE_BANDS && octave_center(bands) * M_SQRT2 <= sample_rate / 2.0)
+		bands++;
+	return bands;
+}
+
+float spectrum_octave_frequency(unsigned band)
+{
+	return octave_frequency[band];
+}
+
+unsigned spectrum_file_segments(Spectrum *spectrum)
+{
+	return spectrum->file_segments;
+}
+
+bool spectrum_file_open(Spectrum *spectrum, const char *output_filepath, struct config *config)
+{
+	spectrum_file_close(spectrum);
+
+	char *filepath = malloc(strlen(output_filepath) + strlen(SPECTRUM_FILE_EXTENSION) + 1);
+	if (filepath == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return false;
+	}
+	strcpy(filepath, output_filepath);
+	strcat(filepath, SPECTRUM_FILE_EXTENSION);
+	spectrum->fd = fopen(filepath, "w");
+	if (spectrum->fd == NULL) {
+		fprintf(stderr, "fopen(%s, \"w\") error: %s\n", filepath, strerror(errno));
+		free(filepath);
+		return false;
+	}
+	free(filepath);
+
+	spectrum->calendar = time(NULL);
+	spectrum->file_segments = 0;
+
+	struct __attribute__ ((packed)) {
+		char magic[4];
+		uint16_t version;
+		uint16_t header_size;
+		uint32_t sample_rate;
+		uint32_t fft_size;
+		uint32_t hop_size;
+		uint32_t segment_duration;
+		float calibration_delta;
+		int64_t ts;
+	} header = {
+		.version = SPECTRUM_FILE_VERSION,
+		.header_size = sizeof header,
+		.sample_rate = config->sample_rate,
+		.fft_size = spectrum->size,
+		.hop_size = spectrum->hop,
+		.segment_duration = config->segment_duration,
+		.calibration_delta = config->level_raw ? 0 : config->calibration_delta,
+		.ts = spectrum->calendar,
+	};
+	_Static_assert(offsetof(__typeof__(header), ts) == SPECTRUM_FILE_TS_OFFSET, "spectrum header");
+	memcpy(header.magic, SPECTRUM_FILE_MAGIC, sizeof header.magic);
+	if (fwrite(&header, sizeof header, 1, spectrum->fd) != 1) {
+		fprintf(stderr, "Spectrum: error writing header: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+void spectrum_file_close(Spectrum *spectrum)
+{
+	if (spectrum->fd != NULL)
+		fclose(spectrum->fd);
+	spectrum->fd = NULL;
+}
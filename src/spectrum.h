@@ -0,0 +1,112 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "config.h"
+#include "fft.h"
+#include "sbuffer.h"
+
+/*
+ * Espectro de banda estreita por segmento (método de Welch).
+ *
+ * As amostras sem ponderação (Z) do canal 0 são depositadas num sbuffer.
+ * Cada trama de N amostras, com janela de Hann e sobreposição de 50%,
+ * é lida diretamente do sbuffer pela FFT. As potências das tramas
+ * de um segmento são somadas e, no fim do segmento, a média é registada
+ * num ficheiro binário que acompanha o ficheiro de saída.
+ *
+ * Formato do ficheiro (little-endian):
+ *
+ *	cabeçalho
+ *		char     magic[4]		"SMSP"
+ *		uint16_t version		SPECTRUM_FILE_VERSION
+ *		uint16_t header_size		dimensão do cabeçalho em bytes
+ *		uint32_t sample_rate
+ *		uint32_t fft_size		N
+ *		uint32_t hop_size		N / 2
+ *		uint32_t segment_duration	milisegundos
+ *		float    calibration_delta	já incluído nos níveis (0 com level_raw)
+ *		int64_t  ts			início do ficheiro (segundos, UNIX)
+ *	registo por segmento
+ *		uint32_t segment		índice do segmento no ficheiro
+ *		uint16_t frames			número de tramas somadas
+ *		int16_t  level[N / 2 + 1]	nível de cada risca em centésimos de dB
+ */
+
+#define SPECTRUM_FILE_MAGIC	"SMSP"
+#define SPECTRUM_FILE_VERSION	1
+#define SPECTRUM_FILE_EXTENSION	".spectrum"
+#define SPECTRUM_FILE_TS_OFFSET	28	// posição de ts no cabeçalho
+#define SPECTRUM_LEVEL_MIN	INT16_MIN
+#define SPECTRUM_OCTAVE_BANDS	10	// bandas de oitava de 31,5 Hz a 16 kHz
+
+typedef struct spectrum Spectrum;
+
+Spectrum *spectrum_create(unsigned fft_size, unsigned block_size);
+void spectrum_destroy(Spectrum *spectrum);
+
+/**
+ * @brief Retorna o ponteiro onde pode ser depositado o próximo bloco
+ * de amostras Z, evitando a cópia em spectrum_write_produces.
+ */
+float *spectrum_write_ptr(Spectrum *spectrum);
+
+/**
+ * @brief Acrescenta um bloco de amostras Z e processa as tramas completas.
+ *
+ * Se block for o ponteiro devolvido por spectrum_write_ptr não há cópia.
+ */
+void spectrum_write_produces(Spectrum *spectrum, const float *block, unsigned length);
+
+/**
+ * @brief Fecha o segmento corrente: regista a média das tramas e reinicia a soma.
+ */
+void spectrum_segment(Spectrum *spectrum, struct config *config);
+
+/**
+ * @brief Níveis das bandas de oitava do último segmento fechado por spectrum_segment.
+ *
+ * Obtidos somando as riscas cuja frequência pertence a cada banda;
+ * as bandas mais baixas só têm riscas se a resolução da FFT o permitir
+ * (-infinito se vazias).
+ */
+const float *spectrum_octave_levels(Spectrum *spectrum);
+
+/**
+ * @brief Número de bandas de oitava abaixo da frequência de Nyquist.
+ */
+unsigned spectrum_octave_bands(unsigned sample_rate);
+
+/**
+ * @brief Frequência central nominal da banda de oitava (0 - 31,5 Hz).
+ */
+float spectrum_octave_frequency(unsigned band);
+
+/**
+ * @brief Número de segmentos registados no ficheiro corrente.
+ */
+unsigned spectrum_file_segments(Spectrum *spectrum);
+
+bool spectrum_file_open(Spectrum *spectrum, const char *output_filepath, struct config *config);
+void spectrum_file_close(Spectrum *spectrum);
+
+#endif
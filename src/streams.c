@@ -0,0 +1,791 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#define _GNU_SOURCE	// accept4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <threads.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "streams.h"
+#include "mqtt.h"
+#include "server.h"
+#include "process.h"
+#include "filter.h"
+#include "sbuffer.h"
+#include "in_out.h"
+#include "direction.h"
+
+typedef enum {
+	STREAM_WAITING,		// fechado, até restart
+	STREAM_POLLING,		// aberto, à espera de amostras (poll do ciclo principal)
+	STREAM_QUEUED,		// na fila ou numa tarefa do conjunto
+	STREAM_FINISHED		// ficheiro lido até ao fim
+} Stream_state;
+
+/*
+ * Um fluxo só é acedido por uma tarefa de cada vez: pelo ciclo principal
+ * em STREAM_WAITING e STREAM_POLLING, pela tarefa que o tirou da fila
+ * em STREAM_QUEUED. A mudança de estado é feita com mutex.
+ */
+typedef struct {
+	struct config config;
+	Stream_state state;
+	time_t restart;			// próxima abertura (CLOCK_MONOTONIC, segundos)
+	bool open;
+	Input_device input;
+	struct pollfd pollfds[STREAMS_DESCRIPTORS_MAX];
+	unsigned descriptors;		// 0 - entrada sempre pronta (ficheiro)
+	Weighting weighting;
+	Afilter *afilter;
+	Timeweight *timeweight;
+	float *block_a;			// amostras lidas, um bloco por canal
+	float *block_c;			// ao quadrado
+	struct sbuffer *ring_b;		// ponderado
+	struct sbuffer *ring_d;		// média exponencial
+	Lae_average average;
+	Levels *levels;
+	char *directory;		// <output_path><identification>/
+	FILE *fd;
+	unsigned file_segments;		// segmentos no ficheiro de saída
+	unsigned starts;
+	uint64_t segments, lost;
+} Stream;
+
+typedef struct {
+	unsigned stream;
+	uint64_t ts;			// segundos, UNIX
+	float laeq, lafmin, lae, lafmax, lapeak;
+} Stream_record;
+
+typedef struct {
+	int fd;				// -1 - livre
+	uint64_t streams;		// bit i - fluxo i subscrito
+	unsigned length;
+	char request[SERVER_REQUEST_SIZE];
+} Streams_client;
+
+static volatile sig_atomic_t streams_running;
+
+static Stream streams[STREAMS_MAX];
+static const char *devices[STREAMS_MAX];
+static unsigned streams_number;
+static struct config *streams_config;
+static bool verbose_flag;
+
+//	Conjunto de tarefas
+static mtx_t mutex;
+static cnd_t ready_condition;
+static thrd_t workers[STREAMS_MAX];
+static unsigned workers_number;
+static bool stopping;
+static unsigned ready_queue[STREAMS_MAX];	// fluxos em STREAM_QUEUED por processar
+static unsigned ready_head, ready_count;
+static int wake_fd = -1;			// acorda o ciclo principal
+
+//	Registos das tarefas para o ciclo principal, que os publica
+static Stream_record records[STREAMS_RECORDS_SIZE];
+static unsigned records_head, records_count;
+
+static int listen_fd = -1;
+static int epoll_fd = -1;
+static Streams_client clients[STREAMS_CLIENTS_MAX];
+static uint64_t clients_disconnected;
+
+//------------------------------------------------------------------------------
+
+static bool identification_valid(const char *identification)
+{
+	size_t length = strlen(identification);
+	if (length == 0 || length > MQTT_GATEWAY_NAME_MAX)
+		return false;
+	//	Também faz parte de nomes de ficheiros
+	return strspn(identification, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-")
+		== length && identification[0] != '.';
+}
+
+/*
+ * Configurações dos fluxos, validadas. Só o array é libertado por quem chama:
+ * as strings pertencem a config.c e ficam válidas até config_sweep_destroy.
+ */
+static struct config *streams_load(const char *filename, unsigned *count)
+{
+	struct config *configs = config_sweep_load(filename, count);
+	if (configs == NULL)
+		return NULL;
+	if (*count > STREAMS_MAX) {
+		fprintf(stderr, "%s: too many streams (max %d)\n", filename, STREAMS_MAX);
+		config_sweep_destroy(configs);
+		return NULL;
+	}
+	for (unsigned i = 0; i < *count; i++) {
+		Weighting weighting;
+		if (!identification_valid(configs[i].identification)) {
+			fprintf(stderr, "%s: stream %u: invalid identification \"%s\"\n",
+				filename, i, configs[i].identification);
+			config_sweep_destroy(configs);
+			return NULL;
+		}
+		if (!weighting_parse(configs[i].weighting, &weighting)) {
+			fprintf(stderr, "%s: stream %s: unknown weighting \"%s\" (A or Z)\n",
+				filename, configs[i].identification, configs[i].weighting);
+			config_sweep_destroy(configs);
+			return NULL;
+		}
+		for (unsigned j = 0; j < i; j++)
+			if (strcmp(configs[i].identification, configs[j].identification) == 0) {
+				fprintf(stderr, "%s: repeated identification \"%s\"\n",
+					filename, configs[i].identification);
+				config_sweep_destroy(configs);
+				return NULL;
+			}
+	}
+	return configs;
+}
+
+static time_t monotonic_seconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+static void main_wake()
+{
+	uint64_t one = 1;
+	if (write(wake_fd, &one, sizeof one) < 0 && errno != EAGAIN)
+		fprintf(stderr, "Streams: eventfd write error: %s\n", strerror(errno));
+}
+
+//	Com mutex
+static void ready_push(unsigned index)
+{
+	ready_queue[(ready_head + ready_count++) % STREAMS_MAX] = index;
+	streams[index].state = STREAM_QUEUED;
+	cnd_signal(&ready_condition);
+}
+
+//------------------------------------------------------------------------------
+//	Processamento de um fluxo
+
+/*
+ * <directory><identification>_<AAAAMMDDHHMMSS>.csv
+ */
+static bool stream_file_open(Stream *stream)
+{
+	const char *directory = stream->directory;
+	const char *identification = stream->config.identification;
+	time_t calendar = time(NULL);
+	struct tm tm;
+	char date[sizeof "AAAAMMDDHHMMSS"];
+	strftime(date, sizeof date, "%Y%m%d%H%M%S", localtime_r(&calendar, &tm));
+	size_t size = strlen(directory) + strlen(identification) + sizeof "_AAAAMMDDHHMMSS_4294967295.csv";
+	char filepath[size];
+	//	Um ficheiro de entrada é lido mais depressa do que o tempo real
+	snprintf(filepath, size, "%s%s_%s.csv", directory, identification, date);
+	for (unsigned sequence = 2; access(filepath, F_OK) == 0; sequence++)
+		snprintf(filepath, size, "%s%s_%s_%u.csv", directory, identification, date, sequence);
+	stream->file_segments = 0;
+	stream->fd = fopen(filepath, "w");
+	if (stream->fd == NULL) {
+		fprintf(stderr, "fopen(%s, \"w\") error: %s\n", filepath, strerror(errno));
+		return false;
+	}
+	fprintf(stream->fd, "LAeq, LAFmin, LAE, LAFmax, LApeak\n");
+	return true;
+}
+
+static void stream_close(Stream *stream)
+{
+	input_close(&stream->input);
+	if (stream->fd != NULL)
+		fclose(stream->fd);
+	if (stream->levels != NULL)
+		levels_destroy(stream->levels);
+	if (stream->ring_b != NULL)
+		sbuffer_destroy(stream->ring_b);
+	if (stream->ring_d != NULL)
+		sbuffer_destroy(stream->ring_d);
+	if (stream->afilter != NULL)
+		aweighting_destroy(stream->afilter);
+	if (stream->timeweight != NULL)
+		timeweight_destroy(stream->timeweight);
+	free(stream->block_a);
+	free(stream->block_c);
+	stream->fd = NULL;
+	stream->levels = NULL;
+	stream->ring_b = stream->ring_d = NULL;
+	stream->afilter = NULL;
+	stream->timeweight = NULL;
+	stream->block_a = stream->block_c = NULL;
+	stream->open = false;
+}
+
+static bool stream_open(Stream *stream)
+{
+	struct config *config = &stream->config;
+	if (!input_open(&stream->input, config, false))
+		return false;
+	stream->open = true;
+	//	A entrada define sample_rate num ficheiro WAVE
+	config->segment_size = config->segment_duration * config->sample_rate / 1000;
+	if (config->segment_size == 0) {
+		fprintf(stderr, "Streams: %s: invalid segment duration %u\n",
+			config->identification, config->segment_duration);
+		stream_close(stream);
+		return false;
+	}
+	unsigned block_size = config->block_size;
+	unsigned segment_buffer_size = ((config->segment_size + block_size - 1) / block_size + 1) * block_size;
+	weighting_parse(config->weighting, &stream->weighting);
+	stream->afilter = aweighting_create(3);
+	stream->timeweight = timeweight_create();
+	stream->block_a = malloc(config->channels * block_size * sizeof *stream->block_a);
+	stream->block_c = malloc(block_size * sizeof *stream->block_c);
+	stream->ring_b = sbuffer_create(segment_buffer_size);
+	stream->ring_d = sbuffer_create(segment_buffer_size);
+	stream->levels = levels_create();
+	stream->average = (Lae_average){0};
+	if (stream->afilter == NULL || stream->timeweight == NULL || stream->block_a == NULL
+			|| stream->block_c == NULL || stream->ring_b == NULL || stream->ring_d == NULL
+			|| stream->levels == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		stream_close(stream);
+		return false;
+	}
+	if (!stream_file_open(stream)) {
+		stream_close(stream);
+		return false;
+	}
+	stream->descriptors = input_descriptors(&stream->input, stream->pollfds, STREAMS_DESCRIPTORS_MAX);
+	stream->starts++;
+	if (verbose_flag)
+		printf("Streams: %s opened (%s)\n", config->identification,
+			config->input_file != NULL ? config->input_file : config->input_device);
+	return true;
+}
+
+static void stream_segment(Stream *stream)
+{
+	Levels *levels = stream->levels;
+	if (stream->fd != NULL) {
+		fprintf(stream->fd, "%5.1f, %5.1f, %5.1f, %5.1f, %5.1f\n",
+				levels->LAeq[0], levels->LAFmin[0], levels->LAE[0],
+				levels->LAFmax[0], levels->LApeak[0]);
+		fflush(stream->fd);
+	}
+	stream->segments++;
+	//	Sem ficheiro, o fluxo continua a ser publicado
+	if (++stream->file_segments >= stream->config.file_period) {
+		if (stream->fd != NULL)
+			fclose(stream->fd);
+		stream_file_open(stream);
+	}
+
+	Stream_record record = {
+		.stream = stream - streams, .ts = (uint64_t)time(NULL),
+		.laeq = levels->LAeq[0], .lafmin = levels->LAFmin[0], .lae = levels->LAE[0],
+		.lafmax = levels->LAFmax[0], .lapeak = levels->LApeak[0]
+	};
+	mtx_lock(&mutex);
+	if (records_count < STREAMS_RECORDS_SIZE)
+		records[(records_head + records_count++) % STREAMS_RECORDS_SIZE] = record;
+	else
+		stream->lost++;
+	mtx_unlock(&mutex);
+	main_wake();
+	levels->segment_number = 0;
+}
+
+static void stream_block(Stream *stream, unsigned length)
+{
+	struct config *config = &stream->config;
+	float *block_b = sbuffer_write_ptr(stream->ring_b);
+	assert(length <= sbuffer_write_size(stream->ring_b));	// Há sempre um bloco disponível
+	weighting_filtering(stream->afilter, stream->weighting, stream->block_a, block_b, length);
+	sbuffer_write_produces(stream->ring_b, length);
+	process_segment_lapeak(stream->levels, stream->ring_b, config);
+	process_block_square(block_b, stream->block_c, length);
+
+	float *block_d = sbuffer_write_ptr(stream->ring_d);
+	assert(length <= sbuffer_write_size(stream->ring_d));
+	timeweight_filtering(stream->timeweight, stream->block_c, block_d, length);
+	sbuffer_write_produces(stream->ring_d, length);
+	if (sbuffer_size(stream->ring_d) >= config->segment_size) {
+		process_segment_levels_average(stream->levels, stream->ring_d, config, &stream->average);
+		stream_segment(stream);
+	}
+}
+
+/*
+ * Há amostras para ler sem esperar?
+ */
+static bool stream_ready(Stream *stream)
+{
+	//	Um emissor PCM pode ter-se ligado ou desligado
+	stream->descriptors = input_descriptors(&stream->input, stream->pollfds, STREAMS_DESCRIPTORS_MAX);
+	if (poll(stream->pollfds, stream->descriptors, 0) < 0)
+		return true;	// o erro aparece na leitura
+	return input_ready(&stream->input, stream->pollfds, stream->descriptors, stream->config.block_size);
+}
+
+/*
+ * Uma tarefa: abre o fluxo ou processa até STREAMS_TASK_BLOCKS blocos.
+ *
+ * @return Estado seguinte do fluxo.
+ */
+static Stream_state stream_task(Stream *stream)
+{
+	const char *identification = stream->config.identification;
+	if (!stream->open) {
+		if (stream_open(stream))
+			return stream->descriptors == 0 ? STREAM_QUEUED : STREAM_POLLING;
+		fprintf(stderr, "Streams: %s not opened, retry in %d s\n", identification, STREAMS_RESTART_DELAY);
+		stream->restart = monotonic_seconds() + STREAMS_RESTART_DELAY;
+		return STREAM_WAITING;
+	}
+	for (unsigned i = 0; i < STREAMS_TASK_BLOCKS; i++) {
+		size_t length = input_read(&stream->input, stream->config.channels,
+					stream->block_a, stream->config.block_size);
+		if (length == 0 && !input_ended(&stream->input))
+			break;	// sem amostras: fica à espera do emissor PCM
+		if (length == 0) {
+			stream_close(stream);
+			if (stream->config.input_file != NULL) {
+				if (verbose_flag)
+					printf("Streams: %s finished\n", identification);
+				return STREAM_FINISHED;
+			}
+			fprintf(stderr, "Streams: %s ended, reopen in %d s\n", identification, STREAMS_RESTART_DELAY);
+			stream->restart = monotonic_seconds() + STREAMS_RESTART_DELAY;
+			return STREAM_WAITING;
+		}
+		stream_block(stream, length);
+		if (stream->descriptors > 0 && !stream_ready(stream))
+			break;
+	}
+	if (stream->descriptors == 0)
+		return STREAM_QUEUED;
+	//	Com ou sem emissor, um fluxo PCM é vigiado também no socket à escuta
+	stream->descriptors = input_descriptors(&stream->input, stream->pollfds, STREAMS_DESCRIPTORS_MAX);
+	return STREAM_POLLING;
+}
+
+static int worker(void *argument)
+{
+	mtx_lock(&mutex);
+	while (true) {
+		while (!stopping && ready_count == 0)
+			cnd_wait(&ready_condition, &mutex);
+		if (stopping)
+			break;
+		unsigned index = ready_queue[ready_head];
+		ready_head = (ready_head + 1) % STREAMS_MAX;
+		ready_count--;
+		mtx_unlock(&mutex);
+
+		Stream_state state = stream_task(&streams[index]);
+
+		mtx_lock(&mutex);
+		if (state == STREAM_QUEUED) {
+			ready_push(index);	// no fim da fila: os outros fluxos não esperam
+		}
+		else {
+			streams[index].state = state;
+			main_wake();
+		}
+	}
+	mtx_unlock(&mutex);
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//	Servidor partilhado
+
+static void client_close(Streams_client *client)
+{
+	close(client->fd);
+	client->fd = -1;
+}
+
+static void client_send(Streams_client *client, const char *message, int length)
+{
+	//	Uma mensagem incompleta não pode ser retomada: o cliente é desligado
+	if (send(client->fd, message, length, MSG_NOSIGNAL | MSG_DONTWAIT) != length) {
+		client_close(client);
+		clients_disconnected++;
+	}
+}
+
+static void client_request(Streams_client *client, char *request)
+{
+	char *token = strtok(request, " \t\r");
+	if (token == NULL || strcmp(token, "streams") != 0) {
+		static const char error[] = "{\"error\": \"unknown request\"}\n";
+		client_send(client, error, sizeof error - 1);
+		return;
+	}
+	client->streams = 0;
+	while ((token = strtok(NULL, " \t\r")) != NULL) {
+		unsigned i = 0;
+		while (i < streams_number && strcmp(streams[i].config.identification, token) != 0)
+			i++;
+		if (i < streams_number) {
+			client->streams |= 1ULL << i;
+		}
+		else {
+			char error[SERVER_REQUEST_SIZE + 40];
+			int length = snprintf(error, sizeof error, "{\"error\": \"unknown stream %s\"}\n", token);
+			client_send(client, error, length);
+			if (client->fd < 0)
+				return;
+		}
+	}
+}
+
+static void client_read(Streams_client *client)
+{
+	ssize_t length = read(client->fd, client->request + client->length,
+				sizeof client->request - 1 - client->length);
+	if (length <= 0) {
+		if (length == 0 || errno != EAGAIN)
+			client_close(client);
+		return;
+	}
+	client->length += length;
+	client->request[client->length] = '\0';
+	char *end;
+	while (client->fd >= 0 && (end = strchr(client->request, '\n')) != NULL) {
+		*end = '\0';
+		client_request(client, client->request);
+		client->length -= end + 1 - client->request;
+		memmove(client->request, end + 1, client->length + 1);
+	}
+	if (client->fd >= 0 && client->length == sizeof client->request - 1)
+		client_close(client);	// pedido demasiado longo
+}
+
+static void client_accept()
+{
+	int fd;
+	while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		unsigned i = 0;
+		while (i < STREAMS_CLIENTS_MAX && clients[i].fd >= 0)
+			i++;
+		if (i == STREAMS_CLIENTS_MAX) {
+			close(fd);
+			continue;
+		}
+		struct epoll_event event = {.events = EPOLLIN, .data.ptr = &clients[i]};
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+			fprintf(stderr, "epoll_ctl error: %s\n", strerror(errno));
+			close(fd);
+			continue;
+		}
+		clients[i] = (Streams_client){.fd = fd, .streams = UINT64_MAX};
+	}
+}
+
+static bool server_open(const char *path)
+{
+	for (unsigned i = 0; i < STREAMS_CLIENTS_MAX; i++)
+		clients[i].fd = -1;
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof address.sun_path) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return false;
+	}
+	strcpy(address.sun_path, path);
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (listen_fd < 0 || epoll_fd < 0) {
+		fprintf(stderr, "socket error: %s\n", strerror(errno));
+		return false;
+	}
+	unlink(path);
+	struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+	if (bind(listen_fd, (struct sockaddr *)&address, sizeof address) < 0
+			|| listen(listen_fd, SOMAXCONN) < 0
+			|| epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) < 0) {
+		fprintf(stderr, "bind(%s) error: %s\n", path, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static void server_close(const char *path)
+{
+	for (unsigned i = 0; i < STREAMS_CLIENTS_MAX; i++)
+		if (clients[i].fd >= 0)
+			client_close(&clients[i]);
+	if (listen_fd >= 0) {
+		close(listen_fd);
+		unlink(path);
+	}
+	if (epoll_fd >= 0)
+		close(epoll_fd);
+	listen_fd = epoll_fd = -1;
+}
+
+static void server_poll(int timeout)
+{
+	struct epoll_event events[STREAMS_CLIENTS_MAX + 1];
+	int n = epoll_wait(epoll_fd, events, STREAMS_CLIENTS_MAX + 1, timeout);
+	for (int i = 0; i < n; i++)
+		if (events[i].data.ptr == NULL)
+			client_accept();
+		else if (((Streams_client *)events[i].data.ptr)->fd >= 0)
+			client_read(events[i].data.ptr);
+}
+
+//------------------------------------------------------------------------------
+//	Publicação dos níveis
+
+static void record_forward(const Stream_record *record)
+{
+	if (streams_config->mqtt_enable) {
+		Mqtt_record mqtt_record = {
+			.ts = record->ts * 1000, .LAeq = record->laeq, .LAFmin = record->lafmin,
+			.LAE = record->lae, .LAFmax = record->lafmax, .LApeak = record->lapeak,
+			.direction = DIRECTION_UNDEFINED, .device = record->stream
+		};
+		mqtt_publish_record(&mqtt_record);
+	}
+	char message[SERVER_MESSAGE_SIZE + MQTT_GATEWAY_NAME_MAX];
+	int length = snprintf(message, sizeof message, "{\"identification\": \"%s\", \"ts\": %llu, \"values\": "
+			"{\"LAeq\": %.1f, \"LAFmin\": %.1f, \"LAE\": %.1f, \"LAFmax\": %.1f, \"LApeak\": %.1f } }\n",
+			streams[record->stream].config.identification, (unsigned long long)record->ts,
+			record->laeq, record->lafmin, record->lae, record->lafmax, record->lapeak);
+	for (unsigned i = 0; i < STREAMS_CLIENTS_MAX; i++)
+		if (clients[i].fd >= 0 && (clients[i].streams & 1ULL << record->stream))
+			client_send(&clients[i], message, length);
+}
+
+static void records_forward()
+{
+	Stream_record pending[STREAMS_RECORDS_SIZE];
+	mtx_lock(&mutex);
+	unsigned count = records_count;
+	for (unsigned i = 0; i < count; i++)
+		pending[i] = records[(records_head + i) % STREAMS_RECORDS_SIZE];
+	records_head = (records_head + count) % STREAMS_RECORDS_SIZE;
+	records_count = 0;
+	mtx_unlock(&mutex);
+	for (unsigned i = 0; i < count; i++)
+		record_forward(&pending[i]);
+}
+
+/*
+ * Espera por amostras dos fluxos em STREAM_POLLING, por pedidos
+ * dos clientes e pelas tarefas; põe na fila os fluxos prontos.
+ *
+ * @return false quando todos os fluxos terminaram.
+ */
+static bool streams_poll()
+{
+	struct pollfd pollfds[2 + STREAMS_MAX * STREAMS_DESCRIPTORS_MAX];
+	unsigned first[STREAMS_MAX] = {0};	// posição dos descritores de cada fluxo vigiado
+	pollfds[0] = (struct pollfd){.fd = epoll_fd, .events = POLLIN};
+	pollfds[1] = (struct pollfd){.fd = wake_fd, .events = POLLIN};
+	unsigned count = 2;
+	unsigned finished = 0;
+	time_t now = monotonic_seconds();
+
+	mtx_lock(&mutex);
+	for (unsigned i = 0; i < streams_number; i++) {
+		Stream *stream = &streams[i];
+		if (stream->state == STREAM_WAITING && now >= stream->restart)
+			ready_push(i);
+		else if (stream->state == STREAM_POLLING && stream->descriptors == 0)
+			ready_push(i);
+		else if (stream->state == STREAM_POLLING) {
+			first[i] = count;
+			memcpy(pollfds + count, stream->pollfds, stream->descriptors * sizeof *pollfds);
+			count += stream->descriptors;
+		}
+		finished += stream->state == STREAM_FINISHED;
+	}
+	mtx_unlock(&mutex);
+	if (finished == streams_number)
+		return false;
+
+	//	Só o ciclo principal tira um fluxo de STREAM_POLLING
+	if (poll(pollfds, count, STREAMS_POLL_INTERVAL) > 0) {
+		if (pollfds[1].revents != 0) {
+			uint64_t value;
+			if (read(wake_fd, &value, sizeof value) < 0 && errno != EAGAIN)
+				fprintf(stderr, "Streams: eventfd read error: %s\n", strerror(errno));
+		}
+		for (unsigned i = 0; i < streams_number; i++) {
+			Stream *stream = &streams[i];
+			if (first[i] == 0)
+				continue;	// não vigiado (pode ter voltado entretanto de uma tarefa)
+			for (unsigned d = 0; d < stream->descriptors; d++)
+				stream->pollfds[d].revents = pollfds[first[i] + d].revents;
+			if (input_ready(&stream->input, stream->pollfds, stream->descriptors, stream->config.block_size)) {
+				mtx_lock(&mutex);
+				ready_push(i);
+				mtx_unlock(&mutex);
+			}
+		}
+		if (pollfds[0].revents != 0)
+			server_poll(0);
+	}
+	records_forward();
+	return true;
+}
+
+static void signal_handler(int signal)
+{
+	streams_running = false;
+}
+
+static bool workers_start()
+{
+	long processors = sysconf(_SC_NPROCESSORS_ONLN);
+	workers_number = processors > 0 ? processors : 1;
+	if (workers_number > streams_number)
+		workers_number = streams_number;
+	if (mtx_init(&mutex, mtx_plain) != thrd_success || cnd_init(&ready_condition) != thrd_success) {
+		fprintf(stderr, "Streams: mutex initialization error\n");
+		return false;
+	}
+	//	Os sinais são tratados pelo ciclo principal
+	sigset_t signals, previous;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, &previous);
+	unsigned created = 0;
+	while (created < workers_number && thrd_create(&workers[created], worker, NULL) == thrd_success)
+		created++;
+	pthread_sigmask(SIG_SETMASK, &previous, NULL);
+	if (created < workers_number) {
+		fprintf(stderr, "Streams: error creating worker threads\n");
+		workers_number = created;
+		return false;
+	}
+	return true;
+}
+
+static void workers_stop()
+{
+	mtx_lock(&mutex);
+	stopping = true;
+	cnd_broadcast(&ready_condition);
+	mtx_unlock(&mutex);
+	for (unsigned i = 0; i < workers_number; i++)
+		thrd_join(workers[i], NULL);
+	mtx_destroy(&mutex);
+	cnd_destroy(&ready_condition);
+}
+
+//------------------------------------------------------------------------------
+
+bool streams_run(const char *filename, struct config *config, bool verbose)
+{
+	verbose_flag = verbose;
+	streams_config = config;
+	struct config *configs = streams_load(filename, &streams_number);
+	if (configs == NULL)
+		return false;
+	bool done = true;
+	for (unsigned i = 0; i < streams_number; i++) {
+		Stream *stream = &streams[i];
+		*stream = (Stream){.config = configs[i], .state = STREAM_WAITING};
+		devices[i] = stream->config.identification;
+		const char *output_path = stream->config.output_path;
+		stream->directory = malloc(strlen(output_path) + strlen(devices[i]) + 2);
+		if (stream->directory == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			done = false;
+			break;
+		}
+		sprintf(stream->directory, "%s%s/", output_path, devices[i]);
+		if (mkdir(stream->directory, 0755) < 0 && errno != EEXIST) {
+			fprintf(stderr, "mkdir(%s) error: %s\n", stream->directory, strerror(errno));
+			done = false;
+			break;
+		}
+	}
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (done && wake_fd < 0) {
+		fprintf(stderr, "eventfd error: %s\n", strerror(errno));
+		done = false;
+	}
+	done = done && server_open(config->server_socket);
+	if (done && config->mqtt_enable) {
+		mqtt_gateway(devices, streams_number);
+		mqtt_begin();	// sem ligação, a tarefa de publicação volta a tentar
+	}
+
+	//	Sem SA_RESTART: os sinais interrompem poll
+	struct sigaction action = {.sa_handler = signal_handler};
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	done = done && workers_start();
+	streams_running = done;
+
+	if (verbose && done)
+		printf("Streams: %u streams on %u worker threads, server %s%s\n", streams_number,
+			workers_number, config->server_socket, config->mqtt_enable ? ", MQTT gateway" : "");
+	while (streams_running && streams_poll())
+		;
+
+	workers_stop();
+	for (unsigned i = 0; i < streams_number; i++)
+		if (streams[i].open)
+			stream_close(&streams[i]);
+	records_forward();	// os últimos níveis
+
+	if (config->mqtt_enable && done) {
+		mqtt_end();
+		if (verbose) {
+			Mqtt_statistics statistics;
+			mqtt_statistics(&statistics);
+			printf("MQTT gateway: %llu records in %llu messages, %llu dropped, %llu failed\n",
+				(unsigned long long)statistics.records, (unsigned long long)statistics.messages,
+				(unsigned long long)statistics.dropped, (unsigned long long)statistics.failed);
+		}
+	}
+	server_close(config->server_socket);
+	if (wake_fd >= 0)
+		close(wake_fd);
+	if (verbose) {
+		for (unsigned i = 0; i < streams_number; i++)
+			printf("Streams: %s %llu segments, %llu lost, %u starts\n", streams[i].config.identification,
+				(unsigned long long)streams[i].segments, (unsigned long long)streams[i].lost,
+				streams[i].starts);
+		printf("Streams: %llu slow clients disconnected\n", (unsigned long long)clients_disconnected);
+	}
+	for (unsigned i = 0; i < streams_number; i++)
+		free(streams[i].directory);
+	config_sweep_destroy(configs);
+	return done;
+}
@@ -0,0 +1,73 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef STREAMS_H
+#define STREAMS_H
+
+#include <stdbool.h>
+
+#include "config.h"
+
+/*
+ * Modo multi-fluxo: vários fluxos de som medidos num só processo,
+ * a partir de uma só configuração.
+ *
+ * O ficheiro de fluxos contém uma lista JSON de objetos, cada um com
+ * a identification do fluxo e os parâmetros que altera na configuração
+ * de base (input_device ou input_file, channels, weighting, ...), como no varrimento.
+ *
+ * Cada fluxo tem o seu contexto: entrada (in_out.h), filtros, buffers
+ * de segmento, cálculo de LAeq e ficheiro de saída CSV
+ * <output_path><identification>/<identification>_AAAAMMDDHHMMSS.csv,
+ * mudado a cada file_period segmentos.
+ *
+ * Os fluxos são processados por um conjunto de tarefas partilhado,
+ * uma por processador (no máximo uma por fluxo). O ciclo principal vigia
+ * as entradas com poll e põe na fila os fluxos com amostras; uma tarefa
+ * processa os blocos disponíveis de um fluxo, até STREAMS_TASK_BLOCKS,
+ * e devolve-o. Um ficheiro está sempre pronto e volta ao fim da fila.
+ * Uma tarefa nunca espera por um emissor PCM (pcm_stream_listen): o socket
+ * à escuta é criado na abertura e mantido quando o emissor desliga, e é
+ * vigiado pelo ciclo principal, tal como a ligação do emissor.
+ * Uma entrada que termina ou falha é reaberta ao fim de STREAMS_RESTART_DELAY
+ * segundos; um ficheiro é lido uma vez. O modo termina com SIGINT ou SIGTERM,
+ * ou quando todos os fluxos são ficheiros lidos até ao fim.
+ *
+ * Os níveis de cada segmento são entregues ao ciclo principal, que
+ * - os publica numa só ligação MQTT, no modo gateway (mqtt.h),
+ *   com a identification de cada fluxo como dispositivo;
+ * - os envia aos clientes do socket server_socket, um objeto JSON por linha:
+ *	{"identification": "<fluxo>", "ts": ..., "values": {"LAeq": ..., ...}}
+ *   Um cliente escolhe os fluxos com a linha "streams <identification> ...\n"
+ *   (por omissão, todos). Um cliente que não acompanha o ritmo é desligado.
+ * Os níveis que não cabem em STREAMS_RECORDS_SIZE são perdidos (contados).
+ * Não há histórico, eventos, arquivo de som nem memória partilhada por fluxo.
+ */
+
+#define STREAMS_MAX		64
+#define STREAMS_POLL_INTERVAL	100	// milisegundos
+#define STREAMS_RESTART_DELAY	5	// segundos
+#define STREAMS_TASK_BLOCKS	16	// blocos processados por tarefa, no máximo
+#define STREAMS_DESCRIPTORS_MAX	4	// descritores de poll por entrada
+#define STREAMS_RECORDS_SIZE	256	// níveis à espera de publicação
+#define STREAMS_CLIENTS_MAX	64
+
+/**
+ * @brief Mede os fluxos do ficheiro filename até SIGINT ou SIGTERM.
+ */
+bool streams_run(const char *filename, struct config *config, bool verbose);
+
+#endif
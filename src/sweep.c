@@ -0,0 +1,236 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+
+#include "sweep.h"
+#include "config.h"
+#include "process.h"
+#include "filter.h"
+#include "sbuffer.h"
+#include "in_out.h"
+
+#define SWEEP_STAGES	2	// uma por ponderação
+
+typedef struct {
+	Weighting weighting;
+	Afilter *afilter;
+	Timeweight *timeweight;
+	float *block_b;		// ponderado
+	float *block_c;		// ao quadrado
+	float *block_d;		// média exponencial
+} Sweep_stage;
+
+typedef struct {
+	struct config *config;
+	Sweep_stage *stage;
+	struct sbuffer *ring_b;
+	struct sbuffer *ring_d;
+	Lae_average average;
+	Levels *levels;
+	char *filepath;
+	FILE *fd;
+	unsigned segments;
+} Sweep_pipeline;
+
+static Sweep_stage stages[SWEEP_STAGES];
+static unsigned stages_number;
+static Sweep_pipeline *pipelines;
+static unsigned pipelines_number;
+
+static Sweep_stage *stage_get(Weighting weighting, unsigned block_size)
+{
+	for (unsigned i = 0; i < stages_number; i++)
+		if (stages[i].weighting == weighting)
+			return &stages[i];
+	Sweep_stage *stage = &stages[stages_number++];
+	stage->weighting = weighting;
+	stage->afilter = aweighting_create(3);
+	stage->timeweight = timeweight_create();
+	stage->block_b = malloc(3 * block_size * sizeof *stage->block_b);
+	stage->block_c = stage->block_b + block_size;
+	stage->block_d = stage->block_c + block_size;
+	return stage;
+}
+
+/*
+ * <ficheiro de saída sem extensão>_<index>.csv
+ */
+static char *pipeline_filepath(unsigned index)
+{
+	const char *output = output_get_filepath();
+	const char *filename = strrchr(output, '/');
+	const char *extension = strrchr(filename != NULL ? filename : output, '.');
+	size_t stem = extension != NULL ? (size_t)(extension - output) : strlen(output);
+	char *filepath = malloc(stem + 16);
+	if (filepath != NULL)
+		sprintf(filepath, "%.*s_%u.csv", (int)stem, output, index);
+	return filepath;
+}
+
+static bool pipeline_create(Sweep_pipeline *pipeline, struct config *config, unsigned index)
+{
+	//	Os blocos chegam com o formato da entrada, lida uma só vez
+	const char *input_key = config->sample_rate != config_struct->sample_rate ? "sample_rate"
+		: config->channels != config_struct->channels ? "channels"
+		: config->block_size != config_struct->block_size ? "block_size"
+		: (config->input_file == NULL) != (config_struct->input_file == NULL)
+			|| (config->input_file != NULL && strcmp(config->input_file, config_struct->input_file) != 0)
+			? "input_file" : NULL;
+	if (input_key != NULL) {
+		fprintf(stderr, "Sweep %u: %s can't change, it is defined by the input\n", index, input_key);
+		return false;
+	}
+	Weighting weighting;
+	if (!weighting_parse(config->weighting, &weighting)) {
+		fprintf(stderr, "Sweep %u: unknown weighting \"%s\" (A or Z)\n", index, config->weighting);
+		return false;
+	}
+	config->segment_size = config->segment_duration * config->sample_rate / 1000;
+	if (config->segment_size == 0) {
+		fprintf(stderr, "Sweep %u: invalid segment duration %u\n", index, config->segment_duration);
+		return false;
+	}
+	unsigned block_size = config_struct->block_size;
+	pipeline->config = config;
+	pipeline->stage = stage_get(weighting, block_size);
+	unsigned segment_buffer_size = ((config->segment_size + block_size - 1) / block_size + 1) * block_size;
+	pipeline->ring_b = sbuffer_create(segment_buffer_size);
+	pipeline->ring_d = sbuffer_create(segment_buffer_size);
+	pipeline->average = (Lae_average){0};
+	pipeline->levels = levels_create();
+	pipeline->segments = 0;
+	pipeline->filepath = pipeline_filepath(index);
+	if (pipeline->stage->block_b == NULL || pipeline->ring_b == NULL || pipeline->ring_d == NULL
+			|| pipeline->levels == NULL || pipeline->filepath == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return false;
+	}
+	pipeline->fd = fopen(pipeline->filepath, "w");
+	if (pipeline->fd == NULL) {
+		fprintf(stderr, "fopen(%s, \"w\") error: %s\n", pipeline->filepath, strerror(errno));
+		return false;
+	}
+	fprintf(pipeline->fd, "LAeq, LAFmin, LAE, LAFmax, LApeak\n");
+	return true;
+}
+
+static void pipeline_destroy(Sweep_pipeline *pipeline)
+{
+	if (pipeline->fd != NULL)
+		fclose(pipeline->fd);
+	free(pipeline->filepath);
+	if (pipeline->levels != NULL)
+		levels_destroy(pipeline->levels);
+	if (pipeline->ring_b != NULL)
+		sbuffer_destroy(pipeline->ring_b);
+	if (pipeline->ring_d != NULL)
+		sbuffer_destroy(pipeline->ring_d);
+}
+
+static void ring_write(struct sbuffer *ring, const float *block, unsigned length)
+{
+	float *buffer = sbuffer_write_ptr(ring);
+	assert(length <= sbuffer_write_size(ring));	// Há sempre um bloco disponível
+	memcpy(buffer, block, length * sizeof *block);
+	sbuffer_write_produces(ring, length);
+}
+
+static void pipeline_block(Sweep_pipeline *pipeline, unsigned length)
+{
+	Levels *levels = pipeline->levels;
+	ring_write(pipeline->ring_b, pipeline->stage->block_b, length);
+	process_segment_lapeak(levels, pipeline->ring_b, pipeline->config);
+	ring_write(pipeline->ring_d, pipeline->stage->block_d, length);
+	if (sbuffer_size(pipeline->ring_d) >= pipeline->config->segment_size) {
+		process_segment_levels_average(levels, pipeline->ring_d, pipeline->config, &pipeline->average);
+		fprintf(pipeline->fd, "%5.1f, %5.1f, %5.1f, %5.1f, %5.1f\n",
+				levels->LAeq[0], levels->LAFmin[0], levels->LAE[0],
+				levels->LAFmax[0], levels->LApeak[0]);
+		levels->segment_number = 0;
+		pipeline->segments++;
+	}
+}
+
+static double elapsed(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+bool sweep_run(const char *sweep_filename, bool verbose)
+{
+	//	A entrada define sample_rate, herdado pelas configurações
+	if (!input_device_open(config_struct))
+		return false;
+	struct config *configs = config_sweep_load(sweep_filename, &pipelines_number);
+	if (configs == NULL) {
+		input_device_close();
+		return false;
+	}
+	pipelines = calloc(pipelines_number, sizeof *pipelines);
+	bool result = pipelines != NULL;
+	for (unsigned i = 0; result && i < pipelines_number; i++)
+		result = pipeline_create(&pipelines[i], &configs[i], i);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned block_size = config_struct->block_size;
+	float *block = malloc(config_struct->channels * block_size * sizeof *block);
+	uint64_t frames = 0;
+	size_t length;
+	while (result && block != NULL && (length = input_device_read(block, block_size)) > 0) {
+		frames += length;
+		for (unsigned s = 0; s < stages_number; s++) {
+			Sweep_stage *stage = &stages[s];
+			weighting_filtering(stage->afilter, stage->weighting, block, stage->block_b, length);
+			process_block_square(stage->block_b, stage->block_c, length);
+			timeweight_filtering(stage->timeweight, stage->block_c, stage->block_d, length);
+		}
+		for (unsigned p = 0; p < pipelines_number; p++)
+			pipeline_block(&pipelines[p], length);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	free(block);
+	input_device_close();
+
+	if (result && verbose) {
+		printf("Sweep: %u configurations, %u filter stages, %.1f s of audio in %.3f s\n",
+			pipelines_number, stages_number, (double)frames / config_struct->sample_rate,
+			elapsed(&start, &end));
+		for (unsigned p = 0; p < pipelines_number; p++) {
+			struct config *config = pipelines[p].config;
+			printf("\t%u: weighting %s, segment %u ms, calibration delta %.1f, %u segments, %s\n",
+				p, config->weighting, config->segment_duration, config->calibration_delta,
+				pipelines[p].segments, pipelines[p].filepath);
+		}
+	}
+	for (unsigned p = 0; pipelines != NULL && p < pipelines_number; p++)
+		pipeline_destroy(&pipelines[p]);
+	free(pipelines);
+	for (unsigned s = 0; s < stages_number; s++) {
+		aweighting_destroy(stages[s].afilter);
+		timeweight_destroy(stages[s].timeweight);
+		free(stages[s].block_b);
+	}
+	stages_number = 0;
+	config_sweep_destroy(configs);
+	return result;
+}
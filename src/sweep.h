@@ -0,0 +1,46 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdbool.h>
+
+/*
+ * Varrimento de configurações: um ficheiro de entrada é lido uma vez
+ * e cada bloco é processado por várias cadeias, uma por configuração
+ * do ficheiro de varrimento (config_sweep_load).
+ *
+ * As cadeias com a mesma ponderação (config weighting) partilham
+ * os blocos filtrados - ponderação, quadrado e média exponencial são
+ * calculados uma vez por ponderação. Cada cadeia tem os seus buffers
+ * de segmento, a sua duração de segmento (segment_duration) e a sua
+ * calibração (calibration_delta).
+ *
+ * Os níveis de cada configuração n são escritos em CSV, no formato
+ * dos ficheiros de saída, em <ficheiro de saída sem extensão>_<n>.csv.
+ * Os parâmetros da entrada (input_file, sample_rate, channels
+ * e block_size) são os de config_struct; uma configuração que os altere
+ * é rejeitada.
+ */
+
+/**
+ * @brief Processa config_struct->input_file com as configurações
+ * do ficheiro sweep_filename.
+ */
+bool sweep_run(const char *sweep_filename, bool verbose);
+
+#endif
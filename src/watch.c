@@ -0,0 +1,508 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
+
+#include "watch.h"
+
+//	Conjunto de strings, endereçamento aberto
+typedef struct {
+	char **slots;
+	size_t capacity;		// potência de 2
+	size_t count;			// inclui as removidas
+} String_set;
+
+static char removed[1];			// marca de posição removida
+
+typedef struct watch_job {
+	struct watch_job *next;
+	char *filepath;
+	char *key;			// linha do journal
+	bool stale;			// alterado durante o processamento
+} Watch_job;
+
+typedef struct {
+	pid_t pid;			// 0 - livre
+	Watch_job *job;
+	struct timespec start;
+} Watch_worker;
+
+static volatile sig_atomic_t watching;
+
+static String_set done;			// chaves do journal
+static String_set pending;		// caminhos em fila ou em processamento
+static Watch_job *queue_head, *queue_tail;
+static Watch_worker *workers;
+static unsigned workers_number, workers_busy;
+static FILE *journal;
+static char *const *worker_arguments;
+static bool verbose_flag;
+
+static int inotify_fd;
+static int watch_descriptors[WATCH_PATHS_MAX];
+static char *const *watch_paths;
+static unsigned watch_paths_number;
+
+static struct {
+	unsigned queued, processed, failed, requeued;
+	double time, time_max;		// duração dos processamentos (segundos)
+} statistics;
+
+//------------------------------------------------------------------------------
+
+static size_t string_hash(const char *string)
+{
+	size_t hash = 14695981039346656037ULL;
+	while (*string != '\0')
+		hash = (hash ^ (unsigned char)*string++) * 1099511628211ULL;
+	return hash;
+}
+
+static char **set_slot(String_set *set, const char *key)
+{
+	size_t mask = set->capacity - 1;
+	for (size_t i = string_hash(key) & mask; ; i = (i + 1) & mask)
+		if (set->slots[i] == NULL
+				|| (set->slots[i] != removed && strcmp(set->slots[i], key) == 0))
+			return &set->slots[i];
+}
+
+static bool set_contains(String_set *set, const char *key)
+{
+	return set->capacity > 0 && *set_slot(set, key) != NULL;
+}
+
+/*
+ * key passa a pertencer ao conjunto.
+ */
+static bool set_insert(String_set *set, char *key)
+{
+	if ((set->count + 1) * 2 > set->capacity) {
+		String_set larger = {.capacity = set->capacity == 0 ? 64 : set->capacity * 2};
+		larger.slots = calloc(larger.capacity, sizeof *larger.slots);
+		if (larger.slots == NULL)
+			return false;
+		for (size_t i = 0; i < set->capacity; i++)
+			if (set->slots[i] != NULL && set->slots[i] != removed) {
+				*set_slot(&larger, set->slots[i]) = set->slots[i];
+				larger.count++;
+			}
+		free(set->slots);
+		*set = larger;
+	}
+	char **slot = set_slot(set, key);
+	if (*slot != NULL) {
+		free(key);
+		return true;
+	}
+	*slot = key;
+	set->count++;
+	return true;
+}
+
+static void set_remove(String_set *set, const char *key)
+{
+	if (set->capacity == 0)
+		return;
+	char **slot = set_slot(set, key);
+	if (*slot != NULL) {
+		free(*slot);
+		*slot = removed;
+	}
+}
+
+static void set_destroy(String_set *set)
+{
+	for (size_t i = 0; i < set->capacity; i++)
+		if (set->slots[i] != removed)
+			free(set->slots[i]);
+	free(set->slots);
+	*set = (String_set){0};
+}
+
+//------------------------------------------------------------------------------
+
+static bool journal_open(const char *filepath)
+{
+	FILE *fd = fopen(filepath, "r");
+	if (fd != NULL) {
+		char *line = NULL;
+		size_t size = 0;
+		ssize_t length;
+		while ((length = getline(&line, &size, fd)) > 0) {
+			if (line[length - 1] == '\n')
+				line[length - 1] = '\0';
+			if (line[0] != '\0')
+				set_insert(&done, strdup(line));
+		}
+		free(line);
+		fclose(fd);
+	}
+	journal = fopen(filepath, "a");
+	if (journal == NULL) {
+		fprintf(stderr, "fopen(%s, \"a\") error: %s\n", filepath, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static void journal_append(char *key)
+{
+	fprintf(journal, "%s\n", key);
+	fflush(journal);
+	fsync(fileno(journal));
+	set_insert(&done, key);
+}
+
+//------------------------------------------------------------------------------
+
+static bool is_sound(const char *name)
+{
+	static const char *const extensions[] = WATCH_EXTENSIONS;
+	size_t length = strlen(name);
+	for (unsigned i = 0; i < sizeof extensions / sizeof extensions[0]; i++) {
+		size_t extension = strlen(extensions[i]);
+		if (length > extension && strcasecmp(name + length - extension, extensions[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Linha do journal do ficheiro absolute, com a data e a dimensão atuais.
+ */
+static bool file_key(const char *absolute, char *key, size_t size)
+{
+	struct stat status;
+	if (stat(absolute, &status) < 0 || !S_ISREG(status.st_mode))
+		return false;
+	snprintf(key, size, "%lld\t%lld\t%s",
+		(long long)status.st_mtime, (long long)status.st_size, absolute);
+	return true;
+}
+
+static Watch_job *job_running(const char *absolute)
+{
+	for (unsigned i = 0; i < workers_number; i++)
+		if (workers[i].pid != 0 && strcmp(workers[i].job->filepath, absolute) == 0)
+			return workers[i].job;
+	return NULL;
+}
+
+/*
+ * Põe o ficheiro absolute na fila, se ainda não foi processado
+ * nem está na fila. Um ficheiro em processamento que foi alterado
+ * (changed, ou com outra data ou dimensão) volta à fila no fim.
+ */
+static void filepath_enqueue(const char *absolute, bool changed)
+{
+	char key[64 + PATH_MAX];
+	if (!file_key(absolute, key, sizeof key))
+		return;
+	if (set_contains(&pending, absolute)) {
+		//	Na fila, a chave é tirada no início do processamento
+		Watch_job *job = job_running(absolute);
+		if (job != NULL && (changed || strcmp(job->key, key) != 0))
+			job->stale = true;
+		return;
+	}
+	if (set_contains(&done, key))
+		return;
+	Watch_job *job = malloc(sizeof *job);
+	if (job == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return;
+	}
+	job->next = NULL;
+	job->stale = false;
+	job->filepath = strdup(absolute);
+	job->key = strdup(key);
+	if (job->filepath == NULL || job->key == NULL || !set_insert(&pending, strdup(absolute))) {
+		fprintf(stderr, "Out of memory\n");
+		free(job->filepath);
+		free(job->key);
+		free(job);
+		return;
+	}
+	if (queue_tail == NULL)
+		queue_head = job;
+	else
+		queue_tail->next = job;
+	queue_tail = job;
+	statistics.queued++;
+}
+
+static void file_enqueue(const char *path, const char *name, bool changed)
+{
+	if (!is_sound(name))
+		return;
+	char filepath[strlen(path) + 1 + strlen(name) + 1];
+	sprintf(filepath, "%s/%s", path, name);
+	char absolute[PATH_MAX];
+	if (realpath(filepath, absolute) != NULL)
+		filepath_enqueue(absolute, changed);
+}
+
+static void directory_scan(const char *path)
+{
+	struct dirent **entries;
+	int count = scandir(path, &entries, NULL, alphasort);
+	if (count < 0) {
+		fprintf(stderr, "scandir(%s) error: %s\n", path, strerror(errno));
+		return;
+	}
+	for (int i = 0; i < count; i++) {
+		file_enqueue(path, entries[i]->d_name, false);
+		free(entries[i]);
+	}
+	free(entries);
+}
+
+//------------------------------------------------------------------------------
+
+static void job_destroy(Watch_job *job)
+{
+	set_remove(&pending, job->filepath);
+	free(job->filepath);
+	free(job->key);
+	free(job);
+}
+
+static void worker_start(Watch_worker *worker)
+{
+	Watch_job *job = queue_head;
+	queue_head = job->next;
+	if (queue_head == NULL)
+		queue_tail = NULL;
+
+	//	O journal regista a data e a dimensão do ficheiro processado
+	char key[64 + PATH_MAX];
+	if (!file_key(job->filepath, key, sizeof key)) {
+		statistics.failed++;
+		fprintf(stderr, "Watch: %s disappeared before processing\n", job->filepath);
+		job_destroy(job);
+		return;
+	}
+	char *fresh = strdup(key);
+	if (fresh != NULL) {
+		free(job->key);
+		job->key = fresh;
+	}
+
+	unsigned arguments_number = 0;
+	while (worker_arguments[arguments_number] != NULL)
+		arguments_number++;
+	char *argv[arguments_number + 4];
+	argv[0] = "sound_meter";
+	memcpy(argv + 1, worker_arguments, arguments_number * sizeof *argv);
+	argv[arguments_number + 1] = "-i";
+	argv[arguments_number + 2] = job->filepath;
+	argv[arguments_number + 3] = NULL;
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		//	Grupo próprio: o SIGINT do terminal não interrompe o processamento
+		setpgid(0, 0);
+		execv("/proc/self/exe", argv);
+		fprintf(stderr, "execv(/proc/self/exe) error: %s\n", strerror(errno));
+		_exit(EXIT_FAILURE);
+	}
+	if (pid < 0) {
+		fprintf(stderr, "fork error: %s\n", strerror(errno));
+		statistics.failed++;
+		job_destroy(job);
+		return;
+	}
+	worker->pid = pid;
+	worker->job = job;
+	clock_gettime(CLOCK_MONOTONIC, &worker->start);
+	workers_busy++;
+}
+
+static void workers_reap()
+{
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		Watch_worker *worker = NULL;
+		for (unsigned i = 0; i < workers_number; i++)
+			if (workers[i].pid == pid)
+				worker = &workers[i];
+		if (worker == NULL)
+			continue;
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double time = (end.tv_sec - worker->start.tv_sec) + (end.tv_nsec - worker->start.tv_nsec) / 1e9;
+		Watch_job *job = worker->job;
+		if (job->stale) {
+			//	O resultado é de um ficheiro incompleto: não fica no journal
+			char filepath[PATH_MAX];
+			snprintf(filepath, sizeof filepath, "%s", job->filepath);
+			statistics.requeued++;
+			if (verbose_flag)
+				printf("Watch: %s changed while processing, queued again\n", filepath);
+			job_destroy(job);
+			worker->pid = 0;
+			workers_busy--;
+			filepath_enqueue(filepath, false);
+			continue;
+		}
+		if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+			journal_append(job->key);
+			job->key = NULL;
+			statistics.processed++;
+			statistics.time += time;
+			if (statistics.time_max < time)
+				statistics.time_max = time;
+			if (verbose_flag)
+				printf("Watch: %s processed in %.1f s\n", job->filepath, time);
+		}
+		else {
+			statistics.failed++;
+			fprintf(stderr, "Watch: %s failed (%s %d)\n", job->filepath,
+				WIFEXITED(status) ? "exit status" : "signal",
+				WIFEXITED(status) ? WEXITSTATUS(status) : WTERMSIG(status));
+		}
+		job_destroy(job);
+		worker->pid = 0;
+		workers_busy--;
+	}
+}
+
+static void events_read()
+{
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t length;
+	while ((length = read(inotify_fd, buffer, sizeof buffer)) > 0) {
+		for (char *ptr = buffer; ptr < buffer + length; ) {
+			const struct inotify_event *event = (const struct inotify_event *)ptr;
+			ptr += sizeof *event + event->len;
+			if (event->mask & IN_Q_OVERFLOW) {
+				//	Eventos perdidos: procura nas diretorias
+				for (unsigned i = 0; i < watch_paths_number; i++)
+					directory_scan(watch_paths[i]);
+				continue;
+			}
+			if (event->len == 0)
+				continue;
+			for (unsigned i = 0; i < watch_paths_number; i++)
+				if (watch_descriptors[i] == event->wd)
+					file_enqueue(watch_paths[i], event->name, true);
+		}
+	}
+}
+
+static void signal_handler(int signal)
+{
+	if (signal != SIGCHLD)
+		watching = false;
+}
+
+//------------------------------------------------------------------------------
+
+bool watch_run(char *const *paths, unsigned paths_number, char *const *arguments,
+		struct config *config, bool verbose)
+{
+	verbose_flag = verbose;
+	worker_arguments = arguments;
+	watch_paths = paths;
+	watch_paths_number = paths_number;
+	workers_number = config->watch_workers > 0 ? config->watch_workers : 1;
+	workers = calloc(workers_number, sizeof *workers);
+	if (workers == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return false;
+	}
+	if (!journal_open(config->watch_journal)) {
+		free(workers);
+		return false;
+	}
+
+	//	Sem SA_RESTART: os sinais interrompem poll
+	struct sigaction action = {.sa_handler = signal_handler};
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGCHLD, &action, NULL);
+	watching = true;
+
+	//	A vigilância começa antes da procura, para não perder ficheiros
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0) {
+		fprintf(stderr, "inotify_init1 error: %s\n", strerror(errno));
+		fclose(journal);
+		free(workers);
+		return false;
+	}
+	for (unsigned i = 0; i < paths_number; i++) {
+		watch_descriptors[i] = inotify_add_watch(inotify_fd, paths[i], IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (watch_descriptors[i] < 0) {
+			fprintf(stderr, "inotify_add_watch(%s) error: %s\n", paths[i], strerror(errno));
+			watching = false;
+		}
+	}
+	if (watching) {
+		for (unsigned i = 0; i < paths_number; i++)
+			directory_scan(paths[i]);
+		if (verbose)
+			printf("Watch: %u files to process, %u workers\n", statistics.queued, workers_number);
+	}
+
+	while (watching || workers_busy > 0) {
+		workers_reap();
+		for (unsigned i = 0; watching && queue_head != NULL && i < workers_number; i++)
+			if (workers[i].pid == 0)
+				worker_start(&workers[i]);
+		if (!watching && workers_busy == 0)
+			break;
+		struct pollfd pollfd = {.fd = inotify_fd, .events = POLLIN};
+		if (poll(&pollfd, watching ? 1 : 0, 1000) > 0)
+			events_read();
+	}
+
+	if (verbose)
+		printf("Watch: %u files processed, %u failed, %u processed again, %u not processed, "
+			"time mean %.1f s max %.1f s\n",
+			statistics.processed, statistics.failed, statistics.requeued,
+			statistics.queued - statistics.processed - statistics.failed - statistics.requeued,
+			statistics.processed > 0 ? statistics.time / statistics.processed : 0,
+			statistics.time_max);
+	while (queue_head != NULL) {
+		Watch_job *job = queue_head;
+		queue_head = job->next;
+		job_destroy(job);
+	}
+	queue_tail = NULL;
+	close(inotify_fd);
+	fclose(journal);
+	set_destroy(&done);
+	set_destroy(&pending);
+	free(workers);
+	return true;
+}
@@ -0,0 +1,60 @@
+/*
+Copyright 2024 Laboratório de Audio e Acústica do ISEL
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+	http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+
+#include "config.h"
+
+/*
+ * Modo de vigilância de diretorias.
+ *
+ * Os ficheiros de som (WATCH_EXTENSIONS) das diretorias vigiadas são
+ * processados, cada um por um processo filho "sound_meter <argumentos> -i
+ * <ficheiro>", até watch_workers em simultâneo. O processamento é um
+ * processo próprio porque a configuração, a saída e a entrada são únicas
+ * em cada processo.
+ *
+ * Ao arrancar são processados os ficheiros existentes ainda não processados;
+ * depois, com inotify, os ficheiros fechados depois de escritos (IN_CLOSE_WRITE)
+ * ou movidos para a diretoria (IN_MOVED_TO).
+ *
+ * O ficheiro watch_journal tem uma linha por ficheiro processado com sucesso:
+ *
+ *	<mtime (segundos, UNIX)>\t<dimensão>\t<caminho absoluto>
+ *
+ * Um ficheiro só é processado de novo se for substituído por outro,
+ * com outra data ou dimensão. A linha é tirada no início do processamento;
+ * um ficheiro alterado durante o processamento (ainda a ser copiado,
+ * por exemplo) não fica no journal e volta à fila no fim.
+ */
+
+#define WATCH_PATHS_MAX		16
+#define WATCH_EXTENSIONS	{".wav", ".flac"}
+
+/**
+ * @brief Vigia as diretorias paths até SIGINT ou SIGTERM; depois espera
+ * pelos processamentos em curso.
+ * Os processamentos falhados são assinalados e repetidos no arranque seguinte.
+ *
+ * @param arguments opções passadas a cada processamento, terminadas em NULL.
+ */
+bool watch_run(char *const *paths, unsigned paths_number, char *const *arguments,
+		struct config *config, bool verbose);
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Converte um ficheiro de arquivo (.sma) em ficheiro WAVE PCM 16 bits
+ * e mostra a taxa de compressão.
+ *
+ * $ make build/archive_to_wav
+ * $ build/archive_to_wav <ficheiro.sma> <ficheiro.wav>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "archive.h"
+#include "pcm_codec.h"
+
+static unsigned get_uint16(const uint8_t *bytes)
+{
+	return bytes[0] | bytes[1] << 8;
+}
+
+static uint32_t get_uint32(const uint8_t *bytes)
+{
+	return get_uint16(bytes) | (uint32_t)get_uint16(bytes + 2) << 16;
+}
+
+static void put_uint32(FILE *fd, uint32_t value)
+{
+	uint8_t bytes[] = {value, value >> 8, value >> 16, value >> 24};
+	fwrite(bytes, sizeof bytes, 1, fd);
+}
+
+static void put_uint16(FILE *fd, uint16_t value)
+{
+	uint8_t bytes[] = {value, value >> 8};
+	fwrite(bytes, sizeof bytes, 1, fd);
+}
+
+static void wave_header(FILE *fd, unsigned channels, unsigned sample_rate, uint32_t data_size)
+{
+	fwrite("RIFF", 4, 1, fd);
+	put_uint32(fd, 4 + (8 + 16) + (8 + data_size));
+	fwrite("WAVE", 4, 1, fd);
+	fwrite("fmt ", 4, 1, fd);
+	put_uint32(fd, 16);
+	put_uint16(fd, 1);
+	put_uint16(fd, channels);
+	put_uint32(fd, sample_rate);
+	put_uint32(fd, sample_rate * channels * 2);
+	put_uint16(fd, channels * 2);
+	put_uint16(fd, 16);
+	fwrite("data", 4, 1, fd);
+	put_uint32(fd, data_size);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <archive.sma> <output.wav>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	FILE *input = fopen(argv[1], "r");
+	if (input == NULL) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+	uint8_t header[ARCHIVE_HEADER_SIZE];
+	if (fread(header, sizeof header, 1, input) != 1
+			|| memcmp(header, ARCHIVE_FILE_MAGIC, 4) != 0
+			|| get_uint16(header + 4) != ARCHIVE_FILE_VERSION) {
+		fprintf(stderr, "%s: not a sound meter archive\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	unsigned channels = get_uint16(header + 6);
+	unsigned sample_rate = get_uint32(header + 8);
+	unsigned block_frames = get_uint32(header + 12);
+
+	FILE *output = fopen(argv[2], "w");
+	if (output == NULL) {
+		perror(argv[2]);
+		return EXIT_FAILURE;
+	}
+	wave_header(output, channels, sample_rate, 0);
+
+	uint8_t *data = malloc(PCM_CODEC_BOUND(block_frames, channels));
+	int16_t *frames = malloc((size_t)block_frames * channels * sizeof *frames);
+	if (data == NULL || frames == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return EXIT_FAILURE;
+	}
+	uint64_t total_frames = 0, lost_frames = 0, compressed = sizeof header;
+	uint8_t block_header[8];
+	while (fread(block_header, sizeof block_header, 1, input) == 1) {
+		unsigned nframes = get_uint16(block_header + 2);
+		uint32_t size = get_uint32(block_header + 4);
+		if (get_uint16(block_header) != ARCHIVE_BLOCK_SYNC || nframes > block_frames
+				|| size > PCM_CODEC_BOUND(nframes, channels)
+				|| fread(data, 1, size, input) != size) {
+			fprintf(stderr, "%s: corrupted block at frame %llu\n", argv[1],
+				(unsigned long long)total_frames);
+			break;
+		}
+		if (size == 0) {
+			memset(frames, 0, (size_t)nframes * channels * sizeof *frames);
+			lost_frames += nframes;
+		}
+		else if (!pcm_codec_decode(data, size, nframes, channels, frames)) {
+			fprintf(stderr, "%s: corrupted block at frame %llu\n", argv[1],
+				(unsigned long long)total_frames);
+			break;
+		}
+		fwrite(frames, nframes * channels * sizeof *frames, 1, output);
+		total_frames += nframes;
+		compressed += sizeof block_header + size;
+	}
+	uint64_t raw = total_frames * channels * sizeof *frames;
+	fseek(output, 0, SEEK_SET);
+	wave_header(output, channels, sample_rate, raw);
+	fclose(output);
+	fclose(input);
+	free(data);
+	free(frames);
+
+	printf("%llu frames (%.1f s), %llu lost, compression ratio %.2f\n",
+		(unsigned long long)total_frames, (double)total_frames / sample_rate,
+		(unsigned long long)lost_frames, compressed > 0 ? (double)raw / compressed : 0.0);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+/*
+ * Custo da estimação da direção (GCC-PHAT) por segmento, para 4 e 6 canais.
+ *
+ * Simula uma fonte de ruído branco num ângulo conhecido, aplicando a cada
+ * microfone o atraso fracionário correspondente (interpolação sinc).
+ *
+ * $ make build/bench_direction
+ * $ build/bench_direction
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "direction.h"
+
+#define SAMPLE_RATE	48000
+#define BLOCK_SIZE	1024
+#define SEGMENT_SIZE	SAMPLE_RATE		// segmento de 1 segundo
+#define RADIUS		0.0463f			// ReSpeaker 6-Mic Circular Array
+#define SOURCE_ANGLE	60
+#define SEGMENTS	20
+#define SINC_HALF	32
+
+static double elapsed(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static float delayed_sample(const float *source, long n, double delay)
+{
+	//	source[n - delay] por interpolação sinc com janela de Hann
+	double sum = 0;
+	long center = n - (long)floor(delay);
+	double fraction = delay - floor(delay);
+	for (int k = -SINC_HALF; k <= SINC_HALF; k++) {
+		double x = k - fraction;
+		double sinc = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+		double window = 0.5 + 0.5 * cos(M_PI * x / (SINC_HALF + 1));
+		sum += source[center - k] * sinc * window;
+	}
+	return sum;
+}
+
+static void bench(unsigned channels)
+{
+	unsigned blocks = SEGMENT_SIZE / BLOCK_SIZE;
+	size_t length = (size_t)blocks * BLOCK_SIZE;
+	float *source = malloc((length + 4 * SINC_HALF) * sizeof *source);
+	float *signal = malloc(channels * length * sizeof *signal);
+	srand(1);
+	for (size_t i = 0; i < length + 4 * SINC_HALF; i++)
+		source[i] = (float)rand() / RAND_MAX - 0.5f;
+
+	double theta = 2 * M_PI * SOURCE_ANGLE / 360;
+	for (unsigned c = 0; c < channels; c++) {
+		double phi = 2 * M_PI * c / channels;
+		double delay = -RADIUS * cos(theta - phi) / DIRECTION_SOUND_SPEED * SAMPLE_RATE;
+		for (size_t i = 0; i < length; i++)
+			signal[c * length + i] = delayed_sample(source + 2 * SINC_HALF, i, delay);
+	}
+
+	Direction *direction = direction_create(channels, BLOCK_SIZE, SAMPLE_RATE, RADIUS);
+	float *block = malloc(channels * BLOCK_SIZE * sizeof *block);
+	int angle = DIRECTION_UNDEFINED;
+	double time_blocks = 0, time_estimate = 0;
+	for (unsigned s = 0; s < SEGMENTS; s++) {
+		struct timespec t0, t1, t2;
+		for (unsigned b = 0; b < blocks; b++) {
+			for (unsigned c = 0; c < channels; c++)
+				for (unsigned i = 0; i < BLOCK_SIZE; i++)
+					block[c * BLOCK_SIZE + i] = signal[c * length + b * BLOCK_SIZE + i];
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			direction_block(direction, block, BLOCK_SIZE);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			time_blocks += elapsed(&t0, &t1);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		angle = direction_estimate(direction);
+		clock_gettime(CLOCK_MONOTONIC, &t2);
+		time_estimate += elapsed(&t1, &t2);
+	}
+	printf("%u channels: blocks %.3f ms + estimate %.3f ms per segment (%.2f%% of real time), "
+		"angle %d (source %d)\n",
+		channels, time_blocks * 1000 / SEGMENTS, time_estimate * 1000 / SEGMENTS,
+		(time_blocks + time_estimate) / SEGMENTS * 100, angle, SOURCE_ANGLE);
+	direction_destroy(direction);
+	free(block);
+	free(signal);
+	free(source);
+}
+
+int main()
+{
+	bench(4);
+	bench(6);
+}
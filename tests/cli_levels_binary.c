@@ -0,0 +1,155 @@
+/*
+ * Cliente do protocolo binário do servidor local (server_protocol.h).
+ * Mostra os níveis de cada segmento e assinala os registos perdidos.
+ *
+ * $ make build/cli_levels_binary
+ * $ build/cli_levels_binary [socket] [pedido]
+ *
+ * Exemplo: build/cli_levels_binary sound_meter_server_socket "since 1700000000"
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server_protocol.h"
+
+static unsigned get_uint16(const uint8_t *bytes)
+{
+	return bytes[0] | bytes[1] << 8;
+}
+
+static uint32_t get_uint32(const uint8_t *bytes)
+{
+	return get_uint16(bytes) | (uint32_t)get_uint16(bytes + 2) << 16;
+}
+
+static uint64_t get_uint64(const uint8_t *bytes)
+{
+	return get_uint32(bytes) | (uint64_t)get_uint32(bytes + 4) << 32;
+}
+
+static float get_float(const uint8_t *bytes)
+{
+	uint32_t word = get_uint32(bytes);
+	float value;
+	memcpy(&value, &word, sizeof value);
+	return value;
+}
+
+static bool read_all(int fd, uint8_t *buffer, size_t size)
+{
+	while (size > 0) {
+		ssize_t nbytes = read(fd, buffer, size);
+		if (nbytes <= 0)
+			return false;
+		buffer += nbytes;
+		size -= nbytes;
+	}
+	return true;
+}
+
+static void record_print(const uint8_t *data, uint32_t length, bool live)
+{
+	static bool first = true;
+	static uint64_t next_seq;
+	if (length < SERVER_RECORD_SIZE)
+		return;
+	uint64_t seq = get_uint64(data);
+	if (live) {
+		if (!first && seq != next_seq)
+			printf("-- %llu records lost\n", (unsigned long long)(seq - next_seq));
+		first = false;
+		next_seq = seq + 1;
+	}
+	printf("%llu %lld %6.1f%6.1f%6.1f%6.1f%6.1f %4d",
+		(unsigned long long)seq, (long long)get_uint64(data + 8),
+		get_float(data + 16), get_float(data + 20), get_float(data + 24),
+		get_float(data + 28), get_float(data + 32), (int32_t)get_uint32(data + 36));
+	unsigned channels = get_uint16(data + 40);
+	unsigned bands = get_uint16(data + 42);
+	if (SERVER_RECORD_SIZE + 4 * (channels + bands) <= length) {
+		const uint8_t *levels = data + SERVER_RECORD_SIZE;
+		for (unsigned i = 0; i < channels; i++, levels += 4)
+			printf(" Z%u %.1f", i, get_float(levels));
+		for (unsigned i = 0; i < bands; i++, levels += 4)
+			printf(" B%u %.1f", i, get_float(levels));
+	}
+	putchar('\n');
+}
+
+int main(int argc, char *argv[])
+{
+	const char *socket_name = argc > 1 ? argv[1] : "sound_meter_server_socket";
+	int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sockfd < 0) {
+		perror("socket(AF_UNIX, SOCK_STREAM, 0)");
+		return EXIT_FAILURE;
+	}
+	struct sockaddr_un sockaddr_server;
+	sockaddr_server.sun_family = AF_UNIX;
+	strncpy(sockaddr_server.sun_path, socket_name, sizeof sockaddr_server.sun_path - 1);
+	sockaddr_server.sun_path[sizeof sockaddr_server.sun_path - 1] = '\0';
+	size_t len = sizeof(sockaddr_server.sun_family) + strlen(sockaddr_server.sun_path);
+	if (connect(sockfd, (struct sockaddr *)&sockaddr_server, len) < 0) {
+		perror(socket_name);
+		return EXIT_FAILURE;
+	}
+	char request[200];
+	int length = snprintf(request, sizeof request, "binary\n%s%s", argc > 2 ? argv[2] : "",
+			argc > 2 ? "\n" : "");
+	if (write(sockfd, request, length) != length) {
+		perror("write");
+		return EXIT_FAILURE;
+	}
+
+	uint8_t header[SERVER_FRAME_HEADER_SIZE];
+	uint8_t *data = NULL;
+	while (read_all(sockfd, header, sizeof header)) {
+		if (get_uint16(header) != SERVER_PROTOCOL_MAGIC || header[2] != SERVER_PROTOCOL_VERSION) {
+			fprintf(stderr, "Protocol error\n");
+			return EXIT_FAILURE;
+		}
+		uint32_t length = get_uint32(header + 4);
+		data = realloc(data, length + 1);
+		if (data == NULL || !read_all(sockfd, data, length))
+			break;
+		switch (header[3]) {
+		case SERVER_FRAME_HELLO:
+			if (length >= 12) {
+				printf("sample rate %u, segment %u ms, %u channels, %u bands:",
+					get_uint32(data), get_uint32(data + 4), get_uint16(data + 8),
+					get_uint16(data + 10));
+				for (unsigned i = 0; i < get_uint16(data + 10) && 12 + 4 * i + 4 <= length; i++)
+					printf(" %g", get_float(data + 12 + 4 * i));
+				putchar('\n');
+			}
+			break;
+		case SERVER_FRAME_RECORD:
+		case SERVER_FRAME_HISTORY:
+			record_print(data, length, header[3] == SERVER_FRAME_RECORD);
+			break;
+		case SERVER_FRAME_END:
+			if (length >= 8)
+				printf("-- end, %llu records\n", (unsigned long long)get_uint64(data));
+			break;
+		case SERVER_FRAME_AGGREGATE:
+			if (length >= 28)
+				printf("%lld..%lld %llu segments LAeq %.1f\n", (long long)get_uint64(data),
+					(long long)get_uint64(data + 8), (unsigned long long)get_uint64(data + 16),
+					get_float(data + 24));
+			break;
+		case SERVER_FRAME_ERROR:
+			data[length] = '\0';
+			printf("error: %s\n", (char *)data);
+			break;
+		}
+	}
+	free(data);
+	close(sockfd);
+	return EXIT_SUCCESS;
+}
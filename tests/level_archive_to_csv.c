@@ -0,0 +1,165 @@
+/*
+ * Converte um ficheiro de arquivo de níveis (.sla) em CSV, com o instante
+ * de cada segmento (segundos, UNIX) na primeira coluna, e mostra
+ * o número de blocos, os blocos rejeitados e o tempo de descodificação.
+ * Os níveis dos blocos sem calibração (LEVEL_ARCHIVE_RAW) são calibrados
+ * com a tabela de épocas indicada em -c (calibration_table.h).
+ *
+ * $ make build/level_archive_to_csv
+ * $ build/level_archive_to_csv [-c <tabela de calibração>] <ficheiro.sla> > <ficheiro.csv>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "level_archive.h"
+#include "level_codec.h"
+#include "calibration_table.h"
+
+static unsigned get_uint16(const uint8_t *bytes)
+{
+	return bytes[0] | bytes[1] << 8;
+}
+
+static uint32_t get_uint32(const uint8_t *bytes)
+{
+	return get_uint16(bytes) | (uint32_t)get_uint16(bytes + 2) << 16;
+}
+
+static uint64_t get_uint64(const uint8_t *bytes)
+{
+	return get_uint32(bytes) | (uint64_t)get_uint32(bytes + 4) << 32;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *calibration_filepath = NULL;
+	int option;
+	while ((option = getopt(argc, argv, "c:")) != -1)
+		if (option == 'c')
+			calibration_filepath = optarg;
+		else
+			argc = 0;
+	argc -= optind - 1;
+	argv += optind - 1;
+	if (argc != 2) {
+		fprintf(stderr, "usage: level_archive_to_csv [-c <calibration table>] <file.sla>\n");
+		return EXIT_FAILURE;
+	}
+	Calibration_table *table = NULL;
+	if (calibration_filepath != NULL) {
+		table = calibration_table_load(calibration_filepath);
+		if (table == NULL) {
+			fprintf(stderr, "%s: %s\n", calibration_filepath, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+	unsigned uncalibrated = 0;
+	FILE *fd = fopen(argv[1], "r");
+	if (fd == NULL) {
+		fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+		return EXIT_FAILURE;
+	}
+	fseek(fd, 0, SEEK_END);
+	size_t size = ftell(fd);
+	rewind(fd);
+	uint8_t *data = malloc(size);
+	if (data == NULL || fread(data, 1, size, fd) != size) {
+		fprintf(stderr, "%s: read error\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	fclose(fd);
+	if (size < LEVEL_ARCHIVE_HEADER_SIZE || memcmp(data, LEVEL_ARCHIVE_FILE_MAGIC, 4) != 0
+			|| get_uint16(data + 4) != LEVEL_ARCHIVE_FILE_VERSION) {
+		fprintf(stderr, "%s: not a level archive file\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	char identification[LEVEL_ARCHIVE_HEADER_SIZE - 8 + 1] = {0};
+	memcpy(identification, data + 8, sizeof identification - 1);
+
+	int32_t *columns[LEVEL_ARCHIVE_COLUMNS_MAX] = {NULL};
+	unsigned capacity = 0;
+	unsigned blocks = 0, rejected = 0;
+	unsigned long long segments = 0;
+	double decode_time = 0;
+
+	size_t position = get_uint16(data + 6);
+	while (position + LEVEL_ARCHIVE_BLOCK_HEADER_SIZE <= size) {
+		const uint8_t *header = data + position;
+		unsigned columns_number = get_uint16(header + 2);
+		unsigned count = get_uint32(header + 4);
+		int64_t ts = get_uint64(header + 8);
+		unsigned segment_duration = get_uint32(header + 16);
+		unsigned flags = get_uint32(header + 20);
+		size_t block_size = get_uint32(header + 24);
+		if (get_uint16(header) != LEVEL_ARCHIVE_BLOCK_SYNC
+				|| columns_number < LEVEL_ARCHIVE_LEVELS || columns_number > LEVEL_ARCHIVE_COLUMNS_MAX
+				|| block_size > size - position - LEVEL_ARCHIVE_BLOCK_HEADER_SIZE
+				|| level_codec_crc32(level_codec_crc32(0, header, 28),
+					header + LEVEL_ARCHIVE_BLOCK_HEADER_SIZE, block_size) != get_uint32(header + 28)) {
+			//	Procura o bloco seguinte
+			rejected++;
+			position++;
+			while (position + 2 <= size && get_uint16(data + position) != LEVEL_ARCHIVE_BLOCK_SYNC)
+				position++;
+			continue;
+		}
+		if (count > capacity) {
+			capacity = count;
+			for (unsigned c = 0; c < LEVEL_ARCHIVE_COLUMNS_MAX; c++)
+				columns[c] = realloc(columns[c], capacity * sizeof *columns[c]);
+		}
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		const uint8_t *input = header + LEVEL_ARCHIVE_BLOCK_HEADER_SIZE;
+		size_t remaining = block_size;
+		unsigned c;
+		for (c = 0; c < columns_number; c++) {
+			size_t used = level_codec_decode(input, remaining, count, columns[c]);
+			if (used == 0)
+				break;
+			input += used;
+			remaining -= used;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		decode_time += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		position += LEVEL_ARCHIVE_BLOCK_HEADER_SIZE + block_size;
+		if (c < columns_number) {
+			rejected++;
+			continue;
+		}
+		blocks++;
+		segments += count;
+
+		unsigned first_band = LEVEL_ARCHIVE_LEVELS + ((flags & LEVEL_ARCHIVE_DIRECTION) != 0);
+		bool raw = (flags & LEVEL_ARCHIVE_RAW) != 0;
+		if (raw && table == NULL)
+			uncalibrated++;
+		for (unsigned i = 0; i < count; i++) {
+			int64_t segment_ts = ts + (int64_t)i * segment_duration;
+			float delta = raw && table != NULL ? calibration_table_delta(table, segment_ts) : 0;
+			printf("%.3f", segment_ts / 1000.0);
+			for (c = 0; c < columns_number; c++)
+				if (c >= LEVEL_ARCHIVE_LEVELS && c < first_band)
+					printf(", %3d", columns[c][i]);
+				else
+					printf(", %5.1f", level_codec_level(columns[c][i]) + delta);
+			putchar('\n');
+		}
+	}
+	fprintf(stderr, "%s: %s, %u blocks, %u rejected, %llu segments, %.1f bytes/segment, decode %.2f ms\n",
+		argv[1], identification, blocks, rejected, segments,
+		segments > 0 ? (double)size / segments : 0, decode_time * 1000);
+	if (uncalibrated > 0)
+		fprintf(stderr, "%s: %u blocks with uncalibrated levels (use -c <calibration table>)\n",
+			argv[1], uncalibrated);
+	if (table != NULL)
+		calibration_table_destroy(table);
+	for (unsigned c = 0; c < LEVEL_ARCHIVE_COLUMNS_MAX; c++)
+		free(columns[c]);
+	free(data);
+	return EXIT_SUCCESS;
+}
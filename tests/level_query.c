@@ -0,0 +1,108 @@
+/*
+ * Consulta a base de dados de níveis (level_db.h): LAeq, LAFmax, LAFmin
+ * e LApeak do intervalo [from, to[, ou de cada passo de step segundos
+ * dentro do intervalo, com o número de leituras e o tempo de cada consulta.
+ * Os instantes são segundos UNIX ou hora local AAAA-MM-DDTHH:MM[:SS].
+ * Uma base de dados escrita com level_raw é calibrada com a tabela
+ * de épocas indicada em -c (calibration_table.h).
+ *
+ * $ make build/level_query
+ * $ build/level_query data/db/ 2024-06-01T00:00 2024-07-01T00:00
+ * $ build/level_query data/db/ 2024-06-01T00:00 2024-06-02T00:00 3600
+ * $ build/level_query -c data/calibration.csv data/db/ 2024-06-01T00:00 2024-07-01T00:00
+ */
+#define _GNU_SOURCE	// strptime
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "level_db_reader.h"
+
+static bool time_parse(const char *text, int64_t *ms)
+{
+	char *end;
+	long long seconds = strtoll(text, &end, 10);
+	if (*end == '\0' && end != text) {
+		*ms = seconds * 1000;
+		return true;
+	}
+	struct tm tm = {.tm_isdst = -1};
+	end = strptime(text, "%Y-%m-%dT%H:%M", &tm);
+	if (end != NULL && *end == ':')
+		end = strptime(end + 1, "%S", &tm);
+	if (end == NULL || *end != '\0')
+		return false;
+	*ms = (int64_t)mktime(&tm) * 1000;
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *calibration_filepath = NULL;
+	int option;
+	while ((option = getopt(argc, argv, "c:")) != -1)
+		if (option == 'c')
+			calibration_filepath = optarg;
+		else
+			argc = 0;
+	argc -= optind;
+	argv += optind;
+	int64_t from, to, step = 0;
+	if (argc < 3 || argc > 4 || !time_parse(argv[1], &from) || !time_parse(argv[2], &to)
+			|| (argc == 4 && (step = strtoll(argv[3], NULL, 10) * 1000) <= 0)) {
+		fprintf(stderr, "usage: level_query [-c <calibration table>] <directory> <from> <to> [step]\n"
+			"\t<from>, <to>: UNIX seconds or YYYY-MM-DDTHH:MM[:SS] (local time)\n"
+			"\t[step]: seconds\n");
+		return EXIT_FAILURE;
+	}
+	Level_db_reader *reader = level_db_reader_open(argv[0]);
+	if (reader == NULL) {
+		fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+		return EXIT_FAILURE;
+	}
+	Calibration_table *table = NULL;
+	if (calibration_filepath != NULL) {
+		table = calibration_table_load(calibration_filepath);
+		if (table == NULL) {
+			fprintf(stderr, "%s: %s\n", calibration_filepath, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+	else if (level_db_reader_raw(reader)) {
+		fprintf(stderr, "%s: uncalibrated levels (use -c <calibration table>)\n", argv[0]);
+	}
+	if (step == 0)
+		step = to - from;
+	printf("%-19s  %6s %6s %6s %6s %9s %9s %6s %9s\n",
+		"start", "LAeq", "LAFmax", "LAFmin", "LApeak", "coverage", "segments", "reads", "time (ms)");
+	for (int64_t start = from; start < to; start += step) {
+		int64_t end = start + step < to ? start + step : to;
+		Level_db_summary result;
+		unsigned reads;
+		struct timespec begin, finish;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		bool done = table != NULL
+			? level_db_reader_query_calibrated(reader, table, start, end, &result, &reads)
+			: level_db_reader_query(reader, start, end, &result, &reads);
+		clock_gettime(CLOCK_MONOTONIC, &finish);
+		if (!done) {
+			fprintf(stderr, "%s: read error\n", argv[0]);
+			level_db_reader_close(reader);
+			return EXIT_FAILURE;
+		}
+		time_t seconds = start / 1000;
+		char text[32];
+		strftime(text, sizeof text, "%Y-%m-%dT%H:%M:%S", localtime(&seconds));
+		printf("%-19s  %6.1f %6.1f %6.1f %6.1f %8.1f%% %9u %6u %9.3f\n",
+			text, level_db_summary_laeq(&result), result.lafmax, result.lafmin, result.lapeak,
+			100.0 * result.duration / (end - start), result.count, reads,
+			(finish.tv_sec - begin.tv_sec) * 1e3 + (finish.tv_nsec - begin.tv_nsec) / 1e6);
+	}
+	if (table != NULL)
+		calibration_table_destroy(table);
+	level_db_reader_close(reader);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,50 @@
+#!/bin/bash
+
+#	Guarda e recuperação dos registos MQTT com um broker local (mosquitto).
+#	Requer mosquitto e mosquitto_sub. Executar na diretoria tests.
+
+PORT=18830
+TOPIC=sound_meter/test
+
+cat > mqtt_spool_config.json << END
+{
+	"output_path": "data/",
+	"output_format": ".csv",
+	"mqtt_enable": true,
+	"mqtt_broker": "tcp://localhost:$PORT",
+	"mqtt_topic": "$TOPIC",
+	"mqtt_qos": 1,
+	"mqtt_spool_enable": true,
+	"mqtt_spool_rate": 10000
+}
+END
+
+mkdir -p data
+rm -f data/mqtt_spool
+
+#	Sem broker - os registos ficam guardados
+../build/sound_meter -i TestNoise.wav -g mqtt_spool_config.json
+if [ ! -s data/mqtt_spool ] || [ $(stat -c %s data/mqtt_spool) -le 16 ]; then
+	echo "spool not written"
+	exit 1
+fi
+records=$((($(stat -c %s data/mqtt_spool) - 16) / 32))
+
+#	Com broker - os registos guardados são enviados
+mosquitto -p $PORT &
+broker=$!
+sleep 1
+mosquitto_sub -p $PORT -t $TOPIC -v > mqtt_spool_received.txt &
+subscriber=$!
+sleep 1
+../build/sound_meter -i TestNoise.wav -g mqtt_spool_config.json
+sleep 1
+kill $subscriber $broker
+
+received=$(grep -o '"ts"' mqtt_spool_received.txt | wc -l)
+if [ $(stat -c %s data/mqtt_spool) -ne 16 ] || [ $received -lt $((2 * records)) ]; then
+	echo "spool not drained: $records records stored, $received received"
+	exit 1
+fi
+
+echo done
@@ -0,0 +1,169 @@
+/*
+ * Emissor de som PCM para a entrada de um sound_meter remoto (pcm_stream.h).
+ * Lê amostras S16_LE intercaladas da entrada padrão e envia-as, precedidas
+ * do cabeçalho, para o destino.
+ *
+ * $ make build/pcm_stream_send
+ * $ build/pcm_stream_send [-r ritmo] [-a canais] [-p] <destino>
+ *
+ * destino: - (saída padrão), fifo:<caminho>, unix:<caminho> ou tcp:<endereço>:<porto>
+ * -p envia ao ritmo de amostragem, como uma placa de som.
+ *
+ * Exemplo: arecord -f S16_LE -r 48000 -c 1 -t raw | build/pcm_stream_send -r 48000 tcp:servidor:7000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "pcm_stream.h"
+
+static int unix_connect(const char *path)
+{
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	strncpy(address.sun_path, path, sizeof address.sun_path - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof address) < 0) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+static int tcp_connect(const char *destination)
+{
+	char host[strlen(destination) + 1];
+	strcpy(host, destination);
+	char *port = strrchr(host, ':');
+	if (port == NULL)
+		return -1;
+	*port++ = '\0';
+	struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+	struct addrinfo *addresses;
+	int result = getaddrinfo(host, port, &hints, &addresses);
+	if (result != 0) {
+		fprintf(stderr, "%s: %s\n", destination, gai_strerror(result));
+		return -1;
+	}
+	int fd = -1;
+	for (struct addrinfo *ai = addresses; ai != NULL && fd < 0; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(addresses);
+	return fd;
+}
+
+static bool write_all(int fd, const void *buffer, size_t size)
+{
+	const uint8_t *bytes = buffer;
+	while (size > 0) {
+		ssize_t nbytes = write(fd, bytes, size);
+		if (nbytes <= 0)
+			return false;
+		bytes += nbytes;
+		size -= nbytes;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned sample_rate = 48000, channels = 1;
+	bool paced = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "r:a:p")) != -1) {
+		switch (opt) {
+		case 'r':
+			sample_rate = atoi(optarg);
+			break;
+		case 'a':
+			channels = atoi(optarg);
+			break;
+		case 'p':
+			paced = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-r rate] [-a channels] [-p] <destination>\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc || sample_rate == 0 || channels == 0) {
+		fprintf(stderr, "usage: %s [-r rate] [-a channels] [-p] <destination>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *destination = argv[optind];
+	int fd;
+	if (strcmp(destination, "-") == 0)
+		fd = STDOUT_FILENO;
+	else if (strncmp(destination, "fifo:", 5) == 0)
+		fd = open(destination + 5, O_WRONLY);
+	else if (strncmp(destination, "unix:", 5) == 0)
+		fd = unix_connect(destination + 5);
+	else if (strncmp(destination, "tcp:", 4) == 0)
+		fd = tcp_connect(destination + 4);
+	else
+		fd = -1;
+	if (fd < 0) {
+		perror(destination);
+		return EXIT_FAILURE;
+	}
+
+	Pcm_stream_header header = {
+		.magic = PCM_STREAM_MAGIC, .version = PCM_STREAM_VERSION, .format = PCM_STREAM_S16_LE,
+		.sample_rate = sample_rate, .channels = channels
+	};
+	if (!write_all(fd, &header, sizeof header)) {
+		perror("write");
+		return EXIT_FAILURE;
+	}
+	//	Blocos de 10 ms
+	size_t frame_size = channels * sizeof(int16_t);
+	size_t block_size = sample_rate / 100 * frame_size;
+	uint8_t *buffer = malloc(block_size);
+	if (buffer == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return EXIT_FAILURE;
+	}
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	uint64_t total = 0;
+	size_t length = 0;
+	ssize_t nbytes;
+	while ((nbytes = read(STDIN_FILENO, buffer + length, block_size - length)) > 0) {
+		length += nbytes;
+		if (length < block_size)
+			continue;
+		if (paced) {
+			next.tv_nsec += 10000000;
+			if (next.tv_nsec >= 1000000000) {
+				next.tv_nsec -= 1000000000;
+				next.tv_sec++;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		}
+		if (!write_all(fd, buffer, length)) {
+			perror("write");
+			return EXIT_FAILURE;
+		}
+		total += length;
+		length = 0;
+	}
+	if (length > 0 && write_all(fd, buffer, length))
+		total += length;
+	fprintf(stderr, "%llu frames sent\n", (unsigned long long)(total / frame_size));
+	free(buffer);
+	close(fd);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,59 @@
+/*
+ * Leitor dos níveis publicados em memória partilhada (shm_levels_reader.h).
+ * Mostra os registos disponíveis do histórico e depois cada novo registo,
+ * à medida que são publicados, sem usar o socket do servidor.
+ *
+ * $ make build/shm_levels_monitor
+ * $ build/shm_levels_monitor [nome]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include "shm_levels_reader.h"
+
+static void record_print(const Shm_levels_record *record)
+{
+	printf("%llu %lld %6.1f%6.1f%6.1f%6.1f%6.1f %4d",
+		(unsigned long long)record->seq, (long long)record->ts,
+		record->laeq, record->lafmin, record->lae, record->lafmax, record->lapeak,
+		record->direction);
+	for (unsigned i = 0; i < record->channels; i++)
+		printf(" Z%u %.1f", i, record->channel_levels[i]);
+	for (unsigned i = 0; i < record->bands; i++)
+		printf(" B%u %.1f", i, record->band_levels[i]);
+	putchar('\n');
+}
+
+int main(int argc, char *argv[])
+{
+	const char *name = argc > 1 ? argv[1] : "/sound_meter_levels";
+	Shm_levels_reader *reader = shm_levels_reader_open(name);
+	if (reader == NULL) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	uint64_t next = shm_levels_reader_first(reader);
+	while (!shm_levels_reader_closed(reader)) {
+		uint64_t count = shm_levels_reader_count(reader);
+		while (next < count) {
+			Shm_levels_record record;
+			if (shm_levels_reader_get(reader, next, &record)) {
+				record_print(&record);
+				next++;
+				continue;
+			}
+			//	Reescrito enquanto este leitor estava atrasado
+			uint64_t first = shm_levels_reader_first(reader);
+			if (first > next) {
+				printf("-- %llu records skipped\n", (unsigned long long)(first - next));
+				next = first;
+			}
+		}
+		fflush(stdout);
+		shm_levels_reader_wait(reader, next, 2 * shm_levels_reader_segment_duration(reader));
+	}
+	shm_levels_reader_close(reader);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,77 @@
+/*
+ * Consumidor do som derivado para memória partilhada (shm_pcm_reader.h).
+ * Mostra, a cada segundo, o valor eficaz (dBFS) de cada canal do som
+ * original e do canal 0 com ponderação A, e as frames perdidas por atraso.
+ * O som com ponderação A é lido sem cópia.
+ *
+ * $ make build/shm_pcm_monitor
+ * $ build/shm_pcm_monitor [nome]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+
+#include "shm_pcm_reader.h"
+
+#define BLOCK_FRAMES	1024
+
+int main(int argc, char *argv[])
+{
+	const char *name = argc > 1 ? argv[1] : "/sound_meter_pcm";
+	Shm_pcm_reader *reader = shm_pcm_reader_open(name);
+	if (reader == NULL) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	unsigned sample_rate = shm_pcm_reader_sample_rate(reader);
+	unsigned channels = shm_pcm_reader_channels(reader, SHM_PCM_RAW);
+	int16_t *raw = malloc(BLOCK_FRAMES * channels * sizeof *raw);
+	double *raw_energy = calloc(channels, sizeof *raw_energy);
+	if (raw == NULL || raw_energy == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return EXIT_FAILURE;
+	}
+	double weighted_energy = 0;
+	unsigned raw_frames = 0, weighted_frames = 0;
+
+	while (shm_pcm_reader_wait(reader, SHM_PCM_AWEIGHTED, 1000) || !shm_pcm_reader_closed(reader)) {
+		unsigned nframes;
+		const float *weighted;
+		while ((weighted = shm_pcm_reader_peek(reader, SHM_PCM_AWEIGHTED, &nframes)), nframes > 0) {
+			double energy = 0;
+			for (unsigned i = 0; i < nframes; i++)
+				energy += weighted[i] * weighted[i];
+			if (shm_pcm_reader_consume(reader, SHM_PCM_AWEIGHTED, nframes)) {
+				weighted_energy += energy;
+				weighted_frames += nframes;
+			}
+		}
+		while ((nframes = shm_pcm_reader_read(reader, SHM_PCM_RAW, raw, BLOCK_FRAMES)) > 0) {
+			for (unsigned i = 0; i < nframes; i++)
+				for (unsigned c = 0; c < channels; c++) {
+					double sample = raw[i * channels + c] / 32768.0;
+					raw_energy[c] += sample * sample;
+				}
+			raw_frames += nframes;
+		}
+		if (weighted_frames >= sample_rate && raw_frames > 0) {
+			for (unsigned c = 0; c < channels; c++) {
+				printf("%7.1f", 10 * log10(raw_energy[c] / raw_frames + 1e-20));
+				raw_energy[c] = 0;
+			}
+			printf(" | A %7.1f dBFS | lost %llu %llu\n",
+				10 * log10(weighted_energy / weighted_frames + 1e-20),
+				(unsigned long long)shm_pcm_reader_lost(reader, SHM_PCM_RAW),
+				(unsigned long long)shm_pcm_reader_lost(reader, SHM_PCM_AWEIGHTED));
+			fflush(stdout);
+			weighted_energy = 0;
+			weighted_frames = raw_frames = 0;
+		}
+	}
+	free(raw);
+	free(raw_energy);
+	shm_pcm_reader_close(reader);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+/*
+ * Converte um ficheiro de níveis por colunas (.slv) em CSV, no formato
+ * dos ficheiros de saída CSV. Sem colunas indicadas converte todas;
+ * caso contrário só as colunas pedidas são lidas do ficheiro.
+ * Os níveis de um ficheiro sem calibração (SLV_FLAG_RAW) são calibrados
+ * com a tabela de épocas indicada em -c (calibration_table.h).
+ *
+ * $ make build/slv_to_csv
+ * $ build/slv_to_csv [-c <tabela de calibração>] <ficheiro.slv> [LAeq LAFmin LAE LAFmax LApeak Direction <frequência da banda>]...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "slv_reader.h"
+#include "calibration_table.h"
+
+static const char *level_names[] = {"LAeq", "LAFmin", "LAE", "LAFmax", "LApeak"};
+
+typedef struct {
+	char name[16];
+	const float *level;
+	const int32_t *direction;
+} Column;
+
+static Column columns[SLV_BANDS + 32];
+static unsigned ncolumns;
+
+static void column_level(Slv_reader *reader, unsigned level)
+{
+	Column *column = &columns[ncolumns++];
+	strcpy(column->name, level_names[level]);
+	column->level = slv_reader_level(reader, level);
+}
+
+static bool column_direction(Slv_reader *reader)
+{
+	Column *column = &columns[ncolumns];
+	column->direction = slv_reader_direction(reader);
+	if (column->direction == NULL)
+		return false;
+	strcpy(column->name, "Direction");
+	ncolumns++;
+	return true;
+}
+
+static void column_band(Slv_reader *reader, unsigned band)
+{
+	Column *column = &columns[ncolumns++];
+	snprintf(column->name, sizeof column->name, "%g", slv_reader_band_frequency(reader, band));
+	column->level = slv_reader_band(reader, band);
+}
+
+static bool column_add(Slv_reader *reader, const char *name)
+{
+	if (ncolumns == sizeof columns / sizeof columns[0])
+		return false;
+	for (unsigned i = 0; i < sizeof level_names / sizeof level_names[0]; i++)
+		if (strcmp(name, level_names[i]) == 0) {
+			column_level(reader, i);
+			return true;
+		}
+	if (strcmp(name, "Direction") == 0)
+		return column_direction(reader);
+	for (unsigned b = 0; b < slv_reader_bands(reader); b++) {
+		char frequency[16];
+		snprintf(frequency, sizeof frequency, "%g", slv_reader_band_frequency(reader, b));
+		if (strcmp(name, frequency) == 0) {
+			column_band(reader, b);
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *calibration_filepath = NULL;
+	int option;
+	while ((option = getopt(argc, argv, "c:")) != -1)
+		if (option == 'c')
+			calibration_filepath = optarg;
+		else
+			argc = 0;
+	argc -= optind - 1;
+	argv += optind - 1;
+	if (argc < 2) {
+		fprintf(stderr, "usage: slv_to_csv [-c <calibration table>] <file.slv> [column]...\n");
+		return EXIT_FAILURE;
+	}
+	Slv_reader *reader = slv_reader_open(argv[1]);
+	if (reader == NULL) {
+		fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+		return EXIT_FAILURE;
+	}
+	Calibration_table *table = NULL;
+	if (calibration_filepath != NULL && slv_reader_raw(reader)) {
+		table = calibration_table_load(calibration_filepath);
+		if (table == NULL) {
+			fprintf(stderr, "%s: %s\n", calibration_filepath, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+	else if (slv_reader_raw(reader)) {
+		fprintf(stderr, "%s: uncalibrated levels (use -c <calibration table>)\n", argv[1]);
+	}
+	if (argc == 2) {
+		for (unsigned i = 0; i < sizeof level_names / sizeof level_names[0]; i++)
+			column_level(reader, i);
+		column_direction(reader);
+		for (unsigned b = 0; b < slv_reader_bands(reader); b++)
+			column_band(reader, b);
+	}
+	for (int i = 2; i < argc; i++)
+		if (!column_add(reader, argv[i])) {
+			fprintf(stderr, "%s: no column \"%s\"\n", argv[1], argv[i]);
+			return EXIT_FAILURE;
+		}
+
+	fprintf(stderr, "%s: %s, ts %lld, segment %u ms, calibration delta %.1f, %u segments\n",
+		argv[1], slv_reader_identification(reader), (long long)slv_reader_ts(reader),
+		slv_reader_segment_duration(reader), slv_reader_calibration_delta(reader),
+		slv_reader_count(reader));
+
+	for (unsigned c = 0; c < ncolumns; c++)
+		printf("%s%s", c == 0 ? "" : ", ", columns[c].name);
+	putchar('\n');
+	unsigned count = slv_reader_count(reader);
+	int64_t ts = slv_reader_ts(reader) * 1000;
+	for (unsigned i = 0; i < count; i++) {
+		float delta = table != NULL
+			? calibration_table_delta(table, ts + (int64_t)i * slv_reader_segment_duration(reader)) : 0;
+		for (unsigned c = 0; c < ncolumns; c++) {
+			if (c > 0)
+				fputs(", ", stdout);
+			if (columns[c].direction != NULL)
+				printf("%3d", columns[c].direction[i]);
+			else
+				printf("%5.1f", columns[c].level[i] + delta);
+		}
+		putchar('\n');
+	}
+	if (table != NULL)
+		calibration_table_destroy(table);
+	slv_reader_close(reader);
+	return EXIT_SUCCESS;
+}